@@ -0,0 +1,371 @@
+// AdminServer.cc : TCP admin port for the tracker
+
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "AdminServer.h"
+#include "Tracker.h"
+#include "Logger.h"
+#include "WireLayout.h"
+
+/* Stop refilling a dump once this much output is already waiting */
+#define ADMIN_OUTPUT_LOW_WATER   16384
+
+/* Dump chunks formatted per wakeup - a fast client still shares the reactor */
+#define ADMIN_CHUNKS_PER_WAKE    16
+
+AdminServer::AdminServer (Tracker * pTracker)
+{
+   m_pTracker = pTracker;
+   m_pReactor = NULL;
+   m_nListenSocket = -1;
+}
+
+AdminServer::~AdminServer ()
+{
+   stop();
+}
+
+bool AdminServer::start (uint16_t nPort, Reactor * pReactor)
+{
+   struct sockaddr_in   theAddress;
+   int                  nEnable = 1;
+
+   m_pReactor = pReactor;
+
+   m_nListenSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+   if (m_nListenSocket == -1)
+   {
+      LOG_ERROR("admin: socket: %s", strerror(errno));
+      return false;
+   }
+
+   setsockopt(m_nListenSocket, SOL_SOCKET, SO_REUSEADDR, &nEnable, sizeof(nEnable));
+
+   /* Local only - there is no authentication on the console */
+   memset(&theAddress, 0, sizeof(theAddress));
+   theAddress.sin_family = AF_INET;
+   theAddress.sin_port = htons(nPort);
+   theAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+   if (bind(m_nListenSocket, (struct sockaddr *) &theAddress, sizeof(theAddress)) == -1 || listen(m_nListenSocket, 8) == -1)
+   {
+      LOG_ERROR("admin: bind / listen on port %d: %s", nPort, strerror(errno));
+      close(m_nListenSocket);
+      m_nListenSocket = -1;
+      return false;
+   }
+
+   if (!m_pReactor->add(m_nListenSocket, EPOLLIN, [this] (uint32_t) { acceptClients(); }))
+   {
+      close(m_nListenSocket);
+      m_nListenSocket = -1;
+      return false;
+   }
+
+   LOG_INFO("Admin console listening on 127.0.0.1:%d", nPort);
+   return true;
+}
+
+void AdminServer::stop ()
+{
+   while (!m_Clients.empty())
+   {
+      closeClient(m_Clients.begin()->first);
+   }
+
+   if (m_nListenSocket != -1)
+   {
+      m_pReactor->remove(m_nListenSocket);
+      close(m_nListenSocket);
+      m_nListenSocket = -1;
+   }
+}
+
+void AdminServer::acceptClients ()
+{
+   while (1)
+   {
+      int nSocket = accept4(m_nListenSocket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+      if (nSocket == -1)
+      {
+         if (errno != EAGAIN && errno != EWOULDBLOCK)
+         {
+            LOG_WARN("admin: accept: %s", strerror(errno));
+         }
+
+         return;
+      }
+
+      unique_ptr<AdminClient>  pClient (new AdminClient());
+
+      pClient->nSocket = nSocket;
+      pClient->nOutputSent = 0;
+      pClient->nDumpCursor = 0;
+      pClient->bClosing = false;
+      pClient->bWantWrite = false;
+
+      if (!m_pReactor->add(nSocket, EPOLLIN | EPOLLRDHUP, [this, nSocket] (uint32_t nEvents) { handleClient(nSocket, nEvents); }))
+      {
+         close(nSocket);
+         continue;
+      }
+
+      pClient->sOutput = "Tracker admin console - type help for the commands\n";
+
+      AdminClient * pRaw = pClient.get();
+      m_Clients[nSocket] = move(pClient);
+
+      flushClient(pRaw);
+   }
+}
+
+void AdminServer::handleClient (int nSocket, uint32_t nEvents)
+{
+   unordered_map<int, unique_ptr<AdminClient>>::iterator theEntry = m_Clients.find(nSocket);
+
+   if (theEntry == m_Clients.end())
+   {
+      return;
+   }
+
+   AdminClient * pClient = theEntry->second.get();
+
+   if (nEvents & EPOLLIN)
+   {
+      char  szBuffer [512];
+      int   nRead;
+
+      while ((nRead = recv(nSocket, szBuffer, sizeof(szBuffer), 0)) > 0)
+      {
+         pClient->sInput.append(szBuffer, nRead);
+      }
+
+      if (nRead == 0 || (nRead == -1 && errno != EAGAIN && errno != EWOULDBLOCK))
+      {
+         closeClient(nSocket);
+         return;
+      }
+
+      size_t nEnd;
+
+      while (!pClient->bClosing && (nEnd = pClient->sInput.find('\n')) != string::npos)
+      {
+         string sLine = pClient->sInput.substr(0, nEnd);
+         pClient->sInput.erase(0, nEnd + 1);
+
+         if (!sLine.empty() && sLine[sLine.size()-1] == '\r')
+         {
+            sLine.erase(sLine.size()-1);
+         }
+
+         processLine(pClient, sLine);
+      }
+
+      if (pClient->sInput.size() > ADMIN_MAX_LINE)
+      {
+         closeClient(nSocket);
+         return;
+      }
+   }
+   else if (nEvents & (EPOLLHUP | EPOLLERR))
+   {
+      closeClient(nSocket);
+      return;
+   }
+
+   flushClient(pClient);
+}
+
+void AdminServer::processLine (AdminClient * pClient, const string & sLine)
+{
+   if (sLine == "dump")
+   {
+      /* An immutable copy of the table - nothing is locked while it streams */
+      pClient->pDump = m_pTracker->getSnapshot();
+      pClient->nDumpCursor = 0;
+
+      char szLine [64];
+      snprintf(szLine, sizeof(szLine), "Tracking Table (%u entries)\n", pClient->pDump->getCount());
+      pClient->sOutput += szLine;
+   }
+   else if (sLine == "stats")
+   {
+      appendStats(pClient);
+   }
+   else if (sLine == "quit")
+   {
+      pClient->bClosing = true;
+   }
+   else if (sLine == "help")
+   {
+      pClient->sOutput += "  dump   List every node in the table\n";
+      pClient->sOutput += "  stats  Message counters and latencies\n";
+      pClient->sOutput += "  quit   Close the connection\n";
+   }
+   else if (!sLine.empty())
+   {
+      pClient->sOutput += "Unknown command: " + sLine + "\n";
+   }
+}
+
+void AdminServer::appendStats (AdminClient * pClient)
+{
+   TrackerStats * pStats = m_pTracker->getStats();
+   TypeTotals     theTotals;
+   char           szLine [160];
+
+   snprintf(szLine, sizeof(szLine), "Nodes %u, expired %llu, pushes dropped %llu, serving threads %d\n",
+            m_pTracker->getSnapshot()->getCount(), (unsigned long long) pStats->getExpired(),
+            (unsigned long long) pStats->getPushDropped(), pStats->getThreadCount());
+   pClient->sOutput += szLine;
+
+   for (int nSlot=0; nSlot<STATS_TYPE_SLOTS; nSlot++)
+   {
+      pStats->sumType(nSlot, &theTotals);
+
+      if (theTotals.nReceived == 0 && theTotals.nLimited == 0)
+      {
+         continue;
+      }
+
+      snprintf(szLine, sizeof(szLine), "  %-16s %10llu received %8llu errors %8llu limited  p50 %8llu ns  p99 %8llu ns  max %8llu ns\n",
+               Message::getTypeName(nSlot).c_str(), (unsigned long long) theTotals.nReceived, (unsigned long long) theTotals.nErrors,
+               (unsigned long long) theTotals.nLimited,
+               (unsigned long long) theTotals.getPercentile(0.5), (unsigned long long) theTotals.getPercentile(0.99),
+               (unsigned long long) theTotals.nMaxLatency);
+      pClient->sOutput += szLine;
+   }
+}
+
+void AdminServer::fillDump (AdminClient * pClient)
+{
+   uint8_t     byRecord [NODE_DATA_V2_SIZE];
+   uint32_t    nEnd = pClient->nDumpCursor + ADMIN_DUMP_CHUNK;
+
+   if (nEnd > pClient->pDump->getCount())
+   {
+      nEnd = pClient->pDump->getCount();
+   }
+
+   for (; pClient->nDumpCursor < nEnd; pClient->nDumpCursor++)
+   {
+      char        szLine [96];
+
+      pClient->pDump->copyRecords(true, pClient->nDumpCursor, 1, byRecord);
+
+      WireReader<NodeDataWideLayout>   theRecord (byRecord, sizeof(byRecord));
+      uint32_t    nAddress = theRecord.get<NodeDataWideLayout::Address>();
+      uint8_t *   pAddress = (uint8_t *) &nAddress;
+
+      /* Same layout as Tracker::dumpTable */
+      snprintf(szLine, sizeof(szLine), "%10u %3d.%3d.%3d.%3d %5d %3d %ld\n", theRecord.get<NodeDataWideLayout::ID>(),
+               pAddress[0], pAddress[1], pAddress[2], pAddress[3],
+               theRecord.get<NodeDataWideLayout::Port>(), theRecord.get<NodeDataWideLayout::Files>(),
+               (long) theRecord.get<NodeDataWideLayout::Expiry>());
+      pClient->sOutput += szLine;
+   }
+
+   if (pClient->nDumpCursor >= pClient->pDump->getCount())
+   {
+      pClient->pDump.reset();
+   }
+}
+
+bool AdminServer::flushClient (AdminClient * pClient)
+{
+   int nChunks = 0;
+
+   while (1)
+   {
+      /* Keep a dump topped up a chunk at a time */
+      if (pClient->pDump && pClient->sOutput.size() - pClient->nOutputSent < ADMIN_OUTPUT_LOW_WATER)
+      {
+         if (nChunks == ADMIN_CHUNKS_PER_WAKE)
+         {
+            /* Come back for more on the next pass through the reactor */
+            break;
+         }
+
+         fillDump(pClient);
+         nChunks++;
+      }
+
+      if (pClient->nOutputSent == pClient->sOutput.size())
+      {
+         pClient->sOutput.clear();
+         pClient->nOutputSent = 0;
+         break;
+      }
+
+      ssize_t nSent = send(pClient->nSocket, pClient->sOutput.data() + pClient->nOutputSent,
+                           pClient->sOutput.size() - pClient->nOutputSent, MSG_NOSIGNAL);
+
+      if (nSent == -1)
+      {
+         if (errno == EAGAIN || errno == EWOULDBLOCK)
+         {
+            /* Pick it up again once the client has read some */
+            if (!pClient->bWantWrite)
+            {
+               m_pReactor->modify(pClient->nSocket, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+               pClient->bWantWrite = true;
+            }
+
+            return true;
+         }
+
+         closeClient(pClient->nSocket);
+         return false;
+      }
+
+      pClient->nOutputSent += nSent;
+
+      /* Do not let the front of a long dump pile up */
+      if (pClient->nOutputSent > ADMIN_OUTPUT_LOW_WATER)
+      {
+         pClient->sOutput.erase(0, pClient->nOutputSent);
+         pClient->nOutputSent = 0;
+      }
+   }
+
+   /* Only wait on EPOLLOUT while there is more to send */
+   bool bMore = (bool) pClient->pDump;
+
+   if (pClient->bWantWrite != bMore)
+   {
+      m_pReactor->modify(pClient->nSocket, bMore ? (EPOLLIN | EPOLLOUT | EPOLLRDHUP) : (EPOLLIN | EPOLLRDHUP));
+      pClient->bWantWrite = bMore;
+   }
+
+   if (bMore)
+   {
+      return true;
+   }
+
+   if (pClient->bClosing)
+   {
+      closeClient(pClient->nSocket);
+      return false;
+   }
+
+   return true;
+}
+
+void AdminServer::closeClient (int nSocket)
+{
+   m_pReactor->remove(nSocket);
+   close(nSocket);
+
+   m_Clients.erase(nSocket);
+}
@@ -0,0 +1,94 @@
+// AdminServer.h : TCP admin port for the tracker
+//
+// A line based console (e.g. nc localhost <port>) that runs on the tracker's
+// control reactor.  Nothing here ever blocks: output is written as the socket
+// takes it and a table dump is streamed out of an immutable NodeSnapshot a
+// chunk at a time, so the table lock is never held while a slow client reads.
+
+#ifndef __ADMINSERVER_H
+#define __ADMINSERVER_H
+
+#include <stdint.h>
+
+#include <string>
+#include <memory>
+#include <unordered_map>
+using namespace std;
+
+#include "Reactor.h"
+#include "NodeSnapshot.h"
+
+/* Nodes formatted per refill of a client's output while dumping */
+#define ADMIN_DUMP_CHUNK      256
+
+/* Longest command line accepted before the client is dropped */
+#define ADMIN_MAX_LINE        1024
+
+class Tracker;
+
+/** AdminServer accepts admin connections and answers their commands */
+class AdminServer
+{
+   private:
+      struct AdminClient
+      {
+         int      nSocket;
+
+         /* Partial command line */
+         string   sInput;
+
+         /* Waiting to be written (from nOutputSent onwards) */
+         string   sOutput;
+         size_t   nOutputSent;
+
+         /* Table dump in progress (NULL if none) */
+         shared_ptr<NodeSnapshot>   pDump;
+         uint32_t                   nDumpCursor;
+
+         /* Close once the output is written */
+         bool     bClosing;
+
+         /* Currently waiting on EPOLLOUT? */
+         bool     bWantWrite;
+      };
+
+      Tracker *   m_pTracker;
+      Reactor *   m_pReactor;
+      int         m_nListenSocket;
+
+      unordered_map<int, unique_ptr<AdminClient>>  m_Clients;
+
+      void  acceptClients ();
+      void  handleClient (int nSocket, uint32_t nEvents);
+
+      /** Act on one command line */
+      void  processLine (AdminClient * pClient, const string & sLine);
+
+      /** Write as much as the socket will take (refilling from a dump)
+       *  @returns false if the client is gone
+       */
+      bool  flushClient (AdminClient * pClient);
+
+      /** Format the next chunk of a dump into the output */
+      void  fillDump (AdminClient * pClient);
+
+      void  appendStats (AdminClient * pClient);
+
+      void  closeClient (int nSocket);
+
+   public:
+      AdminServer (Tracker * pTracker);
+      ~AdminServer ();
+
+      /** Listen on the loopback interface
+       *  @param nPort TCP port to listen on
+       *  @param pReactor The reactor that drives the listener and the clients
+       *  @returns false if the port could not be set up
+       */
+      bool  start (uint16_t nPort, Reactor * pReactor);
+
+      /** Drop every client and stop listening */
+      void  stop ();
+};
+
+#endif
@@ -0,0 +1,215 @@
+// BloomIndex.cc : Bloom filter summaries of the files each node holds
+
+#include <stdint.h>
+#include <cstring>
+#include <arpa/inet.h>
+
+#include "BloomIndex.h"
+
+/* Eight lanes of 32 bits - one block */
+typedef uint32_t BloomLanes __attribute__ ((vector_size (BLOOM_BLOCK_BYTES)));
+
+/* Odd multipliers that spread one 32 bit hash across the eight words */
+static const BloomLanes g_Salt = { 0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+                                   0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U };
+
+/** The bits a key sets within its block */
+static inline void makeMask (uint64_t nKey, BloomLanes * pMask)
+{
+   BloomLanes  theOnes = { 1, 1, 1, 1, 1, 1, 1, 1 };
+   BloomLanes  theKey = theOnes * (uint32_t) nKey;
+
+   *pMask = theOnes << ((theKey * g_Salt) >> 27);
+}
+
+BloomIndex::BloomIndex ()
+{
+   m_nGarbage = 0;
+   m_pPublished = make_shared<BloomSnapshot>();
+}
+
+void BloomIndex::setFilter (uint32_t nID, const uint8_t * pData, uint16_t nLength)
+{
+   BloomChange theChange;
+
+   theChange.nID = nID;
+   theChange.nBlocks = nLength / BLOOM_BLOCK_BYTES;
+   theChange.nOffset = m_PendingWords.size();
+
+   m_PendingWords.resize(m_PendingWords.size() + theChange.nBlocks * BLOOM_BLOCK_WORDS);
+
+   for (uint32_t j=0; j<theChange.nBlocks * BLOOM_BLOCK_WORDS; j++)
+   {
+      uint32_t nWord;
+
+      memcpy(&nWord, pData + j * 4, 4);
+      m_PendingWords[theChange.nOffset + j] = ntohl(nWord);
+   }
+
+   m_Pending.push_back(theChange);
+}
+
+void BloomIndex::removeNode (uint32_t nID)
+{
+   BloomChange theChange;
+
+   theChange.nID = nID;
+   theChange.nBlocks = 0;
+   theChange.nOffset = 0;
+
+   m_Pending.push_back(theChange);
+}
+
+bool BloomIndex::takeChanges ()
+{
+   if (m_Pending.empty())
+   {
+      return false;
+   }
+
+   /* The publisher is done with the last lot - reuse its storage */
+   m_Taken.clear();
+   m_TakenWords.clear();
+
+   m_Taken.swap(m_Pending);
+   m_TakenWords.swap(m_PendingWords);
+
+   return true;
+}
+
+void BloomIndex::apply (const BloomChange & theChange)
+{
+   unordered_map<uint32_t, size_t>::iterator theEntry = m_Positions.find(theChange.nID);
+   vector<BloomFilterEntry> & theFilters = m_Current.m_Filters;
+
+   if (theChange.nBlocks == 0)
+   {
+      if (theEntry == m_Positions.end())
+      {
+         return;
+      }
+
+      size_t nPosition = theEntry->second;
+
+      m_Positions.erase(theEntry);
+      m_nGarbage += theFilters[nPosition].nBlocks * BLOOM_BLOCK_WORDS;
+
+      /* Swap the last filter into the hole to keep the list dense */
+      if (nPosition != theFilters.size() - 1)
+      {
+         theFilters[nPosition] = theFilters.back();
+         m_Positions[theFilters[nPosition].nID] = nPosition;
+      }
+
+      theFilters.pop_back();
+      return;
+   }
+
+   if (theEntry == m_Positions.end())
+   {
+      BloomFilterEntry  theFilter;
+
+      theFilter.nID = theChange.nID;
+      theFilter.nBlocks = 0;
+      theFilter.nOffset = 0;
+
+      m_Positions[theChange.nID] = theFilters.size();
+      theFilters.push_back(theFilter);
+      theEntry = m_Positions.find(theChange.nID);
+   }
+
+   BloomFilterEntry & theFilter = theFilters[theEntry->second];
+
+   /* A filter of the same size is overwritten where it is, anything else
+      goes on the end and leaves the old words behind */
+   if (theFilter.nBlocks != theChange.nBlocks)
+   {
+      m_nGarbage += theFilter.nBlocks * BLOOM_BLOCK_WORDS;
+
+      theFilter.nBlocks = theChange.nBlocks;
+      theFilter.nOffset = m_Current.m_Words.size();
+      m_Current.m_Words.resize(m_Current.m_Words.size() + theChange.nBlocks * BLOOM_BLOCK_WORDS);
+   }
+
+   memcpy(&m_Current.m_Words[theFilter.nOffset], &m_TakenWords[theChange.nOffset], theChange.nBlocks * BLOOM_BLOCK_BYTES);
+}
+
+void BloomIndex::compact ()
+{
+   vector<uint32_t>  thePacked;
+
+   thePacked.reserve(m_Current.m_Words.size() - m_nGarbage);
+
+   for (size_t j=0; j<m_Current.m_Filters.size(); j++)
+   {
+      BloomFilterEntry & theFilter = m_Current.m_Filters[j];
+      uint32_t nOffset = thePacked.size();
+
+      thePacked.insert(thePacked.end(), m_Current.m_Words.begin() + theFilter.nOffset,
+                       m_Current.m_Words.begin() + theFilter.nOffset + theFilter.nBlocks * BLOOM_BLOCK_WORDS);
+      theFilter.nOffset = nOffset;
+   }
+
+   m_Current.m_Words.swap(thePacked);
+   m_nGarbage = 0;
+}
+
+void BloomIndex::publish ()
+{
+   for (size_t j=0; j<m_Taken.size(); j++)
+   {
+      apply(m_Taken[j]);
+   }
+
+   if (m_nGarbage * 2 > m_Current.m_Words.size())
+   {
+      compact();
+   }
+
+   /* The working copy is the publisher's alone, so the copy for the readers
+      can be made without holding anyone else up */
+   shared_ptr<const BloomSnapshot> pSnapshot = make_shared<BloomSnapshot>(m_Current);
+
+   {
+      lock_guard<mutex>   theGuard(m_PublishLock);
+      m_pPublished.swap(pSnapshot);
+   }
+
+   /* The old copy (if nobody is scanning it) goes away out here */
+}
+
+shared_ptr<const BloomSnapshot> BloomIndex::getSnapshot ()
+{
+   lock_guard<mutex>   theGuard(m_PublishLock);
+   return m_pPublished;
+}
+
+int BloomSnapshot::findCandidates (uint64_t nKey, size_t nStart, uint32_t * pIDs, int nMax) const
+{
+   BloomLanes  theMask;
+   int         nFound = 0;
+
+   makeMask(nKey, &theMask);
+
+   for (size_t j=0; j<m_Filters.size() && nFound < nMax; j++)
+   {
+      const BloomFilterEntry &   theFilter = m_Filters[(nStart + j) % m_Filters.size()];
+      BloomLanes                 theBlock;
+
+      /* The words are only word aligned - copy the block into the lanes */
+      memcpy(&theBlock, &m_Words[theFilter.nOffset + BloomIndex::getBlock(nKey, theFilter.nBlocks) * BLOOM_BLOCK_WORDS], BLOOM_BLOCK_BYTES);
+
+      /* Every bit of the mask has to be set in the key's block */
+      BloomLanes  theMissing = theMask & ~theBlock;
+      uint64_t    nWords [4];
+
+      memcpy(nWords, &theMissing, sizeof(nWords));
+
+      if ((nWords[0] | nWords[1] | nWords[2] | nWords[3]) == 0)
+      {
+         pIDs[nFound++] = theFilter.nID;
+      }
+   }
+
+   return nFound;
+}
@@ -0,0 +1,148 @@
+// BloomIndex.h : Bloom filter summaries of the files each node holds
+//
+// Nodes with too many files to publish one by one (see FileIndex.h) can
+// instead attach a Bloom filter of their file keys to REGISTER_V2.  The
+// filters are split block Bloom filters (the layout Parquet uses): the filter
+// is a run of 32 byte blocks, each eight 32 bit words, and a key sets exactly
+// one bit in every word of a single block.  Testing a key is then one block
+// load and one compare, which vector types (see BloomIndex.cc) turn into a
+// couple of SIMD instructions.
+//
+// Keys are hashed as for FileIndex (64 bit FNV-1a of the key as published,
+// finished off with fmix64):
+//   block = ((hash >> 32) * blocks) >> 32
+//   bit in word i = ((uint32_t) hash * SALT[i]) >> 27
+//
+// The filters are changed under the table lock, but FIND_FILE scans a copy
+// published alongside the LIST_NODES snapshot (see Tracker::publishSnapshot)
+// so a scan over every filter never holds up registrations.  The writers only
+// note what changed - the copy is brought up to date and duplicated for the
+// readers by the publisher, after it has let go of the table lock.
+
+#ifndef __BLOOMINDEX_H
+#define __BLOOMINDEX_H
+
+#include <stdint.h>
+
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+using namespace std;
+
+#define BLOOM_BLOCK_BYTES     32
+#define BLOOM_BLOCK_WORDS     8
+
+/* Largest filter a node may send (has to fit in a REGISTER_V2 with room to
+   spare for the other extensions) */
+#define BLOOM_MAX_BLOCKS      40
+
+/* Where one node's filter sits in the shared run of words */
+struct BloomFilterEntry
+{
+   uint32_t    nID;
+   uint32_t    nBlocks;
+
+   /* Index of its first word */
+   uint32_t    nOffset;
+};
+
+/** BloomSnapshot is a published (read only) copy of every filter */
+class BloomSnapshot
+{
+   friend class BloomIndex;
+
+   private:
+      vector<BloomFilterEntry>   m_Filters;
+
+      /* Every filter's words back to back, BLOOM_BLOCK_WORDS per block (host
+         order) - one allocation so a scan runs straight through memory */
+      vector<uint32_t>           m_Words;
+
+   public:
+      /** Find the nodes whose filters say they probably hold a file
+       *  @param nKey The hashed file key (FileIndex::makeKey)
+       *  @param nStart Where to start the scan (spreads popular files around)
+       *  @param pIDs Filled in with the IDs of the likely holders
+       *  @param nMax Room in pIDs
+       *  @returns The number of IDs filled in
+       */
+      int   findCandidates (uint64_t nKey, size_t nStart, uint32_t * pIDs, int nMax) const;
+
+      /** Number of nodes with a filter */
+      size_t size () const
+      { return m_Filters.size(); }
+};
+
+/** BloomIndex takes each node's filter (table lock) and publishes copies for
+ *  FIND_FILE to scan without it
+ */
+class BloomIndex
+{
+   private:
+      /* A new filter (nBlocks words at nOffset in the pending words) or a
+         removal (no blocks) */
+      typedef BloomFilterEntry   BloomChange;
+
+      /* Noted by the writers since the last takeChanges (table lock) */
+      vector<BloomChange>                 m_Pending;
+      vector<uint32_t>                    m_PendingWords;
+
+      /* Handed over to the publisher by takeChanges */
+      vector<BloomChange>                 m_Taken;
+      vector<uint32_t>                    m_TakenWords;
+
+      /* The publisher's working copy - words left behind by replaced or
+         removed filters are reclaimed once they make up half of the run */
+      BloomSnapshot                       m_Current;
+      size_t                              m_nGarbage;
+
+      /* Node ID -> where its entry sits in m_Current.m_Filters */
+      unordered_map<uint32_t, size_t>     m_Positions;
+
+      /* Guards m_pPublished (held just long enough to copy the pointer) */
+      mutex                               m_PublishLock;
+      shared_ptr<const BloomSnapshot>     m_pPublished;
+
+      /** Bring the working copy up to date with one change (publisher) */
+      void  apply (const BloomChange & theChange);
+
+      /** Pack the words of the live filters back together (publisher) */
+      void  compact ();
+
+   public:
+      BloomIndex ();
+
+      /** Is this a usable filter size (whole blocks, not too many)? */
+      static bool isValidLength (uint16_t nLength)
+      { return nLength > 0 && nLength % BLOOM_BLOCK_BYTES == 0 && nLength / BLOOM_BLOCK_BYTES <= BLOOM_MAX_BLOCKS; }
+
+      /** Which block of an nBlocks filter a key falls in */
+      static uint32_t getBlock (uint64_t nKey, uint32_t nBlocks)
+      { return ((nKey >> 32) * nBlocks) >> 32; }
+
+      /** Store (or replace) a node's filter (table lock held)
+       *  @param pData The filter as sent (words in network order)
+       *  @param nLength Its length - must pass isValidLength
+       */
+      void  setFilter (uint32_t nID, const uint8_t * pData, uint16_t nLength);
+
+      /** Forget a node's filter on expiry (table lock held) */
+      void  removeNode (uint32_t nID);
+
+      /** Hand what changed since the last time over to publish (table lock
+       *  held) - only swaps the lists, however many filters there are
+       *  @returns false if nothing changed (and there is nothing to publish)
+       */
+      bool  takeChanges ();
+
+      /** Apply the changes that were taken and hand readers a copy of the
+       *  result.  No lock needed, but only one thread may publish.
+       */
+      void  publish ();
+
+      /** The filters as last published (no lock needed) */
+      shared_ptr<const BloomSnapshot> getSnapshot ();
+};
+
+#endif
@@ -0,0 +1,46 @@
+// CoarseClock.cc : Cheap once-per-loop reading of the time for the tracker
+
+#include <time.h>
+#include <sys/time.h>
+
+#include "CoarseClock.h"
+
+static time_t readMonotonicSeconds ()
+{
+   struct timespec theTime;
+
+   clock_gettime(CLOCK_MONOTONIC_COARSE, &theTime);
+   return theTime.tv_sec;
+}
+
+/* Monotonic seconds at which the tracker started - ticks count from here so
+   that they start near zero no matter how long the machine has been up.  Set
+   before main runs so the workers never race on it. */
+static const time_t s_nEpoch = readMonotonicSeconds();
+
+uint64_t CoarseClock::readNanos ()
+{
+   struct timespec theTime;
+
+   clock_gettime(CLOCK_MONOTONIC, &theTime);
+   return (uint64_t) theTime.tv_sec * 1000000000ULL + theTime.tv_nsec;
+}
+
+CoarseClock::CoarseClock ()
+{
+   update();
+}
+
+void CoarseClock::update ()
+{
+   struct timespec theTime;
+
+   clock_gettime(CLOCK_MONOTONIC_COARSE, &theTime);
+   m_nTick = theTime.tv_sec - s_nEpoch;
+
+   clock_gettime(CLOCK_REALTIME_COARSE, &theTime);
+   m_WallTime.tv_sec = theTime.tv_sec;
+   m_WallTime.tv_usec = theTime.tv_nsec / 1000;
+
+   m_nNanos = readNanos();
+}
@@ -0,0 +1,45 @@
+// CoarseClock.h : Cheap once-per-loop reading of the time for the tracker
+
+#ifndef __COARSECLOCK_H
+#define __COARSECLOCK_H
+
+#include <stdint.h>
+#include <sys/time.h>
+#include <time.h>
+
+/** CoarseClock caches one reading of the coarse (tick granularity) monotonic
+ * and wall clocks.  A serving loop updates it once per iteration and every
+ * message handled in that iteration uses the same notion of "now".
+ */
+class CoarseClock
+{
+   private:
+      /* Whole seconds since the tracker started (monotonic) */
+      uint32_t          m_nTick;
+
+      /* Wall clock time - used for anything that goes on the wire */
+      struct timeval    m_WallTime;
+
+      /* Precise monotonic time (nanoseconds) - used for measuring latency */
+      uint64_t          m_nNanos;
+
+   public:
+      CoarseClock ();
+
+      /** Read the clocks */
+      void  update ();
+
+      uint32_t getTick ()
+      { return m_nTick; }
+
+      struct timeval * getWallTime ()
+      { return &m_WallTime; }
+
+      uint64_t getNanos ()
+      { return m_nNanos; }
+
+      /** Read the precise monotonic clock right now (in nanoseconds) */
+      static uint64_t readNanos ();
+};
+
+#endif
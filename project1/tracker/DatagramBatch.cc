@@ -0,0 +1,140 @@
+// DatagramBatch.cc : Batched datagram I/O for the tracker
+
+#include <stdio.h>
+#include <errno.h>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include "DatagramBatch.h"
+#include "Logger.h"
+
+DatagramBatch::DatagramBatch (int nSize, MessagePool * pPool)
+{
+   if (nSize < 1)
+   {
+      nSize = 1;
+   }
+
+   m_nSize = nSize;
+   m_nReceived = 0;
+
+   m_Inbound.resize(m_nSize);
+   m_RecvHeaders.resize(m_nSize);
+   m_RecvVectors.resize(m_nSize);
+
+   m_Replies.reserve(m_nSize);
+   m_SendHeaders.resize(m_nSize);
+   m_SendVectors.resize(m_nSize);
+
+   for (int j=0; j<m_nSize; j++)
+   {
+      m_Inbound[j] = pPool->acquire();
+   }
+}
+
+DatagramBatch::~DatagramBatch ()
+{
+   // The handles hand everything back to the pool
+}
+
+int DatagramBatch::receive (int nSocket, CoarseClock * pClock)
+{
+   /* The kernel overwrites the name length and the message length on each call
+      so the headers need to be rebuilt every time */
+   memset(&m_RecvHeaders[0], 0, m_nSize * sizeof(struct mmsghdr));
+
+   for (int j=0; j<m_nSize; j++)
+   {
+      m_RecvVectors[j].iov_base = m_Inbound[j]->getData();
+      m_RecvVectors[j].iov_len = m_Inbound[j]->getMaxLength();
+
+      m_RecvHeaders[j].msg_hdr.msg_name = m_Inbound[j]->getAddress();
+      m_RecvHeaders[j].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+      m_RecvHeaders[j].msg_hdr.msg_iov = &m_RecvVectors[j];
+      m_RecvHeaders[j].msg_hdr.msg_iovlen = 1;
+   }
+
+   int nReceived;
+
+   /* Take whatever is queued - the reactor only calls in once it is readable */
+   do
+   {
+      nReceived = recvmmsg(nSocket, &m_RecvHeaders[0], m_nSize, MSG_DONTWAIT, NULL);
+   } while (nReceived == -1 && errno == EINTR);
+
+   if (nReceived == -1)
+   {
+      m_nReceived = 0;
+      return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+   }
+
+   /* One timestamp for the whole batch - they all came in on the same call */
+   pClock->update();
+
+   for (int j=0; j<nReceived; j++)
+   {
+      Message * pMessage = m_Inbound[j].get();
+
+      pMessage->setLength(m_RecvHeaders[j].msg_len);
+      pMessage->setType(pMessage->getData()[0]);
+      pMessage->recordArrival(pClock);
+      pMessage->setSocket(nSocket);
+      pMessage->setBatch(this);
+   }
+
+   m_nReceived = nReceived;
+   return nReceived;
+}
+
+int DatagramBatch::flush (int nSocket)
+{
+   int nTotalSent = 0;
+   int nPending = m_Replies.size();
+
+   while (nTotalSent < nPending)
+   {
+      int nChunk = nPending - nTotalSent;
+
+      if (nChunk > m_nSize)
+      {
+         nChunk = m_nSize;
+      }
+
+      memset(&m_SendHeaders[0], 0, nChunk * sizeof(struct mmsghdr));
+
+      for (int j=0; j<nChunk; j++)
+      {
+         Message * pReply = m_Replies[nTotalSent+j].get();
+
+         m_SendVectors[j].iov_base = pReply->getData();
+         m_SendVectors[j].iov_len = pReply->getLength();
+
+         m_SendHeaders[j].msg_hdr.msg_name = pReply->getAddress();
+         m_SendHeaders[j].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+         m_SendHeaders[j].msg_hdr.msg_iov = &m_SendVectors[j];
+         m_SendHeaders[j].msg_hdr.msg_iovlen = 1;
+      }
+
+      int nSent = sendmmsg(nSocket, &m_SendHeaders[0], nChunk, 0);
+
+      if (nSent == -1)
+      {
+         if (errno == EINTR)
+         {
+            continue;
+         }
+
+         LOG_ERROR("flush: sendmmsg: %s", strerror(errno));
+         break;
+      }
+
+      nTotalSent += nSent;
+   }
+
+   /* Back to the pool they go */
+   m_Replies.clear();
+   return nTotalSent;
+}
@@ -0,0 +1,78 @@
+// DatagramBatch.h : Batched datagram I/O (recvmmsg / sendmmsg) for the tracker
+
+#ifndef __DATAGRAMBATCH_H
+#define __DATAGRAMBATCH_H
+
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <vector>
+using namespace std;
+
+#include "Message.h"
+#include "CoarseClock.h"
+#include "MessagePool.h"
+#include "ReplyQueue.h"
+
+/** DatagramBatch holds a fixed set of receive buffers that are filled with a
+ * single recvmmsg call along with a queue of replies that are flushed with a
+ * single sendmmsg call.  The receive messages are taken from a pool once and
+ * reused from one call to the next; replies go back to their pool on flush.
+ */
+class DatagramBatch : public ReplyQueue
+{
+   private:
+      /* Maximum number of datagrams per receive / send */
+      int      m_nSize;
+
+      /* Messages that are filled in by receive */
+      vector<MessageHandle>   m_Inbound;
+      vector<struct mmsghdr>  m_RecvHeaders;
+      vector<struct iovec>    m_RecvVectors;
+
+      /* How many messages did the last receive produce? */
+      int      m_nReceived;
+
+      /* Headers for flushing the queued replies */
+      vector<struct mmsghdr>  m_SendHeaders;
+      vector<struct iovec>    m_SendVectors;
+
+   public:
+      /** Constructor
+       *  @param nSize The maximum number of datagrams to move per system call
+       *  @param pPool Where the receive buffers come from (replies to them
+       *               are drawn from the same pool)
+       */
+      DatagramBatch (int nSize, MessagePool * pPool);
+      ~DatagramBatch ();
+
+      int getSize ()
+      { return m_nSize; }
+
+      int getReceived ()
+      { return m_nReceived; }
+
+      /** Drain up to the batch size of queued datagrams in one call without
+       *  waiting for any more to arrive
+       *  @param nSocket The socket to read from
+       *  @param pClock Updated once the datagrams are in and used to stamp them
+       *  @returns The number of messages received (0 if none were waiting) or
+       *           -1 on an error
+       */
+      int receive (int nSocket, CoarseClock * pClock);
+
+      /** Retrieve one of the messages from the last receive */
+      Message * getMessage (int nIndex)
+      { return m_Inbound[nIndex].get(); }
+
+      /** Send all of the queued replies
+       *  @param nSocket The socket to send on
+       *  @returns The number of datagrams that were sent
+       */
+      int flush (int nSocket);
+};
+
+#endif
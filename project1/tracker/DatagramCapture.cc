@@ -0,0 +1,95 @@
+// DatagramCapture.cc : Record every datagram the tracker receives
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "DatagramCapture.h"
+
+DatagramCapture::DatagramCapture ()
+{
+   m_pFile = NULL;
+   m_pBuffer = NULL;
+   m_nRecords.store(0);
+}
+
+DatagramCapture::~DatagramCapture ()
+{
+   close();
+}
+
+bool DatagramCapture::open (const char * pszPath)
+{
+   close();
+
+   m_pFile = fopen(pszPath, "wb");
+
+   if (m_pFile == NULL)
+   {
+      return false;
+   }
+
+   /* Big enough that a busy tracker only goes to the disk now and then */
+   m_pBuffer = (char *) malloc(CAPTURE_BUFFER_SIZE);
+
+   if (m_pBuffer != NULL)
+   {
+      setvbuf(m_pFile, m_pBuffer, _IOFBF, CAPTURE_BUFFER_SIZE);
+   }
+
+   struct timeval theNow;
+   uint8_t        byHeader [CaptureFileLayout::nSize];
+
+   gettimeofday(&theNow, NULL);
+
+   CaptureFileLayout::Magic::store(byHeader, CAPTURE_MAGIC);
+   CaptureFileLayout::Version::store(byHeader, CAPTURE_VERSION);
+   CaptureFileLayout::RecordSize::store(byHeader, CaptureRecordLayout::nSize);
+   CaptureFileLayout::Started::store(byHeader, (uint64_t) theNow.tv_sec * 1000000 + theNow.tv_usec);
+
+   if (fwrite(byHeader, sizeof(byHeader), 1, m_pFile) != 1)
+   {
+      close();
+      return false;
+   }
+
+   m_nRecords.store(0);
+   return true;
+}
+
+void DatagramCapture::record (Message * pMessage)
+{
+   uint8_t  byRecord [CaptureRecordLayout::nSize + MSG_MAX_SIZE];
+   uint16_t nLength = pMessage->getLength();
+
+   struct timeval *        pWall = pMessage->getArrivalTime();
+   struct sockaddr_in *    pSource = pMessage->getAddress();
+
+   CaptureRecordLayout::Nanos::store(byRecord, pMessage->getArrivalNanos());
+   CaptureRecordLayout::Wall::store(byRecord, (uint64_t) pWall->tv_sec * 1000000 + pWall->tv_usec);
+   CaptureRecordLayout::Address::store(byRecord, pSource->sin_addr.s_addr);
+   CaptureRecordLayout::Port::store(byRecord, ntohs(pSource->sin_port));
+   CaptureRecordLayout::Length::store(byRecord, nLength);
+
+   memcpy(byRecord + CaptureRecordLayout::nSize, pMessage->getData(), nLength);
+
+   /* One write per record so records from different loops never interleave */
+   if (fwrite(byRecord, CaptureRecordLayout::nSize + nLength, 1, m_pFile) == 1)
+   {
+      m_nRecords.fetch_add(1, memory_order_relaxed);
+   }
+}
+
+void DatagramCapture::close ()
+{
+   if (m_pFile != NULL)
+   {
+      fclose(m_pFile);
+      m_pFile = NULL;
+   }
+
+   /* Only safe to let go of once stdio is done with it */
+   free(m_pBuffer);
+   m_pBuffer = NULL;
+}
@@ -0,0 +1,102 @@
+// DatagramCapture.h : Record every datagram the tracker receives
+//
+// With -capture the tracker writes each datagram it receives (before the
+// rate limits get a look at it) to a file, along with when and where it came
+// from.  bench/replay feeds a capture back to a tracker, so a performance
+// problem seen on live traffic can be reproduced and benchmarked offline.
+//
+// The file is a header followed by one record per datagram, everything in
+// network order:
+//
+//   Header (16 bytes)
+//     4 Bytes - Magic - "TCAP"
+//     2 Bytes - Version - 1
+//     2 Bytes - Record header size - 24 (so later versions can add fields)
+//     8 Bytes - Started - Wall clock time the capture began (microseconds)
+//
+//   Record (24 bytes, then the datagram itself)
+//     8 Bytes - Nanos - Monotonic arrival time (Message::getArrivalNanos)
+//     8 Bytes - Wall - Arrival time (Message::getArrivalTime) in microseconds
+//     4 Bytes - Address - Source IPv4 address
+//     2 Bytes - Port - Source port
+//     2 Bytes - Length - Datagram length in bytes
+
+#ifndef __DATAGRAMCAPTURE_H
+#define __DATAGRAMCAPTURE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <string>
+using namespace std;
+
+#include "Message.h"
+#include "WireLayout.h"
+
+#define CAPTURE_MAGIC            0x54434150     /* "TCAP" */
+#define CAPTURE_VERSION          1
+
+/* Size of the stdio buffer in front of the file */
+#define CAPTURE_BUFFER_SIZE      (1 << 20)
+
+struct CaptureFileLayout
+{
+   typedef WireBE32<0>  Magic;
+   typedef WireBE16<4>  Version;
+   typedef WireBE16<6>  RecordSize;
+   typedef WireBE64<8>  Started;
+
+   static constexpr uint16_t  nSize = 16;
+   static constexpr bool      bVariable = false;
+};
+
+struct CaptureRecordLayout
+{
+   typedef WireBE64<0>  Nanos;
+   typedef WireBE64<8>  Wall;
+   typedef WireRaw32<16> Address;
+   typedef WireBE16<20> Port;
+   typedef WireBE16<22> Length;
+
+   static constexpr uint16_t  nSize = 24;
+   static constexpr bool      bVariable = true;
+};
+
+static_assert(CaptureFileLayout::Started::nEnd == CaptureFileLayout::nSize, "Capture header layout does not fill the header");
+static_assert(CaptureRecordLayout::Length::nEnd == CaptureRecordLayout::nSize, "Capture record layout does not fill the record header");
+
+/** DatagramCapture appends received datagrams to a capture file.  Any of the
+ *  serving loops may record at once - each record goes out in a single
+ *  fwrite, which stdio keeps whole.
+ */
+class DatagramCapture
+{
+   private:
+      FILE *            m_pFile;
+      char *            m_pBuffer;
+      atomic<uint64_t>  m_nRecords;
+
+   public:
+      DatagramCapture ();
+      ~DatagramCapture ();
+
+      /** Start a new capture (replacing anything already in the file)
+       *  @returns false if the file could not be written
+       */
+      bool  open (const char * pszPath);
+
+      bool  isEnabled ()
+      { return m_pFile != NULL; }
+
+      /** Append one received datagram */
+      void  record (Message * pMessage);
+
+      /** Flush what is buffered and close the file */
+      void  close ();
+
+      uint64_t getCount ()
+      { return m_nRecords.load(memory_order_relaxed); }
+};
+
+#endif
@@ -0,0 +1,117 @@
+// FileIndex.cc : Which nodes hold which files
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "FileIndex.h"
+#include "utils.h"
+
+uint64_t FileIndex::makeKey (const uint8_t * pKey, uint8_t nLength)
+{
+   uint64_t nHash = 14695981039346656037ULL;
+
+   for (int j=0; j<nLength; j++)
+   {
+      nHash ^= pKey[j];
+      nHash *= 1099511628211ULL;
+   }
+
+   /* FNV leaves the top bits poorly mixed for keys that only differ at the
+      end (file-1, file-2, ...) - finish off with mix64 */
+   return mix64(nHash);
+}
+
+bool FileIndex::addFile (uint32_t nID, uint64_t nKey)
+{
+   unordered_set<uint64_t> & theFiles = m_Published[nID];
+
+   if (theFiles.count(nKey) != 0)
+   {
+      return true;
+   }
+
+   if (theFiles.size() >= FILE_INDEX_MAX_PER_NODE)
+   {
+      return false;
+   }
+
+   theFiles.insert(nKey);
+   m_Holders[nKey].push_back(nID);
+   return true;
+}
+
+void FileIndex::dropHolder (uint64_t nKey, uint32_t nID)
+{
+   unordered_map<uint64_t, vector<uint32_t>>::iterator theEntry = m_Holders.find(nKey);
+
+   if (theEntry == m_Holders.end())
+   {
+      return;
+   }
+
+   vector<uint32_t> & theIDs = theEntry->second;
+
+   for (size_t j=0; j<theIDs.size(); j++)
+   {
+      if (theIDs[j] == nID)
+      {
+         /* Order does not matter - swap the last one into the hole */
+         theIDs[j] = theIDs.back();
+         theIDs.pop_back();
+         break;
+      }
+   }
+
+   if (theIDs.empty())
+   {
+      m_Holders.erase(theEntry);
+   }
+}
+
+void FileIndex::removeFile (uint32_t nID, uint64_t nKey)
+{
+   unordered_map<uint32_t, unordered_set<uint64_t>>::iterator theEntry = m_Published.find(nID);
+
+   if (theEntry == m_Published.end() || theEntry->second.erase(nKey) == 0)
+   {
+      return;
+   }
+
+   dropHolder(nKey, nID);
+
+   if (theEntry->second.empty())
+   {
+      m_Published.erase(theEntry);
+   }
+}
+
+void FileIndex::removeNode (uint32_t nID)
+{
+   unordered_map<uint32_t, unordered_set<uint64_t>>::iterator theEntry = m_Published.find(nID);
+
+   if (theEntry == m_Published.end())
+   {
+      return;
+   }
+
+   for (unordered_set<uint64_t>::iterator theKey = theEntry->second.begin(); theKey != theEntry->second.end(); ++theKey)
+   {
+      dropHolder(*theKey, nID);
+   }
+
+   m_Published.erase(theEntry);
+}
+
+uint32_t FileIndex::getFileCount (uint32_t nID)
+{
+   unordered_map<uint32_t, unordered_set<uint64_t>>::iterator theEntry = m_Published.find(nID);
+
+   return (theEntry == m_Published.end()) ? 0 : theEntry->second.size();
+}
+
+const vector<uint32_t> * FileIndex::findHolders (uint64_t nKey)
+{
+   unordered_map<uint64_t, vector<uint32_t>>::iterator theEntry = m_Holders.find(nKey);
+
+   return (theEntry == m_Holders.end()) ? NULL : &theEntry->second;
+}
@@ -0,0 +1,73 @@
+// FileIndex.h : Which nodes hold which files
+//
+// Nodes publish the files they hold (by name, content hash or whatever the
+// clients agree to look them up by) and the tracker keeps an inverted index
+// from each file key to the IDs of the nodes holding it.  A client then asks
+// the tracker directly rather than listing the nodes and asking every one of
+// them in turn.  Keys are kept as a 64 bit hash of what was published so the
+// index stays small however long the names are.
+//
+// Like the node table itself the index is guarded by the table lock.  It is
+// not checkpointed or gossiped - nodes publish again after a restart.
+
+#ifndef __FILEINDEX_H
+#define __FILEINDEX_H
+
+#include <stdint.h>
+
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+using namespace std;
+
+/* Most files a single node may have in the index */
+#define FILE_INDEX_MAX_PER_NODE     4096
+
+/** FileIndex maps file keys to their holders (and back, so that everything a
+ *  node published goes away with it)
+ */
+class FileIndex
+{
+   private:
+      /* File key -> IDs of the nodes that hold it */
+      unordered_map<uint64_t, vector<uint32_t>>       m_Holders;
+
+      /* Node ID -> the file keys it published */
+      unordered_map<uint32_t, unordered_set<uint64_t>>   m_Published;
+
+      /** Take one node off the holders of one key */
+      void  dropHolder (uint64_t nKey, uint32_t nID);
+
+   public:
+      /** Hash a file key as it appears on the wire (FNV-1a, then the
+       *  MurmurHash3 fmix64 finalizer)
+       *  @param pKey The name / content hash
+       *  @param nLength Its length in bytes
+       */
+      static uint64_t makeKey (const uint8_t * pKey, uint8_t nLength);
+
+      /** Note that a node holds a file
+       *  @returns false if the node is already at FILE_INDEX_MAX_PER_NODE
+       */
+      bool  addFile (uint32_t nID, uint64_t nKey);
+
+      /** Note that a node no longer holds a file */
+      void  removeFile (uint32_t nID, uint64_t nKey);
+
+      /** Forget everything a node published (on expiry or a replace) */
+      void  removeNode (uint32_t nID);
+
+      /** How many files has a node published? */
+      uint32_t getFileCount (uint32_t nID);
+
+      /** Who holds a file?
+       *  @returns The IDs of the holders (NULL if nobody does)
+       */
+      const vector<uint32_t> * findHolders (uint64_t nKey);
+
+      /** Number of distinct files in the index */
+      size_t size ()
+      { return m_Holders.size(); }
+};
+
+#endif
@@ -0,0 +1,254 @@
+// Gossip.cc : Sharing registrations between tracker instances
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <cstring>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include <string>
+using namespace std;
+
+#include "Gossip.h"
+#include "Message.h"
+#include "Logger.h"
+#include "utils.h"
+
+Gossip::Gossip ()
+{
+   m_nInstance = 0;
+   m_bOutboundFull = false;
+   m_nRound = 0;
+   m_bLocalOnly = false;
+}
+
+bool Gossip::addPeer (const char * pszPeer)
+{
+   struct sockaddr_in   thePeer;
+
+   if (!resolve_host_port(pszPeer, &thePeer))
+   {
+      return false;
+   }
+
+   addPeer(&thePeer);
+   return true;
+}
+
+bool Gossip::isPeer (struct sockaddr_in * pAddress)
+{
+   for (size_t j=0; j<m_Peers.size(); j++)
+   {
+      if (m_Peers[j].sin_addr.s_addr == pAddress->sin_addr.s_addr && m_Peers[j].sin_port == pAddress->sin_port)
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+int Gossip::collect (NodeTable * pTable)
+{
+   m_Outbound.clear();
+   m_nRound++;
+
+   m_bOutboundFull = (m_nRound % GOSSIP_FULL_SYNC_ROUNDS == 0);
+
+   if (m_bOutboundFull)
+   {
+      /* Anti-entropy - everything we know about, changed or not */
+      m_Outbound.resize(pTable->size() * MSG_GOSSIP_RECORD);
+
+      size_t nRecords = 0;
+
+      for (size_t j=0; j<pTable->size(); j++)
+      {
+         if (!m_bLocalOnly || pTable->isLocalID(pTable->getEntry(j).getID()))
+         {
+            writeRecord(&pTable->getEntry(j), &m_Outbound[nRecords * MSG_GOSSIP_RECORD]);
+            nRecords++;
+         }
+      }
+
+      m_Outbound.resize(nRecords * MSG_GOSSIP_RECORD);
+   }
+   else
+   {
+      /* A node renewed several times since the last round only goes out once */
+      sort(m_Pending.begin(), m_Pending.end());
+      m_Pending.erase(unique(m_Pending.begin(), m_Pending.end()), m_Pending.end());
+
+      m_Outbound.reserve(m_Pending.size() * MSG_GOSSIP_RECORD);
+
+      for (size_t j=0; j<m_Pending.size(); j++)
+      {
+         /* Gone since (expired) - nothing to share */
+         Node * pNode = pTable->findNode(m_Pending[j]);
+
+         /* Sharded - the other shards hear about their own nodes from them */
+         if (m_bLocalOnly && !pTable->isLocalID(m_Pending[j]))
+         {
+            continue;
+         }
+
+         if (pNode != NULL)
+         {
+            m_Outbound.resize(m_Outbound.size() + MSG_GOSSIP_RECORD);
+            writeRecord(pNode, &m_Outbound[m_Outbound.size() - MSG_GOSSIP_RECORD]);
+         }
+      }
+   }
+
+   m_Pending.clear();
+
+   return m_Outbound.size() / MSG_GOSSIP_RECORD;
+}
+
+int Gossip::send (int nSocket)
+{
+   uint8_t  byDatagram [MSG_MAX_SIZE];
+   size_t   nRecords = m_Outbound.size() / MSG_GOSSIP_RECORD;
+   size_t   nPerDatagram = (MSG_MAX_SIZE - MSG_GOSSIP_HEADER) / MSG_GOSSIP_RECORD;
+   int      nSent = 0;
+
+   for (size_t nStart=0; nStart<nRecords; nStart+=nPerDatagram)
+   {
+      uint16_t nCount = min(nPerDatagram, nRecords - nStart);
+      uint16_t nLength = MSG_GOSSIP_HEADER + nCount * MSG_GOSSIP_RECORD;
+      uint16_t theShort;
+
+      byDatagram[0] = MSG_TYPE_GOSSIP;
+
+      theShort = htons(nLength);
+      memcpy(byDatagram+1, &theShort, 2);
+
+      byDatagram[3] = m_nInstance;
+      byDatagram[4] = m_bOutboundFull ? MSG_GOSSIP_KIND_FULL : MSG_GOSSIP_KIND_DELTA;
+
+      theShort = htons(nCount);
+      memcpy(byDatagram+5, &theShort, 2);
+
+      memcpy(byDatagram + MSG_GOSSIP_HEADER, &m_Outbound[nStart * MSG_GOSSIP_RECORD], nCount * MSG_GOSSIP_RECORD);
+
+      for (size_t j=0; j<m_Peers.size(); j++)
+      {
+         if (sendto(nSocket, byDatagram, nLength, 0, (struct sockaddr *) &m_Peers[j], sizeof(struct sockaddr_in)) == -1)
+         {
+            LOG_WARN("gossip: sendto: %s", strerror(errno));
+            continue;
+         }
+
+         nSent++;
+      }
+   }
+
+   LOG_DEBUG("Gossip round %u: %lu record(s) (%s) in %d datagram(s)", m_nRound, (unsigned long) nRecords,
+             m_bOutboundFull ? "full" : "delta", nSent);
+
+   return nSent;
+}
+
+uint16_t Gossip::writeRecord (Node * pNode, uint8_t * pData)
+{
+   uint32_t theLong;
+   uint16_t theShort;
+
+   /*   4 Bytes - ID
+    *   4 Bytes - IP Address (network order as is)
+    *   2 Bytes - Port
+    *   2 Bytes - Number of files
+    *   4 Bytes - Registration time (seconds)
+    *   4 Bytes - Registration time (microseconds)
+    *   4 Bytes - Expiration (seconds)
+    *   1 Byte  - Has a load report?
+    *   2 Bytes - Connections
+    *   4 Bytes - Bytes per second
+    *   4 Bytes - Free bandwidth
+    */
+
+   theLong = htonl(pNode->getID());
+   memcpy(pData, &theLong, 4);
+
+   theLong = pNode->getIPAddress();
+   memcpy(pData+4, &theLong, 4);
+
+   theShort = htons(pNode->getPort());
+   memcpy(pData+8, &theShort, 2);
+
+   theShort = htons(pNode->getFiles());
+   memcpy(pData+10, &theShort, 2);
+
+   theLong = htonl(pNode->getRegistrationTime()->tv_sec);
+   memcpy(pData+12, &theLong, 4);
+
+   theLong = htonl(pNode->getRegistrationTime()->tv_usec);
+   memcpy(pData+16, &theLong, 4);
+
+   theLong = htonl(pNode->getExpirationTimeAsPointer()->tv_sec);
+   memcpy(pData+20, &theLong, 4);
+
+   pData[24] = pNode->hasLoad() ? 1 : 0;
+
+   theShort = htons(pNode->getLoad()->nConnections);
+   memcpy(pData+25, &theShort, 2);
+
+   theLong = htonl(pNode->getLoad()->nBytesPerSecond);
+   memcpy(pData+27, &theLong, 4);
+
+   theLong = htonl(pNode->getLoad()->nFreeBandwidth);
+   memcpy(pData+31, &theLong, 4);
+
+   return MSG_GOSSIP_RECORD;
+}
+
+void Gossip::readRecord (const uint8_t * pData, Node * pNode)
+{
+   uint32_t       theLong;
+   uint16_t       theShort;
+   struct timeval theTime;
+
+   memcpy(&theLong, pData, 4);
+   pNode->setID(ntohl(theLong));
+
+   memcpy(&theLong, pData+4, 4);
+   pNode->setIPAddress(theLong);
+
+   memcpy(&theShort, pData+8, 2);
+   pNode->setPort(ntohs(theShort));
+
+   memcpy(&theShort, pData+10, 2);
+   pNode->setFiles(ntohs(theShort));
+
+   memcpy(&theLong, pData+12, 4);
+   theTime.tv_sec = ntohl(theLong);
+   memcpy(&theLong, pData+16, 4);
+   theTime.tv_usec = ntohl(theLong);
+   pNode->updateRegistrationTime(&theTime);
+
+   memcpy(&theLong, pData+20, 4);
+   theTime.tv_sec = ntohl(theLong);
+   theTime.tv_usec = 0;
+   pNode->setExpirationTime(theTime);
+
+   if (pData[24])
+   {
+      NodeLoad theLoad;
+
+      memcpy(&theShort, pData+25, 2);
+      theLoad.nConnections = ntohs(theShort);
+
+      memcpy(&theLong, pData+27, 4);
+      theLoad.nBytesPerSecond = ntohl(theLong);
+
+      memcpy(&theLong, pData+31, 4);
+      theLoad.nFreeBandwidth = ntohl(theLong);
+
+      pNode->setLoad(&theLoad);
+   }
+}
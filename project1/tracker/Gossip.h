@@ -0,0 +1,109 @@
+// Gossip.h : Sharing registrations between tracker instances
+//
+// Trackers that are peered push every registration they see (local or
+// learned from a peer) to all of their peers as a GOSSIP datagram.  Every so
+// often a tracker pushes its whole table instead (anti-entropy) so anything
+// lost along the way gets repaired.  A record wins over what a tracker
+// already has only if its registration time is newer, so applying the same
+// record twice (or out of order) does no harm and every tracker converges on
+// the same view.  Leases run out on each tracker on their own - removals are
+// never gossiped.
+
+#ifndef __GOSSIP_H
+#define __GOSSIP_H
+
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <vector>
+using namespace std;
+
+#include "Node.h"
+#include "NodeTable.h"
+
+/* Default milliseconds between gossip rounds */
+#define DEFAULT_GOSSIP_INTERVAL     1000
+
+/* Every Nth round sends the whole table rather than just the changes */
+#define GOSSIP_FULL_SYNC_ROUNDS     10
+
+/** Gossip keeps the list of peers, the registrations that changed since the
+ * last round and turns them into GOSSIP datagrams.  Everything other than
+ * send must be called with the table lock held.
+ */
+class Gossip
+{
+   private:
+      /* Our instance number (sent along so peers can spot a misconfiguration) */
+      uint32_t    m_nInstance;
+
+      vector<struct sockaddr_in>    m_Peers;
+
+      /* IDs registered / renewed since the last round */
+      vector<uint32_t>  m_Pending;
+
+      /* Records ready to go out on the next send */
+      vector<uint8_t>   m_Outbound;
+      bool              m_bOutboundFull;
+
+      /* Rounds so far (decides when to send the whole table) */
+      uint32_t    m_nRound;
+
+      /* Only pass on the nodes we handed out (sharded - every shard is
+         peered with every other one so nothing needs relaying) */
+      bool        m_bLocalOnly;
+
+   public:
+      Gossip ();
+
+      void setInstance (uint32_t nInstance)
+      { m_nInstance = nInstance; }
+
+      /** Add a peer to push changes to (and accept changes from)
+       *  @param pszPeer host:port of the other tracker
+       *  @returns false if the peer could not be resolved
+       */
+      bool  addPeer (const char * pszPeer);
+
+      void addPeer (struct sockaddr_in * pPeer)
+      { m_Peers.push_back(*pPeer); }
+
+      void setLocalOnly (bool bLocalOnly)
+      { m_bLocalOnly = bLocalOnly; }
+
+      bool isEnabled ()
+      { return !m_Peers.empty(); }
+
+      int getPeerCount ()
+      { return m_Peers.size(); }
+
+      /** Did a datagram come from one of our peers? */
+      bool  isPeer (struct sockaddr_in * pAddress);
+
+      /** Note that a node was registered / renewed / updated */
+      void noteChanged (uint32_t nID)
+      { if (isEnabled()) m_Pending.push_back(nID); }
+
+      /** Serialize this round's records (the changes or the whole table)
+       *  @returns The number of records waiting to be sent
+       */
+      int   collect (NodeTable * pTable);
+
+      /** Push the collected records to every peer (no lock needed)
+       *  @returns The number of datagrams sent
+       */
+      int   send (int nSocket);
+
+      /** Write a node out in the gossip record layout
+       *  @returns The number of bytes written (MSG_GOSSIP_RECORD)
+       */
+      static uint16_t writeRecord (Node * pNode, uint8_t * pData);
+
+      /** Read a gossip record back into a node */
+      static void readRecord (const uint8_t * pData, Node * pNode);
+};
+
+#endif
@@ -0,0 +1,223 @@
+// Logger.cc : Asynchronous logging for the tracker
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <strings.h>
+
+#include "Logger.h"
+
+/* How long the flusher naps when there is nothing to write (microseconds) */
+#define LOG_FLUSH_IDLE_USEC   2000
+
+atomic<int>          Logger::s_nLevel (LOG_DEFAULT_LEVEL);
+mutex                Logger::s_RingLock;
+vector<LogRing *>    Logger::s_Rings;
+thread               Logger::s_Flusher;
+atomic<bool>         Logger::s_bRunning (false);
+
+/** Errors and warnings go to stderr, everything else to stdout */
+static FILE * getStream (int nLevel)
+{
+   return nLevel <= LOG_LEVEL_WARN ? stderr : stdout;
+}
+
+LogRing::LogRing ()
+{
+   m_nHead.store(0);
+   m_nTail.store(0);
+   m_nDropped.store(0);
+}
+
+bool LogRing::push (int nLevel, const char * pszFormat, va_list theArgs)
+{
+   uint32_t nHead = m_nHead.load(memory_order_relaxed);
+
+   /* Never wait on the flusher - if it is behind, the entry is lost */
+   if (nHead - m_nTail.load(memory_order_acquire) >= LOG_RING_SIZE)
+   {
+      m_nDropped.fetch_add(1, memory_order_relaxed);
+      return false;
+   }
+
+   LogEntry * pEntry = &m_Entries[nHead % LOG_RING_SIZE];
+
+   int nLength = vsnprintf(pEntry->szText, LOG_ENTRY_SIZE, pszFormat, theArgs);
+
+   if (nLength < 0)
+   {
+      nLength = 0;
+   }
+   else if (nLength >= LOG_ENTRY_SIZE)
+   {
+      nLength = LOG_ENTRY_SIZE - 1;
+   }
+
+   pEntry->byLevel = nLevel;
+   pEntry->nLength = nLength;
+
+   m_nHead.store(nHead + 1, memory_order_release);
+   return true;
+}
+
+int LogRing::drain ()
+{
+   uint32_t nTail = m_nTail.load(memory_order_relaxed);
+   uint32_t nHead = m_nHead.load(memory_order_acquire);
+   int      nWritten = 0;
+
+   while (nTail != nHead)
+   {
+      LogEntry * pEntry = &m_Entries[nTail % LOG_RING_SIZE];
+      FILE *     pStream = getStream(pEntry->byLevel);
+
+      fwrite(pEntry->szText, 1, pEntry->nLength, pStream);
+      fputc('\n', pStream);
+
+      nTail++;
+      nWritten++;
+   }
+
+   m_nTail.store(nTail, memory_order_release);
+   return nWritten;
+}
+
+int Logger::parseLevel (const char * pszLevel)
+{
+   if (strcasecmp(pszLevel, "error") == 0)
+   {
+      return LOG_LEVEL_ERROR;
+   }
+   else if (strcasecmp(pszLevel, "warn") == 0)
+   {
+      return LOG_LEVEL_WARN;
+   }
+   else if (strcasecmp(pszLevel, "info") == 0)
+   {
+      return LOG_LEVEL_INFO;
+   }
+   else if (strcasecmp(pszLevel, "debug") == 0)
+   {
+      return LOG_LEVEL_DEBUG;
+   }
+
+   return -1;
+}
+
+LogRing * Logger::getRing ()
+{
+   static thread_local LogRing * t_pRing = NULL;
+
+   if (t_pRing == NULL)
+   {
+      t_pRing = new LogRing();
+
+      lock_guard<mutex>   theGuard(s_RingLock);
+      s_Rings.push_back(t_pRing);
+   }
+
+   return t_pRing;
+}
+
+int Logger::drainAll ()
+{
+   int nWritten = 0;
+
+   lock_guard<mutex>   theGuard(s_RingLock);
+
+   for (size_t j=0; j<s_Rings.size(); j++)
+   {
+      nWritten += s_Rings[j]->drain();
+   }
+
+   return nWritten;
+}
+
+void Logger::flushLoop ()
+{
+   while (s_bRunning.load(memory_order_acquire))
+   {
+      if (drainAll() > 0)
+      {
+         fflush(stdout);
+         fflush(stderr);
+      }
+      else
+      {
+         usleep(LOG_FLUSH_IDLE_USEC);
+      }
+   }
+}
+
+void Logger::start ()
+{
+   if (s_bRunning.exchange(true))
+   {
+      return;
+   }
+
+   s_Flusher = thread(flushLoop);
+
+   /* Make sure anything queued is written out however the process exits */
+   atexit(stop);
+}
+
+void Logger::stop ()
+{
+   if (!s_bRunning.exchange(false))
+   {
+      return;
+   }
+
+   s_Flusher.join();
+
+   /* Whatever came in while the flusher was winding down */
+   drainAll();
+
+   uint64_t nDropped = getDropped();
+
+   if (nDropped > 0)
+   {
+      fprintf(stderr, "Logger: %llu entries were dropped (ring full)\n", (unsigned long long) nDropped);
+   }
+
+   fflush(stdout);
+   fflush(stderr);
+}
+
+void Logger::log (int nLevel, const char * pszFormat, ...)
+{
+   va_list  theArgs;
+
+   va_start(theArgs, pszFormat);
+
+   if (s_bRunning.load(memory_order_acquire))
+   {
+      getRing()->push(nLevel, pszFormat, theArgs);
+   }
+   else
+   {
+      /* No flusher (before start / after stop) - just write it out */
+      FILE * pStream = getStream(nLevel);
+
+      vfprintf(pStream, pszFormat, theArgs);
+      fputc('\n', pStream);
+   }
+
+   va_end(theArgs);
+}
+
+uint64_t Logger::getDropped ()
+{
+   uint64_t nDropped = 0;
+
+   lock_guard<mutex>   theGuard(s_RingLock);
+
+   for (size_t j=0; j<s_Rings.size(); j++)
+   {
+      nDropped += s_Rings[j]->getDropped();
+   }
+
+   return nDropped;
+}
@@ -0,0 +1,133 @@
+// Logger.h : Asynchronous logging for the tracker
+//
+// Each thread that logs gets its own single producer / single consumer ring
+// of fixed size entries.  Formatting happens on the calling thread (and only
+// if the level is enabled) while a background thread does the actual
+// writing, so the packet path never waits on stdout.
+
+#ifndef __LOGGER_H
+#define __LOGGER_H
+
+#include <stdint.h>
+#include <stdarg.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#define LOG_LEVEL_ERROR    0
+#define LOG_LEVEL_WARN     1
+#define LOG_LEVEL_INFO     2
+#define LOG_LEVEL_DEBUG    3
+
+#define LOG_DEFAULT_LEVEL  LOG_LEVEL_WARN
+
+/* Entries per thread and the longest single entry */
+#define LOG_RING_SIZE      1024
+#define LOG_ENTRY_SIZE     256
+
+/* Check the level before anything is evaluated or formatted */
+#define LOG_AT(nLevel, ...) \
+   do { if (Logger::isEnabled(nLevel)) Logger::log(nLevel, __VA_ARGS__); } while (0)
+
+#define LOG_ERROR(...)     LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...)      LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...)      LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...)     LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+/** LogRing is a single producer / single consumer queue of formatted log
+ * entries.  The owning thread is the only producer and the flusher thread
+ * is the only consumer.
+ */
+class LogRing
+{
+   private:
+      struct LogEntry
+      {
+         uint8_t     byLevel;
+         uint16_t    nLength;
+         char        szText [LOG_ENTRY_SIZE];
+      };
+
+      LogEntry          m_Entries [LOG_RING_SIZE];
+
+      /* Next entry to write (producer) and next to read (consumer) */
+      atomic<uint32_t>  m_nHead;
+      atomic<uint32_t>  m_nTail;
+
+      /* Entries thrown away because the ring was full */
+      atomic<uint64_t>  m_nDropped;
+
+   public:
+      LogRing ();
+
+      /** Format an entry into the ring (producer only)
+       *  @returns false if the ring was full and the entry was dropped
+       */
+      bool  push (int nLevel, const char * pszFormat, va_list theArgs);
+
+      /** Write out everything that is waiting (consumer only)
+       *  @returns The number of entries written
+       */
+      int   drain ();
+
+      uint64_t getDropped ()
+      { return m_nDropped.load(memory_order_relaxed); }
+};
+
+/** Logger owns the per-thread rings and the thread that flushes them */
+class Logger
+{
+   private:
+      static atomic<int>         s_nLevel;
+
+      /* Every ring ever handed out (they live until the process exits) */
+      static mutex               s_RingLock;
+      static vector<LogRing *>   s_Rings;
+
+      static thread              s_Flusher;
+      static atomic<bool>        s_bRunning;
+
+      /** Find (or create) the ring for the calling thread */
+      static LogRing * getRing ();
+
+      /** Body of the flusher thread */
+      static void  flushLoop ();
+
+      /** Write out everything in every ring */
+      static int   drainAll ();
+
+   public:
+      static void setLevel (int nLevel)
+      { s_nLevel.store(nLevel, memory_order_relaxed); }
+
+      static int getLevel ()
+      { return s_nLevel.load(memory_order_relaxed); }
+
+      static bool isEnabled (int nLevel)
+      { return nLevel <= s_nLevel.load(memory_order_relaxed); }
+
+      /** Turn a level name (error, warn, info, debug) into its value
+       *  @returns The level or -1 if the name is not recognized
+       */
+      static int  parseLevel (const char * pszLevel);
+
+      /** Start the background flusher */
+      static void start ();
+
+      /** Stop the flusher after writing out anything that is left */
+      static void stop ();
+
+      /** Queue up an entry (use the LOG_xxx macros instead so nothing is
+       *  formatted when the level is off)
+       */
+      static void log (int nLevel, const char * pszFormat, ...)
+         __attribute__ ((format (printf, 2, 3)));
+
+      /** Total entries dropped across all threads */
+      static uint64_t getDropped ();
+};
+
+#endif
@@ -6,6 +6,7 @@ using namespace std;
 #include <arpa/inet.h>
 
 #include "Tracker.h"
+#include "Logger.h"
 
 
 void showHelp ()
@@ -13,12 +14,44 @@ void showHelp ()
    cout << "Usage: tracker port options" << endl;
    cout << "  port     The port number on which to receive UDP packets" << endl;
    cout << "  -debug   Turn on extra verbose debugging" << endl;
+   cout << "  -log L   Logging level: error, warn (default), info or debug" << endl;
+   cout << "  -batch N Drain / reply to up to N datagrams per system call (default 1)" << endl;
+   cout << "  -uring   Receive / reply through io_uring (multishot recvmsg with" << endl;
+   cout << "           provided buffers) - falls back to -batch if unsupported" << endl;
+   cout << "  -lease N Lease time in seconds handed out to registering nodes (default 300)" << endl;
+   cout << "  -workers N  Serve on N pinned worker threads, each with its own" << endl;
+   cout << "           SO_REUSEPORT socket (default 0 = single thread)" << endl;
+   cout << "  -checkpoint F  Save the node table to file F every so often and reload" << endl;
+   cout << "           it on startup (warm restart)" << endl;
+   cout << "  -checkpoint-every N  Seconds between checkpoints (default 10)" << endl;
+   cout << "  -capture F  Write every datagram received to file F (replay it with" << endl;
+   cout << "           bench/replay)" << endl;
+   cout << "  -instance K  This tracker's instance number (0-15) - each instance hands" << endl;
+   cout << "           out IDs from its own range (only instance 0 can serve version 1" << endl;
+   cout << "           registrations)" << endl;
+   cout << "  -peer H:P  Share registrations with the tracker at H:P (may be repeated," << endl;
+   cout << "           needs -instance)" << endl;
+   cout << "  -shard H:P  Split the table across a group of trackers - list every" << endl;
+   cout << "           one (this one included) in instance order, the same on each" << endl;
+   cout << "           (may be repeated, needs -instance)" << endl;
+   cout << "  -gossip-every N  Milliseconds between gossip rounds (default 1000)" << endl;
+   cout << "  -admin P  Open an admin console on TCP port P (localhost only)" << endl;
+   cout << "  -limit T:R[:B]  Let each source IP send at most R messages of type T a" << endl;
+   cout << "           second, B back to back (default R) - T is a name such as" << endl;
+   cout << "           list-nodes or a number (may be repeated) - a register-batch" << endl;
+   cout << "           also counts as one register-v2 per node in it" << endl;
+   cout << "  -limit-reply  Answer over-limit requests with an error status rather" << endl;
+   cout << "           than dropping them" << endl;
 }
 
 
 int main (int argc, char** argv)
 {
    bool bDoDebug = false;
+   bool bHaveInstance = false;
+   bool bHavePeers = false;
+   bool bHaveShards = false;
+   int  nInstance = 0;
 
    Tracker  theTracker;
 
@@ -36,14 +69,182 @@ int main (int argc, char** argv)
             if(strcmp("-debug", argv[j]) == 0)
             {
                theTracker.setVerbose(true);
+               Logger::setLevel(LOG_LEVEL_DEBUG);
+            }
+            else if(strcmp("-log", argv[j]) == 0 && j+1 < argc)
+            {
+               int nLevel = Logger::parseLevel(argv[++j]);
+
+               if (nLevel < 0)
+               {
+                  cerr << "Error: Unknown logging level " << argv[j] << endl;
+                  exit(-1);
+               }
+
+               Logger::setLevel(nLevel);
+            }
+            else if(strcmp("-batch", argv[j]) == 0 && j+1 < argc)
+            {
+               int nBatchSize = atoi(argv[++j]);
+
+               if (nBatchSize < 1)
+               {
+                  cerr << "Error: Batch size must be at least 1" << endl;
+                  exit(-1);
+               }
+
+               theTracker.setBatchSize(nBatchSize);
+            }
+            else if(strcmp("-uring", argv[j]) == 0)
+            {
+               theTracker.setUring(true);
+            }
+            else if(strcmp("-lease", argv[j]) == 0 && j+1 < argc)
+            {
+               int nLease = atoi(argv[++j]);
+
+               if (nLease < 1)
+               {
+                  cerr << "Error: Lease time must be at least 1 second" << endl;
+                  exit(-1);
+               }
+
+               theTracker.setLeaseTime(nLease);
+            }
+            else if(strcmp("-workers", argv[j]) == 0 && j+1 < argc)
+            {
+               int nWorkers = atoi(argv[++j]);
+
+               if (nWorkers < 0)
+               {
+                  cerr << "Error: Worker count cannot be negative" << endl;
+                  exit(-1);
+               }
+
+               theTracker.setWorkers(nWorkers);
+            }
+            else if(strcmp("-checkpoint", argv[j]) == 0 && j+1 < argc)
+            {
+               theTracker.setCheckpointPath(argv[++j]);
+            }
+            else if(strcmp("-checkpoint-every", argv[j]) == 0 && j+1 < argc)
+            {
+               int nInterval = atoi(argv[++j]);
+
+               if (nInterval < 1)
+               {
+                  cerr << "Error: Checkpoint interval must be at least 1 second" << endl;
+                  exit(-1);
+               }
+
+               theTracker.setCheckpointInterval(nInterval);
+            }
+            else if(strcmp("-capture", argv[j]) == 0 && j+1 < argc)
+            {
+               const char * pszCapture = argv[++j];
+
+               if (!theTracker.startCapture(pszCapture))
+               {
+                  cerr << "Error: Unable to write a capture to " << pszCapture << endl;
+                  exit(-1);
+               }
+            }
+            else if(strcmp("-instance", argv[j]) == 0 && j+1 < argc)
+            {
+               nInstance = atoi(argv[++j]);
+
+               if (nInstance < 0 || nInstance > NODE_ID_MAX_INSTANCE)
+               {
+                  cerr << "Error: Instance must be between 0 and " << NODE_ID_MAX_INSTANCE << endl;
+                  exit(-1);
+               }
+
+               theTracker.setInstance(nInstance);
+               bHaveInstance = true;
+            }
+            else if(strcmp("-peer", argv[j]) == 0 && j+1 < argc)
+            {
+               if (!theTracker.addPeer(argv[++j]))
+               {
+                  exit(-1);
+               }
+
+               bHavePeers = true;
+            }
+            else if(strcmp("-shard", argv[j]) == 0 && j+1 < argc)
+            {
+               if (!theTracker.addShard(argv[++j]))
+               {
+                  exit(-1);
+               }
+
+               bHaveShards = true;
+            }
+            else if(strcmp("-gossip-every", argv[j]) == 0 && j+1 < argc)
+            {
+               int nInterval = atoi(argv[++j]);
+
+               if (nInterval < 1)
+               {
+                  cerr << "Error: Gossip interval must be at least 1 millisecond" << endl;
+                  exit(-1);
+               }
+
+               theTracker.setGossipInterval(nInterval);
+            }
+            else if(strcmp("-admin", argv[j]) == 0 && j+1 < argc)
+            {
+               int nAdminPort = atoi(argv[++j]);
+
+               if (nAdminPort < 1 || nAdminPort > 65535)
+               {
+                  cerr << "Error: Admin port must be between 1 and 65535" << endl;
+                  exit(-1);
+               }
+
+               theTracker.setAdminPort(nAdminPort);
+            }
+            else if(strcmp("-limit", argv[j]) == 0 && j+1 < argc)
+            {
+               if (!theTracker.addLimit(argv[++j]))
+               {
+                  exit(-1);
+               }
+            }
+            else if(strcmp("-limit-reply", argv[j]) == 0)
+            {
+               theTracker.setLimitReply(true);
             }
          }
       }
    }
 
-   /* Register / properly shutdown on a Control-C */
-   // TODO: Add that code
+   /* Peers would hand out clashing IDs without their own instance numbers */
+   if (bHavePeers && !bHaveInstance)
+   {
+      cerr << "Error: -peer needs an -instance number for this tracker" << endl;
+      exit(-1);
+   }
 
+   /* Shards find each other from the list - peering as well would relay
+      every shard's nodes around the group again */
+   if (bHaveShards && (bHavePeers || !bHaveInstance))
+   {
+      cerr << "Error: -shard needs an -instance number and cannot be mixed with -peer" << endl;
+      exit(-1);
+   }
+
+   if (bHaveShards && !theTracker.startSharding(nInstance))
+   {
+      exit(-1);
+   }
+
+   /* A Control-C (or SIGTERM) is picked up by the tracker's control loop
+      which stops the serving threads and writes a last checkpoint - keep it
+      away from the logging thread as well */
+   Tracker::blockShutdownSignals();
+   /* Logging happens off to the side from here on out */
+   Logger::start();
 
    /* Take the port from the first argument */
    /*   Is this properly protected? */
@@ -51,10 +252,18 @@ int main (int argc, char** argv)
 
    /* Try to initialize the tracker */
    if (!theTracker.initialize(NULL)) {
-      cerr << "Error: Failed to initializer tracker - exiting" << endl;
+      LOG_ERROR("Error: Failed to initializer tracker - exiting");
       exit(-1);
    }
 
-   /* Enter the loop for the tracker */
+   /* Pick up where the last run left off (if it left a checkpoint) */
+   if (!theTracker.restoreCheckpoint()) {
+      LOG_WARN("Warning: Unable to use the checkpoint - starting with an empty table");
+   }
+
+   /* Enter the loop for the tracker (returns once asked to shut down) */
    theTracker.go();
+
+   Logger::stop();
+   return 0;
 }
@@ -4,11 +4,18 @@
 #include <sys/types.h>
 
 #include "Message.h"
+#include "CoarseClock.h"
+#include "Logger.h"
 
 Message::Message ()
 {
    m_byType = MSG_TYPE_UNKNOWN;
    m_nDataLength = 0;
+   m_nArrivalTick = 0;
+   m_nArrivalNanos = 0;
+   m_nSocket = -1;
+   m_pBatch = NULL;
+   m_pPool = NULL;
    memset(m_byData, 0, MSG_MAX_SIZE);
 }
 
@@ -17,9 +24,24 @@ Message::~Message ()
 
 }
 
+void Message::reuse ()
+{
+   m_byType = MSG_TYPE_UNKNOWN;
+   m_nDataLength = 0;
+   m_nArrivalTick = 0;
+   m_nArrivalNanos = 0;
+   m_nSocket = -1;
+   m_pBatch = NULL;
+}
+
 string Message::getTypeAsString ()
 {
-   switch(getType())
+   return getTypeName(getType());
+}
+
+string Message::getTypeName (uint8_t byType)
+{
+   switch(byType)
    {
       case MSG_TYPE_UNKNOWN:
          return "Unknown";
@@ -35,19 +57,101 @@ string Message::getTypeAsString ()
          return "Echo";
       case MSG_TYPE_ECHO_RESPONSE:
          return "Echo-Response";
+      case MSG_TYPE_REGISTER_V2:
+         return "Register-V2";
+      case MSG_TYPE_REGISTER_V2_ACK:
+         return "Register-V2-Ack";
+      case MSG_TYPE_LIST_NODES_V2:
+         return "List-Nodes-V2";
+      case MSG_TYPE_LIST_NODES_V2_DATA:
+         return "List-Nodes-V2-Data";
+      case MSG_TYPE_LIST_NODES_PAGE:
+         return "List-Nodes-Page";
+      case MSG_TYPE_LIST_NODES_PAGE_DATA:
+         return "List-Nodes-Page-Data";
+      case MSG_TYPE_STATS:
+         return "Stats";
+      case MSG_TYPE_STATS_RESPONSE:
+         return "Stats-Response";
+      case MSG_TYPE_GOSSIP:
+         return "Gossip";
+      case MSG_TYPE_PUBLISH_FILES:
+         return "Publish-Files";
+      case MSG_TYPE_PUBLISH_FILES_ACK:
+         return "Publish-Files-Ack";
+      case MSG_TYPE_FIND_FILE:
+         return "Find-File";
+      case MSG_TYPE_FIND_FILE_DATA:
+         return "Find-File-Data";
+      case MSG_TYPE_LIST_NODES_DELTA:
+         return "List-Nodes-Delta";
+      case MSG_TYPE_LIST_NODES_DELTA_DATA:
+         return "List-Nodes-Delta-Data";
+      case MSG_TYPE_REGISTER_BATCH:
+         return "Register-Batch";
+      case MSG_TYPE_REGISTER_BATCH_ACK:
+         return "Register-Batch-Ack";
+      case MSG_TYPE_SUBSCRIBE:
+         return "Subscribe";
+      case MSG_TYPE_SUBSCRIBE_ACK:
+         return "Subscribe-Ack";
+      case MSG_TYPE_NODE_CHANGES:
+         return "Node-Changes";
+      case MSG_TYPE_REDIRECT:
+         return "Redirect";
       default:
          return "Undefined";
    }
 }
 
-void Message::recordArrival ()
+uint8_t Message::getResponseType (uint8_t byType)
+{
+   switch(byType)
+   {
+      case MSG_TYPE_ECHO:
+         return MSG_TYPE_ECHO_RESPONSE;
+      case MSG_TYPE_REGISTER:
+         return MSG_TYPE_REGISTER_ACK;
+      case MSG_TYPE_REGISTER_V2:
+         return MSG_TYPE_REGISTER_V2_ACK;
+      case MSG_TYPE_LIST_NODES:
+         return MSG_TYPE_LIST_NODES_DATA;
+      case MSG_TYPE_LIST_NODES_V2:
+         return MSG_TYPE_LIST_NODES_V2_DATA;
+      case MSG_TYPE_LIST_NODES_PAGE:
+         return MSG_TYPE_LIST_NODES_PAGE_DATA;
+      case MSG_TYPE_STATS:
+         return MSG_TYPE_STATS_RESPONSE;
+      case MSG_TYPE_PUBLISH_FILES:
+         return MSG_TYPE_PUBLISH_FILES_ACK;
+      case MSG_TYPE_FIND_FILE:
+         return MSG_TYPE_FIND_FILE_DATA;
+      case MSG_TYPE_LIST_NODES_DELTA:
+         return MSG_TYPE_LIST_NODES_DELTA_DATA;
+      case MSG_TYPE_REGISTER_BATCH:
+         return MSG_TYPE_REGISTER_BATCH_ACK;
+      case MSG_TYPE_SUBSCRIBE:
+         return MSG_TYPE_SUBSCRIBE_ACK;
+      default:
+         return MSG_TYPE_UNKNOWN;
+   }
+}
+
+void Message::recordArrival (CoarseClock * pClock)
 {
-   gettimeofday(getArrivalTime(), 0);
+   m_timeArrival = *(pClock->getWallTime());
+   m_nArrivalTick = pClock->getTick();
+   m_nArrivalNanos = pClock->getNanos();
 }
 
 int  Message::extractBuffer (uint8_t * pBuffer, int nMaxSize)
 {
-   /* First byte is always the buffer */
+   /* Type and length up front with the data right behind them */
+   if (getLength() + 3 > nMaxSize)
+   {
+      return -1;
+   }
+
    pBuffer[0] = getType();
 
    /* Convert things to big endian (if needed) */
@@ -57,10 +161,7 @@ int  Message::extractBuffer (uint8_t * pBuffer, int nMaxSize)
    memcpy(pBuffer+1,&properLength,2);
 
    /* Put all of the actual data in */
-   for(int j=0; j<getLength(); j++)
-   {
-      pBuffer[j+3] = m_byData[j];
-   }
+   memcpy(pBuffer+3, m_byData, getLength());
 
    /* Length is inclusive of the type and length field */
    return getLength();
@@ -68,37 +169,34 @@ int  Message::extractBuffer (uint8_t * pBuffer, int nMaxSize)
 
 void Message::dumpData ()
 {
-   printf("Message with length (%d bytes)\n", getLength());
-   printf("  Message arrived at %ld.%d\n", m_timeArrival.tv_sec, m_timeArrival.tv_usec);
-   printf("  Type = 0x%02X\n", m_byData[0]);
+   LOG_DEBUG("Message with length (%d bytes)", getLength());
+   LOG_DEBUG("  Message arrived at %ld.%ld", (long) m_timeArrival.tv_sec, (long) m_timeArrival.tv_usec);
+   LOG_DEBUG("  Type = 0x%02X", m_byData[0]);
 
    uint16_t    nHostOrderLength;
 
    memcpy(&nHostOrderLength, m_byData+1, 2);
    nHostOrderLength = ntohs(nHostOrderLength);
 
-   printf("  Length Field = 0x%02X%02X (Value = %d)\n", m_byData[1], m_byData[2], nHostOrderLength);
+   LOG_DEBUG("  Length Field = 0x%02X%02X (Value = %d)", m_byData[1], m_byData[2], nHostOrderLength);
+
+   /* Sixteen bytes to a line rather than one */
+   static const char szHex[] = "0123456789ABCDEF";
+   char  szLine [16 * 3 + 1];
 
-   for (int j=0; j<getLength(); j++)
+   for (int j=0; j<getLength(); j+=16)
    {
-      printf("Byte %02d: %02X", j, m_byData[j]);
+      int nBytes = getLength() - j < 16 ? getLength() - j : 16;
 
-      switch(j)
+      for (int k=0; k<nBytes; k++)
       {
-         case 0:
-            printf("  Type\n");
-            break;
-         case 1:
-            printf("  Length - MSB\n");
-            break;
-         case 2:
-            printf("  Length - LSB\n");
-            break;
-
-         default:
-            printf("\n");
-            break;
+         szLine[k*3] = ' ';
+         szLine[k*3+1] = szHex[m_byData[j+k] >> 4];
+         szLine[k*3+2] = szHex[m_byData[j+k] & 0x0F];
       }
 
+      szLine[nBytes*3] = 0;
+
+      LOG_DEBUG("  %04X:%s", j, szLine);
    }
 }
@@ -15,6 +15,9 @@
 #include <string>
 using namespace std;
 
+class ReplyQueue;
+class CoarseClock;
+class MessagePool;
 
 #define MSG_MAX_SIZE    1500
 
@@ -28,8 +31,135 @@ using namespace std;
 #define MSG_TYPE_ECHO            5
 #define MSG_TYPE_ECHO_RESPONSE   6
 
+// Version 2 - same as above but with 32 bit node identifiers
+#define MSG_TYPE_REGISTER_V2           7
+#define MSG_TYPE_REGISTER_V2_ACK       8
+#define MSG_TYPE_LIST_NODES_V2         9
+#define MSG_TYPE_LIST_NODES_V2_DATA    10
+
+// Paginated listing - walk the whole table one datagram at a time
+#define MSG_TYPE_LIST_NODES_PAGE       11
+#define MSG_TYPE_LIST_NODES_PAGE_DATA  12
+
+// Live statistics - counters and latency histograms per message type
+#define MSG_TYPE_STATS                 13
+#define MSG_TYPE_STATS_RESPONSE        14
+
+// Registrations shared between peered trackers (see Gossip.h) - no response
+#define MSG_TYPE_GOSSIP                15
+
+// File location index - nodes publish the files they hold, clients ask who
+// holds a file (see FileIndex.h)
+#define MSG_TYPE_PUBLISH_FILES         16
+#define MSG_TYPE_PUBLISH_FILES_ACK     17
+#define MSG_TYPE_FIND_FILE             18
+#define MSG_TYPE_FIND_FILE_DATA        19
+
+// Delta listing - only what changed since a generation the client has seen
+#define MSG_TYPE_LIST_NODES_DELTA      20
+#define MSG_TYPE_LIST_NODES_DELTA_DATA 21
+
+// Batch registration - many nodes on one host registered / renewed at once
+#define MSG_TYPE_REGISTER_BATCH        22
+#define MSG_TYPE_REGISTER_BATCH_ACK    23
+
+// Pushed table changes - subscribers hear about joins, renewals and
+// departures as they happen (see Subscribers.h)
+#define MSG_TYPE_SUBSCRIBE             24
+#define MSG_TYPE_SUBSCRIBE_ACK         25
+#define MSG_TYPE_NODE_CHANGES          26
+
+// Sharded trackers - sent in place of the usual reply when another tracker
+// owns the node (see ShardRing.h)
+#define MSG_TYPE_REDIRECT              27
+
+// Fixed sizes (including the type and length fields)
+#define MSG_REGISTER_V2_LENGTH         15
+
+// Optional extensions that may follow the fixed part of a REGISTER_V2.  Each
+// one is a 1 byte tag, a 2 byte length (of the value) and then the value.
+#define MSG_REGISTER_EXT_HEADER        3
+// Load report - connections (2), bytes per second served (4), free bandwidth
+// in bytes per second (4)
+#define MSG_REGISTER_EXT_LOAD          1
+#define MSG_REGISTER_EXT_LOAD_LENGTH   10
+// Bloom filter of the node's file keys - whole 32 byte blocks (see BloomIndex.h)
+#define MSG_REGISTER_EXT_BLOOM         2
+
+#define MSG_REGISTER_V2_ACK_LENGTH     20
+// Type + length + status + max count + count
+#define MSG_LIST_NODES_HEADER          6
+// Type + length + cursor + max count
+#define MSG_LIST_NODES_PAGE_LENGTH     9
+// Type + length + status + generation + total + cursor + count
+#define MSG_LIST_NODES_PAGE_HEADER     18
+
+// Type + length + optional selector (0 = summary, otherwise a message type)
+#define MSG_STATS_LENGTH               3
+#define MSG_STATS_SELECT_LENGTH        4
+// Type + length + status + selector + uptime + nodes + expired + threads + count
+#define MSG_STATS_HEADER               24
+// Type + received + errors + p50 / p90 / p99 / p99.9 / max latency
+#define MSG_STATS_SUMMARY_RECORD       37
+// Type + received + errors + sub-bucket bits + bucket count
+#define MSG_STATS_HISTOGRAM_HEADER     20
+// Bucket index + count
+#define MSG_STATS_HISTOGRAM_BUCKET     10
+
+// Type + length + instance + kind + count, followed by the records
+#define MSG_GOSSIP_HEADER              7
+#define MSG_GOSSIP_RECORD              35
+// Just what changed since the last round / the whole table
+#define MSG_GOSSIP_KIND_DELTA          0
+#define MSG_GOSSIP_KIND_FULL           1
+
+// Type + length + node ID + flags + count, followed by count file keys (each
+// a 1 byte length and then the name / content hash)
+#define MSG_PUBLISH_FILES_HEADER       9
+#define MSG_PUBLISH_FILES_ACK_LENGTH   10
+// Forget whatever the node published before / withdraw the listed files
+#define MSG_PUBLISH_FLAG_REPLACE       0x01
+#define MSG_PUBLISH_FLAG_REMOVE        0x02
+// Type + length + max count + key length, followed by the key
+#define MSG_FIND_FILE_HEADER           5
+
+// Type + length + epoch + generation
+#define MSG_LIST_NODES_DELTA_LENGTH    15
+// Type + length + status + flags + epoch + generation + total + updated +
+// removed, followed by the updated nodes and then the removed IDs
+#define MSG_LIST_NODES_DELTA_HEADER    25
+// More changes are waiting - ask again from the generation in the reply
+#define MSG_DELTA_FLAG_MORE            0x01
+
+// Type + length + address + count, followed by count entries of requested ID
+// (4), port (2) and number of files (2)
+#define MSG_REGISTER_BATCH_HEADER      8
+#define MSG_REGISTER_BATCH_ENTRY       8
+// Type + length + status + count + registered + expiry, followed by count
+// entries of ID (4, zero if refused) and port (2)
+#define MSG_REGISTER_BATCH_ACK_HEADER  10
+#define MSG_REGISTER_BATCH_ACK_ENTRY   6
+// Most nodes in one batch (as many as fit in a datagram)
+#define MSG_REGISTER_BATCH_MAX         ((MSG_MAX_SIZE - MSG_REGISTER_BATCH_HEADER) / MSG_REGISTER_BATCH_ENTRY)
+
+// Type + length + lease (seconds, 0 to unsubscribe) + cookie
+#define MSG_SUBSCRIBE_LENGTH           9
+// Type + length + status + lease granted + epoch + generation + cookie
+#define MSG_SUBSCRIBE_ACK_LENGTH       22
+// Type + length + epoch + from generation + to generation + total + updated +
+// removed, followed by the updated nodes and then the removed IDs
+#define MSG_NODE_CHANGES_HEADER        31
+
+// Type + length + request type + owner instance + owner address + owner port
+#define MSG_REDIRECT_LENGTH            11
+
 #define MSG_STATUS_FINE       0
 #define MSG_STATUS_ISSUE      1
+// Delta listings - nothing changed / too far behind (list the whole table)
+#define MSG_STATUS_NOT_MODIFIED  2
+#define MSG_STATUS_RESYNC        3
+// Subscriptions - send the request again echoing the cookie in the ack
+#define MSG_STATUS_COOKIE        4
 
 // Message came from the client
 #define MSG_DIRECTION_CLIENT  0
@@ -50,9 +180,25 @@ class Message
       // Time - when did the message arrive
       struct timeval m_timeArrival;
 
+      // Coarse monotonic tick (seconds) at arrival
+      uint32_t    m_nArrivalTick;
+
+      // Precise monotonic time (nanoseconds) at arrival
+      uint64_t    m_nArrivalNanos;
+
       // Which direction is the message going?
       uint8_t     m_byDirection;
 
+      // The socket that the message arrived on (replies go back out on it)
+      int         m_nSocket;
+
+      // The batch the message arrived in - replies are queued here rather
+      // than sent right away (NULL if the message was read on its own)
+      ReplyQueue *      m_pBatch;
+
+      // The pool the message is recycled through (NULL if it came off the heap)
+      MessagePool *     m_pPool;
+
    public:
       /** Default constructor */
       Message ();
@@ -60,6 +206,11 @@ class Message
       /** Destructor included - not really needed */
       ~Message();
 
+      /** Reset the header fields so that the message can be used again.  The
+       *  data is deliberately left as is.
+       */
+      void  reuse ();
+
       uint8_t  getType ()
       { return m_byType; }
 
@@ -85,19 +236,55 @@ class Message
       */
       string    getTypeAsString ();
 
-      /** Record the arrival time */
-      void     recordArrival ();
+      /** Name of a message type (for the logs and the admin console) */
+      static string  getTypeName (uint8_t byType);
+
+      /** What a tracker answers a request with
+       *  @returns The response type (MSG_TYPE_UNKNOWN if it is not answered,
+       *           e.g. gossip)
+       */
+      static uint8_t getResponseType (uint8_t byType);
+
+      /** Record the arrival time (as of the last clock update) */
+      void     recordArrival (CoarseClock * pClock);
 
       /** Get access to the arrival time */
       timeval *   getArrivalTime ()
       { return &m_timeArrival; }
 
+      /** Get the coarse monotonic tick at which the message arrived */
+      uint32_t getArrivalTick ()
+      { return m_nArrivalTick; }
+
+      /** Get the precise monotonic time (nanoseconds) at which the message arrived */
+      uint64_t getArrivalNanos ()
+      { return m_nArrivalNanos; }
+
       /** Get access to the address that sent the message */
       struct sockaddr_in * getAddress ()
       { return &m_SrcInfo; }
 
+      int   getSocket ()
+      { return m_nSocket; }
+
+      void  setSocket (int nSocket)
+      { m_nSocket = nSocket; }
+
+      ReplyQueue * getBatch ()
+      { return m_pBatch; }
+
+      void  setBatch (ReplyQueue * pBatch)
+      { m_pBatch = pBatch; }
+
+      MessagePool * getPool ()
+      { return m_pPool; }
+
+      void  setPool (MessagePool * pPool)
+      { m_pPool = pPool; }
+
       /** Extract all the data (including type and length) into the
        * specified buffer location
+       * @returns The length of the data or -1 if nMaxSize is too small
        */
       int   extractBuffer (uint8_t * pBuffer, int nMaxSize);
 
@@ -0,0 +1,102 @@
+// MessagePool.cc : Preallocated slab of Message objects for the tracker
+
+#include <stdint.h>
+
+#include "MessagePool.h"
+
+MessageHandle & MessageHandle::operator= (MessageHandle && theOther)
+{
+   if (this != &theOther)
+   {
+      reset();
+      m_pMessage = theOther.m_pMessage;
+      theOther.m_pMessage = NULL;
+   }
+
+   return *this;
+}
+
+void MessageHandle::reset ()
+{
+   if (m_pMessage == NULL)
+   {
+      return;
+   }
+
+   if (m_pMessage->getPool() != NULL)
+   {
+      m_pMessage->getPool()->release(m_pMessage);
+   }
+   else
+   {
+      delete m_pMessage;
+   }
+
+   m_pMessage = NULL;
+}
+
+MessagePool::MessagePool (int nSize)
+{
+   if (nSize < 1)
+   {
+      nSize = 1;
+   }
+
+   /* The one and only time the bulk of the messages get zeroed */
+   m_nSlabSize = nSize;
+   m_pSlab = new Message [m_nSlabSize];
+   m_nAllocations = 1;
+   m_nAcquired = 0;
+
+   m_FreeList.reserve(m_nSlabSize);
+
+   for (int j=0; j<m_nSlabSize; j++)
+   {
+      m_pSlab[j].setPool(this);
+      m_FreeList.push_back(&m_pSlab[j]);
+   }
+}
+
+MessagePool::~MessagePool ()
+{
+   /* Anything beyond the slab came from the heap one at a time */
+   for (size_t j=0; j<m_FreeList.size(); j++)
+   {
+      if (m_FreeList[j] < m_pSlab || m_FreeList[j] >= m_pSlab + m_nSlabSize)
+      {
+         delete m_FreeList[j];
+      }
+   }
+
+   delete [] m_pSlab;
+}
+
+MessageHandle MessagePool::acquire ()
+{
+   Message * pMessage;
+
+   m_nAcquired++;
+
+   if (m_FreeList.empty())
+   {
+      /* Ran dry - grow by one (it will stay in the pool from here on out) */
+      pMessage = new Message();
+      pMessage->setPool(this);
+      m_nAllocations++;
+   }
+   else
+   {
+      pMessage = m_FreeList.back();
+      m_FreeList.pop_back();
+
+      /* Reset the header but leave the data alone - no zeroing here */
+      pMessage->reuse();
+   }
+
+   return MessageHandle(pMessage);
+}
+
+void MessagePool::release (Message * pMessage)
+{
+   m_FreeList.push_back(pMessage);
+}
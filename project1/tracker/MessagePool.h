@@ -0,0 +1,102 @@
+// MessagePool.h : Preallocated slab of Message objects for the tracker
+
+#ifndef __MESSAGEPOOL_H
+#define __MESSAGEPOOL_H
+
+#include <stdint.h>
+
+#include <vector>
+using namespace std;
+
+#include "Message.h"
+
+/* Default number of messages carved out up front for each serving loop */
+#define MESSAGE_POOL_DEFAULT_SIZE     64
+
+class MessagePool;
+
+/** MessageHandle owns a pooled message and hands it back to its pool when it
+ * goes out of scope.  It can be moved but not copied (like a unique_ptr).
+ */
+class MessageHandle
+{
+   private:
+      Message *   m_pMessage;
+
+   public:
+      MessageHandle ()
+      { m_pMessage = NULL; }
+
+      explicit MessageHandle (Message * pMessage)
+      { m_pMessage = pMessage; }
+
+      MessageHandle (MessageHandle && theOther)
+      { m_pMessage = theOther.m_pMessage; theOther.m_pMessage = NULL; }
+
+      MessageHandle & operator= (MessageHandle && theOther);
+
+      MessageHandle (const MessageHandle &) = delete;
+      MessageHandle & operator= (const MessageHandle &) = delete;
+
+      /** Return the message to its pool */
+      ~MessageHandle ()
+      { reset(); }
+
+      Message * get ()
+      { return m_pMessage; }
+
+      Message * operator-> ()
+      { return m_pMessage; }
+
+      /** Give up ownership without returning the message */
+      Message * release ()
+      { Message * pMessage = m_pMessage; m_pMessage = NULL; return pMessage; }
+
+      /** Return the message (if any) to its pool now */
+      void reset ();
+};
+
+/** MessagePool carves out a block of messages once and recycles them through a
+ * free list.  Recycled messages have their header fields reset but their
+ * data is left alone - every handler writes what it sends.  A pool belongs to
+ * a single serving loop (thread) so no locking is needed.
+ */
+class MessagePool
+{
+   private:
+      /* The initial block of messages */
+      Message *            m_pSlab;
+      int                  m_nSlabSize;
+
+      /* Messages ready to be handed out */
+      vector<Message *>    m_FreeList;
+
+      /* How many times did we have to go to the heap (slab included)? */
+      uint64_t    m_nAllocations;
+
+      /* How many messages have been handed out over time? */
+      uint64_t    m_nAcquired;
+
+   public:
+      MessagePool (int nSize);
+      ~MessagePool ();
+
+      /** Grab a message from the pool (only allocates if the pool is dry)
+       *  @returns A handle that returns the message when it is done
+       */
+      MessageHandle  acquire ();
+
+      /** Put a message back (called by MessageHandle) */
+      void  release (Message * pMessage);
+
+      uint64_t getAllocations ()
+      { return m_nAllocations; }
+
+      uint64_t getAcquired ()
+      { return m_nAcquired; }
+
+      int getAvailable ()
+      { return m_FreeList.size(); }
+};
+
+#endif
@@ -11,6 +11,7 @@
 using namespace std;
 
 #include "Node.h"
+#include "WireLayout.h"
 
 Node::Node ()
 {
@@ -25,6 +26,9 @@ Node::Node ()
    m_RegistrationExpiry.tv_usec = 0;
 
    m_nID = 0;
+
+   m_bHasLoad = false;
+   memset(&m_Load, 0, sizeof(m_Load));
 }
 
 Node::~Node ()
@@ -32,44 +36,60 @@ Node::~Node ()
    // Nothing to clean up - for now
 }
 
-void Node::updateRegistrationTime ()
+void Node::updateRegistrationTime (struct timeval * pNow)
 {
-   gettimeofday(&m_LastRegistration, 0);
+   m_LastRegistration = *pNow;
 }
 
-uint16_t Node::constructRegistrationAck (uint8_t * pData)
+uint32_t Node::getLoadScore ()
 {
-   pData[0] = m_nID;
-
-   /* We are assuming that the network address is stored in proper order
-   since it is a byte-wise set of values anyway */
-   memcpy(pData+1, &m_IP_Address, 4);
+   if (!m_bHasLoad)
+   {
+      return NODE_LOAD_SCORE_UNKNOWN;
+   }
 
-   /* Convert this to network order */
-   uint16_t    nDataNetOrder;
+   /* How much of its bandwidth is it using? */
+   uint64_t nCapacity = (uint64_t) m_Load.nBytesPerSecond + m_Load.nFreeBandwidth;
+   uint32_t nUtilization = 0;
 
-   nDataNetOrder = htons(m_nPort);
-   memcpy(pData+5, &nDataNetOrder, 2);
+   if (nCapacity > 0)
+   {
+      nUtilization = (uint32_t) ((uint64_t) m_Load.nBytesPerSecond * 1000 / nCapacity);
+   }
 
-   /* Number of files */
-   nDataNetOrder = htons(m_nFiles);
-   memcpy(pData+7, &nDataNetOrder, 2);
+   /* Lots of connections hurts even if the bandwidth is there */
+   uint32_t nConnections = m_Load.nConnections;
 
-   /* Put up the expiration time with proper network ordering */
-   uint32_t    nTimeNetOrder;
+   if (nConnections > 100)
+   {
+      nConnections = 100;
+   }
 
-   nTimeNetOrder = htonl(m_RegistrationExpiry.tv_sec);
-   memcpy(pData+9, &nTimeNetOrder, 4);
+   return nUtilization + nConnections * 10;
+}
 
+uint16_t Node::constructRegistrationAck (uint8_t * pData)
+{
    /* Magic numbers - whoot, whoot
-      Though in all seriousness
+      Though in all seriousness (see NodeDataLayout)
         1 Byte - ID
         4 Bytes - IP Address
         2 Bytes - Port
         2 Bytes - Num Files
         4 Bytes - Expiration Time for Registration
    */
-   return 13;
+   WireWriter<NodeDataLayout>  theRecord (pData);
+
+   theRecord.set<NodeDataLayout::ID>(m_nID);
+
+   /* We are assuming that the network address is stored in proper order
+   since it is a byte-wise set of values anyway */
+   theRecord.set<NodeDataLayout::Address>(m_IP_Address);
+   theRecord.set<NodeDataLayout::Port>(m_nPort);
+   theRecord.set<NodeDataLayout::Files>(m_nFiles);
+   theRecord.set<NodeDataLayout::Expiry>(m_RegistrationExpiry.tv_sec);
+
+   return NODE_DATA_SIZE;
 }
 
 uint16_t Node::constructNodeData (uint8_t * pData)
@@ -77,3 +97,23 @@ uint16_t Node::constructNodeData (uint8_t * pData)
    /* Code re-use FTW */
    return constructRegistrationAck(pData);
 }
+
+uint16_t Node::constructNodeDataWide (uint8_t * pData)
+{
+   /* Same idea as above but the ID takes up 4 bytes (see NodeDataWideLayout)
+        4 Bytes - ID
+        4 Bytes - IP Address
+        2 Bytes - Port
+        2 Bytes - Num Files
+        4 Bytes - Expiration Time for Registration
+   */
+   WireWriter<NodeDataWideLayout>  theRecord (pData);
+
+   theRecord.set<NodeDataWideLayout::ID>(m_nID);
+   theRecord.set<NodeDataWideLayout::Address>(m_IP_Address);
+   theRecord.set<NodeDataWideLayout::Port>(m_nPort);
+   theRecord.set<NodeDataWideLayout::Files>(m_nFiles);
+   theRecord.set<NodeDataWideLayout::Expiry>(m_RegistrationExpiry.tv_sec);
+
+   return NODE_DATA_V2_SIZE;
+}
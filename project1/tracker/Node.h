@@ -15,6 +15,27 @@
 #include <string>
 using namespace std;
 
+/* What a node reports about how busy it is (all zero if never reported) */
+struct NodeLoad
+{
+   /* Connections the node is serving right now */
+   uint16_t    nConnections;
+
+   /* How fast the node is serving data (bytes per second) */
+   uint32_t    nBytesPerSecond;
+
+   /* How much more it could be serving (bytes per second) */
+   uint32_t    nFreeBandwidth;
+};
+
+/* Score given to a node that has never reported its load - right in the
+   middle so that it neither hogs nor misses out on clients */
+#define NODE_LOAD_SCORE_UNKNOWN     1000
+
+/* Bytes per node in the node data / registration ACK payloads */
+#define NODE_DATA_SIZE        13
+#define NODE_DATA_V2_SIZE     16
+
 /** Node is the object to hold information related to a node that is being tracked
  * by the P2P system.  Each Node has a unique identifier and the tracker keeps track of
  * the IP address and port number for each node.
@@ -38,7 +59,11 @@ class Node
       struct timeval    m_RegistrationExpiry;
 
       /* The ID as assigned by the tracker */
-      uint8_t     m_nID;
+      uint32_t    m_nID;
+
+      /* Most recent load report (if any) */
+      bool        m_bHasLoad;
+      NodeLoad    m_Load;
 
    public:
       Node ();
@@ -66,12 +91,28 @@ class Node
       uint16_t getFiles ()
       { return m_nFiles; }
 
-      void setID (uint8_t nID)
+      void setID (uint32_t nID)
       { m_nID = nID;}
 
-      uint8_t getID ()
+      uint32_t getID ()
       { return m_nID; }
 
+      void setLoad (NodeLoad * pLoad)
+      { m_Load = *pLoad; m_bHasLoad = true; }
+
+      bool hasLoad ()
+      { return m_bHasLoad; }
+
+      NodeLoad * getLoad ()
+      { return &m_Load; }
+
+      /** How busy is the node?  Lower is better.
+       *  @returns Utilization (0-1000, served / (served + free)) plus 10 per
+       *           active connection (capped at 100 connections), or
+       *           NODE_LOAD_SCORE_UNKNOWN if the node has never reported
+       */
+      uint32_t getLoadScore ();
+
       void setExpirationTime (struct timeval theExp)
       { m_RegistrationExpiry = theExp; }
 
@@ -84,7 +125,7 @@ class Node
       /** Update the node registration information, e.g. when did the
        *  node last attempt to register
        */
-      void updateRegistrationTime ();
+      void updateRegistrationTime (struct timeval * pNow);
 
       struct timeval * getRegistrationTime ()
       { return &m_LastRegistration; }
@@ -102,6 +143,13 @@ class Node
        *  @returns The number of bytes filled in by this function
        */
       uint16_t constructNodeData (uint8_t * pData);
+
+      /** Construct / fill the byte array with the version 2 node data
+       *  (same as above but with the full 32 bit ID)
+       *  @param pData The byte buffer location to place the data
+       *  @returns The number of bytes filled in by this function
+       */
+      uint16_t constructNodeDataWide (uint8_t * pData);
 };
 
 
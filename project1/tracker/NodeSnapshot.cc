@@ -0,0 +1,125 @@
+// NodeSnapshot.cc : Pre-serialized copy of the node table for LIST_NODES
+
+#include <cstring>
+
+#include <algorithm>
+#include <utility>
+
+#include "NodeSnapshot.h"
+#include "WireLayout.h"
+
+/* A one byte ID record is the wide record less the top three bytes of its ID */
+static_assert(NODE_DATA_V2_SIZE - NODE_DATA_SIZE == NodeDataWideLayout::Address::nEnd - NodeDataLayout::Address::nEnd &&
+              NodeDataWideLayout::Expiry::nEnd - NodeDataLayout::Expiry::nEnd == NODE_DATA_V2_SIZE - NODE_DATA_SIZE,
+              "The one byte ID record has to be the tail of the wide one");
+
+NodeSnapshot::NodeSnapshot (NodeTable * pTable)
+{
+   m_nGeneration = pTable->getGeneration();
+
+   /* Just what has to be read under the table lock, in table order - rank
+      does the rest once the lock is let go */
+   m_Records.resize(pTable->size() * NODE_DATA_V2_SIZE);
+   m_Scores.resize(pTable->size());
+
+   for (size_t j=0; j<pTable->size(); j++)
+   {
+      Node & theNode = pTable->getEntry(j);
+
+      theNode.constructNodeDataWide(&m_Records[j * NODE_DATA_V2_SIZE]);
+      m_Scores[j] = theNode.getLoadScore();
+   }
+}
+
+void NodeSnapshot::rank ()
+{
+   /* Rank by reported load (ties stay in table order) */
+   vector< pair<uint32_t, uint32_t> >  theOrder (m_Scores.size());
+
+   for (size_t j=0; j<m_Scores.size(); j++)
+   {
+      theOrder[j] = make_pair(m_Scores[j], (uint32_t) j);
+   }
+
+   sort(theOrder.begin(), theOrder.end());
+
+   vector<uint8_t>   theRanked (m_Records.size());
+   uint32_t          nBand = UINT32_MAX;
+   uint32_t          nLegacyBand = UINT32_MAX;
+
+   m_LegacyRecords.clear();
+   m_LegacyRecords.reserve(m_Scores.size() * NODE_DATA_SIZE);
+
+   for (size_t j=0; j<theOrder.size(); j++)
+   {
+      const uint8_t * pRecord = &m_Records[theOrder[j].second * NODE_DATA_V2_SIZE];
+
+      if (theOrder[j].first / SNAPSHOT_SCORE_BAND != nBand)
+      {
+         nBand = theOrder[j].first / SNAPSHOT_SCORE_BAND;
+         m_Bands.push_back(j);
+      }
+
+      memcpy(&theRanked[j * NODE_DATA_V2_SIZE], pRecord, NODE_DATA_V2_SIZE);
+
+      /* Older clients can only make sense of one byte IDs */
+      if (NodeDataWideLayout::ID::load(pRecord) <= NODE_ID_LEGACY_MAX)
+      {
+         if (theOrder[j].first / SNAPSHOT_SCORE_BAND != nLegacyBand)
+         {
+            nLegacyBand = theOrder[j].first / SNAPSHOT_SCORE_BAND;
+            m_LegacyBands.push_back(getLegacyCount());
+         }
+
+         m_LegacyRecords.insert(m_LegacyRecords.end(), pRecord + NODE_DATA_V2_SIZE - NODE_DATA_SIZE, pRecord + NODE_DATA_V2_SIZE);
+      }
+   }
+
+   m_Bands.push_back(getCount());
+   m_LegacyBands.push_back(getLegacyCount());
+
+   m_Records.swap(theRanked);
+   vector<uint32_t>().swap(m_Scores);
+}
+
+uint16_t NodeSnapshot::copyRecords (bool bWide, uint32_t nStart, uint32_t nCount, uint8_t * pData)
+{
+   uint16_t nBytes;
+
+   if (bWide)
+   {
+      nBytes = nCount * NODE_DATA_V2_SIZE;
+      memcpy(pData, m_Records.data() + nStart * NODE_DATA_V2_SIZE, nBytes);
+   }
+   else
+   {
+      nBytes = nCount * NODE_DATA_SIZE;
+      memcpy(pData, m_LegacyRecords.data() + nStart * NODE_DATA_SIZE, nBytes);
+   }
+
+   return nBytes;
+}
+
+uint16_t NodeSnapshot::copyRanked (bool bWide, uint32_t nCount, uint64_t nSpin, uint8_t * pData)
+{
+   vector<uint32_t> & theBands = bWide ? m_Bands : m_LegacyBands;
+   uint16_t           nBytes = 0;
+
+   for (size_t j=0; j+1<theBands.size() && nCount > 0; j++)
+   {
+      uint32_t nFirst = theBands[j];
+      uint32_t nSize = theBands[j+1] - nFirst;
+      uint32_t nTake = min(nSize, nCount);
+      uint32_t nOffset = nSpin % nSize;
+
+      /* From the starting point to the end of the band, then wrap round */
+      uint32_t nRun = min(nTake, nSize - nOffset);
+
+      nBytes += copyRecords(bWide, nFirst + nOffset, nRun, pData + nBytes);
+      nBytes += copyRecords(bWide, nFirst, nTake - nRun, pData + nBytes);
+
+      nCount -= nTake;
+   }
+
+   return nBytes;
+}
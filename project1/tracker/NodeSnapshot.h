@@ -0,0 +1,89 @@
+// NodeSnapshot.h : Pre-serialized copy of the node table for LIST_NODES
+
+#ifndef __NODESNAPSHOT_H
+#define __NODESNAPSHOT_H
+
+#include <stdint.h>
+
+#include <vector>
+using namespace std;
+
+#include "NodeTable.h"
+
+/* Load scores this close together count as the same load (see copyRanked) */
+#define SNAPSHOT_SCORE_BAND   100
+
+/** NodeSnapshot holds the node data region of a LIST_NODES_DATA reply
+ * (both the original and the version 2 layouts) for every live node, already
+ * in wire format and ordered least loaded first.  A snapshot never changes
+ * once published - when the table moves on to a new generation a new snapshot
+ * is built and the old one is dropped once nobody is using it.  Building one
+ * is split in two so that only the copy holds up the table's writers: the
+ * records are taken under the table lock and ranked after it is released.
+ *
+ * The nodes are grouped into bands of similar load.  A listing takes whole
+ * bands from the least loaded up, but starts each band at a different spot
+ * per request - the scores only change when nodes renew, so always handing
+ * out the top of the list would send every client to the same few nodes.
+ */
+class NodeSnapshot
+{
+   private:
+      /* Table generation that this snapshot reflects */
+      uint64_t          m_nGeneration;
+
+      /* 13 byte records - only nodes whose ID fits in one byte */
+      vector<uint8_t>   m_LegacyRecords;
+
+      /* 16 byte records - every node */
+      vector<uint8_t>   m_Records;
+
+      /* Load score of each record until they are ranked */
+      vector<uint32_t>  m_Scores;
+
+      /* Index of the first record in each load band (and one past the last
+         record at the end) for each set of records */
+      vector<uint32_t>  m_LegacyBands;
+      vector<uint32_t>  m_Bands;
+
+   public:
+      /** Copy the table as it stands (caller holds the table lock) - rank
+       *  has to be called before the snapshot is used
+       */
+      NodeSnapshot (NodeTable * pTable);
+
+      /** Order the records least loaded first and pick out the ones older
+       *  clients can use (no lock needed)
+       */
+      void  rank ();
+
+      uint64_t getGeneration ()
+      { return m_nGeneration; }
+
+      uint32_t getCount ()
+      { return m_Records.size() / NODE_DATA_V2_SIZE; }
+
+      uint32_t getLegacyCount ()
+      { return m_LegacyRecords.size() / NODE_DATA_SIZE; }
+
+      /** Copy a run of records into a reply
+       *  @param bWide true for the version 2 (16 byte) records
+       *  @param nStart Index of the first record to copy
+       *  @param nCount How many records to copy (no more than available)
+       *  @param pData Where to copy them
+       *  @returns The number of bytes copied
+       */
+      uint16_t copyRecords (bool bWide, uint32_t nStart, uint32_t nCount, uint8_t * pData);
+
+      /** Copy the records for a listing - least loaded band first, each band
+       *  rotated to a starting point picked by nSpin
+       *  @param bWide true for the version 2 (16 byte) records
+       *  @param nCount How many records to copy (no more than available)
+       *  @param nSpin Anything that differs from one request to the next
+       *  @param pData Where to copy them
+       *  @returns The number of bytes copied
+       */
+      uint16_t copyRanked (bool bWide, uint32_t nCount, uint64_t nSpin, uint8_t * pData);
+};
+
+#endif
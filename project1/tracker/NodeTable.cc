@@ -0,0 +1,403 @@
+// NodeTable.cc : Storage and ID assignment for the tracked nodes
+
+#include <stdint.h>
+#include <cstring>
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <random>
+using namespace std;
+
+#include "NodeTable.h"
+
+/* Starting size of the index - saves a few rehashes during a registration storm */
+#define NODE_TABLE_INITIAL_BUCKETS     1024
+
+NodeTable::NodeTable ()
+{
+   m_nGeneration = 0;
+   m_nRenewals = 0;
+
+   random_device  theRandom;
+   m_nEpoch = theRandom();
+
+   /* Zero is what a client with no listing at all sends */
+   if (m_nEpoch == 0)
+   {
+      m_nEpoch = 1;
+   }
+
+   m_bPartitioned = false;
+   m_nInstance = 0;
+   m_nSlotMask = NODE_ID_SLOT_MASK;
+   m_nMaxSlots = NODE_ID_MAX_SLOTS;
+
+   m_Index.reserve(NODE_TABLE_INITIAL_BUCKETS);
+}
+
+NodeTable::~NodeTable ()
+{
+   // Nothing to clean up - the vectors take care of themselves
+}
+
+void NodeTable::setInstance (uint32_t nInstance)
+{
+   m_bPartitioned = true;
+   m_nInstance = nInstance & NODE_ID_MAX_INSTANCE;
+   m_nSlotMask = NODE_ID_INSTANCE_SLOT_MASK;
+   m_nMaxSlots = NODE_ID_INSTANCE_SLOT_MASK;
+}
+
+Node * NodeTable::findNode (uint32_t nID)
+{
+   unordered_map<uint32_t, uint32_t>::iterator theEntry;
+
+   theEntry = m_Index.find(nID);
+
+   if (theEntry == m_Index.end())
+   {
+      return NULL;
+   }
+
+   return &m_Slots[theEntry->second];
+}
+
+bool NodeTable::takeSlot (bool bLegacy, uint32_t * pSlot)
+{
+   vector<uint32_t> & theFree = bLegacy ? m_LegacySlots : m_FreeSlots;
+
+   /* Prefer recycling a slot over growing the storage */
+   if (!theFree.empty())
+   {
+      *pSlot = theFree.back();
+      theFree.pop_back();
+      return true;
+   }
+
+   if (m_Slots.size() < m_nMaxSlots && (!bLegacy || isLegacySlot(m_Slots.size())))
+   {
+      *pSlot = m_Slots.size();
+      return true;
+   }
+
+   /* A wide ID only takes a legacy slot once there is nothing else left */
+   if (!m_LegacySlots.empty())
+   {
+      *pSlot = m_LegacySlots.back();
+      m_LegacySlots.pop_back();
+      return true;
+   }
+
+   return false;
+}
+
+void NodeTable::freeSlot (uint32_t nSlot)
+{
+   if (isLegacySlot(nSlot))
+   {
+      /* No room for a generation in a version 1 ID (a slot restored from an
+         older checkpoint may still have one) */
+      m_Generations[nSlot] = 0;
+      m_LegacySlots.push_back(nSlot);
+   }
+   else
+   {
+      /* Move the generation on so the old ID stays dead */
+      m_Generations[nSlot]++;
+      m_FreeSlots.push_back(nSlot);
+   }
+}
+
+Node * NodeTable::addNode (uint32_t nMaxID)
+{
+   uint32_t    nSlot;
+
+   if (!takeSlot(nMaxID <= NODE_ID_LEGACY_MAX, &nSlot))
+   {
+      return NULL;
+   }
+
+   return occupySlot(nSlot, makeID(nSlot, nSlot < m_Slots.size() ? m_Generations[nSlot] : 0));
+}
+
+Node * NodeTable::adoptNode (uint32_t nID)
+{
+   uint32_t    nSlot;
+
+   if (nID == NODE_ID_INVALID || m_Index.count(nID) != 0)
+   {
+      return NULL;
+   }
+
+   /* Which slot holds the node does not matter - the ID is not ours */
+   if (!takeSlot(false, &nSlot))
+   {
+      return NULL;
+   }
+
+   return occupySlot(nSlot, nID);
+}
+
+Node * NodeTable::occupySlot (uint32_t nSlot, uint32_t nID)
+{
+   if (nSlot == m_Slots.size())
+   {
+      m_Slots.push_back(Node());
+      m_Generations.push_back(0);
+      m_LivePosition.push_back(0);
+   }
+
+   m_Slots[nSlot] = Node();
+   m_Slots[nSlot].setID(nID);
+
+   m_LivePosition[nSlot] = m_Live.size();
+   m_Live.push_back(nSlot);
+
+   m_Index[nID] = nSlot;
+   noteChange(nID, false);
+
+   return &m_Slots[nSlot];
+}
+
+void NodeTable::noteChange (uint32_t nID, bool bRemoved)
+{
+   TableChange theChange;
+
+   m_nGeneration++;
+
+   theChange.nGeneration = m_nGeneration;
+   theChange.nID = nID;
+   theChange.bRemoved = bRemoved;
+
+   if (m_Journal.size() >= NODE_JOURNAL_LENGTH)
+   {
+      m_Journal.pop_front();
+   }
+
+   m_Journal.push_back(theChange);
+}
+
+bool NodeTable::hasChangesSince (uint64_t nGeneration)
+{
+   if (nGeneration > m_nGeneration)
+   {
+      return false;
+   }
+
+   /* Nothing has happened since - or the journal reaches back far enough */
+   return nGeneration == m_nGeneration || (!m_Journal.empty() && m_Journal.front().nGeneration <= nGeneration + 1);
+}
+
+size_t NodeTable::findChange (uint64_t nGeneration)
+{
+   /* The journal is in generation order (the generations are consecutive
+      but binary search keeps this honest if that ever changes) */
+   TableChange theKey;
+
+   theKey.nGeneration = nGeneration;
+
+   return upper_bound(m_Journal.begin(), m_Journal.end(), theKey,
+                      [] (const TableChange & a, const TableChange & b) { return a.nGeneration < b.nGeneration; }) - m_Journal.begin();
+}
+
+bool NodeTable::writeChanges (uint64_t nGeneration, uint8_t * pData, uint16_t nRoom, uint16_t * pUpdated, uint16_t * pRemoved, uint64_t * pReached)
+{
+   bool  bMore = false;
+
+   m_WrittenIDs.clear();
+   m_RemovedIDs.clear();
+
+   *pReached = nGeneration;
+
+   /* Walk the journal until the room runs out - the reader is then up to the
+      last change that was used */
+   for (size_t nPosition = findChange(nGeneration); nPosition < m_Journal.size(); nPosition++)
+   {
+      const TableChange & theChange = m_Journal[nPosition];
+
+      /* Only the latest state matters - skip anyone already covered */
+      bool bCovered = (find(m_WrittenIDs.begin(), m_WrittenIDs.end(), theChange.nID) != m_WrittenIDs.end() ||
+                       find(m_RemovedIDs.begin(), m_RemovedIDs.end(), theChange.nID) != m_RemovedIDs.end());
+
+      if (!bCovered)
+      {
+         /* Whatever the change was, send the node as it stands now */
+         Node *   pNode = findNode(theChange.nID);
+         uint16_t nNeeded = (pNode != NULL) ? NODE_DATA_V2_SIZE : 4;
+
+         if (nNeeded > nRoom)
+         {
+            bMore = true;
+            break;
+         }
+
+         if (pNode != NULL)
+         {
+            pNode->constructNodeDataWide(pData + m_WrittenIDs.size() * NODE_DATA_V2_SIZE);
+            m_WrittenIDs.push_back(theChange.nID);
+         }
+         else
+         {
+            m_RemovedIDs.push_back(theChange.nID);
+         }
+
+         nRoom -= nNeeded;
+      }
+
+      *pReached = theChange.nGeneration;
+   }
+
+   /* The removals go after the updates */
+   for (size_t j=0; j<m_RemovedIDs.size(); j++)
+   {
+      uint32_t nID = htonl(m_RemovedIDs[j]);
+      memcpy(pData + m_WrittenIDs.size() * NODE_DATA_V2_SIZE + j * 4, &nID, 4);
+   }
+
+   *pUpdated = m_WrittenIDs.size();
+   *pRemoved = m_RemovedIDs.size();
+
+   return bMore;
+}
+
+bool NodeTable::removeNode (uint32_t nID)
+{
+   unordered_map<uint32_t, uint32_t>::iterator theEntry;
+
+   theEntry = m_Index.find(nID);
+
+   if (theEntry == m_Index.end())
+   {
+      return false;
+   }
+
+   uint32_t nSlot = theEntry->second;
+   m_Index.erase(theEntry);
+
+   m_Expiry.cancel(nSlot);
+
+   /* Swap the last live slot into the hole to keep the list dense */
+   uint32_t nPosition = m_LivePosition[nSlot];
+   uint32_t nLastSlot = m_Live.back();
+
+   m_Live[nPosition] = nLastSlot;
+   m_LivePosition[nLastSlot] = nPosition;
+   m_Live.pop_back();
+
+   freeSlot(nSlot);
+
+   noteChange(nID, true);
+
+   return true;
+}
+
+void NodeTable::scheduleExpiry (Node * pNode, uint32_t nExpiryTick)
+{
+   /* Not journaled here - a new node already is and the caller says
+      whether a renewal changed anything more than the expiry */
+   m_Expiry.schedule(pNode - &m_Slots[0], nExpiryTick);
+}
+
+int NodeTable::reapExpired (uint32_t nNowTick, vector<uint32_t> * pRemoved)
+{
+   m_Expired.clear();
+   m_Expiry.advance(nNowTick, &m_Expired);
+
+   for (size_t j=0; j<m_Expired.size(); j++)
+   {
+      uint32_t nID = m_Slots[m_Expired[j]].getID();
+
+      removeNode(nID);
+
+      if (pRemoved != NULL)
+      {
+         pRemoved->push_back(nID);
+      }
+   }
+
+   return m_Expired.size();
+}
+
+void NodeTable::beginRestore (uint32_t nSlots, const uint8_t * pGenerations)
+{
+   m_Slots.assign(nSlots, Node());
+   m_Generations.assign(pGenerations, pGenerations + nSlots);
+   m_LivePosition.assign(nSlots, 0);
+
+   m_FreeSlots.clear();
+   m_LegacySlots.clear();
+   m_Live.clear();
+   m_Index.clear();
+
+   m_Live.reserve(nSlots);
+   m_Index.reserve(nSlots);
+}
+
+Node * NodeTable::restoreNode (uint32_t nID)
+{
+   uint32_t nSlot = (nID & m_nSlotMask) - 1;
+
+   if ((nID & m_nSlotMask) == 0 || nSlot >= m_Slots.size())
+   {
+      return NULL;
+   }
+
+   /* The ID has to be the one the slot would hand out right now */
+   if (makeID(nSlot, m_Generations[nSlot]) != nID || m_Index.count(nID) != 0)
+   {
+      return NULL;
+   }
+
+   m_Slots[nSlot].setID(nID);
+
+   m_LivePosition[nSlot] = m_Live.size();
+   m_Live.push_back(nSlot);
+
+   m_Index[nID] = nSlot;
+   m_nGeneration++;
+
+   return &m_Slots[nSlot];
+}
+
+void NodeTable::retireID (uint32_t nID)
+{
+   uint32_t nSlot = (nID & m_nSlotMask) - 1;
+
+   if ((nID & m_nSlotMask) == 0 || nSlot >= m_Slots.size())
+   {
+      return;
+   }
+
+   /* Only if the slot would otherwise hand out that very ID */
+   if (!isLegacySlot(nSlot) && makeID(nSlot, m_Generations[nSlot]) == nID && m_Index.count(nID) == 0)
+   {
+      m_Generations[nSlot]++;
+   }
+}
+
+void NodeTable::endRestore ()
+{
+   /* Nobody has seen this run's generations yet - nothing to tell them */
+   m_Journal.clear();
+
+   vector<bool>   bInUse (m_Slots.size(), false);
+
+   for (size_t j=0; j<m_Live.size(); j++)
+   {
+      bInUse[m_Live[j]] = true;
+   }
+
+   /* Highest first so the lowest free slot is the next one handed out */
+   for (uint32_t nSlot=m_Slots.size(); nSlot>0; nSlot--)
+   {
+      if (!bInUse[nSlot-1] && isLegacySlot(nSlot-1))
+      {
+         m_Generations[nSlot-1] = 0;
+         m_LegacySlots.push_back(nSlot-1);
+      }
+      else if (!bInUse[nSlot-1])
+      {
+         m_FreeSlots.push_back(nSlot-1);
+      }
+   }
+}
@@ -0,0 +1,291 @@
+// NodeTable.h : Storage and ID assignment for the nodes registered with
+//               the tracker
+
+#ifndef __NODETABLE_H
+#define __NODETABLE_H
+
+#include <stdint.h>
+
+#include <vector>
+#include <deque>
+#include <unordered_map>
+using namespace std;
+
+#include "Node.h"
+#include "TimingWheel.h"
+
+/* A node ID is the storage slot (plus one so that zero is never handed out)
+   in the low 24 bits and the generation of that slot in the top 8 bits.  Each
+   time a slot is recycled its generation moves on so a stale ID from an
+   expired node will not match whoever holds the slot now.  The generation
+   wraps after 256 reuses of a slot, so an ID that stale could match again.
+   The slots whose IDs fit the original protocol (see NODE_ID_LEGACY_MAX)
+   stay at generation 0 - a one byte ID has no room for anything else. */
+#define NODE_ID_INVALID          0
+#define NODE_ID_SLOT_BITS        24
+#define NODE_ID_SLOT_MASK        0x00FFFFFF
+#define NODE_ID_MAX_SLOTS        (NODE_ID_SLOT_MASK - 1)
+
+/* Largest ID that fits in the original (1 byte) protocol fields */
+#define NODE_ID_LEGACY_MAX       0xFF
+
+/* When trackers share their tables (see Gossip.h) each one hands out IDs from
+   its own part of the ID space - the top 4 bits of the slot field become the
+   instance number and each instance is left with 20 bits of slots. */
+#define NODE_ID_INSTANCE_BITS    4
+#define NODE_ID_INSTANCE_SHIFT   20
+#define NODE_ID_MAX_INSTANCE     ((1 << NODE_ID_INSTANCE_BITS) - 1)
+#define NODE_ID_INSTANCE_SLOT_MASK  ((1 << NODE_ID_INSTANCE_SHIFT) - 1)
+
+/* Changes remembered for delta listings - a client further behind than this
+   has to list the whole table again */
+#define NODE_JOURNAL_LENGTH      65536
+
+/* One entry in the change journal */
+struct TableChange
+{
+   /* The table generation this change moved the table on to */
+   uint64_t    nGeneration;
+   uint32_t    nID;
+   bool        bRemoved;
+};
+
+/** NodeTable holds every node known to the tracker.  Nodes live in fixed
+ * storage slots that are recycled through a free list, a hash index maps an
+ * ID to its slot in O(1), and a dense list of the live slots keeps iteration
+ * proportional to the number of live nodes.
+ */
+class NodeTable
+{
+   private:
+      /* Storage - indexed by slot */
+      vector<Node>      m_Slots;
+
+      /* Generation for each slot (bumped every time the slot is released) */
+      vector<uint8_t>   m_Generations;
+
+      /* Slots that can be handed out again */
+      vector<uint32_t>  m_FreeSlots;
+
+      /* Free slots whose IDs fit the original protocol - kept apart so a
+         version 1 registration finds one straight away */
+      vector<uint32_t>  m_LegacySlots;
+
+      /* Dense list of the slots that are in use */
+      vector<uint32_t>  m_Live;
+
+      /* Where each slot sits in m_Live */
+      vector<uint32_t>  m_LivePosition;
+
+      /* ID -> slot */
+      unordered_map<uint32_t, uint32_t>   m_Index;
+
+      /* Lease expiry for each slot (in coarse clock ticks) */
+      TimingWheel       m_Expiry;
+
+      /* Scratch space for the slots that expire on each reap */
+      vector<uint32_t>  m_Expired;
+
+      /* Bumped on every change that shows in a listing other than the
+         expiry (register, update, expire) - each one is journaled */
+      uint64_t          m_nGeneration;
+
+      /* Bumped on renewals that only push the expiry out.  They are left out
+         of the journal (a delta client can count on the lease running on)
+         and only tell the LIST_NODES snapshot to catch up. */
+      uint64_t          m_nRenewals;
+
+      /* Picked at random on startup - generations from another run of the
+         tracker (or another tracker) mean nothing here */
+      uint32_t          m_nEpoch;
+
+      /* The most recent changes, oldest first */
+      deque<TableChange>   m_Journal;
+
+      /* Scratch space for writeChanges */
+      vector<uint32_t>  m_WrittenIDs;
+      vector<uint32_t>  m_RemovedIDs;
+
+      /* Our part of the ID space (only when sharing with other trackers) */
+      bool              m_bPartitioned;
+      uint32_t          m_nInstance;
+
+      /* Bits of an ID that hold the slot and how many slots we may use */
+      uint32_t          m_nSlotMask;
+      uint32_t          m_nMaxSlots;
+
+      uint32_t makeID (uint32_t nSlot, uint8_t nGeneration)
+      { return ((uint32_t) nGeneration << NODE_ID_SLOT_BITS) | (m_nInstance << NODE_ID_INSTANCE_SHIFT) | (nSlot + 1); }
+
+      /** Does the slot hand out IDs a version 1 client can use? */
+      bool isLegacySlot (uint32_t nSlot)
+      { return makeID(nSlot, 0) <= NODE_ID_LEGACY_MAX; }
+
+      /** Take a slot off the free lists (or one past the end of the storage)
+       *  @param bLegacy Only a slot with a version 1 ID will do
+       *  @returns false if there is none
+       */
+      bool  takeSlot (bool bLegacy, uint32_t * pSlot);
+
+      /** Put a slot back on the right free list */
+      void  freeSlot (uint32_t nSlot);
+
+      /** Put a fresh node under an ID into a slot that was just taken off the
+       *  free list (or one past the end of the storage to grow it)
+       */
+      Node * occupySlot (uint32_t nSlot, uint32_t nID);
+
+      /** Move the generation on and note what changed in the journal */
+      void  noteChange (uint32_t nID, bool bRemoved);
+
+   public:
+      NodeTable ();
+      ~NodeTable ();
+
+      /** Hand out IDs from one instance's part of the ID space only
+       *  (must be called while the table is still empty)
+       *  @param nInstance The instance number (0 to NODE_ID_MAX_INSTANCE)
+       */
+      void  setInstance (uint32_t nInstance);
+
+      bool isPartitioned ()
+      { return m_bPartitioned; }
+
+      /** Was the ID handed out by this table (rather than another tracker)? */
+      bool isLocalID (uint32_t nID)
+      { return !m_bPartitioned || getInstanceOf(nID) == m_nInstance; }
+
+      /** Which instance handed out an ID? */
+      static uint32_t getInstanceOf (uint32_t nID)
+      { return (nID >> NODE_ID_INSTANCE_SHIFT) & NODE_ID_MAX_INSTANCE; }
+
+      /** Which version of the table is this?  Anything derived from the
+       *  table (e.g. a serialized copy) is stale once this moves on.
+       */
+      uint64_t getGeneration ()
+      { return m_nGeneration; }
+
+      uint32_t getEpoch ()
+      { return m_nEpoch; }
+
+      uint64_t getRenewals ()
+      { return m_nRenewals; }
+
+      /** Something listed about a node (other than its expiry) changed */
+      void noteUpdated (uint32_t nID)
+      { noteChange(nID, false); }
+
+      /** A node renewed without changing anything but its expiry */
+      void noteRenewed ()
+      { m_nRenewals++; }
+
+      /** Can the journal say everything that changed since a generation?
+       *  (false if it has already forgotten some of it, or the generation is
+       *  from the future)
+       */
+      bool  hasChangesSince (uint64_t nGeneration);
+
+      /** Position in the journal of the first change after a generation (only
+       *  meaningful if hasChangesSince)
+       */
+      size_t findChange (uint64_t nGeneration);
+
+      size_t getChangeCount ()
+      { return m_Journal.size(); }
+
+      const TableChange & getChange (size_t nPosition)
+      { return m_Journal[nPosition]; }
+
+      /** Write out what changed since a generation, each node once and as it
+       *  stands now: the live ones as wide records (NODE_DATA_V2_SIZE) and
+       *  then the IDs (4 bytes, network order) of the ones that are gone
+       *  @param nGeneration Where the reader is up to (hasChangesSince has to
+       *                     be true for it)
+       *  @param pData Where to write
+       *  @param nRoom Bytes available at pData
+       *  @param pUpdated Filled in with the number of records written
+       *  @param pRemoved Filled in with the number of removed IDs written
+       *  @param pReached Filled in with where the reader is up to after this
+       *  @returns true if there was more than would fit
+       */
+      bool  writeChanges (uint64_t nGeneration, uint8_t * pData, uint16_t nRoom, uint16_t * pUpdated, uint16_t * pRemoved, uint64_t * pReached);
+
+      /** How many live nodes are there? */
+      size_t size ()
+      { return m_Live.size(); }
+
+      /** Retrieve the live node at a particular position (0 to size()-1) */
+      Node & getEntry (size_t nPosition)
+      { return m_Slots[m_Live[nPosition]]; }
+
+      /** Look up a node by its ID
+       *  @returns Pointer to the node or NULL if the ID is not live
+       */
+      Node * findNode (uint32_t nID);
+
+      /** Assign a fresh ID and storage for a new node
+       *  @param nMaxID The largest ID the caller is able to use
+       *  @returns Pointer to the (blank other than its ID) node or NULL if no
+       *           suitable ID is available.  The pointer is only good until
+       *           the table is next modified.
+       */
+      Node * addNode (uint32_t nMaxID);
+
+      /** Take in a node that another tracker assigned an ID to
+       *  @param nID The ID (from another instance's part of the ID space)
+       *  @returns Pointer to the (blank other than its ID) node or NULL if the
+       *           ID is already present or there is no room
+       */
+      Node * adoptNode (uint32_t nID);
+
+      /** Release a node and its ID
+       *  @returns true if the node was in the table
+       */
+      bool removeNode (uint32_t nID);
+
+      /** Set (or move) when a node's lease runs out
+       *  @param pNode A node in this table
+       *  @param nExpiryTick The coarse clock tick at which it expires
+       */
+      void scheduleExpiry (Node * pNode, uint32_t nExpiryTick);
+
+      /** How many storage slots are there (live or free)? */
+      uint32_t getSlotCount ()
+      { return m_Slots.size(); }
+
+      /** Generation of a storage slot (the top 8 bits of the next ID it gives out) */
+      uint8_t getSlotGeneration (uint32_t nSlot)
+      { return m_Generations[nSlot]; }
+
+      /** Start putting back a table that was saved earlier.  The table must be
+       *  empty.  Nothing can be added until endRestore is called.
+       *  @param nSlots Number of storage slots the saved table had
+       *  @param pGenerations Generation of each of those slots
+       */
+      void beginRestore (uint32_t nSlots, const uint8_t * pGenerations);
+
+      /** Put back one node with the ID it had before
+       *  @returns Pointer to the (blank other than its ID) node or NULL if the
+       *           ID does not fit the saved slots or is already in use
+       */
+      Node * restoreNode (uint32_t nID);
+
+      /** A saved node is not coming back (its lease ran out while the tracker
+       *  was down) - move its slot's generation on, as removeNode would have,
+       *  so the ID is not handed out again to someone else (other than a
+       *  version 1 ID, which is reused as it always was)
+       */
+      void  retireID (uint32_t nID);
+
+      /** Finish a restore - every slot not restored becomes free again */
+      void endRestore ();
+
+      /** Drop every node whose lease has run out
+       *  @param nNowTick The current coarse clock tick
+       *  @param pRemoved Filled in with the IDs that were dropped (if not NULL)
+       *  @returns The number of nodes that were removed
+       */
+      int  reapExpired (uint32_t nNowTick, vector<uint32_t> * pRemoved = NULL);
+};
+
+#endif
@@ -0,0 +1,226 @@
+// RateLimiter.cc : Per-source admission control for the tracker
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <cstring>
+
+#include <string>
+using namespace std;
+
+#include "RateLimiter.h"
+#include "WireLayout.h"
+#include "Logger.h"
+
+LimitPolicy::LimitPolicy ()
+{
+   memset(m_Rules, 0, sizeof(m_Rules));
+   m_bReply = false;
+   m_bAny = false;
+}
+
+int LimitPolicy::parseType (const char * pszType)
+{
+   char *   pszEnd;
+   long     nType = strtol(pszType, &pszEnd, 10);
+
+   if (*pszType != '\0' && *pszEnd == '\0')
+   {
+      return (nType > MSG_TYPE_UNKNOWN && nType < LIMIT_TYPE_SLOTS) ? nType : -1;
+   }
+
+   for (int j=MSG_TYPE_UNKNOWN+1; j<LIMIT_TYPE_SLOTS; j++)
+   {
+      if (strcasecmp(pszType, Message::getTypeName(j).c_str()) == 0)
+      {
+         return j;
+      }
+   }
+
+   return -1;
+}
+
+bool LimitPolicy::addRule (const char * pszRule)
+{
+   string   sRule (pszRule);
+   size_t   nColon = sRule.find(':');
+
+   if (nColon == string::npos)
+   {
+      LOG_ERROR("Error: Limit %s should be given as type:rate[:burst]", pszRule);
+      return false;
+   }
+
+   int nType = parseType(sRule.substr(0, nColon).c_str());
+
+   if (nType < 0)
+   {
+      LOG_ERROR("Error: Limit %s is for an unknown message type", pszRule);
+      return false;
+   }
+
+   long     nRate, nBurst;
+   char *   pszEnd;
+
+   nRate = strtol(pszRule + nColon + 1, &pszEnd, 10);
+   nBurst = nRate;
+
+   if (*pszEnd == ':')
+   {
+      nBurst = strtol(pszEnd + 1, &pszEnd, 10);
+   }
+
+   /* The bucket holds BURST * scale tokens in 32 bits */
+   if (*pszEnd != '\0' || nRate < 1 || nBurst < 1 || nRate > 1000000 || nBurst > 1000000)
+   {
+      LOG_ERROR("Error: Limit %s needs a rate and burst between 1 and 1000000", pszRule);
+      return false;
+   }
+
+   m_Rules[nType].nRate = nRate;
+   m_Rules[nType].nBurst = nBurst;
+   m_bAny = true;
+   return true;
+}
+
+RateLimiter::RateLimiter (LimitPolicy * pPolicy)
+{
+   Bucket   theEmpty;
+
+   memset(&theEmpty, 0, sizeof(theEmpty));
+
+   m_pPolicy = pPolicy;
+   m_Buckets.assign(LIMIT_TABLE_SIZE, theEmpty);
+}
+
+uint32_t RateLimiter::getHash (uint32_t nAddress, uint8_t byType)
+{
+   /* Multiplicative hash - the top bits are the well mixed ones */
+   uint32_t nKey = (nAddress ^ ((uint32_t) byType << 24)) * 2654435761u;
+
+   return nKey >> (32 - __builtin_ctz(LIMIT_TABLE_SIZE));
+}
+
+void RateLimiter::refill (Bucket * pBucket, LimitRule * pRule, uint32_t nNowMs)
+{
+   /* A rate per second is also thousandths of a request per millisecond */
+   uint64_t nAdded = (uint64_t) (uint32_t) (nNowMs - pBucket->nStamp) * pRule->nRate;
+   uint64_t nTokens = pBucket->nTokens + nAdded;
+   uint64_t nFull = (uint64_t) pRule->nBurst * LIMIT_TOKEN_SCALE;
+
+   pBucket->nTokens = (nTokens > nFull) ? nFull : nTokens;
+   pBucket->nStamp = nNowMs;
+}
+
+bool RateLimiter::admit (Message * pMessage)
+{
+   uint32_t    nAddress = pMessage->getAddress()->sin_addr.s_addr;
+   uint32_t    nNowMs = pMessage->getArrivalNanos() / 1000000;
+   LimitRule * pRule = m_pPolicy->getRule(pMessage->getType());
+   Bucket *    pBucket = NULL;
+
+   if (pRule->nRate != 0)
+   {
+      pBucket = claim(nAddress, pMessage->getType(), nNowMs, pRule, NULL);
+
+      if (pBucket->nTokens < LIMIT_TOKEN_SCALE)
+      {
+         return false;
+      }
+   }
+
+   /* A batch registers many nodes in one go - each of them counts against
+      the REGISTER_V2 limit as if it had come on its own.  Both buckets are
+      checked before either is charged so a refused batch costs nothing. */
+   LimitRule * pEntryRule = m_pPolicy->getRule(MSG_TYPE_REGISTER_V2);
+   Bucket *    pEntries = NULL;
+   uint32_t    nEntries = 0;
+
+   if (pMessage->getType() == MSG_TYPE_REGISTER_BATCH && pEntryRule->nRate != 0)
+   {
+      WireReader<RegisterBatchLayout>  theBatch (pMessage);
+
+      nEntries = theBatch.isValid() ? theBatch.get<RegisterBatchLayout::Count>() : 0;
+
+      /* More than the bucket can ever hold */
+      if (nEntries > pEntryRule->nBurst)
+      {
+         return false;
+      }
+
+      if (nEntries > 0)
+      {
+         pEntries = claim(nAddress, MSG_TYPE_REGISTER_V2, nNowMs, pEntryRule, pBucket);
+
+         if (pEntries->nTokens < nEntries * LIMIT_TOKEN_SCALE)
+         {
+            return false;
+         }
+      }
+   }
+
+   if (pBucket != NULL)
+   {
+      pBucket->nTokens -= LIMIT_TOKEN_SCALE;
+   }
+
+   if (pEntries != NULL)
+   {
+      pEntries->nTokens -= nEntries * LIMIT_TOKEN_SCALE;
+   }
+
+   return true;
+}
+
+RateLimiter::Bucket * RateLimiter::claim (uint32_t nAddress, uint8_t byType, uint32_t nNowMs, LimitRule * pRule, Bucket * pKeep)
+{
+   uint32_t nSlot = getHash(nAddress, byType);
+
+   Bucket * pFree = NULL;
+   Bucket * pOldest = NULL;
+
+   for (int j=0; j<LIMIT_PROBE_LENGTH; j++)
+   {
+      Bucket * pBucket = &m_Buckets[(nSlot + j) & (LIMIT_TABLE_SIZE - 1)];
+
+      if (pBucket->nAddress == nAddress && pBucket->byType == byType && nAddress != 0)
+      {
+         refill(pBucket, pRule, nNowMs);
+         return pBucket;
+      }
+
+      if (pFree != NULL || pBucket == pKeep)
+      {
+         continue;
+      }
+
+      /* Never used, or idle long enough to have filled up again (aged out) */
+      if (pBucket->nAddress == 0)
+      {
+         pFree = pBucket;
+      }
+      else
+      {
+         LimitRule * pOther = m_pPolicy->getRule(pBucket->byType);
+         uint64_t    nIdle = (uint32_t) (nNowMs - pBucket->nStamp);
+
+         if (pBucket->nTokens + nIdle * pOther->nRate >= (uint64_t) pOther->nBurst * LIMIT_TOKEN_SCALE)
+         {
+            pFree = pBucket;
+         }
+         else if (pOldest == NULL || (uint32_t) (nNowMs - pBucket->nStamp) > (uint32_t) (nNowMs - pOldest->nStamp))
+         {
+            pOldest = pBucket;
+         }
+      }
+   }
+
+   /* A newcomer starts with a full bucket */
+   Bucket * pBucket = (pFree != NULL) ? pFree : pOldest;
+
+   pBucket->nAddress = nAddress;
+   pBucket->byType = byType;
+   pBucket->nStamp = nNowMs;
+   pBucket->nTokens = pRule->nBurst * LIMIT_TOKEN_SCALE;
+   return pBucket;
+}
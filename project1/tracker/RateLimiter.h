@@ -0,0 +1,129 @@
+// RateLimiter.h : Per-source admission control for the tracker
+//
+// Each limited message type gets a token bucket per source IP.  The buckets
+// live in a small open addressed table owned by one serving loop (so there
+// is no locking) and age out on their own: a bucket that has been idle long
+// enough to fill back up is no different from a brand new one, so its slot
+// is simply handed to the next source that needs one.  When every slot along
+// the probe is busy the least recently used one goes.
+//
+// Each serving loop has its own table, so with workers a source spread over
+// several of the SO_REUSEPORT sockets can get up to the limit from each.
+
+#ifndef __RATELIMITER_H
+#define __RATELIMITER_H
+
+#include <stdint.h>
+
+#include <vector>
+using namespace std;
+
+#include "Message.h"
+
+/* Message types that can have a limit */
+#define LIMIT_TYPE_SLOTS         32
+
+/* Buckets per serving loop (must be a power of two) */
+#define LIMIT_TABLE_SIZE         4096
+
+/* Slots looked at for a source before one is reused */
+#define LIMIT_PROBE_LENGTH       8
+
+/* Tokens are kept in thousandths of a request */
+#define LIMIT_TOKEN_SCALE        1000
+
+/* The limit on one message type (a rate of 0 means no limit) */
+struct LimitRule
+{
+   /* Requests per second and the most that can arrive back to back */
+   uint32_t    nRate;
+   uint32_t    nBurst;
+};
+
+/** LimitPolicy is the configuration shared by every serving loop (set up
+ *  before the tracker starts and only read afterwards)
+ */
+class LimitPolicy
+{
+   private:
+      LimitRule   m_Rules [LIMIT_TYPE_SLOTS];
+
+      /* Answer refused requests with MSG_STATUS_ISSUE rather than drop them */
+      bool        m_bReply;
+
+      bool        m_bAny;
+
+   public:
+      LimitPolicy ();
+
+      /** Add a limit given as TYPE:RATE[:BURST] where TYPE is a message type
+       *  name (e.g. list-nodes) or number and BURST defaults to RATE
+       *  @returns false if the limit could not be understood
+       */
+      bool  addRule (const char * pszRule);
+
+      /** Parse a message type given by name (case does not matter) or number
+       *  @returns The type or -1 if there is no such type
+       */
+      static int  parseType (const char * pszType);
+
+      LimitRule * getRule (uint8_t byType)
+      { return (byType < LIMIT_TYPE_SLOTS) ? &m_Rules[byType] : &m_Rules[0]; }
+
+      /** Are any message types limited at all? */
+      bool  isEnabled ()
+      { return m_bAny; }
+
+      bool  isReplying ()
+      { return m_bReply; }
+
+      void  setReplying (bool bReply)
+      { m_bReply = bReply; }
+};
+
+/** RateLimiter holds one serving loop's buckets */
+class RateLimiter
+{
+   private:
+      struct Bucket
+      {
+         /* Source (network order, 0 = slot never used) and message type */
+         uint32_t    nAddress;
+         uint8_t     byType;
+
+         /* Milliseconds at the last refill and what was left then */
+         uint32_t    nStamp;
+         uint32_t    nTokens;
+      };
+
+      LimitPolicy *     m_pPolicy;
+      vector<Bucket>    m_Buckets;
+
+      static uint32_t getHash (uint32_t nAddress, uint8_t byType);
+
+      /** Top a bucket up for the time that has gone by since its last refill */
+      static void  refill (Bucket * pBucket, LimitRule * pRule, uint32_t nNowMs);
+
+      /** Find a sender's bucket for a limited message type and top it up, or
+       *  make room for a new (full) one
+       *  @param pKeep A bucket that must not be given up to make room (or NULL)
+       *  @returns The bucket - nothing has been taken from it yet
+       */
+      Bucket * claim (uint32_t nAddress, uint8_t byType, uint32_t nNowMs, LimitRule * pRule, Bucket * pKeep);
+
+   public:
+      /** Constructor
+       *  @param pPolicy The limits to apply (must outlive the limiter)
+       */
+      RateLimiter (LimitPolicy * pPolicy);
+
+      /** Should the tracker handle this message?  Takes a token from the
+       *  sender's bucket for the message type if it is limited (and one
+       *  REGISTER_V2 token per node for a REGISTER_BATCH).
+       *  @param pMessage A received message (the sender and arrival time are used)
+       *  @returns false if the sender is over its limit
+       */
+      bool  admit (Message * pMessage);
+};
+
+#endif
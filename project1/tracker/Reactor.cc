@@ -0,0 +1,148 @@
+// Reactor.cc : epoll based event loop for the tracker
+
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "Reactor.h"
+#include "Logger.h"
+
+Reactor::Reactor ()
+{
+   m_bRunning = false;
+   m_nEpoll = epoll_create1(EPOLL_CLOEXEC);
+
+   if (m_nEpoll == -1)
+   {
+      LOG_ERROR("reactor: epoll_create1: %s", strerror(errno));
+   }
+}
+
+Reactor::~Reactor ()
+{
+   if (m_nEpoll != -1)
+   {
+      close(m_nEpoll);
+   }
+}
+
+bool Reactor::add (int nFD, uint32_t nEvents, Handler theHandler)
+{
+   struct epoll_event   theEvent;
+
+   memset(&theEvent, 0, sizeof(theEvent));
+   theEvent.events = nEvents;
+   theEvent.data.fd = nFD;
+
+   if (epoll_ctl(m_nEpoll, EPOLL_CTL_ADD, nFD, &theEvent) == -1)
+   {
+      LOG_ERROR("reactor: epoll_ctl(ADD %d): %s", nFD, strerror(errno));
+      return false;
+   }
+
+   m_Handlers[nFD] = theHandler;
+   return true;
+}
+
+bool Reactor::modify (int nFD, uint32_t nEvents)
+{
+   struct epoll_event   theEvent;
+
+   memset(&theEvent, 0, sizeof(theEvent));
+   theEvent.events = nEvents;
+   theEvent.data.fd = nFD;
+
+   if (epoll_ctl(m_nEpoll, EPOLL_CTL_MOD, nFD, &theEvent) == -1)
+   {
+      LOG_ERROR("reactor: epoll_ctl(MOD %d): %s", nFD, strerror(errno));
+      return false;
+   }
+
+   return true;
+}
+
+void Reactor::remove (int nFD)
+{
+   epoll_ctl(m_nEpoll, EPOLL_CTL_DEL, nFD, NULL);
+   m_Handlers.erase(nFD);
+}
+
+bool Reactor::run ()
+{
+   struct epoll_event   theEvents [REACTOR_MAX_EVENTS];
+
+   m_bRunning = true;
+
+   while (m_bRunning)
+   {
+      int nReady = epoll_wait(m_nEpoll, theEvents, REACTOR_MAX_EVENTS, -1);
+
+      if (nReady == -1)
+      {
+         if (errno == EINTR)
+         {
+            continue;
+         }
+
+         LOG_ERROR("reactor: epoll_wait: %s", strerror(errno));
+         return false;
+      }
+
+      for (int j=0; j<nReady; j++)
+      {
+         /* An earlier handler this round may have removed it */
+         unordered_map<int, Handler>::iterator theEntry = m_Handlers.find(theEvents[j].data.fd);
+
+         if (theEntry == m_Handlers.end())
+         {
+            continue;
+         }
+
+         /* Copy - the handler may remove itself while it runs */
+         Handler theHandler = theEntry->second;
+         theHandler(theEvents[j].events);
+      }
+   }
+
+   return true;
+}
+
+int Reactor::createTimer (uint32_t nIntervalMs)
+{
+   int nTimer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+   if (nTimer == -1)
+   {
+      LOG_ERROR("reactor: timerfd_create: %s", strerror(errno));
+      return -1;
+   }
+
+   struct itimerspec    theSpec;
+
+   theSpec.it_interval.tv_sec = nIntervalMs / 1000;
+   theSpec.it_interval.tv_nsec = (nIntervalMs % 1000) * 1000000L;
+   theSpec.it_value = theSpec.it_interval;
+
+   if (timerfd_settime(nTimer, 0, &theSpec, NULL) == -1)
+   {
+      LOG_ERROR("reactor: timerfd_settime: %s", strerror(errno));
+      close(nTimer);
+      return -1;
+   }
+
+   return nTimer;
+}
+
+void Reactor::drainCounter (int nFD)
+{
+   uint64_t nCount;
+
+   /* Non-blocking - nothing to do if it was already drained */
+   if (read(nFD, &nCount, sizeof(nCount)) == -1 && errno != EAGAIN)
+   {
+      LOG_WARN("reactor: read(%d): %s", nFD, strerror(errno));
+   }
+}
@@ -0,0 +1,75 @@
+// Reactor.h : epoll based event loop for the tracker
+
+#ifndef __REACTOR_H
+#define __REACTOR_H
+
+#include <stdint.h>
+
+#include <functional>
+#include <unordered_map>
+using namespace std;
+
+/* Most events handled per epoll_wait */
+#define REACTOR_MAX_EVENTS    64
+
+/** Reactor waits on a set of file descriptors (sockets, timerfds, signalfds,
+ * eventfds) and calls the handler registered for each one that is ready.  A
+ * reactor belongs to the thread that runs it - handlers are called on that
+ * thread and may add / remove descriptors as they go.
+ */
+class Reactor
+{
+   public:
+      /* Called with the ready events (EPOLLIN, EPOLLOUT, ...) */
+      typedef function<void (uint32_t)>   Handler;
+
+   private:
+      int      m_nEpoll;
+      bool     m_bRunning;
+
+      unordered_map<int, Handler>   m_Handlers;
+
+   public:
+      Reactor ();
+      ~Reactor ();
+
+      /** Did the epoll instance get created? */
+      bool isValid ()
+      { return m_nEpoll != -1; }
+
+      /** Start watching a descriptor
+       *  @param nFD The descriptor
+       *  @param nEvents What to wait for (e.g. EPOLLIN)
+       *  @param theHandler Called when the descriptor is ready
+       *  @returns false if epoll would not take it
+       */
+      bool  add (int nFD, uint32_t nEvents, Handler theHandler);
+
+      /** Change what a descriptor is being watched for */
+      bool  modify (int nFD, uint32_t nEvents);
+
+      /** Stop watching a descriptor (the caller still owns / closes it) */
+      void  remove (int nFD);
+
+      /** Dispatch events until stop is called
+       *  @returns false if waiting failed
+       */
+      bool  run ();
+
+      /** Have run return once the current round of events is handled */
+      void stop ()
+      { m_bRunning = false; }
+
+      /** Arm a timerfd to fire every so often
+       *  @param nIntervalMs Milliseconds between expirations (and until the first)
+       *  @returns The timerfd or -1 on failure
+       */
+      static int  createTimer (uint32_t nIntervalMs);
+
+      /** Read (and discard) the expiration count of a timerfd / the count of
+       *  an eventfd so that it stops showing as ready
+       */
+      static void drainCounter (int nFD);
+};
+
+#endif
@@ -0,0 +1,32 @@
+// ReplyQueue.h : Replies held back for a batched send
+
+#ifndef __REPLYQUEUE_H
+#define __REPLYQUEUE_H
+
+#include <vector>
+using namespace std;
+
+#include "MessagePool.h"
+
+/** ReplyQueue collects the replies to a batch of requests so that the
+ * batch's I/O back end (sendmmsg or io_uring) can push them out together.
+ * Messages that arrived in a batch point at its queue (Message::getBatch).
+ */
+class ReplyQueue
+{
+   protected:
+      /* Replies waiting on the next flush (owned by the queue) */
+      vector<MessageHandle>   m_Replies;
+
+   public:
+      /** Queue a reply for the next flush.  The queue takes over the handle
+       *  and the destination is taken from the message's address.
+       */
+      void queueReply (MessageHandle & theReply)
+      { m_Replies.push_back(move(theReply)); }
+
+      int getPendingReplies ()
+      { return m_Replies.size(); }
+};
+
+#endif
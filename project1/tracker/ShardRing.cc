@@ -0,0 +1,81 @@
+// ShardRing.cc : Splitting the node table across several trackers
+
+#include <stdint.h>
+#include <algorithm>
+
+#include "ShardRing.h"
+#include "NodeTable.h"
+#include "Logger.h"
+#include "utils.h"
+
+ShardRing::ShardRing ()
+{
+   m_nSelf = 0;
+}
+
+uint32_t ShardRing::getHash (uint64_t nValue)
+{
+   /* Neighbouring addresses end up far apart */
+   return (uint32_t) (mix64(nValue) >> 32);
+}
+
+bool ShardRing::addMember (const char * pszMember)
+{
+   struct sockaddr_in   theMember;
+
+   if (m_Members.size() > NODE_ID_MAX_INSTANCE)
+   {
+      LOG_ERROR("Error: At most %d trackers can share the table", NODE_ID_MAX_INSTANCE + 1);
+      return false;
+   }
+
+   if (!resolve_host_port(pszMember, &theMember))
+   {
+      return false;
+   }
+
+   m_Members.push_back(theMember);
+   return true;
+}
+
+bool ShardRing::build (uint32_t nSelf)
+{
+   if (nSelf >= m_Members.size())
+   {
+      LOG_ERROR("Error: Instance %u is not one of the %d shard(s) listed", nSelf, (int) m_Members.size());
+      return false;
+   }
+
+   m_nSelf = nSelf;
+   m_Points.clear();
+
+   for (uint32_t nInstance=0; nInstance<m_Members.size(); nInstance++)
+   {
+      for (uint32_t j=0; j<SHARD_RING_POINTS; j++)
+      {
+         /* Each point from the instance and point number (the top bit keeps
+            them apart from the addresses) */
+         m_Points.push_back(make_pair(getHash(((uint64_t) 1 << 63) | ((uint64_t) nInstance << 32) | j), nInstance));
+      }
+   }
+
+   sort(m_Points.begin(), m_Points.end());
+   return true;
+}
+
+uint32_t ShardRing::findOwner (uint32_t nAddress)
+{
+   uint32_t nHash = getHash(nAddress);
+
+   /* First point at or after the hash, wrapping round to the start */
+   vector< pair<uint32_t, uint32_t> >::iterator thePoint;
+
+   thePoint = lower_bound(m_Points.begin(), m_Points.end(), make_pair(nHash, (uint32_t) 0));
+
+   if (thePoint == m_Points.end())
+   {
+      thePoint = m_Points.begin();
+   }
+
+   return thePoint->second;
+}
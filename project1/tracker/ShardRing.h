@@ -0,0 +1,92 @@
+// ShardRing.h : Splitting the node table across several trackers
+//
+// With -shard every tracker in the group is listed (the same list, in the
+// same order, on each of them - a tracker's place in the list is its
+// instance number).  Each node belongs to exactly one of them: its IP address
+// is hashed onto a ring on which every tracker holds SHARD_RING_POINTS
+// points, and the owner is the tracker with the next point round the ring.
+// Only the owner registers a node, hands out its ID (the ID carries the
+// owner's instance number) and keeps its published files, so the write load
+// is spread across the group.  Any other tracker answers a registration with
+// a REDIRECT to the owner.  The ring only places new nodes: a renewal (and
+// anything else naming a node by ID) goes to the instance in the ID, so a node
+// stays with the tracker that took it even if its address or the shard list
+// changes.
+//
+// Hashing the address (rather than the address and port) keeps every node on
+// a host with the same owner so REGISTER_BATCH never straddles shards.  The
+// points keep the split even and mean that adding a tracker to the list only
+// moves the nodes that land on its points.
+//
+// Listings are answered by any tracker: the shards gossip their own nodes to
+// one another (see Gossip.h) and each tracker lists the merged table.
+
+#ifndef __SHARDRING_H
+#define __SHARDRING_H
+
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <vector>
+#include <utility>
+using namespace std;
+
+/* Points on the ring per tracker */
+#define SHARD_RING_POINTS     64
+
+/** ShardRing maps a node's address to the tracker that owns it.  It is set
+ *  up before the tracker starts and read only from then on, so no lock is
+ *  needed.
+ */
+class ShardRing
+{
+   private:
+      /* Every tracker in the group (by instance number) */
+      vector<struct sockaddr_in>    m_Members;
+
+      /* (Point, instance) sorted by point */
+      vector< pair<uint32_t, uint32_t> >  m_Points;
+
+      /* Our own instance number */
+      uint32_t    m_nSelf;
+
+      static uint32_t getHash (uint64_t nValue);
+
+   public:
+      ShardRing ();
+
+      /** Add the next tracker in the group
+       *  @param pszMember host:port of the tracker
+       *  @returns false if it could not be resolved
+       */
+      bool  addMember (const char * pszMember);
+
+      /** Lay out the ring once every member is known
+       *  @param nSelf This tracker's instance number
+       *  @returns false if this tracker is not one of the members
+       */
+      bool  build (uint32_t nSelf);
+
+      bool isEnabled ()
+      { return !m_Points.empty(); }
+
+      size_t size ()
+      { return m_Members.size(); }
+
+      uint32_t getSelf ()
+      { return m_nSelf; }
+
+      struct sockaddr_in * getMember (uint32_t nInstance)
+      { return &m_Members[nInstance]; }
+
+      /** Which tracker owns the nodes at an address?
+       *  @param nAddress IPv4 address (network order)
+       *  @returns The owner's instance number
+       */
+      uint32_t findOwner (uint32_t nAddress);
+};
+
+#endif
@@ -0,0 +1,126 @@
+// SnapshotDomain.cc : Lock free publication of node table snapshots
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "SnapshotDomain.h"
+
+SnapshotDomain::SnapshotDomain ()
+{
+   for (int j=0; j<SNAPSHOT_MAX_READERS; j++)
+   {
+      m_Readers[j].nEpoch.store(0);
+   }
+
+   m_nReaders.store(0);
+   m_pCurrent.store(NULL);
+   m_nGeneration.store(0);
+
+   /* Zero means not reading so the epochs start at one */
+   m_nEpoch.store(1);
+}
+
+int SnapshotDomain::attachReader ()
+{
+   int nReader = m_nReaders.fetch_add(1);
+
+   return (nReader < SNAPSHOT_MAX_READERS) ? nReader : -1;
+}
+
+NodeSnapshot * SnapshotDomain::beginRead (int nReader)
+{
+   /* Announce first, then look.  Everything here is sequentially consistent:
+      if the writer did not see the announcement the reader is bound to see
+      the snapshot that replaced the one being freed. */
+   m_Readers[nReader].nEpoch.store(m_nEpoch.load());
+
+   return m_pCurrent.load();
+}
+
+void SnapshotDomain::publish (shared_ptr<NodeSnapshot> pSnapshot)
+{
+   lock_guard<mutex>   theGuard(m_Lock);
+
+   shared_ptr<NodeSnapshot>   pReplaced = m_pOwned;
+
+   m_pOwned = pSnapshot;
+   m_nGeneration.store(pSnapshot->getGeneration());
+   m_pCurrent.store(pSnapshot.get());
+
+   /* Anyone who starts reading from here on sees the new one */
+   uint64_t nEpoch = m_nEpoch.fetch_add(1) + 1;
+
+   if (pReplaced)
+   {
+      m_Retired.push_back(make_pair(nEpoch, pReplaced));
+   }
+
+   reclaim();
+}
+
+void SnapshotDomain::reclaim ()
+{
+   /* Oldest epoch any reader is still in */
+   uint64_t nOldest = UINT64_MAX;
+   int      nReaders = m_nReaders.load();
+
+   for (int j=0; j<nReaders && j<SNAPSHOT_MAX_READERS; j++)
+   {
+      uint64_t nEpoch = m_Readers[j].nEpoch.load();
+
+      if (nEpoch != 0 && nEpoch < nOldest)
+      {
+         nOldest = nEpoch;
+      }
+   }
+
+   /* Retired in epoch order - free from the front while nobody can see them */
+   size_t nFreed = 0;
+
+   while (nFreed < m_Retired.size() && m_Retired[nFreed].first <= nOldest)
+   {
+      nFreed++;
+   }
+
+   m_Retired.erase(m_Retired.begin(), m_Retired.begin() + nFreed);
+}
+
+shared_ptr<NodeSnapshot> SnapshotDomain::getShared ()
+{
+   lock_guard<mutex>   theGuard(m_Lock);
+   return m_pOwned;
+}
+
+SnapshotReader::SnapshotReader (SnapshotDomain * pDomain)
+{
+   /* Claimed once per thread (there is only ever the one domain per tracker) */
+   static thread_local SnapshotDomain *   t_pDomain = NULL;
+   static thread_local int                t_nReader = -1;
+
+   if (t_pDomain != pDomain)
+   {
+      t_pDomain = pDomain;
+      t_nReader = pDomain->attachReader();
+   }
+
+   m_pDomain = pDomain;
+   m_nReader = t_nReader;
+
+   if (m_nReader != -1)
+   {
+      m_pSnapshot = pDomain->beginRead(m_nReader);
+   }
+   else
+   {
+      m_pHeld = pDomain->getShared();
+      m_pSnapshot = m_pHeld.get();
+   }
+}
+
+SnapshotReader::~SnapshotReader ()
+{
+   if (m_nReader != -1)
+   {
+      m_pDomain->endRead(m_nReader);
+   }
+}
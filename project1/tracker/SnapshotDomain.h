@@ -0,0 +1,114 @@
+// SnapshotDomain.h : Lock free publication of node table snapshots
+//
+// LIST_NODES is nearly all reads.  Rather than have every listing take the
+// table lock (and queue up behind a storm of registrations) the writers
+// publish an immutable NodeSnapshot and the serving loops pick up whichever
+// one is current without taking any lock at all.
+//
+// Old snapshots are reclaimed RCU style using epochs.  A reader announces the
+// epoch it started in before it picks up the snapshot and clears the
+// announcement when it is done.  A snapshot replaced in epoch E is only freed
+// once no reader is still announcing an epoch before E.  Readers never wait on
+// anything - a slow reader only holds up freeing the snapshots it might be
+// looking at.
+
+#ifndef __SNAPSHOTDOMAIN_H
+#define __SNAPSHOTDOMAIN_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+using namespace std;
+
+#include "NodeSnapshot.h"
+
+/* Threads that can read without a lock - any more fall back to the writer lock */
+#define SNAPSHOT_MAX_READERS     64
+
+/** SnapshotDomain hands the current NodeSnapshot to readers and decides when
+ *  the ones it replaced can go
+ */
+class SnapshotDomain
+{
+   private:
+      /* One per reading thread, each on its own cache line */
+      struct alignas(64) ReaderSlot
+      {
+         /* Epoch the reader started in (0 when it is not reading) */
+         atomic<uint64_t>  nEpoch;
+      };
+
+      ReaderSlot              m_Readers [SNAPSHOT_MAX_READERS];
+      atomic<int>             m_nReaders;
+
+      /* What readers see */
+      atomic<NodeSnapshot *>  m_pCurrent;
+      atomic<uint64_t>        m_nEpoch;
+      atomic<uint64_t>        m_nGeneration;
+
+      /* Writers only - keeps the current snapshot and the replaced ones alive */
+      mutex                                           m_Lock;
+      shared_ptr<NodeSnapshot>                        m_pOwned;
+      vector< pair<uint64_t, shared_ptr<NodeSnapshot>> >  m_Retired;
+
+      /** Free the replaced snapshots no reader can still see (lock held) */
+      void  reclaim ();
+
+   public:
+      SnapshotDomain ();
+
+      /** Claim a reader slot for the calling thread
+       *  @returns The slot (-1 if they are all taken)
+       */
+      int   attachReader ();
+
+      /** Start reading - the snapshot stays valid until endRead
+       *  @param nReader Slot from attachReader
+       *  @returns The current snapshot (NULL if none has been published)
+       */
+      NodeSnapshot * beginRead (int nReader);
+
+      /** Done with the snapshot from beginRead */
+      void  endRead (int nReader)
+      { m_Readers[nReader].nEpoch.store(0); }
+
+      /** Make a new snapshot the current one (writers are serialized) */
+      void  publish (shared_ptr<NodeSnapshot> pSnapshot);
+
+      /** A counted reference to the current snapshot for anyone holding on to
+       *  it for a while (the admin dump) - takes the writer lock
+       */
+      shared_ptr<NodeSnapshot> getShared ();
+
+      /** Table generation of the current snapshot (0 before the first) */
+      uint64_t getGeneration ()
+      { return m_nGeneration.load(); }
+};
+
+/** SnapshotReader is the scope in which a serving loop uses the current
+ *  snapshot.  The reader slot is claimed the first time a thread reads.
+ */
+class SnapshotReader
+{
+   private:
+      SnapshotDomain *           m_pDomain;
+      int                        m_nReader;
+      NodeSnapshot *             m_pSnapshot;
+
+      /* Only used if the thread could not get a reader slot */
+      shared_ptr<NodeSnapshot>   m_pHeld;
+
+   public:
+      SnapshotReader (SnapshotDomain * pDomain);
+      ~SnapshotReader ();
+
+      /** The snapshot (NULL if none has been published yet) */
+      NodeSnapshot * get ()
+      { return m_pSnapshot; }
+};
+
+#endif
@@ -0,0 +1,261 @@
+// Subscribers.cc : Pushing table changes to clients that asked for them
+
+#include <stdint.h>
+#include <errno.h>
+#include <cstring>
+#include <random>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "Subscribers.h"
+#include "WireLayout.h"
+#include "Logger.h"
+#include "utils.h"
+
+Subscribers::Subscribers ()
+{
+   m_nPushed = 0;
+
+   random_device  theRandom;
+
+   m_nSecret[0] = ((uint64_t) theRandom() << 32) | theRandom();
+   m_nSecret[1] = ((uint64_t) theRandom() << 32) | theRandom();
+}
+
+uint32_t Subscribers::getCookie (struct sockaddr_in * pAddress, uint32_t nPeriod)
+{
+   /* Not a MAC, but with the secret mixed in twice nobody who cannot see the
+      acks can guess one */
+   uint64_t nValue = mix64(makeKey(pAddress) ^ m_nSecret[0]);
+
+   nValue = mix64(nValue ^ ((uint64_t) nPeriod << 32) ^ m_nSecret[1]);
+
+   uint32_t nCookie = (uint32_t) (nValue >> 32);
+
+   return (nCookie != 0) ? nCookie : 1;
+}
+
+bool Subscribers::checkCookie (struct sockaddr_in * pAddress, uint32_t nCookie, uint32_t nNowTick)
+{
+   uint32_t nPeriod = nNowTick / SUBSCRIBERS_COOKIE_PERIOD;
+
+   if (nCookie == 0)
+   {
+      return false;
+   }
+
+   return nCookie == getCookie(pAddress, nPeriod) || (nPeriod > 0 && nCookie == getCookie(pAddress, nPeriod - 1));
+}
+
+void Subscribers::removeAt (size_t nPosition)
+{
+   m_Positions.erase(makeKey(&m_Subscribers[nPosition].theAddress));
+
+   /* Swap the last one into the gap to keep the list dense */
+   if (nPosition != m_Subscribers.size() - 1)
+   {
+      m_Subscribers[nPosition] = m_Subscribers.back();
+      m_Positions[makeKey(&m_Subscribers[nPosition].theAddress)] = nPosition;
+   }
+
+   m_Subscribers.pop_back();
+}
+
+uint16_t Subscribers::subscribe (struct sockaddr_in * pAddress, uint16_t nLease, uint32_t nNowTick, uint64_t nGeneration)
+{
+   if (nLease == 0)
+   {
+      unsubscribe(pAddress);
+      return 0;
+   }
+
+   if (nLease > SUBSCRIBERS_MAX_LEASE)
+   {
+      nLease = SUBSCRIBERS_MAX_LEASE;
+   }
+
+   unordered_map<uint64_t, size_t>::iterator theEntry = m_Positions.find(makeKey(pAddress));
+
+   if (theEntry != m_Positions.end())
+   {
+      m_Subscribers[theEntry->second].nExpiryTick = nNowTick + nLease;
+      return nLease;
+   }
+
+   if (m_Subscribers.size() >= SUBSCRIBERS_MAX)
+   {
+      return 0;
+   }
+
+   /* Nobody has been listening - there is no backlog worth pushing */
+   if (m_Subscribers.empty())
+   {
+      m_nPushed = nGeneration;
+   }
+
+   Subscriber  theSubscriber;
+
+   theSubscriber.theAddress = *pAddress;
+   theSubscriber.nExpiryTick = nNowTick + nLease;
+
+   m_Positions[makeKey(pAddress)] = m_Subscribers.size();
+   m_Subscribers.push_back(theSubscriber);
+
+   return nLease;
+}
+
+void Subscribers::unsubscribe (struct sockaddr_in * pAddress)
+{
+   unordered_map<uint64_t, size_t>::iterator theEntry = m_Positions.find(makeKey(pAddress));
+
+   if (theEntry != m_Positions.end())
+   {
+      removeAt(theEntry->second);
+   }
+}
+
+void Subscribers::expire (uint32_t nNowTick)
+{
+   size_t j = 0;
+
+   while (j < m_Subscribers.size())
+   {
+      if (m_Subscribers[j].nExpiryTick <= nNowTick)
+      {
+         /* Something else was swapped into j - look at it next */
+         removeAt(j);
+      }
+      else
+      {
+         j++;
+      }
+   }
+}
+
+int Subscribers::collect (NodeTable * pTable)
+{
+   m_Lengths.clear();
+   m_Targets.clear();
+
+   /* Nobody to tell - don't let a backlog build up for the first subscriber */
+   if (m_Subscribers.empty())
+   {
+      m_nPushed = pTable->getGeneration();
+      return 0;
+   }
+
+   if (m_nPushed == pTable->getGeneration())
+   {
+      return 0;
+   }
+
+   /* Fell behind the journal - start from what it still has.  The From in the
+      push will not match the last To so subscribers know to catch up. */
+   if (!pTable->hasChangesSince(m_nPushed))
+   {
+      m_nPushed = (pTable->getChangeCount() > 0) ? pTable->getChange(0).nGeneration - 1 : pTable->getGeneration();
+   }
+
+   m_Outbound.resize(SUBSCRIBERS_MAX_DATAGRAMS * MSG_MAX_SIZE);
+
+   bool bMore = true;
+
+   while (bMore && m_nPushed != pTable->getGeneration() && m_Lengths.size() < SUBSCRIBERS_MAX_DATAGRAMS)
+   {
+      uint8_t *   pData = &m_Outbound[m_Lengths.size() * MSG_MAX_SIZE];
+      uint16_t    nUpdated = 0;
+      uint16_t    nRemoved = 0;
+      uint64_t    nReached = m_nPushed;
+
+      bMore = pTable->writeChanges(m_nPushed, pData + NodeChangesLayout::nSize, MSG_MAX_SIZE - NodeChangesLayout::nSize,
+                                   &nUpdated, &nRemoved, &nReached);
+
+      uint16_t nLength = NodeChangesLayout::nSize + nUpdated * NODE_DATA_V2_SIZE + nRemoved * 4;
+
+      NodeChangesLayout::Type::store(pData, NodeChangesLayout::byType);
+      NodeChangesLayout::Length::store(pData, nLength);
+      NodeChangesLayout::Epoch::store(pData, pTable->getEpoch());
+      NodeChangesLayout::From::store(pData, m_nPushed);
+      NodeChangesLayout::To::store(pData, nReached);
+      NodeChangesLayout::Total::store(pData, pTable->size());
+      NodeChangesLayout::Updated::store(pData, nUpdated);
+      NodeChangesLayout::Removed::store(pData, nRemoved);
+
+      m_Lengths.push_back(nLength);
+      m_nPushed = nReached;
+   }
+
+   for (size_t j=0; j<m_Subscribers.size(); j++)
+   {
+      m_Targets.push_back(m_Subscribers[j].theAddress);
+   }
+
+   return m_Lengths.size();
+}
+
+int Subscribers::send (int nSocket, int * pDropped)
+{
+   struct mmsghdr theHeaders [SUBSCRIBERS_SEND_BATCH];
+   struct iovec   theVectors [SUBSCRIBERS_SEND_BATCH];
+   int            nQueued = 0;
+   int            nSent = 0;
+   bool           bFull = false;
+   size_t         nTotal = m_Lengths.size() * m_Targets.size();
+
+   /* Every datagram to every subscriber, a batch at a time */
+   for (size_t nNext = 0; nNext < nTotal && !bFull; nNext++)
+   {
+      size_t nDatagram = nNext / m_Targets.size();
+      size_t nTarget = nNext % m_Targets.size();
+
+      theVectors[nQueued].iov_base = &m_Outbound[nDatagram * MSG_MAX_SIZE];
+      theVectors[nQueued].iov_len = m_Lengths[nDatagram];
+
+      memset(&theHeaders[nQueued], 0, sizeof(struct mmsghdr));
+      theHeaders[nQueued].msg_hdr.msg_name = &m_Targets[nTarget];
+      theHeaders[nQueued].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+      theHeaders[nQueued].msg_hdr.msg_iov = &theVectors[nQueued];
+      theHeaders[nQueued].msg_hdr.msg_iovlen = 1;
+      nQueued++;
+
+      if (nQueued == SUBSCRIBERS_SEND_BATCH || nNext == nTotal - 1)
+      {
+         int nDone = 0;
+
+         /* sendmmsg stops at the first datagram it cannot send - carry on
+            from there */
+         while (nDone < nQueued)
+         {
+            int nResult = sendmmsg(nSocket, &theHeaders[nDone], nQueued - nDone, 0);
+
+            if (nResult > 0)
+            {
+               nSent += nResult;
+               nDone += nResult;
+            }
+            else if (nResult < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS))
+            {
+               /* The socket buffer is full - the rest of the round is
+                  dropped and subscribers catch up from the gap */
+               bFull = true;
+               break;
+            }
+            else
+            {
+               /* Just this one (a subscriber we cannot reach) */
+               LOG_DEBUG("subscribers: sendmmsg: %s", strerror(errno));
+               nDone++;
+            }
+         }
+
+         nQueued = 0;
+      }
+   }
+
+   m_Lengths.clear();
+   m_Targets.clear();
+
+   *pDropped = nTotal - nSent;
+   return nSent;
+}
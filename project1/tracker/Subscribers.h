@@ -0,0 +1,147 @@
+// Subscribers.h : Pushing table changes to clients that asked for them
+//
+// Rather than poll LIST_NODES (or LIST_NODES_DELTA) a client can SUBSCRIBE
+// for a while.  Every TRACKER_PUSH_INTERVAL the control thread gathers what
+// changed in the table (joins, renewals and departures, from the journal
+// behind delta listings) into NODE_CHANGES datagrams and sends them to every
+// subscriber with sendmmsg.  Each push says which generation it starts from
+// and which it brings the subscriber up to, so a subscriber that sees a gap
+// (a push went missing) catches up with LIST_NODES_DELTA.
+//
+// Subscriptions are leases like registrations - a subscriber that stops
+// renewing simply stops hearing from the tracker.
+//
+// Pushes go to the address a SUBSCRIBE came from, so the tracker has to know
+// that address is real before it starts sending - otherwise one spoofed
+// datagram would point a stream of pushes at a third party.  Every
+// SUBSCRIBE_ACK carries a cookie (a keyed hash of the client's address and
+// port and the current SUBSCRIBERS_COOKIE_PERIOD) and a SUBSCRIBE, renewal or
+// unsubscribe only takes effect when it echoes one.  Only a client that can
+// receive at the address gets to see it.  Nothing is kept for a client until
+// it does, so a flood of spoofed requests costs the tracker nothing but the
+// (short) acks.
+
+#ifndef __SUBSCRIBERS_H
+#define __SUBSCRIBERS_H
+
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <vector>
+#include <unordered_map>
+using namespace std;
+
+#include "NodeTable.h"
+
+/* Most clients subscribed at once */
+#define SUBSCRIBERS_MAX             1024
+
+/* Longest lease handed out (seconds) - anything asking for more gets this */
+#define SUBSCRIBERS_MAX_LEASE       300
+
+/* Most NODE_CHANGES datagrams gathered per push (the rest wait a round) */
+#define SUBSCRIBERS_MAX_DATAGRAMS   64
+
+/* Datagrams handed to each sendmmsg */
+#define SUBSCRIBERS_SEND_BATCH      64
+
+/* Seconds each cookie is handed out for (it is accepted for one more) */
+#define SUBSCRIBERS_COOKIE_PERIOD   60
+
+/** Subscribers keeps the subscriber set and turns table changes into
+ *  NODE_CHANGES datagrams.  Everything other than send must be called with
+ *  the table lock held.
+ */
+class Subscribers
+{
+   private:
+      struct Subscriber
+      {
+         struct sockaddr_in   theAddress;
+         uint32_t             nExpiryTick;
+      };
+
+      /* Dense so a push runs straight through them */
+      vector<Subscriber>                  m_Subscribers;
+
+      /* Address and port -> position in m_Subscribers */
+      unordered_map<uint64_t, size_t>     m_Positions;
+
+      /* Everything up to here has been pushed */
+      uint64_t          m_nPushed;
+
+      /* Picked at random on startup - keys the cookies */
+      uint64_t          m_nSecret [2];
+
+      /* Gathered by collect for the next send (outside the lock) */
+      vector<uint8_t>               m_Outbound;
+      vector<uint16_t>              m_Lengths;
+      vector<struct sockaddr_in>    m_Targets;
+
+      static uint64_t makeKey (struct sockaddr_in * pAddress)
+      { return ((uint64_t) pAddress->sin_addr.s_addr << 16) | pAddress->sin_port; }
+
+      /** Drop the subscriber at a position */
+      void  removeAt (size_t nPosition);
+
+      /** The cookie for an address and port in one cookie period */
+      uint32_t getCookie (struct sockaddr_in * pAddress, uint32_t nPeriod);
+
+   public:
+      Subscribers ();
+
+      /** Add or renew a subscription
+       *  @param pAddress Where to push to
+       *  @param nLease Seconds the subscription should last (clamped to
+       *                SUBSCRIBERS_MAX_LEASE)
+       *  @param nNowTick Coarse tick the request arrived at
+       *  @param nGeneration Where the table is up to (pushes start from here
+       *                     if nobody was subscribed)
+       *  @returns The lease granted (0 if the set is full)
+       */
+      uint16_t subscribe (struct sockaddr_in * pAddress, uint16_t nLease, uint32_t nNowTick, uint64_t nGeneration);
+
+      /** The cookie to hand a client in its SUBSCRIBE_ACK (never 0, which is
+       *  what a client without one sends)
+       */
+      uint32_t makeCookie (struct sockaddr_in * pAddress, uint32_t nNowTick)
+      { return getCookie(pAddress, nNowTick / SUBSCRIBERS_COOKIE_PERIOD); }
+
+      /** Has the client echoed a cookie handed to its address recently?
+       *  @param pAddress Where the request came from
+       *  @param nCookie The cookie in the request
+       *  @param nNowTick Coarse tick the request arrived at
+       *  @returns true if it is this period's cookie or the last one's
+       */
+      bool  checkCookie (struct sockaddr_in * pAddress, uint32_t nCookie, uint32_t nNowTick);
+
+      /** Drop a subscription (if there is one) */
+      void  unsubscribe (struct sockaddr_in * pAddress);
+
+      /** Drop every subscription whose lease has run out */
+      void  expire (uint32_t nNowTick);
+
+      size_t size ()
+      { return m_Subscribers.size(); }
+
+      /** The generation the next push starts from */
+      uint64_t getPushed ()
+      { return m_nPushed; }
+
+      /** Gather the changes since the last push into NODE_CHANGES datagrams
+       *  @returns The number of datagrams waiting to be sent
+       */
+      int   collect (NodeTable * pTable);
+
+      /** Push the gathered datagrams to every subscriber (no lock needed).
+       *  A full socket buffer ends the round early.
+       *  @param pDropped Set to the number of datagrams that were not sent
+       *  @returns The number of datagrams sent
+       */
+      int   send (int nSocket, int * pDropped);
+};
+
+#endif
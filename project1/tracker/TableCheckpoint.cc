@@ -0,0 +1,287 @@
+// TableCheckpoint.cc : Saving / restoring the node table across restarts
+
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "TableCheckpoint.h"
+#include "Logger.h"
+
+static_assert(sizeof(CheckpointHeader) == 24, "Checkpoint header layout changed");
+static_assert(sizeof(CheckpointRecord) == 48, "Checkpoint record layout changed");
+
+TableCheckpoint::TableCheckpoint ()
+{
+   m_nCapturedGeneration = 0;
+   m_bCaptured = false;
+}
+
+bool TableCheckpoint::capture (NodeTable * pTable)
+{
+   if (m_bCaptured && m_nCapturedGeneration == pTable->getGeneration())
+   {
+      return false;
+   }
+
+   m_Records.resize(pTable->size());
+
+   for (size_t j=0; j<pTable->size(); j++)
+   {
+      Node &               theNode = pTable->getEntry(j);
+      CheckpointRecord *   pRecord = &m_Records[j];
+
+      pRecord->nID = theNode.getID();
+      pRecord->nAddress = theNode.getIPAddress();
+      pRecord->nPort = theNode.getPort();
+      pRecord->nFiles = theNode.getFiles();
+      pRecord->nConnections = theNode.getLoad()->nConnections;
+      pRecord->byHasLoad = theNode.hasLoad() ? 1 : 0;
+      pRecord->byReserved = 0;
+      pRecord->nBytesPerSecond = theNode.getLoad()->nBytesPerSecond;
+      pRecord->nFreeBandwidth = theNode.getLoad()->nFreeBandwidth;
+      pRecord->nRegisteredSec = theNode.getRegistrationTime()->tv_sec;
+      pRecord->nRegisteredUsec = theNode.getRegistrationTime()->tv_usec;
+      pRecord->nExpirySec = theNode.getExpirationTimeAsPointer()->tv_sec;
+      pRecord->nExpiryUsec = theNode.getExpirationTimeAsPointer()->tv_usec;
+   }
+
+   m_Generations.resize(pTable->getSlotCount());
+
+   for (uint32_t j=0; j<pTable->getSlotCount(); j++)
+   {
+      m_Generations[j] = pTable->getSlotGeneration(j);
+   }
+
+   m_nCapturedGeneration = pTable->getGeneration();
+   m_bCaptured = true;
+   return true;
+}
+
+bool TableCheckpoint::save ()
+{
+   string   sTempPath = m_sPath + ".tmp";
+   size_t   nRecordBytes = m_Records.size() * sizeof(CheckpointRecord);
+   size_t   nSize = sizeof(CheckpointHeader) + nRecordBytes + m_Generations.size();
+
+   int nFile = open(sTempPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+   if (nFile == -1)
+   {
+      LOG_ERROR("checkpoint: open %s: %s", sTempPath.c_str(), strerror(errno));
+      return false;
+   }
+
+   if (ftruncate(nFile, nSize) == -1)
+   {
+      LOG_ERROR("checkpoint: ftruncate: %s", strerror(errno));
+      close(nFile);
+      return false;
+   }
+
+   uint8_t * pFile = (uint8_t *) mmap(NULL, nSize, PROT_READ | PROT_WRITE, MAP_SHARED, nFile, 0);
+
+   if (pFile == MAP_FAILED)
+   {
+      LOG_ERROR("checkpoint: mmap: %s", strerror(errno));
+      close(nFile);
+      return false;
+   }
+
+   CheckpointHeader     theHeader;
+   struct timeval       theNow;
+
+   gettimeofday(&theNow, 0);
+
+   theHeader.nMagic = CHECKPOINT_MAGIC;
+   theHeader.nVersion = CHECKPOINT_VERSION;
+   theHeader.nSlots = m_Generations.size();
+   theHeader.nNodes = m_Records.size();
+   theHeader.nWrittenAt = theNow.tv_sec;
+
+   memcpy(pFile, &theHeader, sizeof(theHeader));
+
+   if (nRecordBytes > 0)
+   {
+      memcpy(pFile + sizeof(theHeader), &m_Records[0], nRecordBytes);
+   }
+
+   if (!m_Generations.empty())
+   {
+      memcpy(pFile + sizeof(theHeader) + nRecordBytes, &m_Generations[0], m_Generations.size());
+   }
+
+   /* Make sure it is all on disk before it replaces the last good checkpoint */
+   bool bSynced = (msync(pFile, nSize, MS_SYNC) == 0);
+
+   if (!bSynced)
+   {
+      LOG_ERROR("checkpoint: msync: %s", strerror(errno));
+   }
+
+   munmap(pFile, nSize);
+   close(nFile);
+
+   if (!bSynced)
+   {
+      return false;
+   }
+
+   if (rename(sTempPath.c_str(), m_sPath.c_str()) == -1)
+   {
+      LOG_ERROR("checkpoint: rename to %s: %s", m_sPath.c_str(), strerror(errno));
+      return false;
+   }
+
+   LOG_DEBUG("Wrote a checkpoint of %u node(s) to %s", theHeader.nNodes, m_sPath.c_str());
+   return true;
+}
+
+void TableCheckpoint::restoreRecord (const CheckpointRecord * pRecord, Node * pNode, NodeTable * pTable, struct timeval * pNow, uint32_t nNowTick)
+{
+   pNode->setIPAddress(pRecord->nAddress);
+   pNode->setPort(pRecord->nPort);
+   pNode->setFiles(pRecord->nFiles);
+
+   if (pRecord->byHasLoad)
+   {
+      NodeLoad theLoad;
+
+      theLoad.nConnections = pRecord->nConnections;
+      theLoad.nBytesPerSecond = pRecord->nBytesPerSecond;
+      theLoad.nFreeBandwidth = pRecord->nFreeBandwidth;
+      pNode->setLoad(&theLoad);
+   }
+
+   struct timeval theTime;
+
+   theTime.tv_sec = pRecord->nRegisteredSec;
+   theTime.tv_usec = pRecord->nRegisteredUsec;
+   pNode->updateRegistrationTime(&theTime);
+
+   theTime.tv_sec = pRecord->nExpirySec;
+   theTime.tv_usec = pRecord->nExpiryUsec;
+   pNode->setExpirationTime(theTime);
+
+   /* The wheel runs on this run's ticks - carry over whatever is left of the lease */
+   pTable->scheduleExpiry(pNode, nNowTick + (pRecord->nExpirySec - pNow->tv_sec));
+}
+
+int TableCheckpoint::load (NodeTable * pTable, struct timeval * pNow, uint32_t nNowTick)
+{
+   int nFile = open(m_sPath.c_str(), O_RDONLY);
+
+   if (nFile == -1)
+   {
+      if (errno == ENOENT)
+      {
+         LOG_INFO("No checkpoint at %s - starting with an empty table", m_sPath.c_str());
+         return 0;
+      }
+
+      LOG_ERROR("checkpoint: open %s: %s", m_sPath.c_str(), strerror(errno));
+      return -1;
+   }
+
+   struct stat theStat;
+
+   if (fstat(nFile, &theStat) == -1 || (size_t) theStat.st_size < sizeof(CheckpointHeader))
+   {
+      LOG_ERROR("checkpoint: %s is too short to be a checkpoint", m_sPath.c_str());
+      close(nFile);
+      return -1;
+   }
+
+   size_t      nSize = theStat.st_size;
+   uint8_t *   pFile = (uint8_t *) mmap(NULL, nSize, PROT_READ, MAP_PRIVATE, nFile, 0);
+
+   close(nFile);
+
+   if (pFile == MAP_FAILED)
+   {
+      LOG_ERROR("checkpoint: mmap: %s", strerror(errno));
+      return -1;
+   }
+
+   CheckpointHeader  theHeader;
+
+   memcpy(&theHeader, pFile, sizeof(theHeader));
+
+   size_t nRecordBytes = (size_t) theHeader.nNodes * sizeof(CheckpointRecord);
+
+   if (theHeader.nMagic != CHECKPOINT_MAGIC || theHeader.nVersion != CHECKPOINT_VERSION ||
+       theHeader.nSlots > NODE_ID_MAX_SLOTS || theHeader.nNodes > theHeader.nSlots ||
+       nSize != sizeof(theHeader) + nRecordBytes + theHeader.nSlots)
+   {
+      LOG_ERROR("checkpoint: %s is not a usable checkpoint (version %u)", m_sPath.c_str(), theHeader.nVersion);
+      munmap(pFile, nSize);
+      return -1;
+   }
+
+   const CheckpointRecord *   pRecords = (const CheckpointRecord *) (pFile + sizeof(theHeader));
+   int                        nRestored = 0;
+
+   pTable->beginRestore(theHeader.nSlots, pFile + sizeof(theHeader) + nRecordBytes);
+
+   vector<const CheckpointRecord *>  theAdopted;
+
+   for (uint32_t j=0; j<theHeader.nNodes; j++)
+   {
+      const CheckpointRecord *   pRecord = &pRecords[j];
+
+      /* Ran out while we were down - its ID must not be handed out again */
+      if (pRecord->nExpirySec <= pNow->tv_sec)
+      {
+         if (pTable->isLocalID(pRecord->nID))
+         {
+            pTable->retireID(pRecord->nID);
+         }
+
+         continue;
+      }
+
+      /* Nodes learned from peers do not sit in a slot of their own ID -
+         they are taken in once our own are back in place */
+      if (!pTable->isLocalID(pRecord->nID))
+      {
+         theAdopted.push_back(pRecord);
+         continue;
+      }
+
+      Node * pNode = pTable->restoreNode(pRecord->nID);
+
+      if (pNode == NULL)
+      {
+         LOG_WARN("checkpoint: Skipping node %u (ID does not fit the saved table)", pRecord->nID);
+         continue;
+      }
+
+      restoreRecord(pRecord, pNode, pTable, pNow, nNowTick);
+      nRestored++;
+   }
+
+   pTable->endRestore();
+
+   for (size_t j=0; j<theAdopted.size(); j++)
+   {
+      Node * pNode = pTable->adoptNode(theAdopted[j]->nID);
+
+      if (pNode != NULL)
+      {
+         restoreRecord(theAdopted[j], pNode, pTable, pNow, nNowTick);
+         nRestored++;
+      }
+   }
+
+   munmap(pFile, nSize);
+
+   LOG_INFO("Restored %d of %u node(s) from %s (written %ld seconds ago)", nRestored, theHeader.nNodes,
+            m_sPath.c_str(), (long) (pNow->tv_sec - theHeader.nWrittenAt));
+
+   return nRestored;
+}
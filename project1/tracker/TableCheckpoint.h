@@ -0,0 +1,110 @@
+// TableCheckpoint.h : Saving / restoring the node table across restarts
+
+#ifndef __TABLECHECKPOINT_H
+#define __TABLECHECKPOINT_H
+
+#include <stdint.h>
+#include <sys/time.h>
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "NodeTable.h"
+
+/* "TRKC" and the layout version - bump the version whenever the layout changes */
+#define CHECKPOINT_MAGIC         0x54524B43
+#define CHECKPOINT_VERSION       1
+
+/* Default number of seconds between checkpoints */
+#define DEFAULT_CHECKPOINT_INTERVAL    10
+
+/* The file starts with this header, followed by nNodes records and then one
+   generation byte for each of the nSlots storage slots.  Everything is in
+   host order - the file is only meant for the machine that wrote it. */
+struct CheckpointHeader
+{
+   uint32_t    nMagic;
+   uint32_t    nVersion;
+   uint32_t    nSlots;
+   uint32_t    nNodes;
+
+   /* Wall clock time the checkpoint was taken */
+   int64_t     nWrittenAt;
+};
+
+/* One live node */
+struct CheckpointRecord
+{
+   uint32_t    nID;
+   uint32_t    nAddress;
+   uint16_t    nPort;
+   uint16_t    nFiles;
+   uint16_t    nConnections;
+   uint8_t     byHasLoad;
+   uint8_t     byReserved;
+   uint32_t    nBytesPerSecond;
+   uint32_t    nFreeBandwidth;
+   int64_t     nRegisteredSec;
+   int64_t     nExpirySec;
+   uint32_t    nRegisteredUsec;
+   uint32_t    nExpiryUsec;
+};
+
+/** TableCheckpoint writes the node table out to a file through a memory map
+ * and maps it back in on startup.  Taking a checkpoint is split in two: a
+ * quick copy of the table while the caller holds the table lock (capture),
+ * and the slower part of writing the file once the lock is released (save).
+ * A checkpoint is written to a temporary file and renamed into place so a
+ * crash part way through never leaves a torn file behind.
+ */
+class TableCheckpoint
+{
+   private:
+      string   m_sPath;
+
+      /* Table generation of the last capture (to skip writing an unchanged table) */
+      uint64_t m_nCapturedGeneration;
+      bool     m_bCaptured;
+
+      /* What was captured (reused from one checkpoint to the next) */
+      vector<CheckpointRecord>   m_Records;
+      vector<uint8_t>            m_Generations;
+
+      /** Fill in a restored node from its record and put it back on the wheel */
+      static void restoreRecord (const CheckpointRecord * pRecord, Node * pNode, NodeTable * pTable, struct timeval * pNow, uint32_t nNowTick);
+
+   public:
+      TableCheckpoint ();
+
+      void setPath (const char * pszPath)
+      { m_sPath = pszPath; }
+
+      const char * getPath ()
+      { return m_sPath.c_str(); }
+
+      bool isEnabled ()
+      { return !m_sPath.empty(); }
+
+      /** Copy the table (caller holds the table lock)
+       *  @returns false if nothing changed since the last capture
+       */
+      bool  capture (NodeTable * pTable);
+
+      /** Write out what was last captured
+       *  @returns true if the checkpoint made it to disk
+       */
+      bool  save ();
+
+      /** Map in the checkpoint file and put its nodes back into the table.
+       *  Nodes whose lease ran out while the tracker was down are skipped.
+       *  @param pTable An empty table to fill
+       *  @param pNow The current wall clock time
+       *  @param nNowTick The current coarse clock tick
+       *  @returns The number of nodes restored (0 if there is no file) or -1
+       *           if the file is unusable
+       */
+      int   load (NodeTable * pTable, struct timeval * pNow, uint32_t nNowTick);
+};
+
+#endif
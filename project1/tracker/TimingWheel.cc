@@ -0,0 +1,162 @@
+// TimingWheel.cc : Hierarchical timing wheel used to expire node leases
+
+#include <stdint.h>
+
+#include "TimingWheel.h"
+
+TimingWheel::TimingWheel ()
+{
+   m_nCurrent = 0;
+
+   for (int j=0; j<WHEEL_LEVELS * WHEEL_BUCKETS; j++)
+   {
+      m_Heads[j] = WHEEL_NONE;
+   }
+}
+
+TimingWheel::~TimingWheel ()
+{
+   // Nothing to clean up - the vectors take care of themselves
+}
+
+uint32_t TimingWheel::findBucket (uint32_t nExpiry)
+{
+   /* Anything already due goes out on the very next tick */
+   if (nExpiry <= m_nCurrent)
+   {
+      nExpiry = m_nCurrent + 1;
+   }
+
+   uint32_t nDelta = nExpiry - m_nCurrent;
+
+   for (int nLevel=0; nLevel<WHEEL_LEVELS; nLevel++)
+   {
+      int nShift = WHEEL_BITS * nLevel;
+
+      if (nDelta < (1U << (nShift + WHEEL_BITS)))
+      {
+         return nLevel * WHEEL_BUCKETS + ((nExpiry >> nShift) & WHEEL_MASK);
+      }
+   }
+
+   /* Past the end of the wheel - park it as far out as we can, it will be
+      placed again (using its real expiry) when that bucket cascades */
+   int nShift = WHEEL_BITS * (WHEEL_LEVELS - 1);
+   nExpiry = m_nCurrent + (1U << (nShift + WHEEL_BITS)) - 1;
+
+   return (WHEEL_LEVELS - 1) * WHEEL_BUCKETS + ((nExpiry >> nShift) & WHEEL_MASK);
+}
+
+void TimingWheel::link (uint32_t nHandle, uint32_t nBucket)
+{
+   m_Prev[nHandle] = WHEEL_NONE;
+   m_Next[nHandle] = m_Heads[nBucket];
+
+   if (m_Heads[nBucket] != WHEEL_NONE)
+   {
+      m_Prev[m_Heads[nBucket]] = nHandle;
+   }
+
+   m_Heads[nBucket] = nHandle;
+   m_Bucket[nHandle] = nBucket;
+}
+
+void TimingWheel::unlink (uint32_t nHandle)
+{
+   uint32_t nBucket = m_Bucket[nHandle];
+
+   if (m_Prev[nHandle] != WHEEL_NONE)
+   {
+      m_Next[m_Prev[nHandle]] = m_Next[nHandle];
+   }
+   else
+   {
+      m_Heads[nBucket] = m_Next[nHandle];
+   }
+
+   if (m_Next[nHandle] != WHEEL_NONE)
+   {
+      m_Prev[m_Next[nHandle]] = m_Prev[nHandle];
+   }
+
+   m_Bucket[nHandle] = WHEEL_NONE;
+}
+
+void TimingWheel::schedule (uint32_t nHandle, uint32_t nExpiry)
+{
+   /* Grow the per handle storage to fit */
+   if (nHandle >= m_Bucket.size())
+   {
+      m_Expiry.resize(nHandle+1, 0);
+      m_Next.resize(nHandle+1, WHEEL_NONE);
+      m_Prev.resize(nHandle+1, WHEEL_NONE);
+      m_Bucket.resize(nHandle+1, WHEEL_NONE);
+   }
+
+   if (m_Bucket[nHandle] != WHEEL_NONE)
+   {
+      unlink(nHandle);
+   }
+
+   m_Expiry[nHandle] = nExpiry;
+   link(nHandle, findBucket(nExpiry));
+}
+
+void TimingWheel::cancel (uint32_t nHandle)
+{
+   if (isScheduled(nHandle))
+   {
+      unlink(nHandle);
+   }
+}
+
+void TimingWheel::cascade (int nLevel)
+{
+   uint32_t nBucket = nLevel * WHEEL_BUCKETS + ((m_nCurrent >> (WHEEL_BITS * nLevel)) & WHEEL_MASK);
+   uint32_t nHandle = m_Heads[nBucket];
+
+   /* Take the whole list and drop each entry back in relative to now */
+   m_Heads[nBucket] = WHEEL_NONE;
+
+   while (nHandle != WHEEL_NONE)
+   {
+      uint32_t nNext = m_Next[nHandle];
+
+      link(nHandle, findBucket(m_Expiry[nHandle]));
+      nHandle = nNext;
+   }
+}
+
+int TimingWheel::advance (uint32_t nNow, vector<uint32_t> * pExpired)
+{
+   int nFired = 0;
+
+   while (m_nCurrent < nNow)
+   {
+      m_nCurrent++;
+
+      /* Each time a level wraps, pull the next bucket down from above */
+      for (int nLevel=1; nLevel<WHEEL_LEVELS; nLevel++)
+      {
+         if ((m_nCurrent & ((1U << (WHEEL_BITS * nLevel)) - 1)) != 0)
+         {
+            break;
+         }
+
+         cascade(nLevel);
+      }
+
+      uint32_t nBucket = m_nCurrent & WHEEL_MASK;
+
+      while (m_Heads[nBucket] != WHEEL_NONE)
+      {
+         uint32_t nHandle = m_Heads[nBucket];
+
+         unlink(nHandle);
+         pExpired->push_back(nHandle);
+         nFired++;
+      }
+   }
+
+   return nFired;
+}
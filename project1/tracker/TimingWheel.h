@@ -0,0 +1,79 @@
+// TimingWheel.h : Hierarchical timing wheel used to expire node leases
+
+#ifndef __TIMINGWHEEL_H
+#define __TIMINGWHEEL_H
+
+#include <stdint.h>
+
+#include <vector>
+using namespace std;
+
+/* Each level has 64 buckets and each level is 64 times coarser than the one
+   below it.  With one second ticks, four levels cover about 194 days. */
+#define WHEEL_BITS         6
+#define WHEEL_BUCKETS      (1 << WHEEL_BITS)
+#define WHEEL_MASK         (WHEEL_BUCKETS - 1)
+#define WHEEL_LEVELS       4
+
+/* No bucket / no neighbor */
+#define WHEEL_NONE         0xFFFFFFFF
+
+/** TimingWheel schedules small integer handles (e.g. table slots) to fire at
+ * a given tick.  Scheduling, re-scheduling and cancelling are O(1) and each
+ * entry is moved at most once per level on its way down, so expiry is
+ * amortized O(1).  Entries are kept on intrusive doubly linked lists so the
+ * memory used is proportional to the largest handle, not to the number of
+ * times something was scheduled.
+ */
+class TimingWheel
+{
+   private:
+      /* The tick that the wheel has processed up to */
+      uint32_t    m_nCurrent;
+
+      /* First handle in each bucket (level * WHEEL_BUCKETS + index) */
+      uint32_t    m_Heads [WHEEL_LEVELS * WHEEL_BUCKETS];
+
+      /* Per handle information */
+      vector<uint32_t>  m_Expiry;
+      vector<uint32_t>  m_Next;
+      vector<uint32_t>  m_Prev;
+      vector<uint32_t>  m_Bucket;
+
+      /** Figure out which bucket a particular expiry belongs in */
+      uint32_t findBucket (uint32_t nExpiry);
+
+      void  link (uint32_t nHandle, uint32_t nBucket);
+      void  unlink (uint32_t nHandle);
+
+      /** Move everything in a bucket down to where it belongs now */
+      void  cascade (int nLevel);
+
+   public:
+      TimingWheel ();
+      ~TimingWheel ();
+
+      uint32_t getCurrent ()
+      { return m_nCurrent; }
+
+      /** Schedule (or re-schedule) a handle
+       *  @param nHandle The handle to schedule
+       *  @param nExpiry The tick at which the handle should fire
+       */
+      void  schedule (uint32_t nHandle, uint32_t nExpiry);
+
+      /** Remove a handle from the wheel (no-op if it is not scheduled) */
+      void  cancel (uint32_t nHandle);
+
+      bool  isScheduled (uint32_t nHandle)
+      { return nHandle < m_Bucket.size() && m_Bucket[nHandle] != WHEEL_NONE; }
+
+      /** Move the wheel forward
+       *  @param nNow The current tick
+       *  @param pExpired Filled in with each handle whose time has come
+       *  @returns The number of handles that fired
+       */
+      int   advance (uint32_t nNow, vector<uint32_t> * pExpired);
+};
+
+#endif
@@ -11,12 +11,28 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <sys/time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
 
 #include <iostream>
+#include <algorithm>
+#include <thread>
 using namespace std;
 
 #include "Tracker.h"
+#include "DatagramBatch.h"
+#include "UringBatch.h"
+#include "WireLayout.h"
 #include "utils.h"
+#include "Logger.h"
+#include "Reactor.h"
+#include "AdminServer.h"
 
 Tracker::Tracker()
 {
@@ -24,9 +40,23 @@ Tracker::Tracker()
     m_nPort = 0;
     // Nothing in the socket
     m_nSocket = -1;
-    m_nNextID = 1;
 
     m_nLeaseTime = DEFAULT_REGISTER_EXPIRATION;
+    m_nBatchSize = DEFAULT_BATCH_SIZE;
+    m_bUring = false;
+    m_nWorkers = 0;
+    m_nLastExpiryTick = 0;
+    m_nCheckpointInterval = DEFAULT_CHECKPOINT_INTERVAL;
+    m_nGossipInterval = DEFAULT_GOSSIP_INTERVAL;
+    m_nAdminPort = 0;
+    m_nStopEvent = -1;
+
+    /* Readers always find a snapshot, even of an empty table */
+    shared_ptr<NodeSnapshot> pEmpty = make_shared<NodeSnapshot>(&m_NodeTable);
+
+    pEmpty->rank();
+    m_Snapshots.publish(pEmpty);
+    m_nSnapshotRenewals = 0;
 }
 
 Tracker::~Tracker()
@@ -43,8 +73,8 @@ bool Tracker::initialize (char * pszIP)
     /* Double check that port indeed has been initialized */
     if (m_nPort == 0)
     {
-        cerr << "Error: Unable to create a server on Port 0.  Make sure to properly initialize" << endl;
-        cerr << "  the port setting for the server" << endl;
+        LOG_ERROR("Error: Unable to create a server on Port 0.  Make sure to properly initialize");
+        LOG_ERROR("  the port setting for the server");
         return false;
     }
 
@@ -64,7 +94,7 @@ bool Tracker::initialize (char * pszIP)
     // use for the tracker
 
     if ((rv = getaddrinfo(pszIP, szPortString, &hints, &servinfo)) != 0) {
-        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
+        LOG_ERROR("getaddrinfo: %s", gai_strerror(rv));
         return false;
     }
 
@@ -72,13 +102,19 @@ bool Tracker::initialize (char * pszIP)
 	for(p = servinfo; p != NULL; p = p->ai_next) {
 		if ((m_nSocket = socket(p->ai_family, p->ai_socktype,
 				p->ai_protocol)) == -1) {
-			perror("initialize: socket");
+			LOG_ERROR("initialize: socket: %s", strerror(errno));
 			continue;
 		}
 
+        /* Workers each get their own socket on the same port */
+        if (getWorkers() > 0 && !enableReusePort(m_nSocket)) {
+            close(m_nSocket);
+            continue;
+        }
+
         if (bind(m_nSocket, p->ai_addr, p->ai_addrlen) == -1) {
             close(m_nSocket);
-            perror("initialize: bind");
+            LOG_ERROR("initialize: bind: %s", strerror(errno));
             continue;
         }
 
@@ -86,13 +122,40 @@ bool Tracker::initialize (char * pszIP)
 	}
 
 	if (p == NULL) {
-		fprintf(stderr, "initialize: failed to properly set up socket\n");
+		LOG_ERROR("initialize: failed to properly set up socket");
 		return false;
 	}
 
     // Copy in the respective information for the socket
     memcpy(getAddressInfo(), p->ai_addr, sizeof(struct sockaddr_in));
 
+    // The first worker reuses the socket that we just bound, the rest get
+    // their own so that the kernel can spread the flows across them
+    if (getWorkers() > 0)
+    {
+        m_WorkerSockets.push_back(m_nSocket);
+
+        for (int j=1; j<getWorkers(); j++)
+        {
+            int nSocket;
+
+            if ((nSocket = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1) {
+                LOG_ERROR("initialize: socket: %s", strerror(errno));
+                freeaddrinfo(servinfo);
+                return false;
+            }
+
+            if (!enableReusePort(nSocket) || bind(nSocket, p->ai_addr, p->ai_addrlen) == -1) {
+                LOG_ERROR("initialize: worker bind: %s", strerror(errno));
+                close(nSocket);
+                freeaddrinfo(servinfo);
+                return false;
+            }
+
+            m_WorkerSockets.push_back(nSocket);
+        }
+    }
+
     // A few notes on addrinfo and sockaddr
     //
     // addrinfo contains lots of information, part of which is a pointer to
@@ -120,476 +183,2262 @@ bool Tracker::initialize (char * pszIP)
     return true;
 }
 
-void Tracker::go ()
+bool Tracker::enableReusePort (int nSocket)
 {
-    while(1)
+    int nEnable = 1;
+
+    if (setsockopt(nSocket, SOL_SOCKET, SO_REUSEPORT, &nEnable, sizeof(nEnable)) == -1)
     {
-        Message * pRcvMessage;
+        LOG_ERROR("initialize: setsockopt(SO_REUSEPORT): %s", strerror(errno));
+        return false;
+    }
 
-        pRcvMessage = recvMessage();
+    return true;
+}
 
-        if (pRcvMessage != NULL) {
-            switch(pRcvMessage->getType())
-            {
-                case MSG_TYPE_ECHO:
-                    processEcho(pRcvMessage);
-                    break;
-                case MSG_TYPE_LIST_NODES:
-                    processListNodes(pRcvMessage);
-                    break;
-                case MSG_TYPE_REGISTER:
-                    processRegister(pRcvMessage);
-                    break;
-                default:
-                    printf("Unknown message type: %d\n", pRcvMessage->getType());
-                    // The client should not be sending these messages to us
-                    break;
-            }
+void Tracker::blockShutdownSignals ()
+{
+    sigset_t    theSignals;
 
-            delete pRcvMessage;
-        }
-    }
+    sigemptyset(&theSignals);
+    sigaddset(&theSignals, SIGINT);
+    sigaddset(&theSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &theSignals, NULL);
 }
 
-Message * Tracker::recvMessage ()
+void Tracker::go ()
 {
-    Message * pMessage;
+    /* Shutdown signals are picked up by the control reactor (through a
+       signalfd) rather than by whichever thread they happen to land on */
+    blockShutdownSignals();
 
-    socklen_t addr_len;
-	struct sockaddr clientAddr;
-    int numbytes;
+    m_nStopEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (m_nStopEvent == -1)
+    {
+        LOG_ERROR("go: eventfd: %s", strerror(errno));
+        return;
+    }
 
-    /* Create a new message object */
-    pMessage = new Message ();
+    vector<thread>  theThreads;
 
-	printf("listener: waiting to recvfrom...\n");
+    if (getWorkers() == 0)
+    {
+        theThreads.push_back(thread(&Tracker::serveSocket, this, getSocket()));
+    }
 
-	addr_len = sizeof(clientAddr);
+    for (int j=0; j<getWorkers(); j++)
+    {
+        theThreads.push_back(thread(&Tracker::runWorker, this, j));
+    }
 
-	if ((numbytes = recvfrom(getSocket(), pMessage->getData(), pMessage->getMaxLength() , 0,
-		(struct sockaddr *)&clientAddr, &addr_len)) == -1) {
-		perror("recvfrom");
-		exit(1);
-	}
+    runControl();
 
-    printf("Received a packet from a client of length %d bytes\n", numbytes);
+    /* Wake every serving loop (the event is never read so it stays set) */
+    uint64_t nOne = 1;
 
-    if(isVerbose())
+    if (write(m_nStopEvent, &nOne, sizeof(nOne)) == -1)
     {
-        dump_sockaddr_in((struct sockaddr_in *) &clientAddr);
+        LOG_ERROR("go: write(eventfd): %s", strerror(errno));
     }
 
-    /* Output that we got a packet from that client */
-    pMessage->setType(pMessage->getData()[0]);
-
-    /* Save the relevant info */
-    pMessage->setLength(numbytes);
-    pMessage->recordArrival();
+    for (size_t j=0; j<theThreads.size(); j++)
+    {
+        theThreads[j].join();
+    }
 
-    /* Copy / save the information about the client on the other side */
-    memcpy(pMessage->getAddress(), &clientAddr, sizeof(struct sockaddr));
+    /* Leave the freshest possible table behind for the next run */
+    if (m_Checkpoint.isEnabled())
+    {
+        writeCheckpoint();
+    }
 
-    if(isVerbose())
+    if (m_Capture.isEnabled())
     {
-        pMessage->dumpData();
+        LOG_INFO("Captured %llu datagram(s)", (unsigned long long) m_Capture.getCount());
+        m_Capture.close();
     }
 
-    return pMessage;
+    close(m_nStopEvent);
+    m_nStopEvent = -1;
+
+    LOG_INFO("Tracker stopped");
 }
 
-bool Tracker::processEcho (Message * pMessageEcho)
+void Tracker::runControl ()
 {
-    Message * pEchoResponse;
+    Reactor         theReactor;
+    AdminServer     theAdmin (this);
+    CoarseClock     theClock;
+    sigset_t        theSignals;
 
-    /* The inbound message has the following content:
-        Type        1 byte      0x05   Echo
-        Length      2 bytes     0x04   Four bytes of data to follow
-        Nonce       4 bytes            Randomly generated value in network order
-    */
+    sigemptyset(&theSignals);
+    sigaddset(&theSignals, SIGINT);
+    sigaddset(&theSignals, SIGTERM);
 
-    /* Our task is to reflect the nonce and add in a timestamp that is network
-       ordered */
+    int nSignals = signalfd(-1, &theSignals, SFD_NONBLOCK | SFD_CLOEXEC);
 
-    printf("Processing an echo message from the client");
+    /* Housekeeping - reap leases even when no packets are coming in */
+    int nHousekeeping = Reactor::createTimer(TRACKER_HOUSEKEEPING_INTERVAL);
 
-    uint32_t    theNonce;
-    memcpy(&theNonce, pMessageEcho->getData()+3, 4);
-    theNonce = ntohl(theNonce);
+    /* Catch the snapshot up with changes the writers left for later */
+    int nSnapshot = Reactor::createTimer(TRACKER_SNAPSHOT_INTERVAL);
+    /* Push what changed to the subscribers */
+    int nPush = Reactor::createTimer(TRACKER_PUSH_INTERVAL);
+    int nCheckpoint = -1;
+    int nGossip = -1;
 
-    printf("  Nonce (Network Order): %d\n", theNonce);
+    if (!theReactor.isValid() || nSignals == -1 || nHousekeeping == -1 || nSnapshot == -1 || nPush == -1)
+    {
+        LOG_ERROR("Error: Unable to set up the control reactor");
+    }
+    else
+    {
+        theReactor.add(nSignals, EPOLLIN, [&] (uint32_t)
+        {
+            struct signalfd_siginfo theInfo;
 
-    pEchoResponse = new Message();
+            if (read(nSignals, &theInfo, sizeof(theInfo)) == sizeof(theInfo))
+            {
+                LOG_WARN("Caught signal %d - shutting down", theInfo.ssi_signo);
+                theReactor.stop();
+            }
+        });
 
-    pEchoResponse->setType(MSG_TYPE_ECHO_RESPONSE);
-    pEchoResponse->setLength(16);
+        theReactor.add(nHousekeeping, EPOLLIN, [&] (uint32_t)
+        {
+            Reactor::drainCounter(nHousekeeping);
 
-    // YOLO - Nothing can go wrong directly exposing a pointer and just letting the caller
-    //        manipulate the byte array, right?
+            theClock.update();
+            expireNodes(theClock.getTick());
+        });
 
-    /* Set the type */
+        theReactor.add(nSnapshot, EPOLLIN, [&] (uint32_t)
+        {
+            Reactor::drainCounter(nSnapshot);
+            publishSnapshot();
+        });
 
-    pEchoResponse->getData()[0] = MSG_TYPE_ECHO_RESPONSE;
+        theReactor.add(nPush, EPOLLIN, [&] (uint32_t)
+        {
+            Reactor::drainCounter(nPush);
 
-    /* Set the size field */
-    uint16_t    theSize;
-    theSize = htons(pEchoResponse->getLength());
-    memcpy(pEchoResponse->getData()+1, &theSize, 2);
+            theClock.update();
 
-    /* Set the status field - all is well */
-    pEchoResponse->getData()[3] = 0;
+            int nDatagrams;
 
-    /* Copy over the 32 bit nonce data from the initial packet */
-    memcpy(pEchoResponse->getData()+4, pMessageEcho->getData()+3, 4);
+            {
+                lock_guard<mutex>   theGuard(m_TableLock);
 
-    /* Let's get the current time */
-    struct timeval  theTimeVal;
+                m_Subscribers.expire(theClock.getTick());
+                nDatagrams = m_Subscribers.collect(&m_NodeTable);
+            }
 
-    /* Who needs return codes? */
-    gettimeofday(&theTimeVal, 0);
+            /* The fan-out can be large - keep it outside the lock */
+            if (nDatagrams > 0)
+            {
+                int nDropped = 0;
 
-    printf("  The time at the server is %ld.%d\n", theTimeVal.tv_sec, theTimeVal.tv_usec);
+                m_Subscribers.send(getSocket(), &nDropped);
 
-    uint32_t theIntVal;
-    theIntVal = htonl(theTimeVal.tv_sec);
-    memcpy(pEchoResponse->getData()+8, &theIntVal, 4);
+                if (nDropped > 0)
+                {
+                    m_Stats.addPushDropped(nDropped);
+                }
+            }
+        });
 
-    theIntVal = htonl(theTimeVal.tv_usec);
-    memcpy(pEchoResponse->getData()+12, &theIntVal, 4);
+        if (m_Checkpoint.isEnabled())
+        {
+            nCheckpoint = Reactor::createTimer(getCheckpointInterval() * 1000);
 
-    printf("Sending an echo response from the server containg %d bytes\n", pEchoResponse->getLength());
+            if (nCheckpoint != -1)
+            {
+                theReactor.add(nCheckpoint, EPOLLIN, [&] (uint32_t)
+                {
+                    Reactor::drainCounter(nCheckpoint);
+                    writeCheckpoint();
+                });
+            }
+        }
 
-    if(isVerbose())
-    {
-        pEchoResponse->dumpData();
+        if (m_Gossip.isEnabled())
+        {
+            nGossip = Reactor::createTimer(m_nGossipInterval);
+
+            if (nGossip != -1)
+            {
+                theReactor.add(nGossip, EPOLLIN, [&] (uint32_t)
+                {
+                    Reactor::drainCounter(nGossip);
+                    gossipRound();
+                });
+            }
+        }
+
+        if (m_nAdminPort != 0)
+        {
+            theAdmin.start(m_nAdminPort, &theReactor);
+        }
+
+        theReactor.run();
+        theAdmin.stop();
     }
 
-    sendto(getSocket(), pEchoResponse->getData(), pEchoResponse->getLength(), 0, (struct sockaddr *) pMessageEcho->getAddress(), sizeof(struct sockaddr_in));
+    int nDescriptors[] = { nSignals, nHousekeeping, nSnapshot, nPush, nCheckpoint, nGossip };
 
-    delete pEchoResponse;
-    return true;
+    for (int j=0; j<6; j++)
+    {
+        if (nDescriptors[j] != -1)
+        {
+            close(nDescriptors[j]);
+        }
+    }
 }
 
-bool Tracker::processRegister (Message * pMessageRegister)
+bool Tracker::restoreCheckpoint ()
 {
-    struct timeval  currentTime;
-    int nCurrentEntry;
+    if (!m_Checkpoint.isEnabled())
+    {
+        return true;
+    }
 
-    /* At this point, we know that the message is a registration (0x01) message */
+    CoarseClock     theClock;
+    int             nRestored;
 
-    Message * pMessageRegisterACK;
+    {
+        lock_guard<mutex>   theGuard(m_TableLock);
+        nRestored = m_Checkpoint.load(&m_NodeTable, theClock.getWallTime(), theClock.getTick());
+    }
 
-    /* The format of the registration message should be
-     *   1 Byte  - Requested Identifier (0 if unknown, non-zero otherwise)
-     *   4 Bytes - IP Address
-     *   2 Bytes - Port Number
-     *   2 Bytes - Number of Files
-     *
-     * All content should be in network order (big endian) which would apply to the
-     *  IP address, port number, and number of files
-    */
+    publishSnapshot();
 
-    /* The response message now adds a status field after the length. The length does
-       include the status field.
-       Overall Format is as follows:
-         1 byte  - Type = 0x02
-         2 bytes - Length = 17 (0x0011 - big endian format)
-         1 byte  - Status = 0 (OK)
-         1 byte  - Identifier = Non-zero if assigned / confirmed or zero if there was an issue
-         4 bytes - IP Address
-         2 bytes - Port
-         2 bytes - Number of files
-         4 bytes - Expiration of registratin
-    */
+    return nRestored >= 0;
+}
 
-    pMessageRegisterACK = new Message();
+void Tracker::writeCheckpoint ()
+{
+    {
+        lock_guard<mutex>   theGuard(m_TableLock);
 
-    pMessageRegisterACK->getData()[0] = 0x02;
+        /* Just a copy under the lock - the file is written after letting go */
+        if (!m_Checkpoint.capture(&m_NodeTable))
+        {
+            return;
+        }
+    }
 
-    /* Set the length appropriately */
-    pMessageRegisterACK->setLength(17);
+    m_Checkpoint.save();
+}
 
-    /* The length is 17 bytes */
-    pMessageRegisterACK->getData()[1] = 0x00;
-    pMessageRegisterACK->getData()[2] = 0x11;
+void Tracker::gossipRound ()
+{
+    int nRecords;
 
-    /* Skip the status code for now - Byte 3 */
-    // Just in case - make it a 1 - something bad??
-    pMessageRegisterACK->getData()[3] = 0x01;
+    {
+        lock_guard<mutex>   theGuard(m_TableLock);
+        nRecords = m_Gossip.collect(&m_NodeTable);
+    }
 
-    /* Copy over the rest of the original content */
-    memcpy(pMessageRegisterACK->getData()+4, pMessageRegister->getData()+3, 9);
+    /* Any socket bound to our port will do - peers know us by that port */
+    if (nRecords > 0)
+    {
+        m_Gossip.send(getSocket());
+    }
+}
 
-    /* Double check / ensure that the registration expiry is zero */
-    memset(pMessageRegisterACK->getData()+13,0,4);
+void Tracker::runWorker (int nWorker)
+{
+    /* Pin the worker so that its socket, buffers and cache lines stay put */
+    long nCPUs = sysconf(_SC_NPROCESSORS_ONLN);
 
-    /* Do we have the right size? */
-    // For inbound messages here to the server, the length is the actual length as observed
-    // as recorded by recvfrom
-    if (pMessageRegister->getLength() != 12)
+    if (nCPUs > 0)
     {
-        /* Bad length - note it here on the console */
-        cout << "Error: Registration message did wrong count of bytes (Expected 12, had )" << pMessageRegister->getLength() << " bytes" << endl;
+        cpu_set_t   theCPUs;
+
+        CPU_ZERO(&theCPUs);
+        CPU_SET(nWorker % nCPUs, &theCPUs);
+
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &theCPUs) != 0)
+        {
+            LOG_WARN("Warning: Unable to pin worker %d to a CPU", nWorker);
+        }
+    }
 
-        cout << "Dumping the data from the message" << endl;
-        pMessageRegister->dumpData();
+    LOG_INFO("Worker %d serving socket %d on CPU %ld", nWorker, m_WorkerSockets[nWorker], nCPUs > 0 ? nWorker % nCPUs : -1);
 
-        /* Status code - nope - this was a bad registration */
-        pMessageRegisterACK->getData()[3] = 0x01;
+    serveSocket(m_WorkerSockets[nWorker]);
+}
 
-        /* Set the identifier to zero */
-        pMessageRegisterACK->getData()[4] = 0x00;
+void Tracker::serveSocket (int nSocket)
+{
+    /* Readiness comes from epoll - the reads themselves must never block */
+    fcntl(nSocket, F_SETFL, fcntl(nSocket, F_GETFL) | O_NONBLOCK);
 
-        /* No need to adjust the expiration time - that was already zero'd */
-    }
-    else
+    if (isUring())
     {
-        /* Is this a new registration or a renewal? */
-        if(pMessageRegister->getData()[3] == 0x00)
+        if (goUring(nSocket))
         {
-            /* This is a new request (we think) */
-            cout << "Detected a new registration (ID was 0)" << endl;
+            return;
+        }
+
+        LOG_WARN("io_uring is not available - serving socket %d with the regular calls", nSocket);
+    }
+
+    if (getBatchSize() > 1)
+    {
+        goBatched(nSocket);
+        return;
+    }
 
-            /* Figure out the next open node ID */
-            uint8_t     assignedID;
+    Reactor         theReactor;
+    CoarseClock     theClock;
+    MessagePool     thePool(MESSAGE_POOL_DEFAULT_SIZE);
+    RateLimiter     theLimiter(&m_Limits);
+    ThreadStats *   pStats = m_Stats.attachThread();
 
-            assignedID = getNextNodeID();
+    theReactor.add(m_nStopEvent, EPOLLIN, [&] (uint32_t) { theReactor.stop(); });
 
-            /* Create a new node entry from this information */
-            Node    theNode;
+    theReactor.add(nSocket, EPOLLIN, [&] (uint32_t)
+    {
+        /* Take what is queued (up to a limit so the stop event gets a look in) */
+        for (int j=0; j<TRACKER_DRAIN_LIMIT; j++)
+        {
+            MessageHandle   theRcvMessage;
 
-            theNode.setID(assignedID);
+            theRcvMessage = recvMessage(nSocket, &theClock, &thePool);
 
-            cout << "  Assigning an ID of " << assignedID << endl;
+            if (theRcvMessage.get() == NULL)
+            {
+                break;
+            }
 
-            uint16_t    theShort;
-            uint32_t    theAddress;
+            Message * pMessage = theRcvMessage.get();
 
-            /* Copy over the IP address */
-            memcpy(theNode.getIPAddressAsPointer(), pMessageRegister->getData()+4, 4);
+            /* Over-limit senders get no further than this */
+            if (!admitMessage(&theLimiter, pStats, pMessage))
+            {
+                continue;
+            }
 
-            /* Port number */
-            memcpy(&theShort, pMessageRegister->getData()+8, 2);
-            theShort = ntohs(theShort);
-            theNode.setPort(theShort);
+            /* Clear out anyone whose lease ran out before answering */
+            expireNodes(theClock.getTick());
 
-            /* Number of files */
-            memcpy(&theShort, pMessageRegister->getData()+10, 2);
-            theShort = ntohs(theShort);
-            theNode.setFiles(theShort);
+            pStats->countMessage(pMessage->getType(), dispatchMessage(pMessage));
 
-            /* When did we last see the node? */
-            theNode.updateRegistrationTime();
+            /* Any reply has gone out by now */
+            pStats->recordLatency(pMessage->getType(), CoarseClock::readNanos() - pMessage->getArrivalNanos());
+        }
+    });
 
-            /* Give it an expiration */
+    theReactor.run();
+}
 
-            // What is the current time?
-            gettimeofday(&currentTime, 0);
+void Tracker::goBatched (int nSocket)
+{
+    /* Room for the receive buffers plus a reply to each one of them */
+    MessagePool     thePool(MESSAGE_POOL_DEFAULT_SIZE + 2 * getBatchSize());
+    DatagramBatch   theBatch(getBatchSize(), &thePool);
+    Reactor         theReactor;
+    CoarseClock     theClock;
+    RateLimiter     theLimiter(&m_Limits);
+    ThreadStats *   pStats = m_Stats.attachThread();
 
-            currentTime.tv_sec += getLeaseTime();
+    /* Which messages of the current batch got past the limits */
+    vector<bool>    theAdmitted(getBatchSize());
 
-            theNode.setExpirationTime(currentTime);
+    theReactor.add(m_nStopEvent, EPOLLIN, [&] (uint32_t) { theReactor.stop(); });
 
-            m_NodeTable.push_back(theNode);
-            nCurrentEntry = m_NodeTable.size()-1;
-        }
-        else
+    theReactor.add(nSocket, EPOLLIN, [&] (uint32_t)
+    {
+        for (int nRound=0; nRound<TRACKER_DRAIN_LIMIT; nRound++)
         {
-            cout << "Detected a renewal - detected ID was " << pMessageRegister->getData()[3] << endl;
+            int nReceived;
 
-            // Which node are we?
-            nCurrentEntry = findNodeIndexByID(pMessageRegister->getData()[3]);
+            nReceived = theBatch.receive(nSocket, &theClock);
 
-            if(nCurrentEntry != -1)
+            if (nReceived == -1)
             {
-                cout << "  Identified the ID as entry " << nCurrentEntry << " in the table" << endl;
+                LOG_ERROR("recvmmsg: %s", strerror(errno));
+                break;
+            }
 
-                /* When did we last see the node? */
-                m_NodeTable[nCurrentEntry].updateRegistrationTime();
+            /* Drained */
+            if (nReceived == 0)
+            {
+                break;
+            }
 
-                // What is the current time?
-                gettimeofday(&currentTime, 0);
+            /* Clear out anyone whose lease ran out before answering */
+            expireNodes(theClock.getTick());
 
-                currentTime.tv_sec += getLeaseTime();
+            LOG_DEBUG("Received a batch of %d packets", nReceived);
 
-                m_NodeTable[nCurrentEntry].setExpirationTime(currentTime);
-            }
-            else
+            for (int j=0; j<nReceived; j++)
             {
-                cout << "Error: Unable to find a node in the table with ID " << pMessageRegister->getData()[3] << endl;
-            }
-        }
+                Message * pMessage = theBatch.getMessage(j);
 
-        if(nCurrentEntry != -1)
-        {
-            if(isVerbose())
-            {
-                cout << "This is entry " << nCurrentEntry << " in the table" << endl;
-                cout << "  The ID is " << m_NodeTable[nCurrentEntry].getID() << endl;
-                cout << "  The expiration is " << m_NodeTable[nCurrentEntry].getExpirationTime().tv_sec << endl;
-            }
+                theAdmitted[j] = admitMessage(&theLimiter, pStats, pMessage);
 
-            pMessageRegisterACK->getData()[3] = 0x00;
-            pMessageRegisterACK->getData()[4] = m_NodeTable[nCurrentEntry].getID();
+                if (theAdmitted[j])
+                {
+                    pStats->countMessage(pMessage->getType(), dispatchMessage(pMessage));
+                }
+            }
 
-            uint32_t    lSecExpiry;
+            /* All of the replies for the batch go out in one shot */
+            theBatch.flush(nSocket);
 
-            /* Get the entry from the table */
-            lSecExpiry = m_NodeTable[nCurrentEntry].getExpirationTime().tv_sec;
-            /* Apply the appropriate endianness */
-            lSecExpiry = htonl(lSecExpiry);
+            /* Every request in the batch waited on that same flush */
+            uint64_t nNow = CoarseClock::readNanos();
 
-            /* Copy in the network order seconds value for the expiration */
-            memcpy(pMessageRegisterACK->getData()+13, &lSecExpiry, 4);
-        }
-        else
-        {
-            cout << "Error - Register-ACK message will note a failure" << endl;
-            // Had an error - something went bad
-            pMessageRegisterACK->getData()[3] = 0x01;
-            pMessageRegisterACK->getData()[4] = 0x00;
-        }
-    }
+            for (int j=0; j<nReceived; j++)
+            {
+                Message * pMessage = theBatch.getMessage(j);
 
-    // Send the registration ACK message back to the requested client
-    printf("Sending a registration ACK from the server containg %d bytes\n", pMessageRegisterACK->getLength());
+                if (!theAdmitted[j])
+                {
+                    continue;
+                }
 
-    if(isVerbose())
-    {
-        pMessageRegisterACK->dumpData();
-    }
+                pStats->recordLatency(pMessage->getType(), nNow - pMessage->getArrivalNanos());
+            }
 
-    sendto(getSocket(), pMessageRegisterACK->getData(), pMessageRegisterACK->getLength(), 0, (struct sockaddr *) pMessageRegister->getAddress(), sizeof(struct sockaddr_in));
+            /* A short batch means the socket is empty */
+            if (nReceived < theBatch.getSize())
+            {
+                break;
+            }
+        }
+    });
 
-    delete pMessageRegisterACK;
-    return true;
+    theReactor.run();
 }
 
-uint8_t Tracker::getNextNodeID ()
+bool Tracker::goUring (int nSocket)
 {
-    // TODO: Make this more sophisticated for searching (maybe)
-    return m_nNextID++;
-}
+    int nBatchSize = (getBatchSize() > 1) ? getBatchSize() : URING_DEFAULT_BATCH;
 
-bool Tracker::processListNodes (Message * pMessageListNodes)
-{
-    if(isVerbose())
+    /* Room for the receive buffers, a reply to each and the sends in flight */
+    MessagePool     thePool(MESSAGE_POOL_DEFAULT_SIZE + 2 * nBatchSize);
+    UringBatch      theRing(nBatchSize, &thePool);
+
+    if (!theRing.initialize(nSocket))
     {
-        dumpTable();
+        return false;
     }
 
-    /* At this point, we know that the message is a list-nodes (0x03) message */
+    Reactor         theReactor;
+    CoarseClock     theClock;
+    RateLimiter     theLimiter(&m_Limits);
+    ThreadStats *   pStats = m_Stats.attachThread();
 
-    Message * pMessageListNodesData;
-
-    /* The format of the list nodes message should be
-     *   1 Byte - MaxCount - The maximum number of nodes provided by the tracker
-     */
+    /* Which messages of the current batch got past the limits */
+    vector<bool>    theAdmitted(nBatchSize);
 
-    /* The response message now adds a status field after the length. The length does
-    include the status field.
-    */
+    theReactor.add(m_nStopEvent, EPOLLIN, [&] (uint32_t) { theReactor.stop(); });
 
-    pMessageListNodesData = new Message();
+    /* The ring's descriptor is readable whenever completions are waiting */
+    theReactor.add(theRing.getDescriptor(), EPOLLIN, [&] (uint32_t)
+    {
+        for (int nRound=0; nRound<TRACKER_DRAIN_LIMIT; nRound++)
+        {
+            int nReceived;
 
-    pMessageListNodesData->getData()[0] = 0x04;
+            nReceived = theRing.receive(&theClock);
 
-    /* The length is now variable depending on how many nodes */
+            if (nReceived == -1)
+            {
+                LOG_ERROR("io_uring receive failed on socket %d - stopping this loop", nSocket);
+                theReactor.stop();
+                break;
+            }
 
-    uint8_t     nNodesToShare;
+            if (nReceived == 0)
+            {
+                break;
+            }
 
-    /* What was the maximum count as requested by the client? */
-    nNodesToShare = pMessageListNodes->getData()[3];
+            /* Clear out anyone whose lease ran out before answering */
+            expireNodes(theClock.getTick());
 
-    /* Which is bigger - the maximum count from the client or how many nodes we actually have? */
-    if (m_NodeTable.size() < nNodesToShare)
-    {
-        nNodesToShare = (uint8_t) m_NodeTable.size();
-    }
+            for (int j=0; j<nReceived; j++)
+            {
+                Message * pMessage = theRing.getMessage(j);
 
-    /* Set the status byte */
-    pMessageListNodesData->getData()[3] = 0x00;
+                theAdmitted[j] = admitMessage(&theLimiter, pStats, pMessage);
 
-    /* Reflect back the maximum count */
-    pMessageListNodesData->getData()[4] = pMessageListNodes->getData()[3];
+                if (theAdmitted[j])
+                {
+                    pStats->countMessage(pMessage->getType(), dispatchMessage(pMessage));
+                }
+            }
 
-    /* State the actual count that is being provided */
-    pMessageListNodesData->getData()[5] = nNodesToShare;
+            /* All of the replies for the batch go to the kernel in one shot */
+            theRing.flush();
 
-    uint16_t    totalLength;
+            uint64_t nNow = CoarseClock::readNanos();
 
-    /* 13 bytes each plus the initial type and length and status and max count / count */
-    totalLength = nNodesToShare * 13 + 3 + 1 + 2;
-    pMessageListNodesData->setLength(totalLength);
+            for (int j=0; j<nReceived; j++)
+            {
+                Message * pMessage = theRing.getMessage(j);
 
-    totalLength = htons(totalLength);
+                if (!theAdmitted[j])
+                {
+                    continue;
+                }
 
-    memcpy(pMessageListNodesData->getData()+1, &totalLength, 2);
+                pStats->recordLatency(pMessage->getType(), nNow - pMessage->getArrivalNanos());
+            }
+        }
+    });
 
-    // Offset into the data
-    //  Initially is 1 (type) + 2 (length) + 1 (status) + 1 (max count) + 1 (actual count)
-    uint16_t theOffset = 1 + 2 + 1 + 1 + 1;
+    theReactor.run();
+    return true;
+}
 
-    for(int j=0; j<nNodesToShare; j++)
+void Tracker::expireNodes (uint32_t nNowTick)
+{
+    /* The wheel only moves once a second - skip the lock the rest of the time */
+    if (m_nLastExpiryTick.load(memory_order_relaxed) == nNowTick)
     {
-        theOffset += m_NodeTable[j].constructNodeData(pMessageListNodesData->getData()+theOffset);
+        return;
     }
 
-    // Send the registration ACK message back to the requested client
-    printf("Sending a list-nodes-data from the server containg %d bytes\n", pMessageListNodesData->getLength());
+    int nExpired;
 
-    if(isVerbose())
     {
-        pMessageListNodesData->dumpData();
+        lock_guard<mutex>   theGuard(m_TableLock);
+
+        m_ExpiredIDs.clear();
+        nExpired = m_NodeTable.reapExpired(nNowTick, &m_ExpiredIDs);
+        m_nLastExpiryTick.store(nNowTick, memory_order_relaxed);
+
+        /* Whatever they published goes with them */
+        for (size_t j=0; j<m_ExpiredIDs.size(); j++)
+        {
+            m_Files.removeNode(m_ExpiredIDs[j]);
+            m_Filters.removeNode(m_ExpiredIDs[j]);
+        }
     }
 
-    sendto(getSocket(), pMessageListNodesData->getData(), pMessageListNodesData->getLength(), 0, (struct sockaddr *) pMessageListNodes->getAddress(), sizeof(struct sockaddr_in));
+    m_Stats.addExpired(nExpired);
 
-    delete pMessageListNodesData;
-    return true;
+    if (nExpired > 0)
+    {
+        LOG_INFO("Expired %d node(s) from the table", nExpired);
+    }
 }
 
-int Tracker::findNodeIndexByID (uint8_t theID)
+bool Tracker::admitMessage (RateLimiter * pLimiter, ThreadStats * pStats, Message * pMessage)
 {
-    for (int j=0; j<m_NodeTable.size(); j++)
+    /* Every datagram comes through here first - capture it as it arrived */
+    if (m_Capture.isEnabled())
     {
-        if (m_NodeTable[j].getID() == theID)
-        {
-            return j;
-        }
+        m_Capture.record(pMessage);
+    }
+
+    if (pLimiter->admit(pMessage))
+    {
+        return true;
+    }
+
+    pStats->countLimited(pMessage->getType());
+
+    LOG_DEBUG("Refused a %s from %s (over its limit)", pMessage->getTypeAsString().c_str(), inet_ntoa(pMessage->getAddress()->sin_addr));
+
+    if (m_Limits.isReplying())
+    {
+        refuseMessage(pMessage);
     }
 
-    return -1;
+    return false;
 }
 
-void Tracker::dumpTable ()
+void Tracker::refuseMessage (Message * pMessage)
 {
-    printf("Tracking Table (%lu entries)\n", m_NodeTable.size());
+    uint8_t byResponse = Message::getResponseType(pMessage->getType());
 
-    for (int j=0; j<m_NodeTable.size(); j++)
+    // Nothing to answer with (e.g. gossip)
+    if (byResponse == MSG_TYPE_UNKNOWN)
     {
-        /* ID for the node */
-        printf("%3d ", m_NodeTable[j].getID());
+        return;
+    }
 
-        /* IP Address */
-        uint8_t * pByte;
-        pByte = (uint8_t *) m_NodeTable[j].getIPAddressAsPointer();
-        for (int i=0; i<4; i++)
+    MessageHandle theReply = allocateReply(pMessage);
+
+    WireWriter<RefusalLayout>  theRefusal (theReply.get(), byResponse);
+
+    theRefusal.set<RefusalLayout::Status>(MSG_STATUS_ISSUE);
+
+    sendReply(pMessage, theReply);
+}
+
+bool Tracker::dispatchMessage (Message * pMessage)
+{
+    switch(pMessage->getType())
+    {
+        case MSG_TYPE_ECHO:
+            return processEcho(pMessage);
+        case MSG_TYPE_LIST_NODES:
+            return processListNodes(pMessage);
+        case MSG_TYPE_REGISTER:
+            return processRegister(pMessage);
+        case MSG_TYPE_REGISTER_V2:
+            return processRegisterV2(pMessage);
+        case MSG_TYPE_REGISTER_BATCH:
+            return processRegisterBatch(pMessage);
+        case MSG_TYPE_LIST_NODES_V2:
+            return processListNodes(pMessage);
+        case MSG_TYPE_LIST_NODES_PAGE:
+            return processListNodesPage(pMessage);
+        case MSG_TYPE_STATS:
+            return processStats(pMessage);
+        case MSG_TYPE_GOSSIP:
+            return processGossip(pMessage);
+        case MSG_TYPE_PUBLISH_FILES:
+            return processPublishFiles(pMessage);
+        case MSG_TYPE_FIND_FILE:
+            return processFindFile(pMessage);
+        case MSG_TYPE_LIST_NODES_DELTA:
+            return processListNodesDelta(pMessage);
+        case MSG_TYPE_SUBSCRIBE:
+            return processSubscribe(pMessage);
+        default:
+            LOG_WARN("Unknown message type: %d", pMessage->getType());
+            // The client should not be sending these messages to us
+            return false;
+    }
+}
+
+MessageHandle Tracker::allocateReply (Message * pRequest)
+{
+    /* Replies come from the same pool as the request (i.e. the same thread) */
+    if (pRequest->getPool() != NULL)
+    {
+        MessageHandle theReply = pRequest->getPool()->acquire();
+
+        /* The pool does not zero - only the fixed part needs it (the records
+           after it are always written in full) */
+        memset(theReply->getData(), 0, TRACKER_REPLY_CLEAR);
+        return theReply;
+    }
+
+    return MessageHandle(new Message());
+}
+
+void Tracker::sendReply (Message * pRequest, MessageHandle & theReply)
+{
+    Message * pReply = theReply.get();
+
+    /* Replies always go back to where the request came from */
+    memcpy(pReply->getAddress(), pRequest->getAddress(), sizeof(struct sockaddr_in));
+
+    if (pRequest->getBatch() != NULL)
+    {
+        pRequest->getBatch()->queueReply(theReply);
+        return;
+    }
+
+    sendto(pRequest->getSocket(), pReply->getData(), pReply->getLength(), 0, (struct sockaddr *) pReply->getAddress(), sizeof(struct sockaddr_in));
+
+    theReply.reset();
+}
+
+MessageHandle Tracker::recvMessage (int nSocket, CoarseClock * pClock, MessagePool * pPool)
+{
+    Message * pMessage;
+
+    socklen_t addr_len;
+	struct sockaddr clientAddr;
+    int numbytes;
+
+    /* Grab a message object from the pool */
+    MessageHandle theMessage = pPool->acquire();
+    pMessage = theMessage.get();
+
+
+	addr_len = sizeof(clientAddr);
+
+	if ((numbytes = recvfrom(nSocket, pMessage->getData(), pMessage->getMaxLength() , 0,
+		(struct sockaddr *)&clientAddr, &addr_len)) == -1) {
+        /* Nothing more waiting is the normal way out */
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            LOG_ERROR("recvfrom: %s", strerror(errno));
+        }
+
+        return MessageHandle();
+	}
+
+    LOG_DEBUG("Received a packet from a client of length %d bytes", numbytes);
+
+    if(isVerbose())
+    {
+        dump_sockaddr_in((struct sockaddr_in *) &clientAddr);
+    }
+
+    /* Output that we got a packet from that client */
+    pMessage->setType(pMessage->getData()[0]);
+
+    /* Save the relevant info */
+    pMessage->setLength(numbytes);
+    pClock->update();
+    pMessage->recordArrival(pClock);
+
+    /* Copy / save the information about the client on the other side */
+    memcpy(pMessage->getAddress(), &clientAddr, sizeof(struct sockaddr));
+
+    /* Replies go straight back out on the same socket */
+    pMessage->setSocket(nSocket);
+
+    if(isVerbose())
+    {
+        pMessage->dumpData();
+    }
+
+    return theMessage;
+}
+
+bool Tracker::processEcho (Message * pMessageEcho)
+{
+    /* The inbound message has the following content:
+        Type        1 byte      0x05   Echo
+        Length      2 bytes     0x04   Four bytes of data to follow
+        Nonce       4 bytes            Randomly generated value in network order
+    */
+
+    /* Our task is to reflect the nonce and add in a timestamp that is network
+       ordered */
+
+    LOG_DEBUG("Processing an echo message from the client");
+
+    WireReader<EchoLayout>  theRequest (pMessageEcho);
+
+    if (!theRequest.isValid())
+    {
+        LOG_WARN("Error: Echo message is too short (%d bytes)", pMessageEcho->getLength());
+        return false;
+    }
+
+    uint32_t    theNonce = theRequest.get<EchoLayout::Nonce>();
+
+    LOG_DEBUG("  Nonce (Host Order): %u", theNonce);
+
+    MessageHandle theReply = allocateReply(pMessageEcho);
+
+    /* Type and length (16) are filled in by the writer */
+    WireWriter<EchoResponseLayout>  theResponse (theReply.get());
+
+    /* All is well - reflect the nonce */
+    theResponse.set<EchoResponseLayout::Status>(MSG_STATUS_FINE);
+    theResponse.set<EchoResponseLayout::Nonce>(theNonce);
+
+    /* Let's get the current time */
+    struct timeval  theTimeVal;
+
+    gettimeofday(&theTimeVal, 0);
+
+    LOG_DEBUG("  The time at the server is %ld.%ld", (long) theTimeVal.tv_sec, (long) theTimeVal.tv_usec);
+
+    theResponse.set<EchoResponseLayout::Seconds>(theTimeVal.tv_sec);
+    theResponse.set<EchoResponseLayout::Microseconds>(theTimeVal.tv_usec);
+
+    LOG_DEBUG("Sending an echo response from the server containg %d bytes", theReply->getLength());
+
+    if(isVerbose())
+    {
+        theReply->dumpData();
+    }
+
+    sendReply(pMessageEcho, theReply);
+    return true;
+}
+
+bool Tracker::processRegister (Message * pMessageRegister)
+{
+    /* At this point, we know that the message is a registration (0x01) message */
+
+    bool      bRegistered = false;
+
+    /* The format of the registration message should be
+     *   1 Byte  - Requested Identifier (0 if unknown, non-zero otherwise)
+     *   4 Bytes - IP Address
+     *   2 Bytes - Port Number
+     *   2 Bytes - Number of Files
+     *
+     * All content should be in network order (big endian) which would apply to the
+     *  IP address, port number, and number of files
+    */
+
+    /* The response message now adds a status field after the length. The length does
+       include the status field.
+       Overall Format is as follows:
+         1 byte  - Type = 0x02
+         2 bytes - Length = 17 (0x0011 - big endian format)
+         1 byte  - Status = 0 (OK)
+         1 byte  - Identifier = Non-zero if assigned / confirmed or zero if there was an issue
+         4 bytes - IP Address
+         2 bytes - Port
+         2 bytes - Number of files
+         4 bytes - Expiration of registratin
+    */
+
+    WireReader<RegisterLayout>  theRequest (pMessageRegister);
+
+    MessageHandle theReply = allocateReply(pMessageRegister);
+
+    /* Type and length (17) are filled in by the writer */
+    WireWriter<RegisterAckLayout>  theAck (theReply.get());
+
+    /* Assume the worst until the registration goes through - no ID and no
+       expiration time */
+    theAck.set<RegisterAckLayout::Status>(MSG_STATUS_ISSUE);
+    theAck.set<RegisterAckLayout::ID>(0);
+    theAck.set<RegisterAckLayout::Expiry>(0);
+
+    /* Do we have the right size? */
+    // For inbound messages here to the server, the length is the actual length as observed
+    // as recorded by recvfrom
+    if (!theRequest.isValid())
+    {
+        /* Bad length - note it here on the console */
+        LOG_WARN("Error: Registration message did wrong count of bytes (Expected %d, had %d bytes)", RegisterLayout::nSize, pMessageRegister->getLength());
+
+        if(isVerbose())
+        {
+            LOG_DEBUG("Dumping the data from the message");
+            pMessageRegister->dumpData();
+        }
+
+        /* Nothing that was sent can be trusted */
+        theAck.set<RegisterAckLayout::Address>(0);
+        theAck.set<RegisterAckLayout::Port>(0);
+        theAck.set<RegisterAckLayout::Files>(0);
+    }
+    else
+    {
+        Node        theResult;
+
+        /* Reflect back what was asked for (IP stays in network order) */
+        uint32_t    theAddress = theRequest.get<RegisterLayout::Address>();
+        uint16_t    thePort = theRequest.get<RegisterLayout::Port>();
+        uint16_t    theFiles = theRequest.get<RegisterLayout::Files>();
+
+        theAck.set<RegisterAckLayout::Address>(theAddress);
+        theAck.set<RegisterAckLayout::Port>(thePort);
+        theAck.set<RegisterAckLayout::Files>(theFiles);
+
+        /* Only instance 0 hands out IDs that fit in the one byte */
+        if (m_Ring.isEnabled() && redirectIfForeign(pMessageRegister, 0))
+        {
+            return true;
+        }
+
+        /* The original message only has room for a one byte ID */
+        if(applyRegistration(pMessageRegister, theRequest.get<RegisterLayout::ID>(), theAddress, thePort, theFiles, NODE_ID_LEGACY_MAX, NULL, &theResult))
+        {
+            theAck.set<RegisterAckLayout::Status>(MSG_STATUS_FINE);
+            theAck.set<RegisterAckLayout::ID>((uint8_t) theResult.getID());
+            theAck.set<RegisterAckLayout::Expiry>(theResult.getExpirationTime().tv_sec);
+            bRegistered = true;
+        }
+        else
+        {
+            LOG_WARN("Error - Register-ACK message will note a failure");
+        }
+    }
+
+    // Send the registration ACK message back to the requested client
+    LOG_DEBUG("Sending a registration ACK from the server containg %d bytes", theReply->getLength());
+
+    if(isVerbose())
+    {
+        theReply->dumpData();
+    }
+
+    sendReply(pMessageRegister, theReply);
+    return bRegistered;
+}
+
+bool Tracker::processRegisterV2 (Message * pMessageRegister)
+{
+    Message * pMessageRegisterACK;
+    bool      bRegistered = false;
+
+    /* Same as the original registration but with a 32 bit identifier
+     *   4 Bytes - Requested Identifier (0 if unknown, non-zero otherwise)
+     *   4 Bytes - IP Address
+     *   2 Bytes - Port Number
+     *   2 Bytes - Number of Files
+     *   ...     - Optional extensions (tag / length / value), e.g. a load report
+     *
+     * The response is laid out as follows:
+     *   1 byte  - Type = 0x08
+     *   2 bytes - Length = 20
+     *   1 byte  - Status
+     *   4 bytes - Identifier (zero if there was an issue)
+     *   4 bytes - IP Address
+     *   2 bytes - Port
+     *   2 bytes - Number of files
+     *   4 bytes - Expiration of registration
+     */
+
+    WireReader<RegisterV2Layout>  theRequest (pMessageRegister);
+
+    MessageHandle theReply = allocateReply(pMessageRegister);
+    pMessageRegisterACK = theReply.get();
+
+    /* Type and length (20) are filled in by the writer */
+    WireWriter<RegisterV2AckLayout>  theAck (pMessageRegisterACK);
+
+    /* Assume the worst until the table says otherwise */
+    theAck.set<RegisterV2AckLayout::Status>(MSG_STATUS_ISSUE);
+
+    RegisterExtensions  theExtensions;
+
+    if (!theRequest.isValid() || !parseRegisterExtensions(pMessageRegister, &theExtensions))
+    {
+        LOG_WARN("Error: Registration (v2) message had %d bytes (Expected %d plus well formed extensions)", pMessageRegister->getLength(), MSG_REGISTER_V2_LENGTH);
+
+        /* Reflect whatever we can and zero the rest */
+        memset(pMessageRegisterACK->getData() + RegisterV2AckLayout::nRecordOffset, 0, NODE_DATA_V2_SIZE);
+
+        if(isVerbose())
+        {
+            pMessageRegister->dumpData();
+        }
+    }
+    else
+    {
+        Node        theResult;
+        uint32_t    theID = theRequest.get<RegisterV2Layout::ID>();
+        uint32_t    theAddress = theRequest.get<RegisterV2Layout::Address>();
+        uint16_t    thePort = theRequest.get<RegisterV2Layout::Port>();
+        uint16_t    theShort = theRequest.get<RegisterV2Layout::Files>();
+
+        /* A renewal goes to whoever handed out the ID (even if the address or
+           the shard list has changed since) - only new nodes follow the ring */
+        if (m_Ring.isEnabled() &&
+            redirectIfForeign(pMessageRegister, (theID != NODE_ID_INVALID) ? NodeTable::getInstanceOf(theID) : m_Ring.findOwner(theAddress)))
+        {
+            return true;
+        }
+
+        if(applyRegistration(pMessageRegister, theID, theAddress, thePort, theShort, UINT32_MAX, &theExtensions, &theResult))
+        {
+            theAck.set<RegisterV2AckLayout::Status>(MSG_STATUS_FINE);
+            bRegistered = true;
+        }
+        else
+        {
+            /* Reflect the request back but with a zero ID and no expiry */
+            theResult.setIPAddress(theAddress);
+            theResult.setPort(thePort);
+            theResult.setFiles(theShort);
+        }
+
+        theResult.constructNodeDataWide(pMessageRegisterACK->getData() + RegisterV2AckLayout::nRecordOffset);
+    }
+
+    if(isVerbose())
+    {
+        pMessageRegisterACK->dumpData();
+    }
+
+    sendReply(pMessageRegister, theReply);
+    return bRegistered;
+}
+
+bool Tracker::processRegisterBatch (Message * pMessageRegister)
+{
+    /* Many nodes behind one address (e.g. the node processes on a storage host)
+     * registered or renewed in one go
+     *   4 Bytes - IP Address (shared by every node in the batch)
+     *   1 Byte  - Count - Number of entries (at most MSG_REGISTER_BATCH_MAX)
+     *   Count entries of
+     *     4 Bytes - Requested Identifier (0 for a new node)
+     *     2 Bytes - Port Number
+     *     2 Bytes - Number of Files
+     *
+     * The response has one entry per requested node, in the same order
+     *   1 Byte  - Status - issue only if the batch itself was malformed
+     *   1 Byte  - Count
+     *   1 Byte  - Registered - How many of the entries were registered
+     *   4 Bytes - Expiration of the registrations (the same for all of them)
+     *   Count entries of
+     *     4 Bytes - Identifier (zero if that node could not be registered)
+     *     2 Bytes - Port Number
+     */
+
+    WireReader<RegisterBatchLayout>  theRequest (pMessageRegister);
+
+    MessageHandle theReply = allocateReply(pMessageRegister);
+
+    WireWriter<RegisterBatchAckLayout>  theAck (theReply.get());
+
+    uint8_t     theCount = 0;
+    uint8_t     theRegistered = 0;
+    uint32_t    theExpiry = 0;
+    bool        bValid = theRequest.isValid();
+
+    if (bValid)
+    {
+        theCount = theRequest.get<RegisterBatchLayout::Count>();
+        bValid = (theCount <= MSG_REGISTER_BATCH_MAX && theRequest.getTailLength() == theCount * MSG_REGISTER_BATCH_ENTRY);
+    }
+
+    if (!bValid)
+    {
+        LOG_WARN("Error: Register-Batch message had %d bytes (Expected %d plus %d per node)", pMessageRegister->getLength(), MSG_REGISTER_BATCH_HEADER, MSG_REGISTER_BATCH_ENTRY);
+        theCount = 0;
+    }
+    else
+    {
+        uint32_t        theAddress = theRequest.get<RegisterBatchLayout::Address>();
+        const uint8_t * pEntries = theRequest.getTail();
+        uint8_t *       pResults = theAck.getTail();
+
+        /* The batch goes where its first renewal's ID was handed out, as a
+           lone renewal would, or where the ring puts the address if it only
+           has new nodes */
+        uint32_t        theOwner = m_Ring.isEnabled() ? m_Ring.findOwner(theAddress) : 0;
+
+        for (uint8_t j=0; j<theCount; j++)
+        {
+            uint32_t theID = RegisterBatchEntryLayout::ID::load(pEntries + j * MSG_REGISTER_BATCH_ENTRY);
+
+            if (theID != NODE_ID_INVALID)
+            {
+                theOwner = NodeTable::getInstanceOf(theID);
+                break;
+            }
+        }
+
+        if (m_Ring.isEnabled() && redirectIfForeign(pMessageRegister, theOwner))
+        {
+            return true;
+        }
+
+        /* One trip through the lock (and at most one snapshot) for the lot */
+        lock_guard<mutex>   theGuard(m_TableLock);
+
+        for (uint8_t j=0; j<theCount; j++)
+        {
+            const uint8_t * pEntry = pEntries + j * MSG_REGISTER_BATCH_ENTRY;
+            uint8_t *       pResult = pResults + j * MSG_REGISTER_BATCH_ACK_ENTRY;
+            Node            theResult;
+
+            uint16_t thePort = RegisterBatchEntryLayout::Port::load(pEntry);
+
+            RegisterBatchAckEntryLayout::ID::store(pResult, NODE_ID_INVALID);
+            RegisterBatchAckEntryLayout::Port::store(pResult, thePort);
+
+            uint32_t theID = RegisterBatchEntryLayout::ID::load(pEntry);
+
+            /* Renewing the gossiped copy of another shard's node would leave
+               the owner's copy to expire - that entry has to be sent there */
+            if (m_Ring.isEnabled() && theID != NODE_ID_INVALID && NodeTable::getInstanceOf(theID) != theOwner)
+            {
+                LOG_WARN("Error: Batch renewal of node %u belongs to tracker %u", theID, NodeTable::getInstanceOf(theID));
+                continue;
+            }
+
+            if (registerNode(pMessageRegister, theID, theAddress, thePort,
+                             RegisterBatchEntryLayout::Files::load(pEntry), UINT32_MAX, NULL, &theResult))
+            {
+                RegisterBatchAckEntryLayout::ID::store(pResult, theResult.getID());
+                theExpiry = theResult.getExpirationTime().tv_sec;
+                theRegistered++;
+            }
+        }
+    }
+
+    theAck.set<RegisterBatchAckLayout::Status>(bValid ? MSG_STATUS_FINE : MSG_STATUS_ISSUE);
+    theAck.set<RegisterBatchAckLayout::Count>(theCount);
+    theAck.set<RegisterBatchAckLayout::Registered>(theRegistered);
+    theAck.set<RegisterBatchAckLayout::Expiry>(theExpiry);
+    theAck.setLength(MSG_REGISTER_BATCH_ACK_HEADER + theCount * MSG_REGISTER_BATCH_ACK_ENTRY);
+
+    LOG_DEBUG("Registered %d of %d node(s) in a batch", theRegistered, theCount);
+
+    if(isVerbose())
+    {
+        theReply->dumpData();
+    }
+
+    sendReply(pMessageRegister, theReply);
+    return bValid;
+}
+
+bool Tracker::parseRegisterExtensions (Message * pMessageRegister, RegisterExtensions * pExtensions)
+{
+    uint8_t *   pData = pMessageRegister->getData();
+    uint16_t    theOffset = MSG_REGISTER_V2_LENGTH;
+
+    pExtensions->bHasLoad = false;
+    pExtensions->bHasBloom = false;
+
+    while (theOffset < pMessageRegister->getLength())
+    {
+        uint8_t     theTag;
+        uint16_t    theLength;
+
+        if (pMessageRegister->getLength() - theOffset < MSG_REGISTER_EXT_HEADER)
+        {
+            return false;
+        }
+
+        theTag = pData[theOffset];
+        memcpy(&theLength, pData+theOffset+1, 2);
+        theLength = ntohs(theLength);
+
+        theOffset += MSG_REGISTER_EXT_HEADER;
+
+        if (pMessageRegister->getLength() - theOffset < theLength)
+        {
+            return false;
+        }
+
+        switch (theTag)
+        {
+            case MSG_REGISTER_EXT_LOAD:
+                if (theLength != MSG_REGISTER_EXT_LOAD_LENGTH)
+                {
+                    return false;
+                }
+
+                memcpy(&pExtensions->theLoad.nConnections, pData+theOffset, 2);
+                pExtensions->theLoad.nConnections = ntohs(pExtensions->theLoad.nConnections);
+
+                memcpy(&pExtensions->theLoad.nBytesPerSecond, pData+theOffset+2, 4);
+                pExtensions->theLoad.nBytesPerSecond = ntohl(pExtensions->theLoad.nBytesPerSecond);
+
+                memcpy(&pExtensions->theLoad.nFreeBandwidth, pData+theOffset+6, 4);
+                pExtensions->theLoad.nFreeBandwidth = ntohl(pExtensions->theLoad.nFreeBandwidth);
+
+                pExtensions->bHasLoad = true;
+                break;
+
+            case MSG_REGISTER_EXT_BLOOM:
+                if (!BloomIndex::isValidLength(theLength))
+                {
+                    return false;
+                }
+
+                pExtensions->pBloom = pData+theOffset;
+                pExtensions->nBloomLength = theLength;
+                pExtensions->bHasBloom = true;
+                break;
+
+            default:
+                /* Something newer than us - skip over it */
+                break;
+        }
+
+        theOffset += theLength;
+    }
+
+    return true;
+}
+
+bool Tracker::applyRegistration (Message * pRequest, uint32_t nRequestedID, uint32_t nAddress, uint16_t nPort, uint16_t nFiles, uint32_t nMaxID, RegisterExtensions * pExtensions, Node * pResult)
+{
+    /* Everything from here on out touches the shared table */
+    lock_guard<mutex>   theGuard(m_TableLock);
+
+    return registerNode(pRequest, nRequestedID, nAddress, nPort, nFiles, nMaxID, pExtensions, pResult);
+}
+
+bool Tracker::registerNode (Message * pRequest, uint32_t nRequestedID, uint32_t nAddress, uint16_t nPort, uint16_t nFiles, uint32_t nMaxID, RegisterExtensions * pExtensions, Node * pResult)
+{
+    struct timeval  currentTime;
+    Node *          pNode;
+
+    /* Is this a new registration or a renewal? */
+    if (nRequestedID == NODE_ID_INVALID)
+    {
+        /* This is a new request (we think) */
+        LOG_INFO("Detected a new registration (ID was 0)");
+
+        pNode = m_NodeTable.addNode(nMaxID);
+
+        if (pNode == NULL)
+        {
+            LOG_WARN("Error: No node ID available (largest usable ID is %u)", nMaxID);
+            return false;
+        }
+
+        LOG_INFO("  Assigning an ID of %u", pNode->getID());
+
+        pNode->setIPAddress(nAddress);
+        pNode->setPort(nPort);
+        pNode->setFiles(nFiles);
+    }
+    else
+    {
+        LOG_INFO("Detected a renewal - detected ID was %u", nRequestedID);
+
+        pNode = m_NodeTable.findNode(nRequestedID);
+
+        if (pNode == NULL)
+        {
+            LOG_WARN("Error: Unable to find a node in the table with ID %u", nRequestedID);
+            return false;
+        }
+    }
+
+    /* Keep the latest load report for ranking the node in listings */
+    if (pExtensions != NULL && pExtensions->bHasLoad)
+    {
+        pNode->setLoad(&pExtensions->theLoad);
+    }
+
+    /* A renewal without a filter keeps the one it sent before */
+    if (pExtensions != NULL && pExtensions->bHasBloom)
+    {
+        m_Filters.setFilter(pNode->getID(), pExtensions->pBloom, pExtensions->nBloomLength);
+    }
+
+    /* When did we last see the node? (the clock was read as the request came in) */
+    pNode->updateRegistrationTime(pRequest->getArrivalTime());
+
+    /* Give it an expiration */
+    currentTime = *(pRequest->getArrivalTime());
+    currentTime.tv_sec += getLeaseTime();
+
+    pNode->setExpirationTime(currentTime);
+
+    /* Put it on the wheel (or move it along if it is a renewal) */
+    m_NodeTable.scheduleExpiry(pNode, pRequest->getArrivalTick() + getLeaseTime());
+
+    /* A renewal only moves the expiry on - not one for the journal */
+    if (nRequestedID != NODE_ID_INVALID)
+    {
+        m_NodeTable.noteRenewed();
+    }
+
+    LOG_DEBUG("  The ID is %u", pNode->getID());
+    LOG_DEBUG("  The expiration is %ld", (long) pNode->getExpirationTime().tv_sec);
+
+    /* Pass it on to the other trackers */
+    m_Gossip.noteChanged(pNode->getID());
+
+    /* Hand back a copy - the pointer is only good while we hold the lock */
+    *pResult = *pNode;
+    return true;
+}
+
+bool Tracker::processListNodes (Message * pMessageListNodes)
+{
+    if(isVerbose())
+    {
+        dumpTable();
+    }
+
+    /* At this point, we know that the message is a list-nodes (0x03) message
+       or its version 2 (0x09) equivalent with 32 bit identifiers */
+
+    /* The format of the list nodes message should be
+     *   1 Byte - MaxCount - The maximum number of nodes provided by the tracker
+     */
+
+    /* The response message now adds a status field after the length. The length does
+    include the status field.
+    */
+
+    WireReader<ListNodesLayout>  theRequest (pMessageListNodes);
+
+    if (!theRequest.isValid())
+    {
+        LOG_WARN("Error: List nodes message is too short (%d bytes)", pMessageListNodes->getLength());
+        return false;
+    }
+
+    bool        bWide = (pMessageListNodes->getType() == MSG_TYPE_LIST_NODES_V2);
+    uint16_t    nRecordSize = bWide ? NODE_DATA_V2_SIZE : NODE_DATA_SIZE;
+
+    MessageHandle theReply = allocateReply(pMessageListNodes);
+
+    /* The length is now variable depending on how many nodes */
+    WireWriter<ListNodesDataLayout>  theData (theReply.get(), bWide ? MSG_TYPE_LIST_NODES_V2_DATA : MSG_TYPE_LIST_NODES_DATA);
+
+    /* What was the maximum count as requested by the client? */
+    uint8_t     nMaxCount = theRequest.get<ListNodesLayout::MaxCount>();
+    uint8_t     nNodesToShare = nMaxCount;
+
+    /* Never go past what fits in a single datagram */
+    if ((MSG_MAX_SIZE - ListNodesDataLayout::nSize) / nRecordSize < nNodesToShare)
+    {
+        nNodesToShare = (MSG_MAX_SIZE - ListNodesDataLayout::nSize) / nRecordSize;
+    }
+
+    /* The records are already serialized - just copy over as many as we need
+       (from whichever snapshot is current, without taking the table lock) */
+    SnapshotReader  theReader (&m_Snapshots);
+    NodeSnapshot *  theSnapshot = theReader.get();
+
+    uint32_t    nAvailable = bWide ? theSnapshot->getCount() : theSnapshot->getLegacyCount();
+
+    if (nAvailable < nNodesToShare)
+    {
+        nNodesToShare = nAvailable;
+    }
+
+    /* Least loaded first, but not the same nodes for everyone */
+    uint64_t    nSpin = mix64(pMessageListNodes->getArrivalNanos() ^ pMessageListNodes->getAddress()->sin_port);
+    uint16_t    nRecordBytes = theSnapshot->copyRanked(bWide, nNodesToShare, nSpin, theData.getTail());
+
+    /* Status, the maximum count reflected back and the actual count */
+    theData.set<ListNodesDataLayout::Status>(MSG_STATUS_FINE);
+    theData.set<ListNodesDataLayout::MaxCount>(nMaxCount);
+    theData.set<ListNodesDataLayout::Count>(nNodesToShare);
+
+    /* Records plus the initial type and length and status and max count / count */
+    theData.setLength(ListNodesDataLayout::nSize + nRecordBytes);
+
+    // Send the registration ACK message back to the requested client
+    LOG_DEBUG("Sending a list-nodes-data from the server containg %d bytes", theReply->getLength());
+
+    if(isVerbose())
+    {
+        theReply->dumpData();
+    }
+
+    sendReply(pMessageListNodes, theReply);
+    return true;
+}
+
+bool Tracker::processListNodesPage (Message * pMessageListNodesPage)
+{
+    /* The request picks up the listing from a cursor
+     *   4 Bytes - Cursor - Index of the first node wanted (0 to start)
+     *   2 Bytes - MaxCount - Most nodes wanted in this page (0 = as many as fit)
+     *
+     * The response carries enough for the client to put the pages back together
+     * (and to ask for several pages at once once it knows the total)
+     *   1 Byte  - Status
+     *   4 Bytes - Generation - changes whenever the table changes.  Pages with
+     *                          different generations are from different versions
+     *                          of the table and should not be mixed.
+     *   4 Bytes - Total - Number of nodes in the whole table
+     *   4 Bytes - Cursor - Index of the first node in this page
+     *   2 Bytes - Count - Nodes in this page (16 bytes each, version 2 layout)
+     *
+     * The next page starts at Cursor + Count and the listing is complete once
+     * that reaches Total.
+     */
+
+    MessageHandle theReply = allocateReply(pMessageListNodesPage);
+    Message * pMessagePageData = theReply.get();
+
+    uint8_t *   pData = pMessagePageData->getData();
+    uint32_t    theCursor = 0;
+    uint16_t    theMaxCount = 0;
+    uint32_t    theTotal = 0;
+    uint32_t    theGeneration = 0;
+    uint16_t    theCount = 0;
+
+    pData[0] = MSG_TYPE_LIST_NODES_PAGE_DATA;
+    pData[3] = MSG_STATUS_ISSUE;
+
+    if (pMessageListNodesPage->getLength() != MSG_LIST_NODES_PAGE_LENGTH)
+    {
+        LOG_WARN("Error: List-Nodes-Page message had %d bytes (Expected %d)", pMessageListNodesPage->getLength(), MSG_LIST_NODES_PAGE_LENGTH);
+    }
+    else
+    {
+        memcpy(&theCursor, pMessageListNodesPage->getData()+3, 4);
+        theCursor = ntohl(theCursor);
+
+        memcpy(&theMaxCount, pMessageListNodesPage->getData()+7, 2);
+        theMaxCount = ntohs(theMaxCount);
+
+        uint16_t nFits = (MSG_MAX_SIZE - MSG_LIST_NODES_PAGE_HEADER) / NODE_DATA_V2_SIZE;
+
+        if (theMaxCount == 0 || theMaxCount > nFits)
+        {
+            theMaxCount = nFits;
+        }
+
+        SnapshotReader  theReader (&m_Snapshots);
+        NodeSnapshot *  theSnapshot = theReader.get();
+
+        theTotal = theSnapshot->getCount();
+        theGeneration = (uint32_t) theSnapshot->getGeneration();
+
+        /* Past the end is not an error - it is just an empty page */
+        if (theCursor < theTotal)
+        {
+            theCount = theMaxCount;
+
+            if (theTotal - theCursor < theCount)
+            {
+                theCount = theTotal - theCursor;
+            }
+
+            theSnapshot->copyRecords(true, theCursor, theCount, pData + MSG_LIST_NODES_PAGE_HEADER);
+        }
+
+        pData[3] = MSG_STATUS_FINE;
+    }
+
+    uint32_t    theLong;
+    uint16_t    theShort;
+
+    theLong = htonl(theGeneration);
+    memcpy(pData+4, &theLong, 4);
+
+    theLong = htonl(theTotal);
+    memcpy(pData+8, &theLong, 4);
+
+    theLong = htonl(theCursor);
+    memcpy(pData+12, &theLong, 4);
+
+    theShort = htons(theCount);
+    memcpy(pData+16, &theShort, 2);
+
+    pMessagePageData->setLength(MSG_LIST_NODES_PAGE_HEADER + theCount * NODE_DATA_V2_SIZE);
+
+    theShort = htons(pMessagePageData->getLength());
+    memcpy(pData+1, &theShort, 2);
+
+    if(isVerbose())
+    {
+        LOG_DEBUG("Sending list-nodes-page-data (cursor %u, %u of %u nodes)", theCursor, theCount, theTotal);
+        pMessagePageData->dumpData();
+    }
+
+    sendReply(pMessageListNodesPage, theReply);
+    return pData[3] == MSG_STATUS_FINE;
+}
+
+bool Tracker::processListNodesDelta (Message * pMessageDelta)
+{
+    /* The client says which version of the table it last saw
+     *   4 Bytes - Epoch - from an earlier reply (changes every run of the tracker)
+     *   8 Bytes - Generation - from an earlier reply
+     *
+     * The response holds everything that changed since then
+     *   1 Byte  - Status - fine, not modified (nothing changed) or resync (the
+     *                      tracker no longer knows what changed - list the
+     *                      table with LIST_NODES_PAGE and carry on from the
+     *                      epoch / generation in this reply)
+     *   1 Byte  - Flags - 0x01 there is more, ask again from this generation
+     *   4 Bytes - Epoch
+     *   8 Bytes - Generation - what the client is up to once it applies this
+     *   4 Bytes - Total - Number of nodes in the whole table
+     *   2 Bytes - Updated - Count of nodes added or renewed (16 bytes each,
+     *                       version 2 layout)
+     *   2 Bytes - Removed - Count of node IDs (4 bytes each) that are gone
+     *
+     * Updates carry the node as it is now, so applying a change twice does no
+     * harm.  A client starting from nothing sends an epoch of zero and
+     * gets a resync.  Renewals that only push a node's expiry out are not
+     * sent - a node listed here stays until it shows up as removed, whatever
+     * the expiry it was listed with.
+     */
+
+    WireReader<ListNodesDeltaLayout>    theRequest (pMessageDelta);
+
+    MessageHandle theReply = allocateReply(pMessageDelta);
+
+    WireWriter<ListNodesDeltaDataLayout>    theData (theReply.get());
+
+    uint8_t     theStatus = MSG_STATUS_ISSUE;
+    uint8_t     theFlags = 0;
+    uint16_t    nUpdated = 0;
+    uint16_t    nRemoved = 0;
+
+    lock_guard<mutex>   theGuard(m_TableLock);
+
+    uint64_t    theGeneration = m_NodeTable.getGeneration();
+
+    if (!theRequest.isValid())
+    {
+        LOG_WARN("Error: List-Nodes-Delta message had %d bytes (Expected %d)", pMessageDelta->getLength(), MSG_LIST_NODES_DELTA_LENGTH);
+    }
+    else if (theRequest.get<ListNodesDeltaLayout::Epoch>() != m_NodeTable.getEpoch() ||
+             !m_NodeTable.hasChangesSince(theRequest.get<ListNodesDeltaLayout::Generation>()))
+    {
+        theStatus = MSG_STATUS_RESYNC;
+
+        /* Carry on from what LIST_NODES_PAGE will be serving (the snapshot
+           can trail the table by a little - replaying a change is harmless,
+           missing one is not) */
+        theGeneration = m_Snapshots.getGeneration();
+    }
+    else if (theRequest.get<ListNodesDeltaLayout::Generation>() == theGeneration)
+    {
+        theStatus = MSG_STATUS_NOT_MODIFIED;
+    }
+    else
+    {
+        theStatus = MSG_STATUS_FINE;
+
+        if (m_NodeTable.writeChanges(theRequest.get<ListNodesDeltaLayout::Generation>(), theData.getTail(), MSG_MAX_SIZE - ListNodesDeltaDataLayout::nSize,
+                                     &nUpdated, &nRemoved, &theGeneration))
+        {
+            theFlags |= MSG_DELTA_FLAG_MORE;
+        }
+    }
+
+    theData.set<ListNodesDeltaDataLayout::Status>(theStatus);
+    theData.set<ListNodesDeltaDataLayout::Flags>(theFlags);
+    theData.set<ListNodesDeltaDataLayout::Epoch>(m_NodeTable.getEpoch());
+    theData.set<ListNodesDeltaDataLayout::Generation>(theGeneration);
+    theData.set<ListNodesDeltaDataLayout::Total>(m_NodeTable.size());
+    theData.set<ListNodesDeltaDataLayout::Updated>(nUpdated);
+    theData.set<ListNodesDeltaDataLayout::Removed>(nRemoved);
+    theData.setLength(ListNodesDeltaDataLayout::nSize + nUpdated * NODE_DATA_V2_SIZE + nRemoved * 4);
+
+    LOG_DEBUG("Sending a list-nodes-delta-data with %d update(s) and %d removal(s)", nUpdated, nRemoved);
+
+    if(isVerbose())
+    {
+        theReply->dumpData();
+    }
+
+    sendReply(pMessageDelta, theReply);
+    return theStatus != MSG_STATUS_ISSUE;
+}
+
+bool Tracker::processSubscribe (Message * pMessageSubscribe)
+{
+    /* The client asks to be told about changes to the table for a while
+     *   2 Bytes - Lease - Seconds to stay subscribed (0 to unsubscribe) - renew
+     *                     before it runs out to keep hearing
+     *   4 Bytes - Cookie - From the last ack (0 if the client has none yet)
+     *
+     * The response
+     *   1 Byte  - Status - issue if malformed or there is no room for another
+     *                      subscriber, cookie if the request has to be sent
+     *                      again with the cookie below (nothing was done)
+     *   2 Bytes - Lease - Seconds granted (at most SUBSCRIBERS_MAX_LEASE)
+     *   4 Bytes - Epoch
+     *   8 Bytes - Generation - the first push carries the changes from here on
+     *   4 Bytes - Cookie - To echo in the next request
+     *
+     * Changes then arrive as NODE_CHANGES, laid out like LIST_NODES_DELTA_DATA
+     *   4 Bytes - Epoch
+     *   8 Bytes - From - Generation the changes start from
+     *   8 Bytes - To - Generation the client is up to once it applies them
+     *   4 Bytes - Total - Number of nodes in the whole table
+     *   2 Bytes - Updated - Count of nodes added or renewed (16 bytes each)
+     *   2 Bytes - Removed - Count of node IDs (4 bytes each) that are gone
+     *
+     * A push whose From is not the To of the one before means one went
+     * missing - catch up with LIST_NODES_DELTA.
+     */
+
+    WireReader<SubscribeLayout>     theRequest (pMessageSubscribe);
+
+    MessageHandle theReply = allocateReply(pMessageSubscribe);
+
+    WireWriter<SubscribeAckLayout>  theAck (theReply.get());
+
+    uint8_t     theStatus = MSG_STATUS_ISSUE;
+    uint16_t    theLease = 0;
+
+    lock_guard<mutex>   theGuard(m_TableLock);
+
+    if (!theRequest.isValid())
+    {
+        LOG_WARN("Error: Subscribe message had %d bytes (Expected %d)", pMessageSubscribe->getLength(), MSG_SUBSCRIBE_LENGTH);
+    }
+    else if (!m_Subscribers.checkCookie(pMessageSubscribe->getAddress(), theRequest.get<SubscribeLayout::Cookie>(),
+                                        pMessageSubscribe->getArrivalTick()))
+    {
+        /* Not proven that the client can hear us at that address yet */
+        theStatus = MSG_STATUS_COOKIE;
+        LOG_DEBUG("Subscribe without a current cookie - asking for it back");
+    }
+    else
+    {
+        uint16_t theRequested = theRequest.get<SubscribeLayout::Lease>();
+
+        theLease = m_Subscribers.subscribe(pMessageSubscribe->getAddress(), theRequested, pMessageSubscribe->getArrivalTick(),
+                                           m_NodeTable.getGeneration());
+
+        if (theLease != 0 || theRequested == 0)
+        {
+            theStatus = MSG_STATUS_FINE;
+        }
+        else
+        {
+            LOG_WARN("Error: No room for another subscriber (%d already)", (int) m_Subscribers.size());
+        }
+    }
+
+    theAck.set<SubscribeAckLayout::Status>(theStatus);
+    theAck.set<SubscribeAckLayout::Lease>(theLease);
+    theAck.set<SubscribeAckLayout::Epoch>(m_NodeTable.getEpoch());
+    theAck.set<SubscribeAckLayout::Generation>(m_Subscribers.getPushed());
+    theAck.set<SubscribeAckLayout::Cookie>(m_Subscribers.makeCookie(pMessageSubscribe->getAddress(),
+                                                                    pMessageSubscribe->getArrivalTick()));
+    theAck.setLength(MSG_SUBSCRIBE_ACK_LENGTH);
+
+    LOG_DEBUG("Sending a subscribe-ack with a lease of %d second(s)", theLease);
+
+    if(isVerbose())
+    {
+        theReply->dumpData();
+    }
+
+    sendReply(pMessageSubscribe, theReply);
+    return theStatus != MSG_STATUS_ISSUE;
+}
+
+bool Tracker::redirectIfForeign (Message * pRequest, uint32_t nOwner)
+{
+    /* The reply names the shard to send the request to instead
+     *   1 Byte  - Request - the type of the request being redirected
+     *   1 Byte  - Instance - the owning shard
+     *   4 Bytes - IP Address of the owning shard
+     *   2 Bytes - Port of the owning shard
+     */
+
+    if (nOwner == m_Ring.getSelf() || nOwner >= m_Ring.size())
+    {
+        return false;
+    }
+
+    MessageHandle theReply = allocateReply(pRequest);
+
+    WireWriter<RedirectLayout>  theRedirect (theReply.get());
+
+    struct sockaddr_in * pOwner = m_Ring.getMember(nOwner);
+
+    theRedirect.set<RedirectLayout::Request>(pRequest->getType());
+    theRedirect.set<RedirectLayout::Instance>(nOwner);
+    theRedirect.set<RedirectLayout::Address>(pOwner->sin_addr.s_addr);
+    theRedirect.set<RedirectLayout::Port>(ntohs(pOwner->sin_port));
+    theRedirect.setLength(MSG_REDIRECT_LENGTH);
+
+    LOG_DEBUG("Redirecting a %s to shard %u", Message::getTypeName(pRequest->getType()).c_str(), nOwner);
+
+    if(isVerbose())
+    {
+        theReply->dumpData();
+    }
+
+    sendReply(pRequest, theReply);
+    return true;
+}
+
+bool Tracker::startSharding (uint32_t nInstance)
+{
+    if (!m_Ring.build(nInstance))
+    {
+        return false;
+    }
+
+    /* Every shard hears about every other shard's nodes straight from it */
+    for (uint32_t j=0; j<m_Ring.size(); j++)
+    {
+        if (j != nInstance)
+        {
+            m_Gossip.addPeer(m_Ring.getMember(j));
+        }
+    }
+
+    m_Gossip.setLocalOnly(true);
+
+    LOG_INFO("Sharing the table as shard %u of %d", nInstance, (int) m_Ring.size());
+    return true;
+}
+
+bool Tracker::processStats (Message * pMessageStats)
+{
+    /* The request optionally picks what to report on
+     *   1 Byte  - Selector - 0 (or absent) for the summary of every message type,
+     *                        otherwise the message type to send the full
+     *                        latency histogram for
+     *
+     * Every response starts the same way
+     *   1 Byte  - Status
+     *   1 Byte  - Selector (reflected back)
+     *   4 Bytes - Uptime in seconds
+     *   4 Bytes - Nodes in the table
+     *   8 Bytes - Nodes expired since startup
+     *   2 Bytes - Serving threads
+     *   1 Byte  - Count of records that follow
+     *
+     * Summary records (one per message type that has been seen)
+     *   1 Byte  - Message type
+     *   8 Bytes - Received
+     *   8 Bytes - Errors (malformed or refused)
+     *   4 Bytes x 5 - Latency (ns) at p50, p90, p99, p99.9 and the max
+     *
+     * Histogram record (just the one)
+     *   1 Byte  - Message type
+     *   8 Bytes - Received
+     *   8 Bytes - Errors
+     *   1 Byte  - Sub-bucket bits (see TrackerStats.h for the bucket layout)
+     *   2 Bytes - Bucket count, followed by that many non-empty buckets of
+     *             2 Bytes - Bucket index
+     *             8 Bytes - Count
+     *
+     * Latencies run from the arrival of the request until its reply is sent.
+     */
+
+    MessageHandle theReply = allocateReply(pMessageStats);
+    Message * pMessageStatsData = theReply.get();
+
+    uint8_t *   pData = pMessageStatsData->getData();
+    uint8_t     theSelector = 0;
+    uint16_t    theOffset = MSG_STATS_HEADER;
+    uint8_t     theRecords = 0;
+    TypeTotals  theTotals;
+
+    pData[0] = MSG_TYPE_STATS_RESPONSE;
+    pData[3] = MSG_STATUS_FINE;
+
+    if (pMessageStats->getLength() == MSG_STATS_SELECT_LENGTH)
+    {
+        theSelector = pMessageStats->getData()[3];
+    }
+    else if (pMessageStats->getLength() != MSG_STATS_LENGTH)
+    {
+        LOG_WARN("Error: Stats message had %d bytes (Expected %d or %d)", pMessageStats->getLength(), MSG_STATS_LENGTH, MSG_STATS_SELECT_LENGTH);
+        pData[3] = MSG_STATUS_ISSUE;
+    }
+
+    if (theSelector >= STATS_TYPE_SLOTS)
+    {
+        LOG_WARN("Error: Stats requested for message type %d which is not tracked", theSelector);
+        pData[3] = MSG_STATUS_ISSUE;
+    }
+
+    uint32_t    theLong;
+    uint64_t    theLongLong;
+    uint16_t    theShort;
+
+    pData[4] = theSelector;
+
+    theLong = htonl(pMessageStats->getArrivalTick());
+    memcpy(pData+5, &theLong, 4);
+
+    {
+        lock_guard<mutex>   theGuard(m_TableLock);
+        theLong = htonl(m_NodeTable.size());
+    }
+    memcpy(pData+9, &theLong, 4);
+
+    theLongLong = htobe64(m_Stats.getExpired());
+    memcpy(pData+13, &theLongLong, 8);
+
+    theShort = htons(m_Stats.getThreadCount());
+    memcpy(pData+21, &theShort, 2);
+
+    if (pData[3] != MSG_STATUS_FINE)
+    {
+        /* Nothing more to add */
+    }
+    else if (theSelector == 0)
+    {
+        for (int nSlot=0; nSlot<STATS_TYPE_SLOTS; nSlot++)
+        {
+            m_Stats.sumType(nSlot, &theTotals);
+
+            if (theTotals.nReceived == 0)
+            {
+                continue;
+            }
+
+            const double fPercentiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+            pData[theOffset] = nSlot;
+
+            theLongLong = htobe64(theTotals.nReceived);
+            memcpy(pData+theOffset+1, &theLongLong, 8);
+
+            theLongLong = htobe64(theTotals.nErrors);
+            memcpy(pData+theOffset+9, &theLongLong, 8);
+
+            for (int j=0; j<5; j++)
+            {
+                uint64_t nLatency = (j < 4) ? theTotals.getPercentile(fPercentiles[j]) : theTotals.nMaxLatency;
+
+                /* Anything over four seconds is just "a long time" */
+                theLong = htonl(nLatency > UINT32_MAX ? UINT32_MAX : nLatency);
+                memcpy(pData+theOffset+17+j*4, &theLong, 4);
+            }
+
+            theOffset += MSG_STATS_SUMMARY_RECORD;
+            theRecords++;
+        }
+    }
+    else
+    {
+        m_Stats.sumType(theSelector, &theTotals);
+
+        pData[theOffset] = theSelector;
+
+        theLongLong = htobe64(theTotals.nReceived);
+        memcpy(pData+theOffset+1, &theLongLong, 8);
+
+        theLongLong = htobe64(theTotals.nErrors);
+        memcpy(pData+theOffset+9, &theLongLong, 8);
+
+        pData[theOffset+17] = STATS_HISTOGRAM_SUB_BITS;
+
+        uint16_t    theBuckets = 0;
+        uint16_t    theBucketOffset = theOffset + MSG_STATS_HISTOGRAM_HEADER;
+
+        /* Only the non-empty buckets, lowest first, for as many as fit */
+        for (int j=0; j<STATS_HISTOGRAM_BUCKETS; j++)
+        {
+            if (theTotals.nCounts[j] == 0)
+            {
+                continue;
+            }
+
+            if (theBucketOffset + MSG_STATS_HISTOGRAM_BUCKET > MSG_MAX_SIZE)
+            {
+                break;
+            }
+
+            theShort = htons(j);
+            memcpy(pData+theBucketOffset, &theShort, 2);
+
+            theLongLong = htobe64(theTotals.nCounts[j]);
+            memcpy(pData+theBucketOffset+2, &theLongLong, 8);
+
+            theBucketOffset += MSG_STATS_HISTOGRAM_BUCKET;
+            theBuckets++;
+        }
+
+        theShort = htons(theBuckets);
+        memcpy(pData+theOffset+18, &theShort, 2);
+
+        theOffset = theBucketOffset;
+        theRecords = 1;
+    }
+
+    pData[23] = theRecords;
+
+    pMessageStatsData->setLength(theOffset);
+
+    theShort = htons(theOffset);
+    memcpy(pData+1, &theShort, 2);
+
+    if(isVerbose())
+    {
+        LOG_DEBUG("Sending stats-response (selector %d, %d records)", theSelector, theRecords);
+        pMessageStatsData->dumpData();
+    }
+
+    sendReply(pMessageStats, theReply);
+    return pData[3] == MSG_STATUS_FINE;
+}
+
+bool Tracker::processGossip (Message * pMessageGossip)
+{
+    /* The message carries registrations from a peer (see Gossip.h)
+     *   1 Byte  - Instance number of the sender
+     *   1 Byte  - Kind (changes only or the whole table)
+     *   2 Bytes - Count of records that follow (35 bytes each)
+     *
+     * Nothing is sent back - anything lost is made up by the next full round
+     */
+
+    uint8_t *   pData = pMessageGossip->getData();
+    uint16_t    theCount;
+
+    if (!m_Gossip.isPeer(pMessageGossip->getAddress()))
+    {
+        LOG_WARN("Error: Ignoring gossip from %s:%d (not a peer)", inet_ntoa(pMessageGossip->getAddress()->sin_addr), ntohs(pMessageGossip->getAddress()->sin_port));
+        return false;
+    }
+
+    if (pMessageGossip->getLength() < MSG_GOSSIP_HEADER)
+    {
+        LOG_WARN("Error: Gossip message had %d bytes (Expected at least %d)", pMessageGossip->getLength(), MSG_GOSSIP_HEADER);
+        return false;
+    }
+
+    memcpy(&theCount, pData+5, 2);
+    theCount = ntohs(theCount);
+
+    if (pMessageGossip->getLength() != MSG_GOSSIP_HEADER + theCount * MSG_GOSSIP_RECORD)
+    {
+        LOG_WARN("Error: Gossip message had %d bytes for %d records", pMessageGossip->getLength(), theCount);
+        return false;
+    }
+
+    int nApplied = 0;
+
+    {
+        lock_guard<mutex>   theGuard(m_TableLock);
+
+        for (int j=0; j<theCount; j++)
+        {
+            Node    theUpdate;
+
+            Gossip::readRecord(pData + MSG_GOSSIP_HEADER + j * MSG_GOSSIP_RECORD, &theUpdate);
+
+            if (applyGossip(&theUpdate, pMessageGossip))
+            {
+                nApplied++;
+            }
+        }
+    }
+
+    LOG_DEBUG("Applied %d of %d gossip record(s) from instance %d", nApplied, theCount, pData[3]);
+    return true;
+}
+
+bool Tracker::applyGossip (Node * pUpdate, Message * pRequest)
+{
+    struct timeval * pNow = pRequest->getArrivalTime();
+
+    /* Ran out in transit (or the clocks disagree a lot) */
+    if (pUpdate->getExpirationTimeAsPointer()->tv_sec <= pNow->tv_sec)
+    {
+        return false;
+    }
+
+    Node * pNode = m_NodeTable.findNode(pUpdate->getID());
+    bool   bAdopted = (pNode == NULL);
+
+    if (pNode == NULL)
+    {
+        /* We hand out our own IDs - if we do not know one of them it is gone */
+        if (m_NodeTable.isLocalID(pUpdate->getID()))
+        {
+            return false;
+        }
+
+        pNode = m_NodeTable.adoptNode(pUpdate->getID());
+
+        if (pNode == NULL)
+        {
+            LOG_WARN("Error: No room for node %u from a peer", pUpdate->getID());
+            return false;
+        }
+    }
+    else if (!timercmp(pUpdate->getRegistrationTime(), pNode->getRegistrationTime(), >))
+    {
+        /* Already have this registration (or a later one) */
+        return false;
+    }
+
+    bool bUpdated = (pNode->getIPAddress() != pUpdate->getIPAddress() || pNode->getPort() != pUpdate->getPort() ||
+                     pNode->getFiles() != pUpdate->getFiles());
+
+    *pNode = *pUpdate;
+
+    m_NodeTable.scheduleExpiry(pNode, pRequest->getArrivalTick() + (pUpdate->getExpirationTimeAsPointer()->tv_sec - pNow->tv_sec));
+
+    /* Adopted nodes were journaled on the way in - one we already had is
+       only journaled if more than its expiry moved */
+    if (!bAdopted)
+    {
+        if (bUpdated)
         {
-            printf("%3d", pByte[i]);
-            if(i<3)
+            m_NodeTable.noteUpdated(pNode->getID());
+        }
+        else
+        {
+            m_NodeTable.noteRenewed();
+        }
+    }
+
+    /* Keep it moving in case some of our peers are not peered with the sender */
+    m_Gossip.noteChanged(pNode->getID());
+    return true;
+}
+
+bool Tracker::processPublishFiles (Message * pMessagePublish)
+{
+    /* A node tells us which files it holds
+     *   4 Bytes - Node ID (as handed out by REGISTER_V2)
+     *   1 Byte  - Flags - 0x01 forget everything published before (e.g. on
+     *             the first datagram of a full listing), 0x02 withdraw the
+     *             files listed rather than add them
+     *   1 Byte  - Count of file keys that follow, each one being
+     *               1 Byte  - Key length (1 to 255)
+     *               N Bytes - Key (file name, content hash, ...)
+     *
+     * The response is laid out as follows:
+     *   1 byte  - Type = 0x11
+     *   2 bytes - Length = 10
+     *   1 byte  - Status
+     *   4 bytes - Node ID (reflected back)
+     *   2 bytes - Files the node now has published
+     */
+
+    WireReader<PublishFilesLayout>  theRequest (pMessagePublish);
+
+    MessageHandle theReply = allocateReply(pMessagePublish);
+
+    WireWriter<PublishFilesAckLayout>   theAck (theReply.get());
+
+    bool        bPublished = false;
+    uint32_t    theID = 0;
+    uint32_t    theFiles = 0;
+
+    if (!theRequest.isValid())
+    {
+        LOG_WARN("Error: Publish files message had %d bytes (Expected at least %d)", pMessagePublish->getLength(), MSG_PUBLISH_FILES_HEADER);
+    }
+    else
+    {
+        theID = theRequest.get<PublishFilesLayout::ID>();
+
+        uint8_t     theFlags = theRequest.get<PublishFilesLayout::Flags>();
+        uint8_t     theCount = theRequest.get<PublishFilesLayout::Count>();
+
+        /* Hash every key up front so a malformed list changes nothing */
+        const uint8_t *   pKey = theRequest.getTail();
+        uint16_t          nRemaining = theRequest.getTailLength();
+        uint64_t          theKeys [255];
+        bool              bWellFormed = true;
+
+        for (int j=0; j<theCount && bWellFormed; j++)
+        {
+            if (nRemaining < 1 || pKey[0] == 0 || pKey[0] + 1 > nRemaining)
+            {
+                bWellFormed = false;
+                break;
+            }
+
+            theKeys[j] = FileIndex::makeKey(pKey + 1, pKey[0]);
+
+            nRemaining -= pKey[0] + 1;
+            pKey += pKey[0] + 1;
+        }
+
+        if (!bWellFormed || nRemaining != 0)
+        {
+            LOG_WARN("Error: Publish files message from node %u does not hold %d well formed keys", theID, theCount);
+        }
+        else if (m_Ring.isEnabled() && redirectIfForeign(pMessagePublish, NodeTable::getInstanceOf(theID)))
+        {
+            /* The files are kept by the shard that handed out the ID */
+            return true;
+        }
+        else
+        {
+            lock_guard<mutex>   theGuard(m_TableLock);
+
+            if (m_NodeTable.findNode(theID) == NULL)
+            {
+                LOG_WARN("Error: Unable to find a node in the table with ID %u to publish files for", theID);
+            }
+            else
+            {
+                if (theFlags & MSG_PUBLISH_FLAG_REPLACE)
+                {
+                    m_Files.removeNode(theID);
+                }
+
+                bPublished = true;
+
+                for (int j=0; j<theCount; j++)
+                {
+                    if (theFlags & MSG_PUBLISH_FLAG_REMOVE)
+                    {
+                        m_Files.removeFile(theID, theKeys[j]);
+                    }
+                    else if (!m_Files.addFile(theID, theKeys[j]))
+                    {
+                        LOG_WARN("Error: Node %u is already publishing %d files - ignoring the rest", theID, FILE_INDEX_MAX_PER_NODE);
+                        bPublished = false;
+                        break;
+                    }
+                }
+
+                theFiles = m_Files.getFileCount(theID);
+            }
+        }
+    }
+
+    theAck.set<PublishFilesAckLayout::Status>(bPublished ? MSG_STATUS_FINE : MSG_STATUS_ISSUE);
+    theAck.set<PublishFilesAckLayout::ID>(theID);
+    theAck.set<PublishFilesAckLayout::Files>((theFiles > UINT16_MAX) ? UINT16_MAX : theFiles);
+
+    if(isVerbose())
+    {
+        theReply->dumpData();
+    }
+
+    sendReply(pMessagePublish, theReply);
+    return bPublished;
+}
+
+bool Tracker::processFindFile (Message * pMessageFind)
+{
+    /* A client asks who holds a file
+     *   1 Byte  - MaxCount - The maximum number of holders to send back
+     *   1 Byte  - Key length
+     *   N Bytes - Key (as the nodes published it)
+     *
+     * The response (type 0x13) is laid out as for LIST_NODES_V2_DATA - status,
+     * max count, count and then the holders as wide node records.  Nodes that
+     * published the file come first, then any whose Bloom filter says they
+     * probably hold it.
+     */
+
+    WireReader<FindFileLayout>  theRequest (pMessageFind);
+
+    MessageHandle theReply = allocateReply(pMessageFind);
+
+    WireWriter<FindFileDataLayout>  theData (theReply.get());
+
+    uint8_t     nMaxCount = 0;
+    uint8_t     nFound = 0;
+    bool        bFine = false;
+
+    if (!theRequest.isValid() || theRequest.get<FindFileLayout::KeyLength>() == 0 ||
+        theRequest.getTailLength() != theRequest.get<FindFileLayout::KeyLength>())
+    {
+        LOG_WARN("Error: Find file message had %d bytes (Expected %d plus a key)", pMessageFind->getLength(), MSG_FIND_FILE_HEADER);
+    }
+    else
+    {
+        uint64_t    theKey = FileIndex::makeKey(theRequest.getTail(), theRequest.get<FindFileLayout::KeyLength>());
+        uint8_t     nNodesToShare;
+
+        nMaxCount = theRequest.get<FindFileLayout::MaxCount>();
+        nNodesToShare = nMaxCount;
+
+        /* Never go past what fits in a single datagram */
+        if ((MSG_MAX_SIZE - FindFileDataLayout::nSize) / NODE_DATA_V2_SIZE < nNodesToShare)
+        {
+            nNodesToShare = (MSG_MAX_SIZE - FindFileDataLayout::nSize) / NODE_DATA_V2_SIZE;
+        }
+
+        /* Start somewhere different each time so a popular file does not
+           send everyone to the same few holders */
+        size_t      nStart = pMessageFind->getArrivalNanos();
+
+        /* The likely holders - the scan runs over every filter so it works
+           from the published copy rather than under the table lock */
+        uint32_t    theCandidates [MSG_MAX_SIZE / NODE_DATA_V2_SIZE];
+        int         nCandidates = 0;
+
+        {
+            shared_ptr<const BloomSnapshot> pFilters = m_Filters.getSnapshot();
+
+            if (pFilters->size() > 0)
+            {
+                nCandidates = pFilters->findCandidates(theKey, nStart % pFilters->size(), theCandidates, nNodesToShare);
+            }
+        }
+
+        lock_guard<mutex>   theGuard(m_TableLock);
+
+        const vector<uint32_t> *  pHolders = m_Files.findHolders(theKey);
+        uint32_t    theIDs [MSG_MAX_SIZE / NODE_DATA_V2_SIZE];
+        int         nIDs = 0;
+
+        if (pHolders != NULL)
+        {
+            for (size_t j=0; j<pHolders->size() && nIDs < nNodesToShare; j++)
+            {
+                theIDs[nIDs++] = (*pHolders)[(nStart + j) % pHolders->size()];
+            }
+        }
+
+        /* Top up with the likely holders (skipping any already in the list) */
+        for (int j=0; j<nCandidates && nIDs < nNodesToShare; j++)
+        {
+            if (find(theIDs, theIDs + nIDs, theCandidates[j]) == theIDs + nIDs)
+            {
+                theIDs[nIDs++] = theCandidates[j];
+            }
+        }
+
+        for (int j=0; j<nIDs; j++)
+        {
+            Node * pNode = m_NodeTable.findNode(theIDs[j]);
+
+            if (pNode != NULL)
             {
-                printf(".");
+                pNode->constructNodeDataWide(theData.getTail() + nFound * NODE_DATA_V2_SIZE);
+                nFound++;
             }
         }
 
-        /* Port Number */
-        printf(" %5d ", m_NodeTable[j].getPort());
+        bFine = true;
+    }
+
+    theData.set<FindFileDataLayout::Status>(bFine ? MSG_STATUS_FINE : MSG_STATUS_ISSUE);
+    theData.set<FindFileDataLayout::MaxCount>(nMaxCount);
+    theData.set<FindFileDataLayout::Count>(nFound);
+    theData.setLength(FindFileDataLayout::nSize + nFound * NODE_DATA_V2_SIZE);
+
+    LOG_DEBUG("Sending a find-file-data with %d holder(s)", nFound);
+
+    if(isVerbose())
+    {
+        theReply->dumpData();
+    }
+
+    sendReply(pMessageFind, theReply);
+    return bFine;
+}
+
+void Tracker::publishSnapshot ()
+{
+    shared_ptr<NodeSnapshot>    pSnapshot;
+    bool                        bFilters;
+
+    {
+        lock_guard<mutex>   theGuard(m_TableLock);
+
+        /* Only re-serialize if the table has changed since the last time (the
+           published one is ours - nobody else publishes) */
+        if (m_Snapshots.getGeneration() != m_NodeTable.getGeneration() ||
+            m_nSnapshotRenewals != m_NodeTable.getRenewals())
+        {
+            pSnapshot = make_shared<NodeSnapshot>(&m_NodeTable);
+            m_nSnapshotRenewals = m_NodeTable.getRenewals();
+        }
+
+        /* A renewal can send a new filter */
+        bFilters = m_Filters.takeChanges();
+    }
+
+    /* The sort and the filter copy are the expensive parts - the writers can
+       carry on meanwhile */
+    if (pSnapshot)
+    {
+        pSnapshot->rank();
+        m_Snapshots.publish(pSnapshot);
+    }
+
+    if (bFilters)
+    {
+        m_Filters.publish();
+    }
+}
+
+shared_ptr<NodeSnapshot> Tracker::getSnapshot ()
+{
+    return m_Snapshots.getShared();
+}
+
+void Tracker::dumpTable ()
+{
+    lock_guard<mutex>   theGuard(m_TableLock);
+
+    LOG_INFO("Tracking Table (%lu entries)", m_NodeTable.size());
 
-        /* Number of files */
-        printf("%3d ", m_NodeTable[j].getFiles());
+    for (size_t j=0; j<m_NodeTable.size(); j++)
+    {
+        Node & theNode = m_NodeTable.getEntry(j);
 
-        /* Expiration Time (UTC) */
-        // TODO: Make this easier to read?
-        printf("%ld\n", m_NodeTable[j].getExpirationTimeAsPointer()->tv_sec);
+        /* IP Address */
+        uint8_t * pByte;
+        pByte = (uint8_t *) theNode.getIPAddressAsPointer();
+
+        /* ID, IP address, port number, number of files and the expiration time (UTC) */
+        // TODO: Make the expiration easier to read?
+        LOG_INFO("%10u %3d.%3d.%3d.%3d %5d %3d %ld", theNode.getID(),
+            pByte[0], pByte[1], pByte[2], pByte[3],
+            theNode.getPort(), theNode.getFiles(),
+            (long) theNode.getExpirationTimeAsPointer()->tv_sec);
     }
-}
\ No newline at end of file
+}
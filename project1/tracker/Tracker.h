@@ -3,19 +3,103 @@
 #define __TRACKER_H
 
 #include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
 using namespace std;
 
 #include <stdint.h>
 
 #include "Node.h"
+#include "NodeTable.h"
+#include "NodeSnapshot.h"
+#include "SnapshotDomain.h"
 #include "Message.h"
+#include "CoarseClock.h"
+#include "MessagePool.h"
+#include "TrackerStats.h"
+#include "TableCheckpoint.h"
+#include "DatagramCapture.h"
+#include "Gossip.h"
+#include "RateLimiter.h"
+#include "FileIndex.h"
+#include "BloomIndex.h"
+#include "Subscribers.h"
+#include "ShardRing.h"
 
 #define DEFAULT_REGISTER_EXPIRATION    300
 
+/* Number of datagrams moved per recvmmsg / sendmmsg (1 = one at a time) */
+#define DEFAULT_BATCH_SIZE             1
+
+/* Milliseconds between housekeeping passes (lease expiry) */
+#define TRACKER_HOUSEKEEPING_INTERVAL  1000
+
+/* Most milliseconds a LIST_NODES snapshot may trail the table by - a burst of
+   changes is folded into one rebuild rather than one per change, and the
+   writers never rebuild it themselves */
+#define TRACKER_SNAPSHOT_INTERVAL      10
+
+/* Milliseconds between pushes of table changes to subscribers */
+#define TRACKER_PUSH_INTERVAL          10
+
+/* Bytes at the front of a pooled reply cleared before it is filled in - the
+   fixed part of every reply, so padding never carries an earlier reply */
+#define TRACKER_REPLY_CLEAR            32
+
+/* Most reads (or batches) taken from a socket per wakeup */
+#define TRACKER_DRAIN_LIMIT            64
+
+/* Everything optional that can ride along with a REGISTER_V2 */
+struct RegisterExtensions
+{
+   /* Did the node report its load? */
+   bool        bHasLoad;
+   NodeLoad    theLoad;
+
+   /* Bloom filter of its files (points into the request) */
+   bool              bHasBloom;
+   const uint8_t *   pBloom;
+   uint16_t          nBloomLength;
+};
+
 class Tracker
 {
    private:
-      vector<Node> m_NodeTable;
+      NodeTable   m_NodeTable;
+
+      /* Guards the node table (and ID assignment) across the workers */
+      mutex    m_TableLock;
+
+      /* Who holds which file (guarded by the table lock) */
+      FileIndex   m_Files;
+
+      /* Bloom filters of what the nodes hold (changed under the table lock,
+         scanned from the copies it publishes) */
+      BloomIndex  m_Filters;
+
+      /* Scratch space for the IDs dropped on each expiry pass (table lock) */
+      vector<uint32_t>  m_ExpiredIDs;
+
+      /* Clients being pushed table changes (guarded by the table lock) */
+      Subscribers       m_Subscribers;
+
+      /* Which tracker owns which nodes (only when sharded, read only once
+         serving) */
+      ShardRing         m_Ring;
+
+      /* Serialized copies of the table handed out by LIST_NODES - published
+         by the control thread, read without any lock */
+      SnapshotDomain    m_Snapshots;
+
+      /* Renewals the current snapshot takes in (table lock) */
+      uint64_t          m_nSnapshotRenewals;
+
+      /* Counters and latency histograms (one block per serving loop) */
+      TrackerStats      m_Stats;
+
+      /* Coarse tick at which expired leases were last reaped */
+      atomic<uint32_t>  m_nLastExpiryTick;
 
       // The port that the tracker will be bound
       uint16_t m_nPort;
@@ -29,11 +113,47 @@ class Tracker
       struct sockaddr_in m_AddressInfo;
 
 
-      uint8_t  m_nNextID;
-
       /* Time that a node receives their lease (default = 300) */
       uint32_t    m_nLeaseTime;
 
+      /* How many datagrams to drain per system call */
+      int         m_nBatchSize;
+
+      /* Serve through io_uring (where the kernel supports it)? */
+      bool        m_bUring;
+
+      /* Number of worker threads (0 = serve on the calling thread) */
+      int         m_nWorkers;
+
+      /* One SO_REUSEPORT socket per worker, all bound to the same port */
+      vector<int> m_WorkerSockets;
+
+      /* Where the table is saved for a warm restart (disabled if no path) */
+      TableCheckpoint   m_Checkpoint;
+
+      /* Seconds between checkpoints */
+      uint32_t    m_nCheckpointInterval;
+
+      /* Every datagram received, for replaying later (disabled unless asked for) */
+      DatagramCapture   m_Capture;
+
+      /* Other trackers we share registrations with (guarded by the table lock) */
+      Gossip      m_Gossip;
+
+      /* Milliseconds between gossip rounds */
+      uint32_t    m_nGossipInterval;
+
+      /* Per-source limits by message type (applied by every serving loop) */
+      LimitPolicy m_Limits;
+
+      /* TCP port for the admin console (0 = none) */
+      uint16_t    m_nAdminPort;
+
+      /* eventfd that becomes readable when the serving loops should stop */
+      int         m_nStopEvent;
+
+      bool  enableReusePort (int nSocket);
+
    public:
 
       Tracker ();
@@ -65,23 +185,219 @@ class Tracker
       void setLeaseTime (uint32_t nLeaseTime)
       { m_nLeaseTime = nLeaseTime; }
 
-      /* Sit and loop */
+      int getBatchSize ()
+      { return m_nBatchSize; }
+
+      void setBatchSize (int nBatchSize)
+      { m_nBatchSize = nBatchSize; }
+
+      bool isUring ()
+      { return m_bUring; }
+
+      void setUring (bool bUring)
+      { m_bUring = bUring; }
+
+      int getWorkers ()
+      { return m_nWorkers; }
+
+      void setWorkers (int nWorkers)
+      { m_nWorkers = nWorkers; }
+
+      void setCheckpointPath (const char * pszPath)
+      { m_Checkpoint.setPath(pszPath); }
+
+      uint32_t getCheckpointInterval ()
+      { return m_nCheckpointInterval; }
+
+      void setCheckpointInterval (uint32_t nInterval)
+      { m_nCheckpointInterval = nInterval; }
+
+      /** Write every datagram received from here on to a capture file
+       *  @returns false if the file could not be opened
+       */
+      bool startCapture (const char * pszPath)
+      { return m_Capture.open(pszPath); }
+
+      /** Hand out IDs from this instance's part of the ID space (needed
+       *  before peering with other trackers)
+       */
+      void setInstance (uint32_t nInstance)
+      { m_NodeTable.setInstance(nInstance); m_Gossip.setInstance(nInstance); }
+
+      bool addPeer (const char * pszPeer)
+      { return m_Gossip.addPeer(pszPeer); }
+
+      /** Add the next tracker to share the table with (every tracker in the
+       *  group, this one included, in instance order)
+       */
+      bool addShard (const char * pszShard)
+      { return m_Ring.addMember(pszShard); }
+
+      /** Split the table across the trackers given with addShard - peers
+       *  with the other shards so each can list the whole table
+       *  @param nInstance This tracker's instance number
+       *  @returns false if this tracker is not one of them
+       */
+      bool  startSharding (uint32_t nInstance);
+
+      void setGossipInterval (uint32_t nInterval)
+      { m_nGossipInterval = nInterval; }
+
+      /** Push this round's registrations to the peers (on the gossip timer) */
+      void  gossipRound ();
+
+      /** Apply one registration learned from a peer (caller holds the table lock)
+       *  @param pUpdate The node as the peer knows it
+       *  @param pRequest The gossip message it came in (for the arrival time)
+       *  @returns true if it was newer than what we had
+       */
+      bool  applyGossip (Node * pUpdate, Message * pRequest);
+
+      /** Load the table from the checkpoint file (if there is one)
+       *  @returns false if the checkpoint exists but could not be used
+       */
+      bool  restoreCheckpoint ();
+
+      /** Save the table to the checkpoint file if it changed since last time */
+      void  writeCheckpoint ();
+
+      /** Limit how often each source may send a message type
+       *  @param pszRule TYPE:RATE[:BURST] (see LimitPolicy::addRule)
+       */
+      bool addLimit (const char * pszRule)
+      { return m_Limits.addRule(pszRule); }
+
+      /** Answer over-limit requests with MSG_STATUS_ISSUE (rather than drop them) */
+      void setLimitReply (bool bReply)
+      { m_Limits.setReplying(bReply); }
+
+      void setAdminPort (uint16_t nPort)
+      { m_nAdminPort = nPort; }
+
+      /** Block SIGINT / SIGTERM so that only the control reactor sees them.
+       *  Call before any thread is started (threads inherit the mask).
+       */
+      static void blockShutdownSignals ();
+
+      /** Serve until told to stop (SIGINT / SIGTERM).  The packets are handled
+       *  on their own thread (or one per worker) while this thread runs the
+       *  control reactor.  A final checkpoint is written on the way out.
+       */
       void  go ();
 
-      /** Wait for a message on the server socket
-       * @returns Pointer to a valid object if there was a message successfully read
+      /** Body of the control reactor - housekeeping timers, signals and the
+       *  admin port.  Returns once a shutdown signal arrives.
+       */
+      void  runControl ();
+
+      /** Body of a worker thread - pin to a CPU and serve its socket */
+      void  runWorker (int nWorker);
+
+      /** Serve one socket (from its own reactor) until the tracker stops */
+      void  serveSocket (int nSocket);
+
+      /* Same as above but draining / replying to a batch of datagrams at a time */
+      void  goBatched (int nSocket);
+
+      /** Same again with io_uring doing the receiving and sending
+       *  @returns false if io_uring could not be set up (nothing was served)
        */
-      Message * recvMessage ();
+      bool  goUring (int nSocket);
+
+      /** Check a received message against its sender's limit (before any
+       *  other work is done on it).  Refused messages are counted and either
+       *  dropped or answered with a refusal.  Capturing happens here too, so
+       *  refused messages are still in the capture.
+       *  @returns true if the message should be handled
+       */
+      bool  admitMessage (RateLimiter * pLimiter, ThreadStats * pStats, Message * pMessage);
+
+      /** Answer a request with a bare MSG_STATUS_ISSUE (if it has a response) */
+      void  refuseMessage (Message * pMessage);
+
+      /** Hand a received message off to the appropriate handler
+       *  @returns false if the message was not understood or was refused
+       */
+      bool  dispatchMessage (Message * pMessage);
+
+      /** Grab a message to reply to a request with */
+      MessageHandle  allocateReply (Message * pRequest);
+
+      /** Send a reply back to whoever sent the request.  The reply handle is
+       *  taken over by this function - the message is either sent and
+       *  returned to its pool or queued on the batch the request arrived in.
+       */
+      void  sendReply (Message * pRequest, MessageHandle & theReply);
+
+      /** Read a message from the (non-blocking) server socket
+       * @returns Handle to a valid (pooled) message if there was a message successfully read
+       *          (empty if nothing was waiting)
+       */
+      MessageHandle recvMessage (int nSocket, CoarseClock * pClock, MessagePool * pPool);
+
+      /** Drop any nodes whose lease has run out (cheap if already done
+       *  for this tick)
+       */
+      void  expireNodes (uint32_t nNowTick);
 
       bool  processEcho (Message * pEchoMessage);
       bool  processRegister (Message * pRegisterMessage);
+      bool  processRegisterV2 (Message * pRegisterMessage);
+      bool  processRegisterBatch (Message * pRegisterMessage);
       bool  processListNodes (Message * pListNodesMessage);
+      bool  processListNodesPage (Message * pListNodesPageMessage);
+      bool  processListNodesDelta (Message * pListNodesDeltaMessage);
+      bool  processSubscribe (Message * pSubscribeMessage);
+
+      /** Send a REDIRECT rather than handle a request another shard owns
+       *  @param nOwner Instance number of the shard that owns the node(s)
+       *  @returns true if the request was redirected (nothing more to do)
+       */
+      bool  redirectIfForeign (Message * pRequest, uint32_t nOwner);
+      bool  processStats (Message * pStatsMessage);
+      bool  processGossip (Message * pGossipMessage);
+      bool  processPublishFiles (Message * pPublishMessage);
+      bool  processFindFile (Message * pFindMessage);
 
       bool  doEcho ();
 
-      uint8_t  getNextNodeID ();
+      /** Register a new node or renew an existing one (shared by both
+       *  versions of the registration message)
+       *  @param pRequest The request (its arrival time is used as "now")
+       *  @param nRequestedID The ID from the request (0 for a new node)
+       *  @param nAddress IP address of the node (network order)
+       *  @param nPort Port number of the node
+       *  @param nFiles Number of files the node has
+       *  @param nMaxID Largest ID the requester is able to receive
+       *  @param pExtensions Optional extras from the request (NULL if none)
+       *  @param pResult Filled in with a copy of the table entry
+       *  @returns true if the node is now registered
+       */
+      bool  applyRegistration (Message * pRequest, uint32_t nRequestedID, uint32_t nAddress, uint16_t nPort, uint16_t nFiles, uint32_t nMaxID, RegisterExtensions * pExtensions, Node * pResult);
+
+      /** The table side of applyRegistration (caller holds the table lock and
+       *  publishes the snapshot afterwards) - same parameters
+       */
+      bool  registerNode (Message * pRequest, uint32_t nRequestedID, uint32_t nAddress, uint16_t nPort, uint16_t nFiles, uint32_t nMaxID, RegisterExtensions * pExtensions, Node * pResult);
+
+      /** Pull any extensions out of a REGISTER_V2 message
+       *  @returns false if the extensions are malformed
+       */
+      bool  parseRegisterExtensions (Message * pMessageRegister, RegisterExtensions * pExtensions);
+
+      /** Rebuild and publish the snapshot if the table has moved on.  Only
+       *  the copy is taken under the table lock, which the caller must not
+       *  hold.  Called from the control thread only (once serving starts).
+       */
+      void  publishSnapshot ();
+
+      /** Get a counted reference to the current snapshot (for holding on to
+       *  it - the serving loops use a SnapshotReader instead)
+       */
+      shared_ptr<NodeSnapshot>   getSnapshot ();
 
-      int   findNodeIndexByID (uint8_t theID);
+      TrackerStats * getStats ()
+      { return &m_Stats; }
 
       void  dumpTable ();
 };
@@ -0,0 +1,169 @@
+// TrackerStats.cc : Live counters and latency histograms for the tracker
+
+#include <stdint.h>
+#include <string.h>
+
+#include "TrackerStats.h"
+
+LatencyHistogram::LatencyHistogram ()
+{
+   for (int j=0; j<STATS_HISTOGRAM_BUCKETS; j++)
+   {
+      m_nCounts[j].store(0);
+   }
+}
+
+void LatencyHistogram::addTo (uint64_t * pTotals)
+{
+   for (int j=0; j<STATS_HISTOGRAM_BUCKETS; j++)
+   {
+      pTotals[j] += m_nCounts[j].load(memory_order_relaxed);
+   }
+}
+
+int LatencyHistogram::getBucket (uint64_t nValue)
+{
+   /* Small values get a bucket each */
+   if (nValue < 2 * STATS_HISTOGRAM_SUB_COUNT)
+   {
+      return nValue;
+   }
+
+   int nTopBit = 63 - __builtin_clzll(nValue);
+
+   if (nTopBit >= STATS_HISTOGRAM_MAX_BITS)
+   {
+      return STATS_HISTOGRAM_BUCKETS - 1;
+   }
+
+   /* Keep the top SUB_BITS+1 bits - the leading one picks the power of two
+      and the rest pick the linear bucket within it */
+   int nShift = nTopBit - STATS_HISTOGRAM_SUB_BITS;
+
+   return (nShift + 1) * STATS_HISTOGRAM_SUB_COUNT + (nValue >> nShift) - STATS_HISTOGRAM_SUB_COUNT;
+}
+
+uint64_t LatencyHistogram::getBucketLowest (int nBucket)
+{
+   if (nBucket < 2 * STATS_HISTOGRAM_SUB_COUNT)
+   {
+      return nBucket;
+   }
+
+   int nShift = nBucket / STATS_HISTOGRAM_SUB_COUNT - 1;
+
+   return (uint64_t) (nBucket % STATS_HISTOGRAM_SUB_COUNT + STATS_HISTOGRAM_SUB_COUNT) << nShift;
+}
+
+uint64_t LatencyHistogram::getBucketHighest (int nBucket)
+{
+   if (nBucket >= STATS_HISTOGRAM_BUCKETS - 1)
+   {
+      return UINT64_MAX;
+   }
+
+   return getBucketLowest(nBucket + 1) - 1;
+}
+
+ThreadStats::ThreadStats ()
+{
+   for (int j=0; j<STATS_TYPE_SLOTS; j++)
+   {
+      m_nReceived[j].store(0);
+      m_nErrors[j].store(0);
+      m_nLimited[j].store(0);
+      m_nMaxLatency[j].store(0);
+   }
+}
+
+uint64_t TypeTotals::getPercentile (double fFraction)
+{
+   uint64_t nTotal = 0;
+
+   for (int j=0; j<STATS_HISTOGRAM_BUCKETS; j++)
+   {
+      nTotal += nCounts[j];
+   }
+
+   if (nTotal == 0)
+   {
+      return 0;
+   }
+
+   /* Rank of the value we are after (1 based) */
+   uint64_t nRank = (uint64_t) (fFraction * nTotal + 0.5);
+
+   if (nRank < 1)
+   {
+      nRank = 1;
+   }
+
+   uint64_t nSeen = 0;
+
+   for (int j=0; j<STATS_HISTOGRAM_BUCKETS; j++)
+   {
+      nSeen += nCounts[j];
+
+      if (nSeen >= nRank)
+      {
+         /* No point claiming more than was actually seen */
+         uint64_t nHighest = LatencyHistogram::getBucketHighest(j);
+         return nHighest < nMaxLatency ? nHighest : nMaxLatency;
+      }
+   }
+
+   return nMaxLatency;
+}
+
+TrackerStats::TrackerStats ()
+{
+   m_nExpired.store(0);
+   m_nPushDropped.store(0);
+}
+
+TrackerStats::~TrackerStats ()
+{
+   for (size_t j=0; j<m_Threads.size(); j++)
+   {
+      delete m_Threads[j];
+   }
+}
+
+ThreadStats * TrackerStats::attachThread ()
+{
+   ThreadStats * pStats = new ThreadStats();
+
+   lock_guard<mutex>   theGuard(m_Lock);
+   m_Threads.push_back(pStats);
+
+   return pStats;
+}
+
+int TrackerStats::getThreadCount ()
+{
+   lock_guard<mutex>   theGuard(m_Lock);
+   return m_Threads.size();
+}
+
+void TrackerStats::sumType (int nSlot, TypeTotals * pTotals)
+{
+   memset(pTotals, 0, sizeof(TypeTotals));
+
+   lock_guard<mutex>   theGuard(m_Lock);
+
+   for (size_t j=0; j<m_Threads.size(); j++)
+   {
+      ThreadStats * pStats = m_Threads[j];
+
+      pTotals->nReceived += pStats->getReceived(nSlot);
+      pTotals->nErrors += pStats->getErrors(nSlot);
+      pTotals->nLimited += pStats->getLimited(nSlot);
+
+      if (pStats->getMaxLatency(nSlot) > pTotals->nMaxLatency)
+      {
+         pTotals->nMaxLatency = pStats->getMaxLatency(nSlot);
+      }
+
+      pStats->getLatency(nSlot)->addTo(pTotals->nCounts);
+   }
+}
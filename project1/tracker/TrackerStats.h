@@ -0,0 +1,197 @@
+// TrackerStats.h : Live counters and latency histograms for the tracker
+//
+// Every serving loop (thread) gets its own block of counters that only it
+// writes, so counting a message costs a couple of uncontended stores.  The
+// blocks are only summed up when someone asks for the statistics.
+
+#ifndef __TRACKERSTATS_H
+#define __TRACKERSTATS_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+using namespace std;
+
+/* Message types are tracked individually up to here (anything larger or
+   unrecognized is lumped in with type 0) */
+#define STATS_TYPE_SLOTS            32
+
+/* Histogram layout (HDR style) - each power of two is split into 2^SUB_BITS
+   linear buckets, which keeps every bucket within 12.5% of its value.  Values
+   are in nanoseconds and anything past 2^MAX_BITS (~68 seconds) lands in the
+   last bucket. */
+#define STATS_HISTOGRAM_SUB_BITS    3
+#define STATS_HISTOGRAM_SUB_COUNT   (1 << STATS_HISTOGRAM_SUB_BITS)
+#define STATS_HISTOGRAM_MAX_BITS    36
+#define STATS_HISTOGRAM_BUCKETS     ((STATS_HISTOGRAM_MAX_BITS - STATS_HISTOGRAM_SUB_BITS + 1) * STATS_HISTOGRAM_SUB_COUNT)
+
+/** LatencyHistogram counts values into log-linear buckets.  There is a single
+ * writer (the owning thread); readers may sum it up at any time.
+ */
+class LatencyHistogram
+{
+   private:
+      atomic<uint64_t>  m_nCounts [STATS_HISTOGRAM_BUCKETS];
+
+   public:
+      LatencyHistogram ();
+
+      /** Count one value (owning thread only) */
+      void  record (uint64_t nValue)
+      {
+         atomic<uint64_t> & theCount = m_nCounts[getBucket(nValue)];
+         theCount.store(theCount.load(memory_order_relaxed) + 1, memory_order_relaxed);
+      }
+
+      /** Add the counts into a plain array of STATS_HISTOGRAM_BUCKETS entries */
+      void  addTo (uint64_t * pTotals);
+
+      /** Which bucket does a value fall in? */
+      static int  getBucket (uint64_t nValue);
+
+      /** Smallest value that lands in a bucket */
+      static uint64_t getBucketLowest (int nBucket);
+
+      /** Largest value that lands in a bucket */
+      static uint64_t getBucketHighest (int nBucket);
+};
+
+/** ThreadStats is the block of counters owned by one serving loop */
+class ThreadStats
+{
+   private:
+      /* Messages received / handled unsuccessfully, by type */
+      atomic<uint64_t>  m_nReceived [STATS_TYPE_SLOTS];
+      atomic<uint64_t>  m_nErrors [STATS_TYPE_SLOTS];
+
+      /* Messages turned away by the per-source limits (never handled) */
+      atomic<uint64_t>  m_nLimited [STATS_TYPE_SLOTS];
+
+      /* Time from arrival to the reply going out, by type */
+      atomic<uint64_t>  m_nMaxLatency [STATS_TYPE_SLOTS];
+      LatencyHistogram  m_Latency [STATS_TYPE_SLOTS];
+
+      static void bump (atomic<uint64_t> & theCounter)
+      { theCounter.store(theCounter.load(memory_order_relaxed) + 1, memory_order_relaxed); }
+
+   public:
+      ThreadStats ();
+
+      /** Map a message type onto the slot it is counted in */
+      static int getSlot (uint8_t byType)
+      { return byType < STATS_TYPE_SLOTS ? byType : 0; }
+
+      /** Count a message that has been handled
+       *  @param byType The type of the request
+       *  @param bSuccess Did the handler accept the request?
+       */
+      void  countMessage (uint8_t byType, bool bSuccess)
+      {
+         int nSlot = getSlot(byType);
+
+         bump(m_nReceived[nSlot]);
+
+         if (!bSuccess)
+         {
+            bump(m_nErrors[nSlot]);
+         }
+      }
+
+      /** Count a message refused for being over its sender's limit */
+      void  countLimited (uint8_t byType)
+      { bump(m_nLimited[getSlot(byType)]); }
+
+      /** Note how long a request took from arrival until its reply was sent
+       *  @param byType The type of the request
+       *  @param nNanos Elapsed time in nanoseconds
+       */
+      void  recordLatency (uint8_t byType, uint64_t nNanos)
+      {
+         int nSlot = getSlot(byType);
+
+         m_Latency[nSlot].record(nNanos);
+
+         if (nNanos > m_nMaxLatency[nSlot].load(memory_order_relaxed))
+         {
+            m_nMaxLatency[nSlot].store(nNanos, memory_order_relaxed);
+         }
+      }
+
+      uint64_t getReceived (int nSlot)
+      { return m_nReceived[nSlot].load(memory_order_relaxed); }
+
+      uint64_t getErrors (int nSlot)
+      { return m_nErrors[nSlot].load(memory_order_relaxed); }
+
+      uint64_t getLimited (int nSlot)
+      { return m_nLimited[nSlot].load(memory_order_relaxed); }
+
+      uint64_t getMaxLatency (int nSlot)
+      { return m_nMaxLatency[nSlot].load(memory_order_relaxed); }
+
+      LatencyHistogram * getLatency (int nSlot)
+      { return &m_Latency[nSlot]; }
+};
+
+/** Totals for one message type summed across all of the threads */
+struct TypeTotals
+{
+   uint64_t    nReceived;
+   uint64_t    nErrors;
+   uint64_t    nLimited;
+   uint64_t    nMaxLatency;
+   uint64_t    nCounts [STATS_HISTOGRAM_BUCKETS];
+
+   /** Value at or below which the given fraction of the latencies fall
+    *  (reported as the top of the bucket, so it never understates)
+    *  @param fFraction Between 0 and 1 (e.g. 0.99 for the 99th percentile)
+    *  @returns The latency in nanoseconds (0 if nothing has been recorded)
+    */
+   uint64_t getPercentile (double fFraction);
+};
+
+/** TrackerStats hands out the per-thread counters and sums them up on demand */
+class TrackerStats
+{
+   private:
+      /* Every block handed out (they live as long as the tracker does) */
+      mutex                   m_Lock;
+      vector<ThreadStats *>   m_Threads;
+
+      /* Nodes dropped because their lease ran out (bumped under the table lock) */
+      atomic<uint64_t>        m_nExpired;
+
+      /* NODE_CHANGES datagrams that could not be sent to a subscriber */
+      atomic<uint64_t>        m_nPushDropped;
+
+   public:
+      TrackerStats ();
+      ~TrackerStats ();
+
+      /** Get a fresh block of counters for a serving loop */
+      ThreadStats * attachThread ();
+
+      int getThreadCount ();
+
+      void addExpired (uint64_t nExpired)
+      { m_nExpired.fetch_add(nExpired, memory_order_relaxed); }
+
+      uint64_t getExpired ()
+      { return m_nExpired.load(memory_order_relaxed); }
+
+      void addPushDropped (uint64_t nDropped)
+      { m_nPushDropped.fetch_add(nDropped, memory_order_relaxed); }
+
+      uint64_t getPushDropped ()
+      { return m_nPushDropped.load(memory_order_relaxed); }
+
+      /** Sum up one message type across all of the threads
+       *  @param nSlot The type slot (see ThreadStats::getSlot)
+       *  @param pTotals Filled in with the totals
+       */
+      void  sumType (int nSlot, TypeTotals * pTotals);
+};
+
+#endif
@@ -0,0 +1,688 @@
+// UringBatch.cc : io_uring based datagram I/O for the tracker
+
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <linux/io_uring.h>
+
+#include "UringBatch.h"
+#include "Logger.h"
+
+/* What a completion belongs to (upper half of user_data - a send carries its
+   slot in the lower half) */
+#define URING_TAG_RECEIVE     1ULL
+#define URING_TAG_SEND        2ULL
+#define URING_TAG_CANCEL      3ULL
+
+#define URING_TAG_SHIFT       32
+
+/* Rounds spent waiting for the receive to be canceled on the way out */
+#define URING_TEARDOWN_TRIES  16
+
+UringBatch::UringBatch (int nSize, MessagePool * pPool)
+{
+   if (nSize < 1)
+   {
+      nSize = 1;
+   }
+
+   m_nSize = nSize;
+   m_pPool = pPool;
+
+   m_nRing = -1;
+   m_nSocket = -1;
+
+   m_pSQRing = NULL;
+   m_nSQRingSize = 0;
+   m_pSQHead = m_pSQTail = m_pSQMask = m_pSQArray = NULL;
+   m_pSQEs = NULL;
+   m_nSQEsSize = 0;
+   m_nSQEntries = 0;
+   m_nSQTail = 0;
+   m_nToSubmit = 0;
+
+   m_pCQRing = NULL;
+   m_nCQRingSize = 0;
+   m_pCQHead = m_pCQTail = m_pCQMask = NULL;
+   m_pCQEs = NULL;
+
+   m_pBufferRing = NULL;
+   m_nBufferRingSize = 0;
+   m_pBuffers = NULL;
+   m_nBufferTail = 0;
+   m_bBufferRingRegistered = false;
+
+   memset(&m_RecvHeader, 0, sizeof(m_RecvHeader));
+   m_bRecvArmed = false;
+
+   m_nReceived = 0;
+   m_Inbound.resize(m_nSize);
+
+   for (int j=0; j<m_nSize; j++)
+   {
+      m_Inbound[j] = pPool->acquire();
+   }
+}
+
+UringBatch::~UringBatch ()
+{
+   teardown();
+}
+
+bool UringBatch::initialize (int nSocket)
+{
+   struct io_uring_params  theParams;
+
+   m_nSocket = nSocket;
+
+   memset(&theParams, 0, sizeof(theParams));
+
+   m_nRing = syscall(__NR_io_uring_setup, URING_ENTRIES, &theParams);
+
+   if (m_nRing == -1)
+   {
+      LOG_WARN("uring: io_uring_setup: %s", strerror(errno));
+      return false;
+   }
+
+   m_nSQEntries = theParams.sq_entries;
+
+   /* Map in the two queues (a single mapping on kernels that allow it) */
+   m_nSQRingSize = theParams.sq_off.array + theParams.sq_entries * sizeof(unsigned);
+   m_nCQRingSize = theParams.cq_off.cqes + theParams.cq_entries * sizeof(struct io_uring_cqe);
+
+   if (theParams.features & IORING_FEAT_SINGLE_MMAP)
+   {
+      if (m_nCQRingSize > m_nSQRingSize)
+      {
+         m_nSQRingSize = m_nCQRingSize;
+      }
+
+      m_nCQRingSize = 0;
+   }
+
+   m_pSQRing = mmap(NULL, m_nSQRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_nRing, IORING_OFF_SQ_RING);
+
+   if (m_pSQRing == MAP_FAILED)
+   {
+      LOG_WARN("uring: mmap(SQ ring): %s", strerror(errno));
+      m_pSQRing = NULL;
+      teardown();
+      return false;
+   }
+
+   if (m_nCQRingSize == 0)
+   {
+      m_pCQRing = m_pSQRing;
+   }
+   else
+   {
+      m_pCQRing = mmap(NULL, m_nCQRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_nRing, IORING_OFF_CQ_RING);
+
+      if (m_pCQRing == MAP_FAILED)
+      {
+         LOG_WARN("uring: mmap(CQ ring): %s", strerror(errno));
+         m_pCQRing = NULL;
+         teardown();
+         return false;
+      }
+   }
+
+   m_nSQEsSize = theParams.sq_entries * sizeof(struct io_uring_sqe);
+   m_pSQEs = (struct io_uring_sqe *) mmap(NULL, m_nSQEsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_nRing, IORING_OFF_SQES);
+
+   if (m_pSQEs == MAP_FAILED)
+   {
+      LOG_WARN("uring: mmap(SQEs): %s", strerror(errno));
+      m_pSQEs = NULL;
+      teardown();
+      return false;
+   }
+
+   uint8_t * pSQ = (uint8_t *) m_pSQRing;
+   uint8_t * pCQ = (uint8_t *) m_pCQRing;
+
+   m_pSQHead = (unsigned *) (pSQ + theParams.sq_off.head);
+   m_pSQTail = (unsigned *) (pSQ + theParams.sq_off.tail);
+   m_pSQMask = (unsigned *) (pSQ + theParams.sq_off.ring_mask);
+   m_pSQArray = (unsigned *) (pSQ + theParams.sq_off.array);
+   m_nSQTail = *m_pSQTail;
+
+   m_pCQHead = (unsigned *) (pCQ + theParams.cq_off.head);
+   m_pCQTail = (unsigned *) (pCQ + theParams.cq_off.tail);
+   m_pCQMask = (unsigned *) (pCQ + theParams.cq_off.ring_mask);
+   m_pCQEs = (struct io_uring_cqe *) (pCQ + theParams.cq_off.cqes);
+
+   /* The provided buffer ring has to be page aligned - an anonymous mapping is */
+   m_nBufferRingSize = URING_BUFFER_COUNT * sizeof(struct io_uring_buf);
+   m_pBufferRing = (struct io_uring_buf_ring *) mmap(NULL, m_nBufferRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   m_pBuffers = (uint8_t *) mmap(NULL, URING_BUFFER_COUNT * URING_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+   if (m_pBufferRing == MAP_FAILED || m_pBuffers == MAP_FAILED)
+   {
+      LOG_WARN("uring: mmap(buffers): %s", strerror(errno));
+
+      if (m_pBufferRing == MAP_FAILED)
+      {
+         m_pBufferRing = NULL;
+      }
+
+      if (m_pBuffers == MAP_FAILED)
+      {
+         m_pBuffers = NULL;
+      }
+
+      teardown();
+      return false;
+   }
+
+   struct io_uring_buf_reg    theRegistration;
+
+   memset(&theRegistration, 0, sizeof(theRegistration));
+   theRegistration.ring_addr = (uint64_t) (uintptr_t) m_pBufferRing;
+   theRegistration.ring_entries = URING_BUFFER_COUNT;
+   theRegistration.bgid = URING_BUFFER_GROUP;
+
+   if (syscall(__NR_io_uring_register, m_nRing, IORING_REGISTER_PBUF_RING, &theRegistration, 1) == -1)
+   {
+      LOG_WARN("uring: provided buffer rings are not supported: %s", strerror(errno));
+      teardown();
+      return false;
+   }
+
+   m_bBufferRingRegistered = true;
+
+   for (int j=0; j<URING_BUFFER_COUNT; j++)
+   {
+      recycleBuffer(j);
+   }
+
+   commitBuffers();
+
+   /* Send slots - one per submission entry is as many as could be in flight */
+   m_InFlight.resize(m_nSQEntries);
+   m_SendHeaders.resize(m_nSQEntries);
+   m_SendVectors.resize(m_nSQEntries);
+   m_FreeSlots.reserve(m_nSQEntries);
+
+   for (int j=m_nSQEntries-1; j>=0; j--)
+   {
+      m_FreeSlots.push_back(j);
+   }
+
+   m_Replies.reserve(m_nSize);
+
+   /* Only the address comes back with each datagram - no ancillary data */
+   m_RecvHeader.msg_namelen = sizeof(struct sockaddr_in);
+
+   armReceive();
+
+   if (!submit(0))
+   {
+      teardown();
+      return false;
+   }
+
+   /* Kernels without multishot recvmsg reject it as soon as it is submitted */
+   unsigned nHead = *m_pCQHead;
+
+   if (nHead != __atomic_load_n(m_pCQTail, __ATOMIC_ACQUIRE))
+   {
+      struct io_uring_cqe * pCQE = &m_pCQEs[nHead & *m_pCQMask];
+
+      if ((pCQE->user_data >> URING_TAG_SHIFT) == URING_TAG_RECEIVE && pCQE->res < 0 && pCQE->res != -ENOBUFS)
+      {
+         LOG_WARN("uring: multishot recvmsg is not supported: %s", strerror(-pCQE->res));
+         __atomic_store_n(m_pCQHead, nHead + 1, __ATOMIC_RELEASE);
+         m_bRecvArmed = false;
+         teardown();
+         return false;
+      }
+   }
+
+   LOG_INFO("uring: %u entries, %d provided buffers on socket %d", m_nSQEntries, URING_BUFFER_COUNT, nSocket);
+   return true;
+}
+
+struct io_uring_sqe * UringBatch::getSQE ()
+{
+   unsigned nHead = __atomic_load_n(m_pSQHead, __ATOMIC_ACQUIRE);
+
+   if (m_nSQTail - nHead >= m_nSQEntries)
+   {
+      return NULL;
+   }
+
+   unsigned nIndex = m_nSQTail & *m_pSQMask;
+   struct io_uring_sqe * pSQE = &m_pSQEs[nIndex];
+
+   memset(pSQE, 0, sizeof(struct io_uring_sqe));
+   m_pSQArray[nIndex] = nIndex;
+
+   m_nSQTail++;
+   m_nToSubmit++;
+
+   return pSQE;
+}
+
+bool UringBatch::submit (unsigned nWaitFor)
+{
+   /* The entries are filled in - let the kernel see them */
+   __atomic_store_n(m_pSQTail, m_nSQTail, __ATOMIC_RELEASE);
+
+   while (1)
+   {
+      /* GETEVENTS also runs any completions still queued up as task work */
+      int nSubmitted = syscall(__NR_io_uring_enter, m_nRing, m_nToSubmit, nWaitFor, IORING_ENTER_GETEVENTS, NULL, 0);
+
+      if (nSubmitted == -1)
+      {
+         if (errno == EINTR)
+         {
+            continue;
+         }
+
+         LOG_ERROR("uring: io_uring_enter: %s", strerror(errno));
+         return false;
+      }
+
+      m_nToSubmit -= nSubmitted;
+      return true;
+   }
+}
+
+void UringBatch::armReceive ()
+{
+   struct io_uring_sqe * pSQE = getSQE();
+
+   if (pSQE == NULL)
+   {
+      submit(0);
+      pSQE = getSQE();
+
+      if (pSQE == NULL)
+      {
+         return;
+      }
+   }
+
+   pSQE->opcode = IORING_OP_RECVMSG;
+   pSQE->fd = m_nSocket;
+   pSQE->addr = (uint64_t) (uintptr_t) &m_RecvHeader;
+   pSQE->len = 1;
+   pSQE->flags = IOSQE_BUFFER_SELECT;
+   pSQE->ioprio = IORING_RECV_MULTISHOT;
+   pSQE->buf_group = URING_BUFFER_GROUP;
+   pSQE->user_data = URING_TAG_RECEIVE << URING_TAG_SHIFT;
+
+   m_bRecvArmed = true;
+}
+
+void UringBatch::recycleBuffer (uint16_t nBufferID)
+{
+   /* Index from the start of the ring rather than through bufs - compiled as
+      C++ the header's flexible array lands 8 bytes further in than the kernel
+      expects (the tail really does overlay the first entry) */
+   struct io_uring_buf * pBuffer = (struct io_uring_buf *) m_pBufferRing + (m_nBufferTail & (URING_BUFFER_COUNT - 1));
+
+   pBuffer->addr = (uint64_t) (uintptr_t) (m_pBuffers + nBufferID * URING_BUFFER_SIZE);
+   pBuffer->len = URING_BUFFER_SIZE;
+   pBuffer->bid = nBufferID;
+
+   m_nBufferTail++;
+}
+
+void UringBatch::commitBuffers ()
+{
+   __atomic_store_n(&m_pBufferRing->tail, m_nBufferTail, __ATOMIC_RELEASE);
+}
+
+int UringBatch::receive (CoarseClock * pClock)
+{
+   bool     bFailed = false;
+   unsigned nHead = *m_pCQHead;
+   unsigned nTail = __atomic_load_n(m_pCQTail, __ATOMIC_ACQUIRE);
+
+   m_nReceived = 0;
+
+   /* Nothing posted yet - completions may still be sitting in task work */
+   if (nHead == nTail)
+   {
+      submit(0);
+      nTail = __atomic_load_n(m_pCQTail, __ATOMIC_ACQUIRE);
+   }
+
+   while (nHead != nTail && m_nReceived < m_nSize)
+   {
+      struct io_uring_cqe * pCQE = &m_pCQEs[nHead & *m_pCQMask];
+
+      switch (pCQE->user_data >> URING_TAG_SHIFT)
+      {
+         case URING_TAG_RECEIVE:
+            if (!completeReceive(pCQE, pClock))
+            {
+               bFailed = true;
+            }
+            break;
+
+         case URING_TAG_SEND:
+            completeSend(pCQE);
+            break;
+      }
+
+      nHead++;
+   }
+
+   __atomic_store_n(m_pCQHead, nHead, __ATOMIC_RELEASE);
+
+   /* Hand the buffers that were copied out back in one go */
+   commitBuffers();
+
+   if (bFailed)
+   {
+      return -1;
+   }
+
+   /* The kernel ends a multishot receive when it runs out of buffers */
+   if (!m_bRecvArmed)
+   {
+      armReceive();
+      submit(0);
+   }
+
+   return m_nReceived;
+}
+
+bool UringBatch::completeReceive (struct io_uring_cqe * pCQE, CoarseClock * pClock)
+{
+   if (!(pCQE->flags & IORING_CQE_F_MORE))
+   {
+      m_bRecvArmed = false;
+   }
+
+   if (pCQE->res < 0)
+   {
+      /* Out of buffers (re-armed once they come back) or shutting down */
+      if (pCQE->res == -ENOBUFS || pCQE->res == -ECANCELED)
+      {
+         return true;
+      }
+
+      LOG_ERROR("uring: recvmsg: %s", strerror(-pCQE->res));
+      return pCQE->res != -EINVAL;
+   }
+
+   if (!(pCQE->flags & IORING_CQE_F_BUFFER))
+   {
+      return true;
+   }
+
+   uint16_t    nBufferID = pCQE->flags >> IORING_CQE_BUFFER_SHIFT;
+   uint8_t *   pBuffer = m_pBuffers + nBufferID * URING_BUFFER_SIZE;
+
+   /* Header, then the address, then (no) control data, then the payload */
+   struct io_uring_recvmsg_out * pOut = (struct io_uring_recvmsg_out *) pBuffer;
+   uint8_t *   pName = pBuffer + sizeof(struct io_uring_recvmsg_out);
+   uint8_t *   pPayload = pName + m_RecvHeader.msg_namelen + m_RecvHeader.msg_controllen;
+
+   uint32_t    nLength = pOut->payloadlen;
+   uint32_t    nInBuffer = pCQE->res - (pPayload - pBuffer);
+
+   if (nLength > nInBuffer)
+   {
+      nLength = nInBuffer;
+   }
+
+   if (nLength > MSG_MAX_SIZE)
+   {
+      nLength = MSG_MAX_SIZE;
+   }
+
+   /* One timestamp for the whole batch */
+   if (m_nReceived == 0)
+   {
+      pClock->update();
+   }
+
+   Message * pMessage = m_Inbound[m_nReceived].get();
+
+   uint32_t nNameLength = pOut->namelen;
+
+   if (nNameLength > sizeof(struct sockaddr_in))
+   {
+      nNameLength = sizeof(struct sockaddr_in);
+   }
+
+   memcpy(pMessage->getAddress(), pName, nNameLength);
+   memcpy(pMessage->getData(), pPayload, nLength);
+
+   pMessage->setLength(nLength);
+   pMessage->setType(pMessage->getData()[0]);
+   pMessage->recordArrival(pClock);
+   pMessage->setSocket(m_nSocket);
+   pMessage->setBatch(this);
+
+   recycleBuffer(nBufferID);
+
+   m_nReceived++;
+   return true;
+}
+
+void UringBatch::completeSend (struct io_uring_cqe * pCQE)
+{
+   int nSlot = pCQE->user_data & 0xFFFFFFFF;
+
+   if (pCQE->res < 0)
+   {
+      /* A failure earlier in the chain cancels the rest of it - those still
+         deserve to go out */
+      if (pCQE->res == -ECANCELED)
+      {
+         sendDirect(m_InFlight[nSlot].get());
+      }
+      else
+      {
+         LOG_WARN("uring: sendmsg: %s", strerror(-pCQE->res));
+      }
+   }
+
+   m_InFlight[nSlot].reset();
+   m_FreeSlots.push_back(nSlot);
+}
+
+void UringBatch::sendDirect (Message * pReply)
+{
+   sendto(m_nSocket, pReply->getData(), pReply->getLength(), 0, (struct sockaddr *) pReply->getAddress(), sizeof(struct sockaddr_in));
+}
+
+int UringBatch::flush ()
+{
+   int   nPending = m_Replies.size();
+   struct io_uring_sqe *   pLast = NULL;
+
+   for (int j=0; j<nPending; j++)
+   {
+      /* Every slot is still with the kernel - this one goes out by hand */
+      if (m_FreeSlots.empty())
+      {
+         sendDirect(m_Replies[j].get());
+         continue;
+      }
+
+      struct io_uring_sqe * pSQE = getSQE();
+
+      if (pSQE == NULL)
+      {
+         /* Close off the chain so far and make room */
+         if (pLast != NULL)
+         {
+            pLast->flags &= ~IOSQE_IO_LINK;
+            pLast = NULL;
+         }
+
+         submit(0);
+         pSQE = getSQE();
+
+         if (pSQE == NULL)
+         {
+            sendDirect(m_Replies[j].get());
+            continue;
+         }
+      }
+
+      int nSlot = m_FreeSlots.back();
+      m_FreeSlots.pop_back();
+
+      Message * pReply = m_Replies[j].get();
+      m_InFlight[nSlot] = move(m_Replies[j]);
+
+      m_SendVectors[nSlot].iov_base = pReply->getData();
+      m_SendVectors[nSlot].iov_len = pReply->getLength();
+
+      memset(&m_SendHeaders[nSlot], 0, sizeof(struct msghdr));
+      m_SendHeaders[nSlot].msg_name = pReply->getAddress();
+      m_SendHeaders[nSlot].msg_namelen = sizeof(struct sockaddr_in);
+      m_SendHeaders[nSlot].msg_iov = &m_SendVectors[nSlot];
+      m_SendHeaders[nSlot].msg_iovlen = 1;
+
+      /* Linked so the replies leave in the order the requests came in */
+      pSQE->opcode = IORING_OP_SENDMSG;
+      pSQE->fd = m_nSocket;
+      pSQE->addr = (uint64_t) (uintptr_t) &m_SendHeaders[nSlot];
+      pSQE->len = 1;
+      pSQE->flags = IOSQE_IO_LINK;
+      pSQE->user_data = (URING_TAG_SEND << URING_TAG_SHIFT) | nSlot;
+
+      pLast = pSQE;
+   }
+
+   if (pLast != NULL)
+   {
+      pLast->flags &= ~IOSQE_IO_LINK;
+   }
+
+   /* Back to the pool go any that were sent by hand */
+   m_Replies.clear();
+
+   if (m_nToSubmit > 0)
+   {
+      submit(0);
+   }
+
+   return nPending;
+}
+
+void UringBatch::teardown ()
+{
+   if (m_nRing != -1 && m_pCQEs != NULL)
+   {
+      /* The kernel must be done with the receive before its buffers go */
+      if (m_bRecvArmed)
+      {
+         struct io_uring_sqe * pSQE = getSQE();
+
+         if (pSQE != NULL)
+         {
+            pSQE->opcode = IORING_OP_ASYNC_CANCEL;
+            pSQE->addr = URING_TAG_RECEIVE << URING_TAG_SHIFT;
+            pSQE->user_data = URING_TAG_CANCEL << URING_TAG_SHIFT;
+         }
+         else
+         {
+            /* No way to wait on it - closing the ring cancels it anyway */
+            m_bRecvArmed = false;
+         }
+      }
+
+      for (int nTry=0; nTry<URING_TEARDOWN_TRIES && (m_bRecvArmed || m_FreeSlots.size() < m_InFlight.size()); nTry++)
+      {
+         if (!submit(1))
+         {
+            break;
+         }
+
+         unsigned nHead = *m_pCQHead;
+         unsigned nTail = __atomic_load_n(m_pCQTail, __ATOMIC_ACQUIRE);
+
+         for (; nHead != nTail; nHead++)
+         {
+            struct io_uring_cqe * pCQE = &m_pCQEs[nHead & *m_pCQMask];
+
+            switch (pCQE->user_data >> URING_TAG_SHIFT)
+            {
+               case URING_TAG_RECEIVE:
+                  if (!(pCQE->flags & IORING_CQE_F_MORE))
+                  {
+                     m_bRecvArmed = false;
+                  }
+                  break;
+
+               case URING_TAG_SEND:
+                  completeSend(pCQE);
+                  break;
+            }
+         }
+
+         __atomic_store_n(m_pCQHead, nHead, __ATOMIC_RELEASE);
+      }
+   }
+
+   if (m_bBufferRingRegistered)
+   {
+      struct io_uring_buf_reg    theRegistration;
+
+      memset(&theRegistration, 0, sizeof(theRegistration));
+      theRegistration.bgid = URING_BUFFER_GROUP;
+
+      syscall(__NR_io_uring_register, m_nRing, IORING_UNREGISTER_PBUF_RING, &theRegistration, 1);
+      m_bBufferRingRegistered = false;
+   }
+
+   if (m_nRing != -1)
+   {
+      close(m_nRing);
+      m_nRing = -1;
+   }
+
+   if (m_pSQEs != NULL)
+   {
+      munmap(m_pSQEs, m_nSQEsSize);
+      m_pSQEs = NULL;
+   }
+
+   if (m_pCQRing != NULL && m_pCQRing != m_pSQRing)
+   {
+      munmap(m_pCQRing, m_nCQRingSize);
+   }
+
+   m_pCQRing = NULL;
+   m_pCQEs = NULL;
+
+   if (m_pSQRing != NULL)
+   {
+      munmap(m_pSQRing, m_nSQRingSize);
+      m_pSQRing = NULL;
+   }
+
+   if (m_pBufferRing != NULL)
+   {
+      munmap(m_pBufferRing, m_nBufferRingSize);
+      m_pBufferRing = NULL;
+   }
+
+   if (m_pBuffers != NULL)
+   {
+      munmap(m_pBuffers, URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+      m_pBuffers = NULL;
+   }
+
+   /* Anything the kernel never got to goes back to the pool */
+   m_InFlight.clear();
+   m_FreeSlots.clear();
+}
@@ -0,0 +1,177 @@
+// UringBatch.h : io_uring based datagram I/O for the tracker
+//
+// The ring is driven straight through the io_uring system calls (there is no
+// liburing here).  A single multishot recvmsg stays posted on the socket and
+// picks its buffers out of a provided buffer ring, so receiving costs no
+// system calls at all while traffic keeps flowing; replies go out as a chain
+// of linked sendmsg requests with one io_uring_enter per batch.
+
+#ifndef __URINGBATCH_H
+#define __URINGBATCH_H
+
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <vector>
+using namespace std;
+
+#include "Message.h"
+#include "CoarseClock.h"
+#include "MessagePool.h"
+#include "ReplyQueue.h"
+
+/* Submission queue entries (the completion queue is twice the size) */
+#define URING_ENTRIES            256
+
+/* Provided receive buffers (must be a power of two) and the size of each.
+   A buffer holds the recvmsg header, the sender's address and the payload. */
+#define URING_BUFFER_COUNT       256
+#define URING_BUFFER_SIZE        2048
+
+/* Buffer group ID of the provided buffer ring */
+#define URING_BUFFER_GROUP       0
+
+/* Batch size used when the tracker's own batch size is left at 1 */
+#define URING_DEFAULT_BATCH      32
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+/** UringBatch plays the same part as DatagramBatch (receive a batch, queue
+ * the replies, flush them) on top of an io_uring instance.  Completions show
+ * up as the ring's descriptor becoming readable, so the ring slots into a
+ * Reactor like any socket would.
+ */
+class UringBatch : public ReplyQueue
+{
+   private:
+      /* Maximum number of datagrams handed out per receive */
+      int         m_nSize;
+
+      int         m_nRing;
+      int         m_nSocket;
+
+      /* Submission queue (the head / tail / mask / array live in the mapping) */
+      void *      m_pSQRing;
+      size_t      m_nSQRingSize;
+      unsigned *  m_pSQHead;
+      unsigned *  m_pSQTail;
+      unsigned *  m_pSQMask;
+      unsigned *  m_pSQArray;
+      struct io_uring_sqe *   m_pSQEs;
+      size_t      m_nSQEsSize;
+      unsigned    m_nSQEntries;
+
+      /* Our copy of the tail (published to the kernel on submit) */
+      unsigned    m_nSQTail;
+
+      /* SQEs filled in but not yet handed to the kernel */
+      unsigned    m_nToSubmit;
+
+      /* Completion queue (may share the submission queue's mapping) */
+      void *      m_pCQRing;
+      size_t      m_nCQRingSize;
+      unsigned *  m_pCQHead;
+      unsigned *  m_pCQTail;
+      unsigned *  m_pCQMask;
+      struct io_uring_cqe *   m_pCQEs;
+
+      /* Provided buffer ring and the buffers it hands to the kernel */
+      struct io_uring_buf_ring * m_pBufferRing;
+      size_t      m_nBufferRingSize;
+      uint8_t *   m_pBuffers;
+      uint16_t    m_nBufferTail;
+      bool        m_bBufferRingRegistered;
+
+      /* Template for the multishot receive (must outlive the request) */
+      struct msghdr  m_RecvHeader;
+      bool        m_bRecvArmed;
+
+      /* Messages filled in by receive */
+      vector<MessageHandle>   m_Inbound;
+      int         m_nReceived;
+      MessagePool *  m_pPool;
+
+      /* Replies the kernel has not finished with yet, indexed by send slot */
+      vector<MessageHandle>   m_InFlight;
+      vector<struct msghdr>   m_SendHeaders;
+      vector<struct iovec>    m_SendVectors;
+      vector<int>             m_FreeSlots;
+
+      /** Next free submission queue entry (NULL if the queue is full) */
+      struct io_uring_sqe *   getSQE ();
+
+      /** Hand any filled in entries to the kernel
+       *  @param nWaitFor Completions to wait for (0 = do not wait)
+       *  @returns false if io_uring_enter failed
+       */
+      bool  submit (unsigned nWaitFor);
+
+      /** Post the multishot recvmsg on the socket */
+      void  armReceive ();
+
+      /** Give a receive buffer back to the kernel (published on the next
+       *  commitBuffers)
+       */
+      void  recycleBuffer (uint16_t nBufferID);
+
+      void  commitBuffers ();
+
+      /** Take one receive completion (a datagram, unless it is an error)
+       *  @returns false if the request failed in a way that cannot be retried
+       */
+      bool  completeReceive (struct io_uring_cqe * pCQE, CoarseClock * pClock);
+
+      /** Take one send completion and free up its slot */
+      void  completeSend (struct io_uring_cqe * pCQE);
+
+      /** Send a reply straight away with sendto (no slot / canceled link) */
+      void  sendDirect (Message * pReply);
+
+      void  teardown ();
+
+   public:
+      /** Constructor
+       *  @param nSize The maximum number of datagrams to hand out per receive
+       *  @param pPool Where the messages for received datagrams come from
+       */
+      UringBatch (int nSize, MessagePool * pPool);
+      ~UringBatch ();
+
+      /** Set up the ring and post the first receive on the socket.  Fails on
+       *  kernels (or sandboxes) without io_uring, provided buffer rings or
+       *  multishot recvmsg - the caller falls back to the plain socket calls.
+       *  @param nSocket A non-blocking UDP socket
+       *  @returns true if the ring is ready to use
+       */
+      bool  initialize (int nSocket);
+
+      /** The ring's descriptor - readable whenever completions are waiting */
+      int getDescriptor ()
+      { return m_nRing; }
+
+      int getSize ()
+      { return m_nSize; }
+
+      /** Reap completions until the batch is full or the queue runs dry
+       *  @param pClock Updated once the datagrams are in and used to stamp them
+       *  @returns The number of messages received (0 if none were waiting) or
+       *           -1 if the ring has failed
+       */
+      int   receive (CoarseClock * pClock);
+
+      /** Retrieve one of the messages from the last receive */
+      Message * getMessage (int nIndex)
+      { return m_Inbound[nIndex].get(); }
+
+      /** Submit all of the queued replies as one chain of linked sends
+       *  @returns The number of replies handed off
+       */
+      int   flush ();
+};
+
+#endif
@@ -0,0 +1,530 @@
+// WireLayout.h : Compile-time wire layouts for the tracker's messages
+//
+// Each message (or record) gets a layout - a struct naming its fields, where
+// every field is a type with its offset baked in - plus the size of its fixed
+// part.  WireReader / WireWriter sit directly on a buffer (nothing is copied
+// in or out) and the length is checked once, when the reader is made.  Every
+// field access is a fixed size memcpy at a constant offset plus a byte swap,
+// which the compiler turns into a single load or store.
+
+#ifndef __WIRELAYOUT_H
+#define __WIRELAYOUT_H
+
+#include <stdint.h>
+#include <cstring>
+#include <endian.h>
+#include <arpa/inet.h>
+
+#include <type_traits>
+using namespace std;
+
+#include "Message.h"
+#include "Node.h"
+
+/** One byte field */
+template <uint16_t OFFSET>
+struct WireU8
+{
+   typedef uint8_t   Value;
+   static constexpr uint16_t nEnd = OFFSET + 1;
+
+   static Value load (const uint8_t * pData)
+   { return pData[OFFSET]; }
+
+   static void store (uint8_t * pData, Value byValue)
+   { pData[OFFSET] = byValue; }
+};
+
+/** Two byte field in network order (handed out in host order) */
+template <uint16_t OFFSET>
+struct WireBE16
+{
+   typedef uint16_t  Value;
+   static constexpr uint16_t nEnd = OFFSET + 2;
+
+   static Value load (const uint8_t * pData)
+   { uint16_t nValue; memcpy(&nValue, pData + OFFSET, 2); return ntohs(nValue); }
+
+   static void store (uint8_t * pData, Value nValue)
+   { nValue = htons(nValue); memcpy(pData + OFFSET, &nValue, 2); }
+};
+
+/** Four byte field in network order (handed out in host order) */
+template <uint16_t OFFSET>
+struct WireBE32
+{
+   typedef uint32_t  Value;
+   static constexpr uint16_t nEnd = OFFSET + 4;
+
+   static Value load (const uint8_t * pData)
+   { uint32_t nValue; memcpy(&nValue, pData + OFFSET, 4); return ntohl(nValue); }
+
+   static void store (uint8_t * pData, Value nValue)
+   { nValue = htonl(nValue); memcpy(pData + OFFSET, &nValue, 4); }
+};
+
+/** Eight byte field in network order (handed out in host order) */
+template <uint16_t OFFSET>
+struct WireBE64
+{
+   typedef uint64_t  Value;
+   static constexpr uint16_t nEnd = OFFSET + 8;
+
+   static Value load (const uint8_t * pData)
+   { uint64_t nValue; memcpy(&nValue, pData + OFFSET, 8); return be64toh(nValue); }
+
+   static void store (uint8_t * pData, Value nValue)
+   { nValue = htobe64(nValue); memcpy(pData + OFFSET, &nValue, 8); }
+};
+
+/** Four byte field that stays in network order (IPv4 addresses) */
+template <uint16_t OFFSET>
+struct WireRaw32
+{
+   typedef uint32_t  Value;
+   static constexpr uint16_t nEnd = OFFSET + 4;
+
+   static Value load (const uint8_t * pData)
+   { uint32_t nValue; memcpy(&nValue, pData + OFFSET, 4); return nValue; }
+
+   static void store (uint8_t * pData, Value nValue)
+   { memcpy(pData + OFFSET, &nValue, 4); }
+};
+
+/* Every message starts with its type and its total length (type and length
+   included).  Layouts deriving from this one are whole messages; the rest
+   describe records inside of a message. */
+struct WireHeader
+{
+   typedef WireU8<0>    Type;
+   typedef WireBE16<1>  Length;
+};
+
+/* ECHO - Type, Length, Nonce (at least 7 bytes) */
+struct EchoLayout : public WireHeader
+{
+   typedef WireBE32<3>  Nonce;
+
+   static constexpr uint16_t  nSize = 7;
+   static constexpr bool      bVariable = true;
+   static constexpr uint8_t   byType = MSG_TYPE_ECHO;
+};
+
+/* ECHO_RESPONSE - Type, Length, Status, Nonce, server time */
+struct EchoResponseLayout : public WireHeader
+{
+   typedef WireU8<3>    Status;
+   typedef WireBE32<4>  Nonce;
+   typedef WireBE32<8>  Seconds;
+   typedef WireBE32<12> Microseconds;
+
+   static constexpr uint16_t  nSize = 16;
+   static constexpr bool      bVariable = false;
+   static constexpr uint8_t   byType = MSG_TYPE_ECHO_RESPONSE;
+};
+
+/* REGISTER - Type, Length, Requested ID (0 = any), IP, Port, Files */
+struct RegisterLayout : public WireHeader
+{
+   typedef WireU8<3>    ID;
+   typedef WireRaw32<4> Address;
+   typedef WireBE16<8>  Port;
+   typedef WireBE16<10> Files;
+
+   static constexpr uint16_t  nSize = 12;
+   static constexpr bool      bVariable = false;
+   static constexpr uint8_t   byType = MSG_TYPE_REGISTER;
+};
+
+/* REGISTER_ACK - Type, Length, Status, then the node as in LIST_NODES_DATA */
+struct RegisterAckLayout : public WireHeader
+{
+   typedef WireU8<3>    Status;
+   typedef WireU8<4>    ID;
+   typedef WireRaw32<5> Address;
+   typedef WireBE16<9>  Port;
+   typedef WireBE16<11> Files;
+   typedef WireBE32<13> Expiry;
+
+   static constexpr uint16_t  nSize = 17;
+   static constexpr bool      bVariable = false;
+   static constexpr uint8_t   byType = MSG_TYPE_REGISTER_ACK;
+};
+
+/* REGISTER_V2 - Type, Length, Requested ID (0 = any), IP, Port, Files and
+   then any extensions (tag / length / value) */
+struct RegisterV2Layout : public WireHeader
+{
+   typedef WireBE32<3>  ID;
+   typedef WireRaw32<7> Address;
+   typedef WireBE16<11> Port;
+   typedef WireBE16<13> Files;
+
+   static constexpr uint16_t  nSize = MSG_REGISTER_V2_LENGTH;
+   static constexpr bool      bVariable = true;
+   static constexpr uint8_t   byType = MSG_TYPE_REGISTER_V2;
+};
+
+/* REGISTER_V2_ACK - Type, Length, Status, then the node as a wide record */
+struct RegisterV2AckLayout : public WireHeader
+{
+   typedef WireU8<3>    Status;
+   typedef WireBE32<4>  ID;
+   typedef WireRaw32<8> Address;
+   typedef WireBE16<12> Port;
+   typedef WireBE16<14> Files;
+   typedef WireBE32<16> Expiry;
+
+   /* Where the wide record (ID onwards) starts */
+   static constexpr uint16_t  nRecordOffset = 4;
+
+   static constexpr uint16_t  nSize = MSG_REGISTER_V2_ACK_LENGTH;
+   static constexpr bool      bVariable = false;
+   static constexpr uint8_t   byType = MSG_TYPE_REGISTER_V2_ACK;
+};
+
+/* Any response cut short because the sender is over its limit - Type (the
+   usual response type), Length, Status (always an issue) */
+struct RefusalLayout : public WireHeader
+{
+   typedef WireU8<3>    Status;
+
+   static constexpr uint16_t  nSize = 4;
+   static constexpr bool      bVariable = false;
+   static constexpr uint8_t   byType = MSG_TYPE_UNKNOWN;
+};
+
+/* LIST_NODES (and LIST_NODES_V2) - Type, Length, Max Count */
+struct ListNodesLayout : public WireHeader
+{
+   typedef WireU8<3>    MaxCount;
+
+   static constexpr uint16_t  nSize = 4;
+   static constexpr bool      bVariable = true;
+   static constexpr uint8_t   byType = MSG_TYPE_LIST_NODES;
+};
+
+/* LIST_NODES_DATA (and its V2 twin) - Type, Length, Status, Max Count,
+   Count, then Count node records */
+struct ListNodesDataLayout : public WireHeader
+{
+   typedef WireU8<3>    Status;
+   typedef WireU8<4>    MaxCount;
+   typedef WireU8<5>    Count;
+
+   static constexpr uint16_t  nSize = MSG_LIST_NODES_HEADER;
+   static constexpr bool      bVariable = true;
+   static constexpr uint8_t   byType = MSG_TYPE_LIST_NODES_DATA;
+};
+
+/* PUBLISH_FILES - Type, Length, Node ID, Flags, Count, then Count file keys
+   (1 byte length + name / content hash) */
+struct PublishFilesLayout : public WireHeader
+{
+   typedef WireBE32<3>  ID;
+   typedef WireU8<7>    Flags;
+   typedef WireU8<8>    Count;
+
+   static constexpr uint16_t  nSize = MSG_PUBLISH_FILES_HEADER;
+   static constexpr bool      bVariable = true;
+   static constexpr uint8_t   byType = MSG_TYPE_PUBLISH_FILES;
+};
+
+/* PUBLISH_FILES_ACK - Type, Length, Status, Node ID, files now published */
+struct PublishFilesAckLayout : public WireHeader
+{
+   typedef WireU8<3>    Status;
+   typedef WireBE32<4>  ID;
+   typedef WireBE16<8>  Files;
+
+   static constexpr uint16_t  nSize = MSG_PUBLISH_FILES_ACK_LENGTH;
+   static constexpr bool      bVariable = false;
+   static constexpr uint8_t   byType = MSG_TYPE_PUBLISH_FILES_ACK;
+};
+
+/* FIND_FILE - Type, Length, Max Count, Key Length, then the key */
+struct FindFileLayout : public WireHeader
+{
+   typedef WireU8<3>    MaxCount;
+   typedef WireU8<4>    KeyLength;
+
+   static constexpr uint16_t  nSize = MSG_FIND_FILE_HEADER;
+   static constexpr bool      bVariable = true;
+   static constexpr uint8_t   byType = MSG_TYPE_FIND_FILE;
+};
+
+/* FIND_FILE_DATA - laid out as LIST_NODES_V2_DATA (Status, Max Count, Count
+   and then Count wide node records) */
+struct FindFileDataLayout : public WireHeader
+{
+   typedef WireU8<3>    Status;
+   typedef WireU8<4>    MaxCount;
+   typedef WireU8<5>    Count;
+
+   static constexpr uint16_t  nSize = MSG_LIST_NODES_HEADER;
+   static constexpr bool      bVariable = true;
+   static constexpr uint8_t   byType = MSG_TYPE_FIND_FILE_DATA;
+};
+
+/* LIST_NODES_DELTA - Type, Length, Epoch, Generation (as last seen) */
+struct ListNodesDeltaLayout : public WireHeader
+{
+   typedef WireBE32<3>  Epoch;
+   typedef WireBE64<7>  Generation;
+
+   static constexpr uint16_t  nSize = MSG_LIST_NODES_DELTA_LENGTH;
+   static constexpr bool      bVariable = false;
+   static constexpr uint8_t   byType = MSG_TYPE_LIST_NODES_DELTA;
+};
+
+/* LIST_NODES_DELTA_DATA - Type, Length, Status, Flags, Epoch, Generation
+   (now up to), Total, Updated, Removed, then Updated wide node records and
+   Removed node IDs */
+struct ListNodesDeltaDataLayout : public WireHeader
+{
+   typedef WireU8<3>    Status;
+   typedef WireU8<4>    Flags;
+   typedef WireBE32<5>  Epoch;
+   typedef WireBE64<9>  Generation;
+   typedef WireBE32<17> Total;
+   typedef WireBE16<21> Updated;
+   typedef WireBE16<23> Removed;
+
+   static constexpr uint16_t  nSize = MSG_LIST_NODES_DELTA_HEADER;
+   static constexpr bool      bVariable = true;
+   static constexpr uint8_t   byType = MSG_TYPE_LIST_NODES_DELTA_DATA;
+};
+
+/* REGISTER_BATCH - Type, Length, Address, Count, then Count entries */
+struct RegisterBatchLayout : public WireHeader
+{
+   typedef WireRaw32<3> Address;
+   typedef WireU8<7>    Count;
+
+   static constexpr uint16_t  nSize = MSG_REGISTER_BATCH_HEADER;
+   static constexpr bool      bVariable = true;
+   static constexpr uint8_t   byType = MSG_TYPE_REGISTER_BATCH;
+};
+
+/* One node in a REGISTER_BATCH */
+struct RegisterBatchEntryLayout
+{
+   typedef WireBE32<0>  ID;
+   typedef WireBE16<4>  Port;
+   typedef WireBE16<6>  Files;
+
+   static constexpr uint16_t  nSize = MSG_REGISTER_BATCH_ENTRY;
+   static constexpr bool      bVariable = false;
+};
+
+/* REGISTER_BATCH_ACK - Type, Length, Status, Count, Registered, Expiry, then
+   Count entries in the order they were asked for */
+struct RegisterBatchAckLayout : public WireHeader
+{
+   typedef WireU8<3>    Status;
+   typedef WireU8<4>    Count;
+   typedef WireU8<5>    Registered;
+   typedef WireBE32<6>  Expiry;
+
+   static constexpr uint16_t  nSize = MSG_REGISTER_BATCH_ACK_HEADER;
+   static constexpr bool      bVariable = true;
+   static constexpr uint8_t   byType = MSG_TYPE_REGISTER_BATCH_ACK;
+};
+
+/* One node in a REGISTER_BATCH_ACK */
+struct RegisterBatchAckEntryLayout
+{
+   typedef WireBE32<0>  ID;
+   typedef WireBE16<4>  Port;
+
+   static constexpr uint16_t  nSize = MSG_REGISTER_BATCH_ACK_ENTRY;
+   static constexpr bool      bVariable = false;
+};
+
+/* SUBSCRIBE - Type, Length, Lease, Cookie */
+struct SubscribeLayout : public WireHeader
+{
+   typedef WireBE16<3>  Lease;
+   typedef WireBE32<5>  Cookie;
+
+   static constexpr uint16_t  nSize = MSG_SUBSCRIBE_LENGTH;
+   static constexpr bool      bVariable = false;
+   static constexpr uint8_t   byType = MSG_TYPE_SUBSCRIBE;
+};
+
+/* SUBSCRIBE_ACK - Type, Length, Status, Lease, Epoch, Generation, Cookie */
+struct SubscribeAckLayout : public WireHeader
+{
+   typedef WireU8<3>    Status;
+   typedef WireBE16<4>  Lease;
+   typedef WireBE32<6>  Epoch;
+   typedef WireBE64<10> Generation;
+   typedef WireBE32<18> Cookie;
+
+   static constexpr uint16_t  nSize = MSG_SUBSCRIBE_ACK_LENGTH;
+   static constexpr bool      bVariable = false;
+   static constexpr uint8_t   byType = MSG_TYPE_SUBSCRIBE_ACK;
+};
+
+/* NODE_CHANGES - Type, Length, Epoch, From, To, Total, Updated, Removed, then
+   the updated nodes (wide records) and the removed IDs */
+struct NodeChangesLayout : public WireHeader
+{
+   typedef WireBE32<3>  Epoch;
+   typedef WireBE64<7>  From;
+   typedef WireBE64<15> To;
+   typedef WireBE32<23> Total;
+   typedef WireBE16<27> Updated;
+   typedef WireBE16<29> Removed;
+
+   static constexpr uint16_t  nSize = MSG_NODE_CHANGES_HEADER;
+   static constexpr bool      bVariable = true;
+   static constexpr uint8_t   byType = MSG_TYPE_NODE_CHANGES;
+};
+
+/* REDIRECT - Type, Length, Request (the type refused), Instance, Address,
+   Port of the tracker to send it to instead */
+struct RedirectLayout : public WireHeader
+{
+   typedef WireU8<3>    Request;
+   typedef WireU8<4>    Instance;
+   typedef WireRaw32<5> Address;
+   typedef WireBE16<9>  Port;
+
+   static constexpr uint16_t  nSize = MSG_REDIRECT_LENGTH;
+   static constexpr bool      bVariable = false;
+   static constexpr uint8_t   byType = MSG_TYPE_REDIRECT;
+};
+
+/* One node in LIST_NODES_DATA (one byte ID) */
+struct NodeDataLayout
+{
+   typedef WireU8<0>    ID;
+   typedef WireRaw32<1> Address;
+   typedef WireBE16<5>  Port;
+   typedef WireBE16<7>  Files;
+   typedef WireBE32<9>  Expiry;
+
+   static constexpr uint16_t  nSize = NODE_DATA_SIZE;
+   static constexpr bool      bVariable = false;
+};
+
+/* One node in LIST_NODES_V2_DATA / LIST_NODES_PAGE_DATA (four byte ID) */
+struct NodeDataWideLayout
+{
+   typedef WireBE32<0>  ID;
+   typedef WireRaw32<4> Address;
+   typedef WireBE16<8>  Port;
+   typedef WireBE16<10> Files;
+   typedef WireBE32<12> Expiry;
+
+   static constexpr uint16_t  nSize = NODE_DATA_V2_SIZE;
+   static constexpr bool      bVariable = false;
+};
+
+/* The fields have to add up to what the rest of the tracker expects */
+static_assert(RegisterAckLayout::Expiry::nEnd == RegisterAckLayout::nSize, "REGISTER_ACK layout does not fill the message");
+static_assert(RegisterAckLayout::ID::nEnd - 1 + NodeDataLayout::nSize == RegisterAckLayout::nSize, "REGISTER_ACK must carry a LIST_NODES_DATA record");
+static_assert(RegisterV2AckLayout::nRecordOffset + NodeDataWideLayout::nSize == RegisterV2AckLayout::nSize, "REGISTER_V2_ACK must carry a wide node record");
+static_assert(NodeDataLayout::Expiry::nEnd == NODE_DATA_SIZE, "Node record layout does not match NODE_DATA_SIZE");
+static_assert(NodeDataWideLayout::Expiry::nEnd == NODE_DATA_V2_SIZE, "Wide node record layout does not match NODE_DATA_V2_SIZE");
+static_assert(PublishFilesAckLayout::Files::nEnd == PublishFilesAckLayout::nSize, "PUBLISH_FILES_ACK layout does not fill the message");
+static_assert(ListNodesDeltaLayout::Generation::nEnd == ListNodesDeltaLayout::nSize, "LIST_NODES_DELTA layout does not fill the message");
+static_assert(ListNodesDeltaDataLayout::Removed::nEnd == ListNodesDeltaDataLayout::nSize, "LIST_NODES_DELTA_DATA header does not match its fields");
+static_assert(EchoResponseLayout::Microseconds::nEnd == EchoResponseLayout::nSize, "ECHO_RESPONSE layout does not fill the message");
+static_assert(RegisterBatchLayout::Count::nEnd == RegisterBatchLayout::nSize, "REGISTER_BATCH header does not match its fields");
+static_assert(RegisterBatchEntryLayout::Files::nEnd == RegisterBatchEntryLayout::nSize, "REGISTER_BATCH entry layout does not fill the entry");
+static_assert(RegisterBatchAckLayout::Expiry::nEnd == RegisterBatchAckLayout::nSize, "REGISTER_BATCH_ACK header does not match its fields");
+static_assert(RegisterBatchAckEntryLayout::Port::nEnd == RegisterBatchAckEntryLayout::nSize, "REGISTER_BATCH_ACK entry layout does not fill the entry");
+static_assert(MSG_REGISTER_BATCH_ACK_HEADER + MSG_REGISTER_BATCH_MAX * MSG_REGISTER_BATCH_ACK_ENTRY <= MSG_MAX_SIZE, "A full REGISTER_BATCH_ACK has to fit in a datagram");
+static_assert(MSG_REGISTER_BATCH_MAX <= 255, "REGISTER_BATCH counts are one byte");
+static_assert(SubscribeLayout::Cookie::nEnd == SubscribeLayout::nSize, "SUBSCRIBE layout does not fill the message");
+static_assert(SubscribeAckLayout::Cookie::nEnd == SubscribeAckLayout::nSize, "SUBSCRIBE_ACK layout does not fill the message");
+static_assert(NodeChangesLayout::Removed::nEnd == NodeChangesLayout::nSize, "NODE_CHANGES header does not match its fields");
+static_assert(RedirectLayout::Port::nEnd == RedirectLayout::nSize, "REDIRECT layout does not fill the message");
+
+/** WireReader is a read only view of a buffer laid out per LAYOUT */
+template <class LAYOUT>
+class WireReader
+{
+   private:
+      const uint8_t *   m_pData;
+      uint16_t          m_nLength;
+
+   public:
+      WireReader (const uint8_t * pData, uint16_t nLength)
+      { m_pData = pData; m_nLength = nLength; }
+
+      /** View a received message (its length as received) */
+      explicit WireReader (Message * pMessage)
+      { m_pData = pMessage->getData(); m_nLength = pMessage->getLength(); }
+
+      /** Is the buffer the right size for the layout?  Check this once before
+       *  getting at any of the fields.
+       */
+      bool isValid () const
+      { return LAYOUT::bVariable ? (m_nLength >= LAYOUT::nSize) : (m_nLength == LAYOUT::nSize); }
+
+      template <class FIELD>
+      typename FIELD::Value get () const
+      {
+         static_assert(FIELD::nEnd <= LAYOUT::nSize, "Field lies outside of the layout");
+         return FIELD::load(m_pData);
+      }
+
+      /** Whatever follows the fixed part (variable length layouts) */
+      const uint8_t * getTail () const
+      { return m_pData + LAYOUT::nSize; }
+
+      uint16_t getTailLength () const
+      { return m_nLength - LAYOUT::nSize; }
+};
+
+/** WireWriter fills in a buffer laid out per LAYOUT */
+template <class LAYOUT>
+class WireWriter
+{
+   private:
+      uint8_t *   m_pData;
+      Message *   m_pMessage;
+
+   public:
+      /** Write into a record (no header) */
+      explicit WireWriter (uint8_t * pData)
+      { m_pData = pData; m_pMessage = NULL; }
+
+      /** Start a message - the type and length are filled in (for the fixed
+       *  part - see setLength for anything variable)
+       */
+      WireWriter (Message * pMessage, uint8_t byType = LAYOUT::byType)
+      {
+         static_assert(is_base_of<WireHeader, LAYOUT>::value, "Only whole messages have a type and length");
+
+         m_pData = pMessage->getData();
+         m_pMessage = pMessage;
+
+         pMessage->setType(byType);
+         WireHeader::Type::store(m_pData, byType);
+         setLength(LAYOUT::nSize);
+      }
+
+      template <class FIELD>
+      void set (typename FIELD::Value theValue)
+      {
+         static_assert(FIELD::nEnd <= LAYOUT::nSize, "Field lies outside of the layout");
+         FIELD::store(m_pData, theValue);
+      }
+
+      /** Where anything past the fixed part goes */
+      uint8_t * getTail ()
+      { return m_pData + LAYOUT::nSize; }
+
+      /** Set the total length (message and header field alike) */
+      void setLength (uint16_t nLength)
+      {
+         m_pMessage->setLength(nLength);
+         WireHeader::Length::store(m_pData, nLength);
+      }
+};
+
+#endif
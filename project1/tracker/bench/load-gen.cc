@@ -0,0 +1,929 @@
+// load-gen.cc : Drive a tracker with a configurable mix of requests
+//
+// Each thread owns a few connected UDP sockets and sends its share of the
+// target rate across them on a fixed schedule (open loop - a slow tracker
+// does not slow the generator down).  Replies are matched back to requests
+// per socket by what they carry (the echo nonce, the address a node was
+// registered with or the ID being renewed) since a tracker running workers
+// can answer out of order.  Anything not answered within the timeout is lost.
+//
+// Latency is taken from when a request was due to go out rather than when it
+// actually went, so stalls in the generator itself are not hidden.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <deque>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "WireLayout.h"
+#include "TrackerStats.h"
+
+/* What the generator can send */
+#define OP_REGISTER     0
+#define OP_RENEW        1
+#define OP_LIST         2
+#define OP_ECHO         3
+#define OP_COUNT        4
+
+static const char * g_pszOpNames [OP_COUNT] = { "register", "renew", "list", "echo" };
+
+/* Replies are matched up against requests of the same kind */
+#define KIND_REGISTER   0
+#define KIND_LIST       1
+#define KIND_ECHO       2
+#define KIND_COUNT      3
+
+static const int g_nOpKinds [OP_COUNT] = { KIND_REGISTER, KIND_REGISTER, KIND_LIST, KIND_ECHO };
+
+/* Datagrams pulled off a socket per recvmmsg */
+#define LOAD_RECV_BATCH       32
+
+/* Node IDs remembered per thread for renewals */
+#define LOAD_MAX_IDS          65536
+
+struct LoadConfig
+{
+   struct sockaddr_in   theTarget;
+
+   /* Requests per second across all threads (0 = as fast as the window allows) */
+   double   fRate;
+   double   fDuration;
+   double   fDrain;
+
+   /* How long to wait on a reply before giving it up as lost */
+   double   fTimeout;
+
+   int      nThreads;
+   int      nSockets;
+
+   /* Requests allowed outstanding per socket */
+   int      nWindow;
+
+   /* Relative weight of each kind of request */
+   int      nWeights [OP_COUNT];
+
+   uint8_t  nListCount;
+
+   /* Version 1 messages (one byte IDs) rather than version 2 */
+   bool     bLegacy;
+};
+
+/* A request waiting on its reply */
+struct Pending
+{
+   uint64_t nDueAt;
+
+   /* What the reply will carry (nonce, address or ID depending on the op) */
+   uint32_t nKey;
+   uint8_t  byOp;
+};
+
+struct LoadSocket
+{
+   int               nSocket;
+
+   /* Oldest first, one queue per kind of reply */
+   deque<Pending>    thePending [KIND_COUNT];
+   int               nOutstanding;
+};
+
+/** LoadThread runs one thread's share of the load */
+class LoadThread
+{
+   private:
+      LoadConfig *      m_pConfig;
+      ThreadStats *     m_pStats;
+      int               m_nIndex;
+
+      vector<LoadSocket>   m_Sockets;
+      vector<uint32_t>     m_IDs;
+
+      mt19937           m_Random;
+      uint32_t          m_nSequence;
+
+   public:
+      uint64_t    m_nSent [OP_COUNT];
+      uint64_t    m_nReplied [OP_COUNT];
+      uint64_t    m_nLost [OP_COUNT];
+      uint64_t    m_nRefused [OP_COUNT];
+
+      /* Sends skipped because every socket's window was full */
+      uint64_t    m_nThrottled;
+
+      /* Replies that matched nothing outstanding */
+      uint64_t    m_nStray;
+
+      LoadThread (LoadConfig * pConfig, ThreadStats * pStats, int nIndex);
+      ~LoadThread ();
+
+      bool  open ();
+      void  run ();
+
+   private:
+      static uint64_t now ();
+
+      uint8_t  pickOp ();
+      uint16_t buildRequest (Pending * pPending, uint8_t * pData);
+      bool     sendRequest (LoadSocket * pSocket, uint64_t nDueAt);
+      int      receiveReplies (LoadSocket * pSocket);
+      void     expireRequests (LoadSocket * pSocket, uint64_t nNow);
+      void     matchReply (LoadSocket * pSocket, uint8_t * pData, int nLength, uint64_t nNow);
+      int      getKind (uint8_t byType);
+      bool     getReplyKey (uint8_t * pData, int nLength, bool bID, uint32_t * pKey);
+};
+
+LoadThread::LoadThread (LoadConfig * pConfig, ThreadStats * pStats, int nIndex)
+{
+   m_pConfig = pConfig;
+   m_pStats = pStats;
+   m_nIndex = nIndex;
+   m_Random.seed(nIndex * 7919 + time(NULL));
+   m_nSequence = 0;
+
+   memset(m_nSent, 0, sizeof(m_nSent));
+   memset(m_nReplied, 0, sizeof(m_nReplied));
+   memset(m_nLost, 0, sizeof(m_nLost));
+   memset(m_nRefused, 0, sizeof(m_nRefused));
+   m_nThrottled = 0;
+   m_nStray = 0;
+}
+
+LoadThread::~LoadThread ()
+{
+   for (size_t j=0; j<m_Sockets.size(); j++)
+   {
+      close(m_Sockets[j].nSocket);
+   }
+}
+
+uint64_t LoadThread::now ()
+{
+   struct timespec theTime;
+
+   clock_gettime(CLOCK_MONOTONIC, &theTime);
+   return (uint64_t) theTime.tv_sec * 1000000000ULL + theTime.tv_nsec;
+}
+
+bool LoadThread::open ()
+{
+   for (int j=0; j<m_pConfig->nSockets; j++)
+   {
+      LoadSocket  theSocket;
+      int         nBuffer = 4 << 20;
+
+      theSocket.nOutstanding = 0;
+      theSocket.nSocket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+      if (theSocket.nSocket == -1)
+      {
+         perror("socket");
+         return false;
+      }
+
+      setsockopt(theSocket.nSocket, SOL_SOCKET, SO_RCVBUF, &nBuffer, sizeof(nBuffer));
+      setsockopt(theSocket.nSocket, SOL_SOCKET, SO_SNDBUF, &nBuffer, sizeof(nBuffer));
+
+      /* Connected - only the tracker's replies come back in */
+      if (connect(theSocket.nSocket, (struct sockaddr *) &m_pConfig->theTarget, sizeof(m_pConfig->theTarget)) == -1)
+      {
+         perror("connect");
+         close(theSocket.nSocket);
+         return false;
+      }
+
+      m_Sockets.push_back(theSocket);
+   }
+
+   return true;
+}
+
+uint8_t LoadThread::pickOp ()
+{
+   int nTotal = 0;
+
+   for (int j=0; j<OP_COUNT; j++)
+   {
+      nTotal += m_pConfig->nWeights[j];
+   }
+
+   int nPick = m_Random() % nTotal;
+
+   for (int j=0; j<OP_COUNT; j++)
+   {
+      if (nPick < m_pConfig->nWeights[j])
+      {
+         /* Nothing to renew yet - register instead */
+         if (j == OP_RENEW && m_IDs.empty())
+         {
+            return OP_REGISTER;
+         }
+
+         return j;
+      }
+
+      nPick -= m_pConfig->nWeights[j];
+   }
+
+   return OP_ECHO;
+}
+
+int LoadThread::getKind (uint8_t byType)
+{
+   switch (byType)
+   {
+      case MSG_TYPE_REGISTER_ACK:
+      case MSG_TYPE_REGISTER_V2_ACK:
+         return KIND_REGISTER;
+
+      case MSG_TYPE_LIST_NODES_DATA:
+      case MSG_TYPE_LIST_NODES_V2_DATA:
+         return KIND_LIST;
+
+      case MSG_TYPE_ECHO_RESPONSE:
+         return KIND_ECHO;
+
+      default:
+         return -1;
+   }
+}
+
+uint16_t LoadThread::buildRequest (Pending * pPending, uint8_t * pData)
+{
+   uint32_t    nNonce = ++m_nSequence;
+
+   /* Every node this thread registers gets its own address (10.x.y.z) and the
+      thread goes in the port */
+   uint32_t    nAddress = htonl((10 << 24) | (nNonce & 0xFFFFFF));
+   uint16_t    nPort = 1024 + m_nIndex;
+
+   switch (pPending->byOp)
+   {
+      case OP_REGISTER:
+      case OP_RENEW:
+      {
+         uint32_t nID = 0;
+
+         /* A renewal is answered with its ID, a new node with its address */
+         if (pPending->byOp == OP_RENEW)
+         {
+            nID = m_IDs[m_Random() % m_IDs.size()];
+            pPending->nKey = nID;
+         }
+         else
+         {
+            pPending->nKey = nAddress;
+         }
+
+         if (m_pConfig->bLegacy)
+         {
+            WireWriter<RegisterLayout> theRequest (pData);
+
+            WireHeader::Type::store(pData, MSG_TYPE_REGISTER);
+            WireHeader::Length::store(pData, RegisterLayout::nSize);
+            theRequest.set<RegisterLayout::ID>(nID);
+            theRequest.set<RegisterLayout::Address>(nAddress);
+            theRequest.set<RegisterLayout::Port>(nPort);
+            theRequest.set<RegisterLayout::Files>(nNonce & 0xFF);
+            return RegisterLayout::nSize;
+         }
+
+         WireWriter<RegisterV2Layout> theRequest (pData);
+
+         WireHeader::Type::store(pData, MSG_TYPE_REGISTER_V2);
+         WireHeader::Length::store(pData, RegisterV2Layout::nSize);
+         theRequest.set<RegisterV2Layout::ID>(nID);
+         theRequest.set<RegisterV2Layout::Address>(nAddress);
+         theRequest.set<RegisterV2Layout::Port>(nPort);
+         theRequest.set<RegisterV2Layout::Files>(nNonce & 0xFF);
+         return RegisterV2Layout::nSize;
+      }
+
+      case OP_LIST:
+      {
+         WireWriter<ListNodesLayout>  theRequest (pData);
+
+         /* Nothing to tell one listing from the next - oldest first */
+         pPending->nKey = 0;
+
+         WireHeader::Type::store(pData, m_pConfig->bLegacy ? MSG_TYPE_LIST_NODES : MSG_TYPE_LIST_NODES_V2);
+         WireHeader::Length::store(pData, ListNodesLayout::nSize);
+         theRequest.set<ListNodesLayout::MaxCount>(m_pConfig->nListCount);
+         return ListNodesLayout::nSize;
+      }
+
+      default:
+      {
+         WireWriter<EchoLayout>  theRequest (pData);
+
+         pPending->nKey = nNonce;
+
+         WireHeader::Type::store(pData, MSG_TYPE_ECHO);
+         WireHeader::Length::store(pData, EchoLayout::nSize);
+         theRequest.set<EchoLayout::Nonce>(nNonce);
+         return EchoLayout::nSize;
+      }
+   }
+}
+
+bool LoadThread::sendRequest (LoadSocket * pSocket, uint64_t nDueAt)
+{
+   uint8_t     byData [MSG_MAX_SIZE];
+   Pending     thePending;
+
+   thePending.byOp = pickOp();
+   thePending.nDueAt = nDueAt;
+
+   uint16_t nLength = buildRequest(&thePending, byData);
+
+   if (send(pSocket->nSocket, byData, nLength, 0) == -1)
+   {
+      /* Socket buffer full - the request was never made */
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+      {
+         return false;
+      }
+
+      /* Nobody listening (ICMP port unreachable) - counts as lost */
+      if (errno != ECONNREFUSED)
+      {
+         perror("send");
+      }
+   }
+
+   m_nSent[thePending.byOp]++;
+   pSocket->thePending[g_nOpKinds[thePending.byOp]].push_back(thePending);
+   pSocket->nOutstanding++;
+   return true;
+}
+
+bool LoadThread::getReplyKey (uint8_t * pData, int nLength, bool bID, uint32_t * pKey)
+{
+   switch (pData[0])
+   {
+      case MSG_TYPE_REGISTER_ACK:
+      {
+         WireReader<RegisterAckLayout>  theAck (pData, nLength);
+
+         if (!theAck.isValid())
+         {
+            return false;
+         }
+
+         *pKey = bID ? theAck.get<RegisterAckLayout::ID>() : theAck.get<RegisterAckLayout::Address>();
+         return true;
+      }
+
+      case MSG_TYPE_REGISTER_V2_ACK:
+      {
+         WireReader<RegisterV2AckLayout>  theAck (pData, nLength);
+
+         if (!theAck.isValid())
+         {
+            return false;
+         }
+
+         *pKey = bID ? theAck.get<RegisterV2AckLayout::ID>() : theAck.get<RegisterV2AckLayout::Address>();
+         return true;
+      }
+
+      case MSG_TYPE_ECHO_RESPONSE:
+      {
+         WireReader<EchoResponseLayout>   theReply (pData, nLength);
+
+         if (!theReply.isValid())
+         {
+            return false;
+         }
+
+         *pKey = theReply.get<EchoResponseLayout::Nonce>();
+         return true;
+      }
+
+      default:
+         *pKey = 0;
+         return true;
+   }
+}
+
+void LoadThread::matchReply (LoadSocket * pSocket, uint8_t * pData, int nLength, uint64_t nNow)
+{
+   int      nKind = (nLength > 0) ? getKind(pData[0]) : -1;
+   uint32_t nID = 0, nAddress = 0;
+
+   if (nKind < 0 || !getReplyKey(pData, nLength, true, &nID) || !getReplyKey(pData, nLength, false, &nAddress))
+   {
+      m_nStray++;
+      return;
+   }
+
+   deque<Pending> &  theQueue = pSocket->thePending[nKind];
+   deque<Pending>::iterator   theMatch = theQueue.end();
+
+   /* Renewals come back with their ID, everything else with its key */
+   for (deque<Pending>::iterator theEntry = theQueue.begin(); theEntry != theQueue.end(); ++theEntry)
+   {
+      if (theEntry->nKey == ((theEntry->byOp == OP_RENEW) ? nID : nAddress))
+      {
+         theMatch = theEntry;
+         break;
+      }
+   }
+
+   /* A refused renewal carries no ID - put it down to the oldest renewal */
+   for (deque<Pending>::iterator theEntry = theQueue.begin(); theEntry != theQueue.end() && theMatch == theQueue.end() && nID == 0; ++theEntry)
+   {
+      if (theEntry->byOp == OP_RENEW)
+      {
+         theMatch = theEntry;
+      }
+   }
+
+   if (theMatch == theQueue.end())
+   {
+      /* Already given up on (or never asked for) */
+      m_nStray++;
+      return;
+   }
+
+   Pending  thePending = *theMatch;
+
+   theQueue.erase(theMatch);
+   pSocket->nOutstanding--;
+
+   bool bFine = (nLength > 3 && pData[3] == MSG_STATUS_FINE);
+
+   /* Keep newly assigned IDs around to renew later on */
+   if (bFine && thePending.byOp == OP_REGISTER && nID != 0)
+   {
+      if (m_IDs.size() < LOAD_MAX_IDS)
+      {
+         m_IDs.push_back(nID);
+      }
+      else
+      {
+         m_IDs[m_Random() % LOAD_MAX_IDS] = nID;
+      }
+   }
+
+   if (!bFine)
+   {
+      m_nRefused[thePending.byOp]++;
+   }
+
+   m_nReplied[thePending.byOp]++;
+
+   /* Latency is filed under the op (not the message type) */
+   m_pStats->countMessage(thePending.byOp, bFine);
+   m_pStats->recordLatency(thePending.byOp, nNow > thePending.nDueAt ? nNow - thePending.nDueAt : 0);
+}
+
+void LoadThread::expireRequests (LoadSocket * pSocket, uint64_t nNow)
+{
+   uint64_t nTimeout = (uint64_t) (m_pConfig->fTimeout * 1e9);
+
+   /* Oldest first - otherwise lost requests would hold the window shut */
+   for (int k=0; k<KIND_COUNT; k++)
+   {
+      deque<Pending> &  theQueue = pSocket->thePending[k];
+
+      while (!theQueue.empty() && theQueue.front().nDueAt + nTimeout < nNow)
+      {
+         m_nLost[theQueue.front().byOp]++;
+         theQueue.pop_front();
+         pSocket->nOutstanding--;
+      }
+   }
+}
+
+int LoadThread::receiveReplies (LoadSocket * pSocket)
+{
+   static thread_local uint8_t   byBuffers [LOAD_RECV_BATCH][MSG_MAX_SIZE];
+   struct mmsghdr    theHeaders [LOAD_RECV_BATCH];
+   struct iovec      theVectors [LOAD_RECV_BATCH];
+   int               nTotal = 0;
+
+   while (1)
+   {
+      memset(theHeaders, 0, sizeof(theHeaders));
+
+      for (int j=0; j<LOAD_RECV_BATCH; j++)
+      {
+         theVectors[j].iov_base = byBuffers[j];
+         theVectors[j].iov_len = MSG_MAX_SIZE;
+         theHeaders[j].msg_hdr.msg_iov = &theVectors[j];
+         theHeaders[j].msg_hdr.msg_iovlen = 1;
+      }
+
+      int nReceived = recvmmsg(pSocket->nSocket, theHeaders, LOAD_RECV_BATCH, MSG_DONTWAIT, NULL);
+
+      if (nReceived <= 0)
+      {
+         return nTotal;
+      }
+
+      uint64_t nNow = now();
+
+      for (int j=0; j<nReceived; j++)
+      {
+         matchReply(pSocket, byBuffers[j], theHeaders[j].msg_len, nNow);
+      }
+
+      nTotal += nReceived;
+
+      if (nReceived < LOAD_RECV_BATCH)
+      {
+         return nTotal;
+      }
+   }
+}
+
+void LoadThread::run ()
+{
+   uint64_t    nStart = now();
+   uint64_t    nStop = nStart + (uint64_t) (m_pConfig->fDuration * 1e9);
+   uint64_t    nDrainUntil = nStop + (uint64_t) (m_pConfig->fDrain * 1e9);
+
+   /* This thread's share of the rate (0 = unpaced) */
+   double      fRate = m_pConfig->fRate / m_pConfig->nThreads;
+   uint64_t    nInterval = (fRate > 0) ? (uint64_t) (1e9 / fRate) : 0;
+   uint64_t    nNextDue = nStart;
+
+   vector<struct pollfd>   thePolls (m_Sockets.size());
+
+   for (size_t j=0; j<m_Sockets.size(); j++)
+   {
+      thePolls[j].fd = m_Sockets[j].nSocket;
+      thePolls[j].events = POLLIN;
+   }
+
+   size_t   nNextSocket = 0;
+
+   while (1)
+   {
+      uint64_t nNow = now();
+
+      if (nNow >= nDrainUntil)
+      {
+         break;
+      }
+
+      bool bBusy = false;
+
+      /* Everything that has come due goes out (round robin over the sockets) */
+      while (nNow < nStop && (nInterval == 0 || nNextDue <= nNow))
+      {
+         bool bSent = false;
+
+         for (size_t nTry=0; nTry<m_Sockets.size() && !bSent; nTry++)
+         {
+            LoadSocket * pSocket = &m_Sockets[nNextSocket];
+            nNextSocket = (nNextSocket + 1) % m_Sockets.size();
+
+            if (pSocket->nOutstanding < m_pConfig->nWindow)
+            {
+               bSent = sendRequest(pSocket, (nInterval == 0) ? now() : nNextDue);
+            }
+         }
+
+         if (nInterval == 0)
+         {
+            /* Unpaced - stop once every window is full */
+            if (!bSent)
+            {
+               break;
+            }
+         }
+         else
+         {
+            if (!bSent)
+            {
+               m_nThrottled++;
+            }
+
+            nNextDue += nInterval;
+         }
+
+         bBusy = true;
+      }
+
+      for (size_t j=0; j<m_Sockets.size(); j++)
+      {
+         if (receiveReplies(&m_Sockets[j]) > 0)
+         {
+            bBusy = true;
+         }
+
+         expireRequests(&m_Sockets[j], nNow);
+      }
+
+      if (bBusy)
+      {
+         continue;
+      }
+
+      /* Idle - wait for a reply or the next send, whichever is first */
+      int nWaitMs = 1;
+
+      if (nInterval != 0 && nNow < nStop && nNextDue > nNow)
+      {
+         nWaitMs = (nNextDue - nNow) / 1000000;
+      }
+
+      poll(thePolls.data(), thePolls.size(), nWaitMs);
+   }
+
+   /* Anything still outstanding is not coming back */
+   for (size_t j=0; j<m_Sockets.size(); j++)
+   {
+      expireRequests(&m_Sockets[j], UINT64_MAX);
+   }
+}
+
+static void printHelp ()
+{
+   printf("Usage: load-gen HOST PORT [options]\n");
+   printf("  -rate N      Requests per second across all threads (default 10000, 0 = as fast\n");
+   printf("               as the windows allow)\n");
+   printf("  -duration S  Seconds to send for (default 10)\n");
+   printf("  -drain S     Seconds to wait for stragglers afterwards (default 1)\n");
+   printf("  -timeout S   Seconds before a request is given up as lost (default 0.5)\n");
+   printf("  -threads N   Sending threads (default 2)\n");
+   printf("  -sockets N   Sockets per thread (default 8)\n");
+   printf("  -window N    Requests outstanding per socket (default 64)\n");
+   printf("  -mix R,N,L,E Weights of register, renew, list and echo (default 10,40,20,30)\n");
+   printf("  -list N      Nodes asked for per list request (default 20)\n");
+   printf("  -v1          Use the version 1 messages (one byte node IDs)\n");
+}
+
+static bool parseMix (const char * pszMix, int * pWeights)
+{
+   int nTotal = 0;
+
+   if (sscanf(pszMix, "%d,%d,%d,%d", &pWeights[0], &pWeights[1], &pWeights[2], &pWeights[3]) != OP_COUNT)
+   {
+      return false;
+   }
+
+   for (int j=0; j<OP_COUNT; j++)
+   {
+      if (pWeights[j] < 0)
+      {
+         return false;
+      }
+
+      nTotal += pWeights[j];
+   }
+
+   return nTotal > 0;
+}
+
+int main (int argc, char ** argv)
+{
+   LoadConfig  theConfig;
+
+   if (argc < 3)
+   {
+      printHelp();
+      return -1;
+   }
+
+   memset(&theConfig, 0, sizeof(theConfig));
+   theConfig.fRate = 10000;
+   theConfig.fDuration = 10;
+   theConfig.fDrain = 1;
+   theConfig.fTimeout = 0.5;
+   theConfig.nThreads = 2;
+   theConfig.nSockets = 8;
+   theConfig.nWindow = 64;
+   theConfig.nListCount = 20;
+   parseMix("10,40,20,30", theConfig.nWeights);
+
+   struct addrinfo   theHints;
+   struct addrinfo * pResult;
+
+   memset(&theHints, 0, sizeof(theHints));
+   theHints.ai_family = AF_INET;
+   theHints.ai_socktype = SOCK_DGRAM;
+
+   if (getaddrinfo(argv[1], argv[2], &theHints, &pResult) != 0)
+   {
+      fprintf(stderr, "Error: Unable to resolve %s:%s\n", argv[1], argv[2]);
+      return -1;
+   }
+
+   memcpy(&theConfig.theTarget, pResult->ai_addr, sizeof(theConfig.theTarget));
+   freeaddrinfo(pResult);
+
+   for (int j=3; j<argc; j++)
+   {
+      if (strcmp(argv[j], "-rate") == 0 && j+1 < argc)
+      {
+         theConfig.fRate = atof(argv[++j]);
+      }
+      else if (strcmp(argv[j], "-duration") == 0 && j+1 < argc)
+      {
+         theConfig.fDuration = atof(argv[++j]);
+      }
+      else if (strcmp(argv[j], "-drain") == 0 && j+1 < argc)
+      {
+         theConfig.fDrain = atof(argv[++j]);
+      }
+      else if (strcmp(argv[j], "-timeout") == 0 && j+1 < argc)
+      {
+         theConfig.fTimeout = atof(argv[++j]);
+      }
+      else if (strcmp(argv[j], "-threads") == 0 && j+1 < argc)
+      {
+         theConfig.nThreads = atoi(argv[++j]);
+      }
+      else if (strcmp(argv[j], "-sockets") == 0 && j+1 < argc)
+      {
+         theConfig.nSockets = atoi(argv[++j]);
+      }
+      else if (strcmp(argv[j], "-window") == 0 && j+1 < argc)
+      {
+         theConfig.nWindow = atoi(argv[++j]);
+      }
+      else if (strcmp(argv[j], "-mix") == 0 && j+1 < argc)
+      {
+         if (!parseMix(argv[++j], theConfig.nWeights))
+         {
+            fprintf(stderr, "Error: -mix takes four non-negative weights (e.g. 10,40,20,30)\n");
+            return -1;
+         }
+      }
+      else if (strcmp(argv[j], "-list") == 0 && j+1 < argc)
+      {
+         theConfig.nListCount = atoi(argv[++j]);
+      }
+      else if (strcmp(argv[j], "-v1") == 0)
+      {
+         theConfig.bLegacy = true;
+      }
+      else
+      {
+         printHelp();
+         return -1;
+      }
+   }
+
+   if (theConfig.nThreads < 1 || theConfig.nSockets < 1 || theConfig.nWindow < 1 || theConfig.fRate < 0 || theConfig.fDuration <= 0 || theConfig.fTimeout <= 0)
+   {
+      fprintf(stderr, "Error: Threads, sockets, window, duration and timeout must be positive\n");
+      return -1;
+   }
+
+   printf("Sending to %s:%s for %.1f s ", argv[1], argv[2], theConfig.fDuration);
+
+   if (theConfig.fRate > 0)
+   {
+      printf("at %.0f req/s", theConfig.fRate);
+   }
+   else
+   {
+      printf("as fast as the windows allow");
+   }
+
+   printf(" (%d threads x %d sockets, window %d)\n", theConfig.nThreads, theConfig.nSockets, theConfig.nWindow);
+
+   /* The tracker's own counters / histograms, keyed by op instead of type */
+   TrackerStats            theStats;
+   vector<LoadThread *>    theLoads;
+   vector<thread>          theThreads;
+
+   for (int j=0; j<theConfig.nThreads; j++)
+   {
+      LoadThread * pLoad = new LoadThread(&theConfig, theStats.attachThread(), j);
+
+      if (!pLoad->open())
+      {
+         return -1;
+      }
+
+      theLoads.push_back(pLoad);
+   }
+
+   for (int j=0; j<theConfig.nThreads; j++)
+   {
+      theThreads.push_back(thread(&LoadThread::run, theLoads[j]));
+   }
+
+   for (int j=0; j<theConfig.nThreads; j++)
+   {
+      theThreads[j].join();
+   }
+
+   /* Add it all up */
+   uint64_t    nSent [OP_COUNT] = { 0 }, nReplied [OP_COUNT] = { 0 }, nLost [OP_COUNT] = { 0 }, nRefused [OP_COUNT] = { 0 };
+   uint64_t    nThrottled = 0, nStray = 0;
+
+   for (int j=0; j<theConfig.nThreads; j++)
+   {
+      for (int k=0; k<OP_COUNT; k++)
+      {
+         nSent[k] += theLoads[j]->m_nSent[k];
+         nReplied[k] += theLoads[j]->m_nReplied[k];
+         nLost[k] += theLoads[j]->m_nLost[k];
+         nRefused[k] += theLoads[j]->m_nRefused[k];
+      }
+
+      nThrottled += theLoads[j]->m_nThrottled;
+      nStray += theLoads[j]->m_nStray;
+
+      delete theLoads[j];
+   }
+
+   TypeTotals  theAll;
+   TypeTotals  theOp;
+   uint64_t    nAllSent = 0, nAllReplied = 0, nAllLost = 0, nAllRefused = 0;
+
+   memset(&theAll, 0, sizeof(theAll));
+
+   printf("\n%-10s %10s %10s %9s %7s %8s %9s %9s %9s %9s\n", "Request", "Sent", "Replied", "Lost", "Loss%", "Refused",
+          "p50 us", "p99 us", "p999 us", "Max us");
+
+   for (int k=0; k<=OP_COUNT; k++)
+   {
+      const char *   pszName;
+      TypeTotals *   pTotals;
+      uint64_t       nRowSent, nRowReplied, nRowLost, nRowRefused;
+
+      if (k < OP_COUNT)
+      {
+         theStats.sumType(k, &theOp);
+
+         for (int b=0; b<STATS_HISTOGRAM_BUCKETS; b++)
+         {
+            theAll.nCounts[b] += theOp.nCounts[b];
+         }
+
+         if (theOp.nMaxLatency > theAll.nMaxLatency)
+         {
+            theAll.nMaxLatency = theOp.nMaxLatency;
+         }
+
+         nAllSent += nSent[k];
+         nAllReplied += nReplied[k];
+         nAllLost += nLost[k];
+         nAllRefused += nRefused[k];
+
+         if (nSent[k] == 0)
+         {
+            continue;
+         }
+
+         pszName = g_pszOpNames[k];
+         pTotals = &theOp;
+         nRowSent = nSent[k];
+         nRowReplied = nReplied[k];
+         nRowLost = nLost[k];
+         nRowRefused = nRefused[k];
+      }
+      else
+      {
+         pszName = "total";
+         pTotals = &theAll;
+         nRowSent = nAllSent;
+         nRowReplied = nAllReplied;
+         nRowLost = nAllLost;
+         nRowRefused = nAllRefused;
+      }
+
+      printf("%-10s %10llu %10llu %9llu %6.2f%% %8llu %9.1f %9.1f %9.1f %9.1f\n", pszName,
+             (unsigned long long) nRowSent, (unsigned long long) nRowReplied, (unsigned long long) nRowLost,
+             nRowSent ? 100.0 * nRowLost / nRowSent : 0.0, (unsigned long long) nRowRefused,
+             pTotals->getPercentile(0.5) / 1000.0, pTotals->getPercentile(0.99) / 1000.0,
+             pTotals->getPercentile(0.999) / 1000.0, pTotals->nMaxLatency / 1000.0);
+   }
+
+   printf("\nThroughput: %.0f req/s sent, %.0f replies/s", nAllSent / theConfig.fDuration, nAllReplied / theConfig.fDuration);
+
+   if (nThrottled > 0)
+   {
+      printf(", %llu sends skipped (window / socket buffer full)", (unsigned long long) nThrottled);
+   }
+
+   if (nStray > 0)
+   {
+      printf(", %llu unmatched replies", (unsigned long long) nStray);
+   }
+
+   printf("\n");
+   return 0;
+}
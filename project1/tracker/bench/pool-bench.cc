@@ -0,0 +1,112 @@
+// pool-bench.cc : Compare new / delete per datagram against the message pool
+//
+// Mimics what the tracker does for each request - one message to receive
+// into and one to reply with - and counts every trip to the allocator.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <new>
+
+#include "Message.h"
+#include "MessagePool.h"
+
+/* Count every allocation made by the process */
+static uint64_t g_nAllocations = 0;
+
+void * operator new (size_t nSize)
+{
+   g_nAllocations++;
+
+   void * pMemory = malloc(nSize);
+
+   if (pMemory == NULL)
+   {
+      throw std::bad_alloc();
+   }
+
+   return pMemory;
+}
+
+void operator delete (void * pMemory) noexcept
+{
+   free(pMemory);
+}
+
+static double getSeconds ()
+{
+   struct timespec theTime;
+
+   clock_gettime(CLOCK_MONOTONIC, &theTime);
+   return theTime.tv_sec + theTime.tv_nsec / 1e9;
+}
+
+/* Pretend to handle a request - touch the header like the handlers do */
+static void fakeHandle (Message * pRequest, Message * pReply)
+{
+   pRequest->getData()[0] = MSG_TYPE_ECHO;
+   pRequest->setLength(7);
+
+   pReply->getData()[0] = MSG_TYPE_ECHO_RESPONSE;
+   pReply->setLength(16);
+}
+
+int main (int argc, char ** argv)
+{
+   long nIterations = 1000000;
+
+   if (argc > 1)
+   {
+      nIterations = atol(argv[1]);
+   }
+
+   printf("Simulating %ld request / reply pairs\n", nIterations);
+
+   /* The original way - a fresh (zeroed) message for each direction */
+   uint64_t nStart = g_nAllocations;
+   double   fStart = getSeconds();
+
+   for (long j=0; j<nIterations; j++)
+   {
+      Message * pRequest = new Message();
+      Message * pReply = new Message();
+
+      fakeHandle(pRequest, pReply);
+
+      delete pReply;
+      delete pRequest;
+   }
+
+   double   fHeap = getSeconds() - fStart;
+   uint64_t nHeap = g_nAllocations - nStart;
+
+   /* The pooled way */
+   nStart = g_nAllocations;
+   fStart = getSeconds();
+
+   {
+      MessagePool thePool(MESSAGE_POOL_DEFAULT_SIZE);
+
+      for (long j=0; j<nIterations; j++)
+      {
+         MessageHandle theRequest = thePool.acquire();
+         MessageHandle theReply = thePool.acquire();
+
+         fakeHandle(theRequest.get(), theReply.get());
+      }
+
+      printf("  Pool: %llu acquired, %llu allocations made by the pool\n",
+         (unsigned long long) thePool.getAcquired(), (unsigned long long) thePool.getAllocations());
+   }
+
+   double   fPool = getSeconds() - fStart;
+   uint64_t nPool = g_nAllocations - nStart;
+
+   printf("%-12s %12s %14s\n", "Method", "ns / pair", "Allocations");
+   printf("%-12s %12.1f %14llu\n", "new/delete", fHeap * 1e9 / nIterations, (unsigned long long) nHeap);
+   printf("%-12s %12.1f %14llu\n", "pool", fPool * 1e9 / nIterations, (unsigned long long) nPool);
+
+   return 0;
+}
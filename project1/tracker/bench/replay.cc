@@ -0,0 +1,719 @@
+// replay.cc : Feed a tracker capture (tracker -capture) back to a tracker
+//
+// Every source seen in the capture gets its own connected UDP socket, so the
+// tracker sees the same spread of senders (per-source limits, worker
+// hashing) as it did live.  Datagrams go out in capture order on the
+// recorded schedule, optionally sped up, or as fast as the windows allow.
+//
+// A tracker answers each source in order, so replies are matched to the
+// oldest outstanding request on the same socket that expects that type of
+// reply.  Latency is taken from when a datagram was due to go out, the same
+// as load-gen.  Anything not answered within the timeout is lost.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+#include "DatagramCapture.h"
+#include "TrackerStats.h"
+
+/* Datagrams pulled off a socket per recvmmsg */
+#define REPLAY_RECV_BATCH     32
+
+struct ReplayConfig
+{
+   struct sockaddr_in   theTarget;
+
+   /* Multiple of the recorded speed (0 = as fast as the windows allow) */
+   double   fSpeed;
+   double   fDrain;
+
+   /* How long to wait on a reply before giving it up as lost */
+   double   fTimeout;
+
+   /* Most sockets opened - sources past that share them */
+   int      nSources;
+
+   /* Requests allowed outstanding per socket */
+   int      nWindow;
+};
+
+/* One datagram out of the capture */
+struct Datagram
+{
+   /* Recorded arrival, relative to the first datagram */
+   uint64_t nOffset;
+
+   /* Where in the capture the bytes are */
+   size_t   nData;
+   uint16_t nLength;
+
+   /* Socket it goes out on */
+   int      nSocket;
+};
+
+/* A request waiting on its reply */
+struct Pending
+{
+   uint64_t nDueAt;
+   uint8_t  byType;
+   uint8_t  byResponse;
+};
+
+struct ReplaySocket
+{
+   int               nSocket;
+
+   /* Oldest first, whatever the type */
+   deque<Pending>    thePending;
+};
+
+/** Replayer owns the capture, the sockets and the counters */
+class Replayer
+{
+   private:
+      ReplayConfig *       m_pConfig;
+      ThreadStats *        m_pStats;
+
+      vector<uint8_t>      m_Capture;
+      vector<Datagram>     m_Datagrams;
+      vector<ReplaySocket> m_Sockets;
+
+      /* Recorded time from the first datagram to the last */
+      uint64_t             m_nSpan;
+
+   public:
+      /* By request type */
+      uint64_t    m_nSent [256];
+      uint64_t    m_nReplied [256];
+      uint64_t    m_nLost [256];
+      uint64_t    m_nIssues [256];
+
+      /* Replies that matched nothing outstanding */
+      uint64_t    m_nStray;
+
+      /* Sources in the capture (can be more than the sockets) */
+      size_t      m_nSourceCount;
+
+      /* Wall time the sending took */
+      uint64_t    m_nSendTime;
+
+      Replayer (ReplayConfig * pConfig, ThreadStats * pStats);
+      ~Replayer ();
+
+      /** Read in the capture and open a socket per source
+       *  @returns false if the capture is unusable
+       */
+      bool  load (const char * pszFile);
+
+      void  run ();
+
+      size_t getCount ()
+      { return m_Datagrams.size(); }
+
+      uint64_t getSpan ()
+      { return m_nSpan; }
+
+   private:
+      static uint64_t now ();
+
+      int   openSocket ();
+      bool  sendDatagram (Datagram * pDatagram, uint64_t nDueAt);
+      void  matchReply (ReplaySocket * pSocket, uint8_t * pData, int nLength, uint64_t nNow);
+      void  expireRequests (ReplaySocket * pSocket, uint64_t nNow);
+      int   receiveReplies (ReplaySocket * pSocket);
+};
+
+Replayer::Replayer (ReplayConfig * pConfig, ThreadStats * pStats)
+{
+   m_pConfig = pConfig;
+   m_pStats = pStats;
+   m_nSpan = 0;
+   m_nStray = 0;
+   m_nSourceCount = 0;
+   m_nSendTime = 0;
+
+   memset(m_nSent, 0, sizeof(m_nSent));
+   memset(m_nReplied, 0, sizeof(m_nReplied));
+   memset(m_nLost, 0, sizeof(m_nLost));
+   memset(m_nIssues, 0, sizeof(m_nIssues));
+}
+
+Replayer::~Replayer ()
+{
+   for (size_t j=0; j<m_Sockets.size(); j++)
+   {
+      close(m_Sockets[j].nSocket);
+   }
+}
+
+uint64_t Replayer::now ()
+{
+   struct timespec theTime;
+
+   clock_gettime(CLOCK_MONOTONIC, &theTime);
+   return (uint64_t) theTime.tv_sec * 1000000000ULL + theTime.tv_nsec;
+}
+
+int Replayer::openSocket ()
+{
+   int nBuffer = 4 << 20;
+   int nSocket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+   if (nSocket == -1)
+   {
+      perror("socket");
+      return -1;
+   }
+
+   setsockopt(nSocket, SOL_SOCKET, SO_RCVBUF, &nBuffer, sizeof(nBuffer));
+   setsockopt(nSocket, SOL_SOCKET, SO_SNDBUF, &nBuffer, sizeof(nBuffer));
+
+   /* Connected - only the tracker's replies come back in */
+   if (connect(nSocket, (struct sockaddr *) &m_pConfig->theTarget, sizeof(m_pConfig->theTarget)) == -1)
+   {
+      perror("connect");
+      close(nSocket);
+      return -1;
+   }
+
+   return nSocket;
+}
+
+bool Replayer::load (const char * pszFile)
+{
+   FILE * pFile = fopen(pszFile, "rb");
+
+   if (pFile == NULL)
+   {
+      fprintf(stderr, "Error: Unable to open %s: %s\n", pszFile, strerror(errno));
+      return false;
+   }
+
+   uint8_t  byChunk [65536];
+   size_t   nRead;
+
+   while ((nRead = fread(byChunk, 1, sizeof(byChunk), pFile)) > 0)
+   {
+      m_Capture.insert(m_Capture.end(), byChunk, byChunk + nRead);
+   }
+
+   fclose(pFile);
+
+   const uint8_t *   pHeader = m_Capture.data();
+
+   if (m_Capture.size() < CaptureFileLayout::nSize || CaptureFileLayout::Magic::load(pHeader) != CAPTURE_MAGIC ||
+       CaptureFileLayout::Version::load(pHeader) != CAPTURE_VERSION || CaptureFileLayout::RecordSize::load(pHeader) < CaptureRecordLayout::nSize)
+   {
+      fprintf(stderr, "Error: %s is not a tracker capture\n", pszFile);
+      return false;
+   }
+
+   uint16_t nRecordSize = CaptureFileLayout::RecordSize::load(pHeader);
+   size_t   nPosition = CaptureFileLayout::nSize;
+   uint64_t nFirst = 0;
+
+   /* Source address and port -> socket */
+   unordered_map<uint64_t, int>  theSources;
+
+   while (nPosition + nRecordSize <= m_Capture.size())
+   {
+      const uint8_t *   pRecord = m_Capture.data() + nPosition;
+      Datagram          theDatagram;
+
+      theDatagram.nLength = CaptureRecordLayout::Length::load(pRecord);
+      theDatagram.nData = nPosition + nRecordSize;
+
+      /* A tracker stopped mid-write can leave a partial record at the end */
+      if (theDatagram.nData + theDatagram.nLength > m_Capture.size())
+      {
+         break;
+      }
+
+      uint64_t nNanos = CaptureRecordLayout::Nanos::load(pRecord);
+
+      if (m_Datagrams.empty())
+      {
+         nFirst = nNanos;
+      }
+
+      /* Loops stamp their own batches so the order can wobble a little */
+      theDatagram.nOffset = (nNanos > nFirst) ? nNanos - nFirst : 0;
+
+      if (!m_Datagrams.empty() && theDatagram.nOffset < m_Datagrams.back().nOffset)
+      {
+         theDatagram.nOffset = m_Datagrams.back().nOffset;
+      }
+
+      uint64_t nSource = ((uint64_t) CaptureRecordLayout::Address::load(pRecord) << 16) | CaptureRecordLayout::Port::load(pRecord);
+      unordered_map<uint64_t, int>::iterator theEntry = theSources.find(nSource);
+
+      if (theEntry == theSources.end())
+      {
+         int nSocket = theSources.size();
+
+         /* Out of sockets - spread the rest over the ones already open */
+         if (nSocket >= m_pConfig->nSources)
+         {
+            nSocket %= m_pConfig->nSources;
+         }
+         else
+         {
+            ReplaySocket   theSocket;
+
+            theSocket.nSocket = openSocket();
+
+            if (theSocket.nSocket == -1)
+            {
+               return false;
+            }
+
+            m_Sockets.push_back(theSocket);
+         }
+
+         theEntry = theSources.insert(make_pair(nSource, nSocket)).first;
+      }
+
+      theDatagram.nSocket = theEntry->second;
+
+      m_Datagrams.push_back(theDatagram);
+      nPosition = theDatagram.nData + theDatagram.nLength;
+   }
+
+   m_nSourceCount = theSources.size();
+
+   if (!m_Datagrams.empty())
+   {
+      m_nSpan = m_Datagrams.back().nOffset;
+   }
+
+   return true;
+}
+
+bool Replayer::sendDatagram (Datagram * pDatagram, uint64_t nDueAt)
+{
+   ReplaySocket * pSocket = &m_Sockets[pDatagram->nSocket];
+   uint8_t *      pData = &m_Capture[pDatagram->nData];
+
+   if (send(pSocket->nSocket, pData, pDatagram->nLength, 0) == -1)
+   {
+      /* Socket buffer full - try again shortly */
+      return false;
+   }
+
+   uint8_t  byType = (pDatagram->nLength > 0) ? pData[0] : MSG_TYPE_UNKNOWN;
+   uint8_t  byResponse = Message::getResponseType(byType);
+
+   m_nSent[byType]++;
+
+   /* Gossip and the like are not answered - nothing to wait for */
+   if (byResponse != MSG_TYPE_UNKNOWN)
+   {
+      Pending  thePending;
+
+      thePending.nDueAt = nDueAt;
+      thePending.byType = byType;
+      thePending.byResponse = byResponse;
+
+      pSocket->thePending.push_back(thePending);
+   }
+
+   return true;
+}
+
+void Replayer::matchReply (ReplaySocket * pSocket, uint8_t * pData, int nLength, uint64_t nNow)
+{
+   deque<Pending>::iterator   theMatch = pSocket->thePending.end();
+
+   for (deque<Pending>::iterator theEntry = pSocket->thePending.begin(); theEntry != pSocket->thePending.end() && nLength > 0; ++theEntry)
+   {
+      if (theEntry->byResponse == pData[0])
+      {
+         theMatch = theEntry;
+         break;
+      }
+   }
+
+   if (theMatch == pSocket->thePending.end())
+   {
+      /* Already given up on */
+      m_nStray++;
+      return;
+   }
+
+   Pending  thePending = *theMatch;
+
+   pSocket->thePending.erase(theMatch);
+
+   /* Every reply carries its status right after the length (not modified
+      and the like are still answers) */
+   bool bFine = (nLength > 3 && pData[3] != MSG_STATUS_ISSUE);
+
+   if (!bFine)
+   {
+      m_nIssues[thePending.byType]++;
+   }
+
+   m_nReplied[thePending.byType]++;
+
+   m_pStats->countMessage(thePending.byType, bFine);
+   m_pStats->recordLatency(thePending.byType, nNow > thePending.nDueAt ? nNow - thePending.nDueAt : 0);
+}
+
+void Replayer::expireRequests (ReplaySocket * pSocket, uint64_t nNow)
+{
+   uint64_t nTimeout = (uint64_t) (m_pConfig->fTimeout * 1e9);
+
+   while (!pSocket->thePending.empty() && pSocket->thePending.front().nDueAt + nTimeout < nNow)
+   {
+      m_nLost[pSocket->thePending.front().byType]++;
+      pSocket->thePending.pop_front();
+   }
+}
+
+int Replayer::receiveReplies (ReplaySocket * pSocket)
+{
+   static uint8_t    byBuffers [REPLAY_RECV_BATCH][MSG_MAX_SIZE];
+   struct mmsghdr    theHeaders [REPLAY_RECV_BATCH];
+   struct iovec      theVectors [REPLAY_RECV_BATCH];
+   int               nTotal = 0;
+
+   while (1)
+   {
+      memset(theHeaders, 0, sizeof(theHeaders));
+
+      for (int j=0; j<REPLAY_RECV_BATCH; j++)
+      {
+         theVectors[j].iov_base = byBuffers[j];
+         theVectors[j].iov_len = MSG_MAX_SIZE;
+         theHeaders[j].msg_hdr.msg_iov = &theVectors[j];
+         theHeaders[j].msg_hdr.msg_iovlen = 1;
+      }
+
+      int nReceived = recvmmsg(pSocket->nSocket, theHeaders, REPLAY_RECV_BATCH, MSG_DONTWAIT, NULL);
+
+      if (nReceived <= 0)
+      {
+         return nTotal;
+      }
+
+      uint64_t nNow = now();
+
+      for (int j=0; j<nReceived; j++)
+      {
+         matchReply(pSocket, byBuffers[j], theHeaders[j].msg_len, nNow);
+      }
+
+      nTotal += nReceived;
+
+      if (nReceived < REPLAY_RECV_BATCH)
+      {
+         return nTotal;
+      }
+   }
+}
+
+void Replayer::run ()
+{
+   uint64_t    nStart = now();
+   uint64_t    nDrainUntil = 0;
+   size_t      nNext = 0;
+
+   vector<struct pollfd>   thePolls (m_Sockets.size());
+
+   for (size_t j=0; j<m_Sockets.size(); j++)
+   {
+      thePolls[j].fd = m_Sockets[j].nSocket;
+      thePolls[j].events = POLLIN;
+   }
+
+   while (1)
+   {
+      uint64_t nNow = now();
+      bool     bBusy = false;
+
+      /* Everything that has come due goes out - strictly in capture order, so
+         a full window holds up the whole replay */
+      while (nNext < m_Datagrams.size())
+      {
+         Datagram *  pDatagram = &m_Datagrams[nNext];
+         uint64_t    nDueAt;
+
+         if (m_pConfig->fSpeed > 0)
+         {
+            nDueAt = nStart + (uint64_t) (pDatagram->nOffset / m_pConfig->fSpeed);
+
+            if (nDueAt > nNow)
+            {
+               break;
+            }
+         }
+         else
+         {
+            nDueAt = now();
+         }
+
+         if ((int) m_Sockets[pDatagram->nSocket].thePending.size() >= m_pConfig->nWindow || !sendDatagram(pDatagram, nDueAt))
+         {
+            break;
+         }
+
+         nNext++;
+         bBusy = true;
+      }
+
+      if (nNext == m_Datagrams.size() && nDrainUntil == 0)
+      {
+         m_nSendTime = now() - nStart;
+         nDrainUntil = now() + (uint64_t) (m_pConfig->fDrain * 1e9);
+      }
+
+      bool bOutstanding = false;
+
+      for (size_t j=0; j<m_Sockets.size(); j++)
+      {
+         if (receiveReplies(&m_Sockets[j]) > 0)
+         {
+            bBusy = true;
+         }
+
+         expireRequests(&m_Sockets[j], nNow);
+
+         if (!m_Sockets[j].thePending.empty())
+         {
+            bOutstanding = true;
+         }
+      }
+
+      /* Done once everything is answered (or the drain runs out) */
+      if (nDrainUntil != 0 && (!bOutstanding || nNow >= nDrainUntil))
+      {
+         break;
+      }
+
+      if (bBusy)
+      {
+         continue;
+      }
+
+      /* Idle - wait for a reply or the next send, whichever is first */
+      int nWaitMs = 1;
+
+      if (m_pConfig->fSpeed > 0 && nNext < m_Datagrams.size())
+      {
+         uint64_t nDueAt = nStart + (uint64_t) (m_Datagrams[nNext].nOffset / m_pConfig->fSpeed);
+
+         if (nDueAt > nNow)
+         {
+            nWaitMs = (nDueAt - nNow) / 1000000;
+         }
+      }
+
+      poll(thePolls.data(), thePolls.size(), nWaitMs);
+   }
+
+   /* Anything still outstanding is not coming back */
+   for (size_t j=0; j<m_Sockets.size(); j++)
+   {
+      expireRequests(&m_Sockets[j], UINT64_MAX);
+   }
+}
+
+static void printHelp ()
+{
+   printf("Usage: replay CAPTURE HOST PORT [options]\n");
+   printf("  -speed X     Replay X times as fast as it was recorded (default 1, 0 = as\n");
+   printf("               fast as the windows allow)\n");
+   printf("  -drain S     Seconds to wait for stragglers afterwards (default 1)\n");
+   printf("  -timeout S   Seconds before a request is given up as lost (default 0.5)\n");
+   printf("  -sources N   Most sockets to open, one per captured source (default 1024)\n");
+   printf("  -window N    Requests outstanding per socket (default 64)\n");
+}
+
+int main (int argc, char ** argv)
+{
+   ReplayConfig   theConfig;
+
+   if (argc < 4)
+   {
+      printHelp();
+      return -1;
+   }
+
+   memset(&theConfig, 0, sizeof(theConfig));
+   theConfig.fSpeed = 1;
+   theConfig.fDrain = 1;
+   theConfig.fTimeout = 0.5;
+   theConfig.nSources = 1024;
+   theConfig.nWindow = 64;
+
+   struct addrinfo   theHints;
+   struct addrinfo * pResult;
+
+   memset(&theHints, 0, sizeof(theHints));
+   theHints.ai_family = AF_INET;
+   theHints.ai_socktype = SOCK_DGRAM;
+
+   if (getaddrinfo(argv[2], argv[3], &theHints, &pResult) != 0)
+   {
+      fprintf(stderr, "Error: Unable to resolve %s:%s\n", argv[2], argv[3]);
+      return -1;
+   }
+
+   memcpy(&theConfig.theTarget, pResult->ai_addr, sizeof(theConfig.theTarget));
+   freeaddrinfo(pResult);
+
+   for (int j=4; j<argc; j++)
+   {
+      if (strcmp(argv[j], "-speed") == 0 && j+1 < argc)
+      {
+         theConfig.fSpeed = atof(argv[++j]);
+      }
+      else if (strcmp(argv[j], "-drain") == 0 && j+1 < argc)
+      {
+         theConfig.fDrain = atof(argv[++j]);
+      }
+      else if (strcmp(argv[j], "-timeout") == 0 && j+1 < argc)
+      {
+         theConfig.fTimeout = atof(argv[++j]);
+      }
+      else if (strcmp(argv[j], "-sources") == 0 && j+1 < argc)
+      {
+         theConfig.nSources = atoi(argv[++j]);
+      }
+      else if (strcmp(argv[j], "-window") == 0 && j+1 < argc)
+      {
+         theConfig.nWindow = atoi(argv[++j]);
+      }
+      else
+      {
+         printHelp();
+         return -1;
+      }
+   }
+
+   if (theConfig.fSpeed < 0 || theConfig.fTimeout <= 0 || theConfig.nSources < 1 || theConfig.nWindow < 1)
+   {
+      fprintf(stderr, "Error: Sources, window and timeout must be positive (speed can be 0)\n");
+      return -1;
+   }
+
+   /* The tracker's own counters / histograms, keyed by request type */
+   TrackerStats   theStats;
+   Replayer       theReplayer (&theConfig, theStats.attachThread());
+
+   if (!theReplayer.load(argv[1]))
+   {
+      return -1;
+   }
+
+   printf("Replaying %zu datagram(s) from %zu source(s) recorded over %.3f s to %s:%s ", theReplayer.getCount(),
+          theReplayer.m_nSourceCount, theReplayer.getSpan() / 1e9, argv[2], argv[3]);
+
+   if (theConfig.fSpeed > 0)
+   {
+      printf("at %gx\n", theConfig.fSpeed);
+   }
+   else
+   {
+      printf("as fast as the windows allow\n");
+   }
+
+   theReplayer.run();
+
+   TypeTotals  theAll;
+   TypeTotals  theType;
+   uint64_t    nAllSent = 0, nAllReplied = 0, nAllLost = 0, nAllIssues = 0;
+
+   memset(&theAll, 0, sizeof(theAll));
+
+   printf("\n%-22s %10s %10s %9s %7s %8s %9s %9s %9s %9s\n", "Request", "Sent", "Replied", "Lost", "Loss%", "Issues",
+          "p50 us", "p99 us", "p999 us", "Max us");
+
+   for (int k=0; k<=256; k++)
+   {
+      string         sName;
+      TypeTotals *   pTotals;
+      uint64_t       nRowSent, nRowReplied, nRowLost, nRowIssues;
+
+      if (k < 256)
+      {
+         nAllSent += theReplayer.m_nSent[k];
+         nAllReplied += theReplayer.m_nReplied[k];
+         nAllLost += theReplayer.m_nLost[k];
+         nAllIssues += theReplayer.m_nIssues[k];
+
+         if (theReplayer.m_nSent[k] == 0)
+         {
+            continue;
+         }
+
+         /* Types past the stats slots share slot 0 - sum each slot once */
+         theStats.sumType(ThreadStats::getSlot(k), &theType);
+
+         if (ThreadStats::getSlot(k) == k)
+         {
+            for (int b=0; b<STATS_HISTOGRAM_BUCKETS; b++)
+            {
+               theAll.nCounts[b] += theType.nCounts[b];
+            }
+
+            if (theType.nMaxLatency > theAll.nMaxLatency)
+            {
+               theAll.nMaxLatency = theType.nMaxLatency;
+            }
+         }
+
+         sName = Message::getTypeName(k);
+         pTotals = &theType;
+         nRowSent = theReplayer.m_nSent[k];
+         nRowReplied = theReplayer.m_nReplied[k];
+         nRowLost = theReplayer.m_nLost[k];
+         nRowIssues = theReplayer.m_nIssues[k];
+      }
+      else
+      {
+         sName = "total";
+         pTotals = &theAll;
+         nRowSent = nAllSent;
+         nRowReplied = nAllReplied;
+         nRowLost = nAllLost;
+         nRowIssues = nAllIssues;
+      }
+
+      printf("%-22s %10llu %10llu %9llu %6.2f%% %8llu %9.1f %9.1f %9.1f %9.1f\n", sName.c_str(),
+             (unsigned long long) nRowSent, (unsigned long long) nRowReplied, (unsigned long long) nRowLost,
+             nRowSent ? 100.0 * nRowLost / nRowSent : 0.0, (unsigned long long) nRowIssues,
+             pTotals->getPercentile(0.5) / 1000.0, pTotals->getPercentile(0.99) / 1000.0,
+             pTotals->getPercentile(0.999) / 1000.0, pTotals->nMaxLatency / 1000.0);
+   }
+
+   double fSeconds = theReplayer.m_nSendTime / 1e9;
+
+   printf("\nThroughput: %.0f req/s sent, %.0f replies/s over %.3f s", fSeconds > 0 ? nAllSent / fSeconds : 0.0,
+          fSeconds > 0 ? nAllReplied / fSeconds : 0.0, fSeconds);
+
+   if (theReplayer.m_nStray > 0)
+   {
+      printf(", %llu unmatched replies", (unsigned long long) theReplayer.m_nStray);
+   }
+
+   printf("\n");
+   return 0;
+}
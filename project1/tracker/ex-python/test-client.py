@@ -128,6 +128,138 @@ def doList (theSocket, theServerInfo):
 
    return True
 
+# Ask for one page of the node listing starting at a given cursor
+def sendListPage (theSocket, theServerInfo, theCursor):
+   theBytes = bytearray()
+
+   # The type is 11
+   theBytes.append(11)
+   # The length is 9 across two bytes (16 bits)
+   theBytes.append(0)
+   theBytes.append(9)
+
+   # Cursor (4 bytes) - index of the first node wanted
+   for theByte in theCursor.to_bytes(4, byteorder='big'):
+      theBytes.append(theByte)
+
+   # Maximum count (2 bytes) - zero means as many as fit in a datagram
+   theBytes.append(0)
+   theBytes.append(0)
+
+   theSocket.sendto(theBytes, theServerInfo)
+
+# Split a page response into its header fields and the 16 byte node records
+def parseListPage (data):
+   theGeneration = int.from_bytes(data[4:8], byteorder='big')
+   theTotal = int.from_bytes(data[8:12], byteorder='big')
+   theCursor = int.from_bytes(data[12:16], byteorder='big')
+   theCount = int.from_bytes(data[16:18], byteorder='big')
+
+   theRecords = []
+   for j in range(theCount):
+      theRecords.append(data[18+j*16:18+(j+1)*16])
+
+   return (data[3], theGeneration, theTotal, theCursor, theRecords)
+
+def doListPaged (theSocket, theServerInfo):
+   try:
+      # The first page tells us how big the table is
+      sendListPage(theSocket, theServerInfo, 0)
+      data, server = theSocket.recvfrom(4096)
+      (theStatus, theGeneration, theTotal, theCursor, theRecords) = parseListPage(data)
+
+      print('Table has ' + str(theTotal) + ' nodes (generation ' + str(theGeneration) + ')')
+
+      thePages = { 0: theRecords }
+      thePageSize = len(theRecords)
+
+      # Ask for all of the other pages at once and put them back together
+      if thePageSize > 0:
+         for theStart in range(thePageSize, theTotal, thePageSize):
+            sendListPage(theSocket, theServerInfo, theStart)
+
+         for theStart in range(thePageSize, theTotal, thePageSize):
+            data, server = theSocket.recvfrom(4096)
+            (theStatus, thePageGeneration, thePageTotal, theCursor, theRecords) = parseListPage(data)
+
+            if thePageGeneration != theGeneration:
+               print('  Table changed while listing - pages may not line up')
+
+            thePages[theCursor] = theRecords
+
+      theNodes = []
+      for theStart in sorted(thePages.keys()):
+         theNodes.extend(thePages[theStart])
+
+      print('Reassembled ' + str(len(theNodes)) + ' nodes from ' + str(len(thePages)) + ' page(s)')
+      for theRecord in theNodes:
+         print('  ID ' + str(int.from_bytes(theRecord[0:4], byteorder='big')) +
+               ' at ' + '.'.join([str(b) for b in theRecord[4:8]]) +
+               ':' + str(int.from_bytes(theRecord[8:10], byteorder='big')))
+   except Exception as e:
+      print(f"Error: {e}")
+   else:
+      print('Success - no errors detected!!')
+
+   return True
+
+# Bucket boundaries for the tracker's latency histograms (HDR style - each
+# power of two is split into 2^subBits linear buckets)
+def bucketLowest (theIndex, theSubBits):
+   theSubCount = 1 << theSubBits
+   if theIndex < 2 * theSubCount:
+      return theIndex
+   theShift = theIndex // theSubCount - 1
+   return (theIndex % theSubCount + theSubCount) << theShift
+
+# Ask the tracker for its counters (selector 0) or the latency histogram of
+# one message type
+def doStats (theSocket, theServerInfo, theSelector):
+   try:
+      theBytes = bytearray()
+
+      # The type is 13 and the length is 4 (type, length and the selector)
+      theBytes.append(13)
+      theBytes.append(0)
+      theBytes.append(4)
+      theBytes.append(theSelector)
+
+      theSocket.sendto(theBytes, theServerInfo)
+      data, server = theSocket.recvfrom(4096)
+
+      print('Status ' + str(data[3]) + ', up ' + str(int.from_bytes(data[5:9], byteorder='big')) + 's, ' +
+            str(int.from_bytes(data[9:13], byteorder='big')) + ' nodes, ' +
+            str(int.from_bytes(data[13:21], byteorder='big')) + ' expired, ' +
+            str(int.from_bytes(data[21:23], byteorder='big')) + ' thread(s)')
+
+      theRecords = data[23]
+      theOffset = 24
+
+      if theSelector == 0:
+         print('  Type   Received     Errors      p50 ns      p90 ns      p99 ns    p99.9 ns      max ns')
+         for j in range(theRecords):
+            theRecord = data[theOffset:theOffset+37]
+            theLatencies = [int.from_bytes(theRecord[17+k*4:21+k*4], byteorder='big') for k in range(5)]
+            print('  %4d %10d %10d ' % (theRecord[0], int.from_bytes(theRecord[1:9], byteorder='big'),
+                  int.from_bytes(theRecord[9:17], byteorder='big')) + ' '.join(['%11d' % x for x in theLatencies]))
+            theOffset += 37
+      elif theRecords == 1:
+         theSubBits = data[theOffset+17]
+         theBuckets = int.from_bytes(data[theOffset+18:theOffset+20], byteorder='big')
+         print('  Type ' + str(data[theOffset]) + ': ' + str(int.from_bytes(data[theOffset+1:theOffset+9], byteorder='big')) +
+               ' received, ' + str(int.from_bytes(data[theOffset+9:theOffset+17], byteorder='big')) + ' errors')
+         theOffset += 20
+         for j in range(theBuckets):
+            theIndex = int.from_bytes(data[theOffset:theOffset+2], byteorder='big')
+            theCount = int.from_bytes(data[theOffset+2:theOffset+10], byteorder='big')
+            print('  %12d - %12d ns: %d' % (bucketLowest(theIndex, theSubBits), bucketLowest(theIndex+1, theSubBits)-1, theCount))
+            theOffset += 10
+   except Exception as e:
+      print(f"Error: {e}")
+   else:
+      print('Success - no errors detected!!')
+
+   return True
 
 
 parser = argparse.ArgumentParser(description='Tracker - Echo Test Client')
@@ -136,7 +268,8 @@ parser.add_argument('host', type=str, help='Hostname or IP address of the server
 parser.add_argument('port', type=int, help='The port number for the server')
 parser.add_argument('--count', type=int, help='Change the number of times to do the echo', default=2)
 parser.add_argument('--delay', type=float, help='Delay in seconds between echo requests', default=1.0)
-parser.add_argument('--msg', type=str, help='Specific message to test (echo, register, list)', default='echo')
+parser.add_argument('--msg', type=str, help='Specific message to test (echo, register, list, page, stats)', default='echo')
+parser.add_argument('--select', type=int, help='For stats - message type to show the latency histogram for (0 = summary)', default=0)
 
 args = parser.parse_args()
 
@@ -160,6 +293,12 @@ for theCount in range(args.count):
    elif args.msg == 'list':
       print('== List Sequence ==')
       doList(sock, server_address)
+   elif args.msg == 'page':
+      print('== Paged List Sequence ==')
+      doListPaged(sock, server_address)
+   elif args.msg == 'stats':
+      print('== Stats Sequence ==')
+      doStats(sock, server_address, args.select)
    elif args.msg == 'all':
       print('== All Sequence ==')
       doEcho(sock, server_address)
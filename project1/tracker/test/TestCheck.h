@@ -0,0 +1,32 @@
+// TestCheck.h : The bare minimum for the tracker's unit tests
+//
+// Each test program is a list of functions full of CHECKs.  A failed CHECK
+// says where it was and the program exits non-zero at the end.
+
+#ifndef __TESTCHECK_H
+#define __TESTCHECK_H
+
+#include <stdio.h>
+
+static int g_nFailures = 0;
+
+#define CHECK(condition)                                                   \
+   do                                                                      \
+   {                                                                       \
+      if (!(condition))                                                    \
+      {                                                                    \
+         fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+         g_nFailures++;                                                    \
+      }                                                                    \
+   } while (0)
+
+/** Run one test function and say how it went */
+#define RUN_TEST(function)                                                 \
+   do                                                                      \
+   {                                                                       \
+      int nBefore = g_nFailures;                                           \
+      function();                                                          \
+      printf("%-40s %s\n", #function, (g_nFailures == nBefore) ? "ok" : "FAILED"); \
+   } while (0)
+
+#endif
@@ -0,0 +1,116 @@
+// bloomindex-test.cc : Filters going through the publish path to FIND_FILE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <cstring>
+
+#include <vector>
+using namespace std;
+
+#include "BloomIndex.h"
+#include "FileIndex.h"
+#include "TestCheck.h"
+
+/* Every filter sees the key in its block or none of it does */
+static void fillFilter (vector<uint8_t> * pFilter, uint64_t nKey, uint32_t nBlocks, bool bHolds)
+{
+   memset(pFilter->data(), 0, nBlocks * BLOOM_BLOCK_BYTES);
+
+   if (bHolds)
+   {
+      memset(pFilter->data() + BloomIndex::getBlock(nKey, nBlocks) * BLOOM_BLOCK_BYTES, 0xff, BLOOM_BLOCK_BYTES);
+   }
+}
+
+/* Nothing shows until it is published - then exactly what was set */
+static void testPublish ()
+{
+   BloomIndex        theIndex;
+   vector<uint8_t>   theFilter (BLOOM_MAX_BLOCKS * BLOOM_BLOCK_BYTES);
+   uint64_t          nKey = FileIndex::makeKey((const uint8_t *) "song", 4);
+   uint32_t          nIDs [8];
+
+   CHECK(!theIndex.takeChanges());
+
+   fillFilter(&theFilter, nKey, 2, true);
+   theIndex.setFilter(7, theFilter.data(), 2 * BLOOM_BLOCK_BYTES);
+
+   CHECK(theIndex.getSnapshot()->size() == 0);
+   CHECK(theIndex.takeChanges());
+   CHECK(theIndex.getSnapshot()->size() == 0);
+
+   theIndex.publish();
+
+   CHECK(theIndex.getSnapshot()->findCandidates(nKey, 0, nIDs, 8) == 1 && nIDs[0] == 7);
+
+   /* A scan already under way keeps its copy */
+   shared_ptr<const BloomSnapshot> pOld = theIndex.getSnapshot();
+
+   theIndex.removeNode(7);
+   CHECK(theIndex.takeChanges());
+   theIndex.publish();
+
+   CHECK(theIndex.getSnapshot()->size() == 0);
+   CHECK(pOld->findCandidates(nKey, 0, nIDs, 8) == 1);
+}
+
+/* Filters replaced with other sizes and removed, round after round, until
+   the run has been compacted many times over */
+static void testChurn ()
+{
+   BloomIndex        theIndex;
+   vector<uint8_t>   theFilter (BLOOM_MAX_BLOCKS * BLOOM_BLOCK_BYTES);
+   uint64_t          nKey = FileIndex::makeKey((const uint8_t *) "x", 1);
+   uint32_t          nIDs [100];
+
+   for (int nRound=0; nRound<200; nRound++)
+   {
+      for (uint32_t nID=1; nID<=50; nID++)
+      {
+         uint32_t nBlocks = 1 + (nID * 7 + nRound) % BLOOM_MAX_BLOCKS;
+
+         if ((nID + nRound) % 5 == 0)
+         {
+            theIndex.removeNode(nID);
+         }
+         else
+         {
+            fillFilter(&theFilter, nKey, nBlocks, nID % 2 == 0);
+            theIndex.setFilter(nID, theFilter.data(), nBlocks * BLOOM_BLOCK_BYTES);
+         }
+      }
+
+      /* The writers get two rounds in before each publish */
+      if (nRound % 2 != 0)
+      {
+         continue;
+      }
+
+      CHECK(theIndex.takeChanges());
+      theIndex.publish();
+
+      int nFound = theIndex.getSnapshot()->findCandidates(nKey, nRound, nIDs, 100);
+      int nExpected = 0;
+      int nWrong = 0;
+
+      for (uint32_t nID=1; nID<=50; nID++)
+      {
+         nExpected += (nID % 2 == 0 && (nID + nRound) % 5 != 0) ? 1 : 0;
+      }
+
+      for (int j=0; j<nFound; j++)
+      {
+         nWrong += (nIDs[j] % 2 != 0 || (nIDs[j] + nRound) % 5 == 0) ? 1 : 0;
+      }
+
+      CHECK(nFound == nExpected && nWrong == 0);
+   }
+}
+
+int main ()
+{
+   RUN_TEST(testPublish);
+   RUN_TEST(testChurn);
+
+   return (g_nFailures == 0) ? 0 : 1;
+}
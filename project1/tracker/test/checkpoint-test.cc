@@ -0,0 +1,196 @@
+// checkpoint-test.cc : Saving the node table and loading it back
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <string>
+using namespace std;
+
+#include "NodeTable.h"
+#include "TableCheckpoint.h"
+#include "Logger.h"
+#include "TestCheck.h"
+
+/* Wall clock second the tests pretend it is */
+#define TEST_NOW_SEC    1000000
+
+static string getTestPath ()
+{
+   char szPath[64];
+
+   snprintf(szPath, sizeof(szPath), "/tmp/checkpoint-test.%d", (int) getpid());
+   return szPath;
+}
+
+/** Add a node whose lease runs out at a given (wall clock) second */
+static Node * addLeased (NodeTable * pTable, uint32_t nMaxID, int64_t nExpirySec)
+{
+   Node * pNode = pTable->addNode(nMaxID);
+
+   if (pNode != NULL)
+   {
+      struct timeval theExp;
+
+      theExp.tv_sec = nExpirySec;
+      theExp.tv_usec = 0;
+      pNode->setExpirationTime(theExp);
+   }
+
+   return pNode;
+}
+
+/** Fill every legacy slot so that later nodes get wide IDs */
+static void fillLegacy (NodeTable * pTable, int64_t nExpirySec)
+{
+   for (int j=0; j<NODE_ID_LEGACY_MAX; j++)
+   {
+      addLeased(pTable, NODE_ID_LEGACY_MAX, nExpirySec);
+   }
+}
+
+/** Capture and save a table, then load it into another one
+ *  @returns What load returned
+ */
+static int saveAndLoad (NodeTable * pFrom, NodeTable * pTo)
+{
+   TableCheckpoint   theCheckpoint;
+   struct timeval    theNow;
+
+   theCheckpoint.setPath(getTestPath().c_str());
+   CHECK(theCheckpoint.capture(pFrom));
+   CHECK(theCheckpoint.save());
+
+   theNow.tv_sec = TEST_NOW_SEC;
+   theNow.tv_usec = 0;
+
+   int nRestored = theCheckpoint.load(pTo, &theNow, 0);
+
+   unlink(getTestPath().c_str());
+   return nRestored;
+}
+
+/* Live nodes come back under the same IDs with everything they reported */
+static void testRoundTrip ()
+{
+   NodeTable   theTable;
+
+   fillLegacy(&theTable, TEST_NOW_SEC + 60);
+
+   Node *   pNode = addLeased(&theTable, UINT32_MAX, TEST_NOW_SEC + 60);
+   uint32_t nKept = pNode->getID();
+   NodeLoad theLoad;
+
+   pNode->setIPAddress(0x0A000001);
+   pNode->setPort(7000);
+   pNode->setFiles(12);
+   theLoad.nConnections = 3;
+   theLoad.nBytesPerSecond = 5000;
+   theLoad.nFreeBandwidth = 15000;
+   pNode->setLoad(&theLoad);
+
+   uint32_t nGone = addLeased(&theTable, UINT32_MAX, TEST_NOW_SEC + 60)->getID();
+
+   CHECK(theTable.removeNode(nGone));
+
+   NodeTable   theLoaded;
+
+   CHECK(saveAndLoad(&theTable, &theLoaded) == NODE_ID_LEGACY_MAX + 1);
+   CHECK(theLoaded.size() == theTable.size());
+   CHECK(theLoaded.findNode(1) != NULL && theLoaded.findNode(NODE_ID_LEGACY_MAX) != NULL);
+
+   pNode = theLoaded.findNode(nKept);
+   CHECK(pNode != NULL);
+
+   if (pNode != NULL)
+   {
+      CHECK(pNode->getIPAddress() == 0x0A000001);
+      CHECK(pNode->getPort() == 7000);
+      CHECK(pNode->getFiles() == 12);
+      CHECK(pNode->hasLoad() && pNode->getLoad()->nBytesPerSecond == 5000);
+      CHECK(pNode->getExpirationTimeAsPointer()->tv_sec == TEST_NOW_SEC + 60);
+   }
+
+   /* The released slot keeps the generation it moved on to */
+   CHECK(theLoaded.findNode(nGone) == NULL);
+
+   uint32_t nNext = theLoaded.addNode(UINT32_MAX)->getID();
+
+   CHECK(nNext == nGone + (1 << NODE_ID_SLOT_BITS));
+}
+
+/* A lease that ran out while the tracker was down retires a wide ID but a
+   version 1 ID goes back into use as before */
+static void testExpiredWhileDown ()
+{
+   NodeTable   theTable;
+
+   fillLegacy(&theTable, TEST_NOW_SEC + 60);
+
+   uint32_t nLegacy = theTable.getEntry(0).getID();
+   struct timeval theExp;
+
+   theExp.tv_sec = TEST_NOW_SEC - 1;
+   theExp.tv_usec = 0;
+   theTable.getEntry(0).setExpirationTime(theExp);
+
+   uint32_t nWide = addLeased(&theTable, UINT32_MAX, TEST_NOW_SEC - 1)->getID();
+
+   NodeTable   theLoaded;
+
+   CHECK(saveAndLoad(&theTable, &theLoaded) == NODE_ID_LEGACY_MAX - 1);
+   CHECK(theLoaded.findNode(nLegacy) == NULL);
+   CHECK(theLoaded.findNode(nWide) == NULL);
+
+   Node * pWide = theLoaded.addNode(UINT32_MAX);
+
+   CHECK(pWide != NULL && pWide->getID() == nWide + (1 << NODE_ID_SLOT_BITS));
+
+   Node * pLegacy = theLoaded.addNode(NODE_ID_LEGACY_MAX);
+
+   CHECK(pLegacy != NULL && pLegacy->getID() == nLegacy);
+}
+
+/* No file is an empty start; a file that is not a checkpoint is refused */
+static void testUnusableFile ()
+{
+   TableCheckpoint   theCheckpoint;
+   NodeTable         theTable;
+   struct timeval    theNow;
+
+   theNow.tv_sec = TEST_NOW_SEC;
+   theNow.tv_usec = 0;
+   theCheckpoint.setPath(getTestPath().c_str());
+
+   unlink(getTestPath().c_str());
+   CHECK(theCheckpoint.load(&theTable, &theNow, 0) == 0);
+
+   FILE * pFile = fopen(getTestPath().c_str(), "w");
+
+   CHECK(pFile != NULL);
+
+   if (pFile != NULL)
+   {
+      fprintf(pFile, "this is not a checkpoint, just some text\n");
+      fclose(pFile);
+   }
+
+   CHECK(theCheckpoint.load(&theTable, &theNow, 0) == -1);
+   CHECK(theTable.size() == 0);
+   CHECK(theTable.addNode(UINT32_MAX) != NULL);
+
+   unlink(getTestPath().c_str());
+}
+
+int main ()
+{
+   /* Keep the expected complaints about the bad file quiet */
+   Logger::setLevel(-1);
+
+   RUN_TEST(testRoundTrip);
+   RUN_TEST(testExpiredWhileDown);
+   RUN_TEST(testUnusableFile);
+
+   return (g_nFailures == 0) ? 0 : 1;
+}
@@ -0,0 +1,136 @@
+// nodetable-test.cc : ID assignment and recycling in the node table
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <vector>
+using namespace std;
+
+#include "NodeTable.h"
+#include "TestCheck.h"
+
+/* Version 1 clients keep getting IDs however often they come and go */
+static void testLegacyCycle ()
+{
+   NodeTable   theTable;
+
+   for (int j=0; j<1000; j++)
+   {
+      Node * pNode = theTable.addNode(NODE_ID_LEGACY_MAX);
+
+      CHECK(pNode != NULL);
+
+      if (pNode == NULL)
+      {
+         return;
+      }
+
+      CHECK(pNode->getID() <= NODE_ID_LEGACY_MAX);
+      CHECK(theTable.removeNode(pNode->getID()));
+   }
+}
+
+/* The whole legacy range can be filled, released and filled again */
+static void testLegacyRefill ()
+{
+   NodeTable         theTable;
+   vector<uint32_t>  theIDs;
+
+   for (int nRound=0; nRound<3; nRound++)
+   {
+      theIDs.clear();
+
+      for (int j=0; j<NODE_ID_LEGACY_MAX; j++)
+      {
+         Node * pNode = theTable.addNode(NODE_ID_LEGACY_MAX);
+
+         if (pNode != NULL)
+         {
+            theIDs.push_back(pNode->getID());
+         }
+      }
+
+      CHECK(theIDs.size() == NODE_ID_LEGACY_MAX);
+
+      /* Full up - there is no 256th one byte ID */
+      CHECK(theTable.addNode(NODE_ID_LEGACY_MAX) == NULL);
+
+      for (size_t j=0; j<theIDs.size(); j++)
+      {
+         CHECK(theTable.removeNode(theIDs[j]));
+      }
+   }
+}
+
+/* A recycled wide ID gets a new generation and the old one is dead */
+static void testWideRecycle ()
+{
+   NodeTable   theTable;
+
+   /* Get past the legacy slots */
+   for (int j=0; j<NODE_ID_LEGACY_MAX; j++)
+   {
+      theTable.addNode(UINT32_MAX);
+   }
+
+   uint32_t nFirst = theTable.addNode(UINT32_MAX)->getID();
+
+   CHECK(nFirst == NODE_ID_LEGACY_MAX + 1);
+   CHECK(theTable.removeNode(nFirst));
+   CHECK(theTable.findNode(nFirst) == NULL);
+
+   uint32_t nSecond = theTable.addNode(UINT32_MAX)->getID();
+
+   CHECK((nSecond & NODE_ID_SLOT_MASK) == (nFirst & NODE_ID_SLOT_MASK));
+   CHECK(nSecond == nFirst + (1 << NODE_ID_SLOT_BITS));
+   CHECK(theTable.findNode(nFirst) == NULL);
+   CHECK(theTable.findNode(nSecond) != NULL);
+   CHECK(!theTable.removeNode(nFirst));
+}
+
+/* Wide IDs leave the released legacy slots alone while the table can grow */
+static void testLegacySlotsKept ()
+{
+   NodeTable   theTable;
+   uint32_t    nLegacy = theTable.addNode(NODE_ID_LEGACY_MAX)->getID();
+
+   CHECK(theTable.removeNode(nLegacy));
+
+   uint32_t nWide = theTable.addNode(UINT32_MAX)->getID();
+
+   CHECK(nWide != nLegacy);
+   CHECK(theTable.addNode(NODE_ID_LEGACY_MAX)->getID() == nLegacy);
+}
+
+/* An instance's IDs carry its number and never fit a version 1 field */
+static void testInstanceIDs ()
+{
+   NodeTable   theTable;
+
+   theTable.setInstance(3);
+
+   Node * pNode = theTable.addNode(UINT32_MAX);
+
+   CHECK(pNode != NULL && NodeTable::getInstanceOf(pNode->getID()) == 3);
+   CHECK(pNode != NULL && theTable.isLocalID(pNode->getID()));
+   CHECK(!theTable.isLocalID(1 << NODE_ID_INSTANCE_SHIFT));
+   CHECK(theTable.addNode(NODE_ID_LEGACY_MAX) == NULL);
+
+   /* Another tracker's node sits in any slot under its own ID */
+   uint32_t nForeign = (5 << NODE_ID_INSTANCE_SHIFT) | 7;
+
+   CHECK(theTable.adoptNode(nForeign) != NULL);
+   CHECK(theTable.findNode(nForeign) != NULL);
+   CHECK(theTable.adoptNode(nForeign) == NULL);
+}
+
+int main ()
+{
+   RUN_TEST(testLegacyCycle);
+   RUN_TEST(testLegacyRefill);
+   RUN_TEST(testWideRecycle);
+   RUN_TEST(testLegacySlotsKept);
+   RUN_TEST(testInstanceIDs);
+
+   return (g_nFailures == 0) ? 0 : 1;
+}
@@ -13,6 +13,11 @@
 #include <netdb.h>
 #include <string.h>
 
+#include <string>
+using namespace std;
+
+#include "Logger.h"
+
 void dump_sockaddr_in (struct sockaddr_in * pInfo)
 {
    /*
@@ -24,35 +29,54 @@ void dump_sockaddr_in (struct sockaddr_in * pInfo)
    };
    */
 
-   printf("Dumping the sockaddr_in struct at %p\n", pInfo);
-   printf("  sin_family: 0x%04X\n", pInfo->sin_family);
-   printf("  sin_port (Host Order):   0x%04X -> %d\n", pInfo->sin_port, pInfo->sin_port);
+   LOG_DEBUG("Dumping the sockaddr_in struct at %p", pInfo);
+   LOG_DEBUG("  sin_family: 0x%04X", pInfo->sin_family);
+   LOG_DEBUG("  sin_port (Host Order):   0x%04X -> %d", pInfo->sin_port, pInfo->sin_port);
 
    // Show this as flipped (endian-wise)
    uint16_t    theCorrectedPort;
 
    // Invoke htons - host to network short
    theCorrectedPort = htons(pInfo->sin_port);
-   printf("  sin_port (Net Order):    0x%04X -> %d\n", theCorrectedPort, theCorrectedPort);
+   LOG_DEBUG("  sin_port (Net Order):    0x%04X -> %d", theCorrectedPort, theCorrectedPort);
 
    uint32_t    theAddress;
    memcpy(&theAddress, &pInfo->sin_addr, 4);
-   printf("  sin_addr:   0x%04X -> ", theAddress);
 
-   /* Print it out one byte at a time - note that there are other mechanisms */
+   /* Show it one byte at a time - note that there are other mechanisms */
    uint8_t * pPtr;
 
    pPtr = (uint8_t *) &(pInfo->sin_addr);
 
-   for(int j=0; j<4; j++)
+   LOG_DEBUG("  sin_addr:   0x%04X -> %d.%d.%d.%d", theAddress, pPtr[0], pPtr[1], pPtr[2], pPtr[3]);
+}
+
+bool resolve_host_port (const char * pszHostPort, struct sockaddr_in * pAddress)
+{
+   string   sHostPort (pszHostPort);
+   size_t   nColon = sHostPort.rfind(':');
+
+   if (nColon == string::npos || nColon == 0 || nColon+1 == sHostPort.size())
    {
-      printf("%d", *(pPtr+j));
+      LOG_ERROR("Error: %s should be given as host:port", pszHostPort);
+      return false;
+   }
+
+   struct addrinfo   hints, *pResult;
+   int               rv;
+
+   memset(&hints, 0, sizeof hints);
+   hints.ai_family = AF_INET;
+   hints.ai_socktype = SOCK_DGRAM;
 
-      if(j<3)
-      {
-         printf(".");
-      }
+   if ((rv = getaddrinfo(sHostPort.substr(0, nColon).c_str(), sHostPort.substr(nColon+1).c_str(), &hints, &pResult)) != 0)
+   {
+      LOG_ERROR("Error: Unable to resolve %s: %s", pszHostPort, gai_strerror(rv));
+      return false;
    }
 
-   printf("\n");
+   memcpy(pAddress, pResult->ai_addr, sizeof(struct sockaddr_in));
+   freeaddrinfo(pResult);
+
+   return true;
 }
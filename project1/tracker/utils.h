@@ -2,6 +2,7 @@
 #ifndef __UTILS_H
 #define __UTILS_H
 
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -10,4 +11,23 @@
 
 void dump_sockaddr_in (struct sockaddr_in * pInfo);
 
+/** Look up a host:port (name or dotted quad) - logs why if it cannot
+ *  @returns false if it is malformed or does not resolve
+ */
+bool resolve_host_port (const char * pszHostPort, struct sockaddr_in * pAddress);
+
+/** MurmurHash3's fmix64 finalizer - every input bit moves about half of the
+ *  output bits, so values that differ only slightly end up far apart
+ */
+inline uint64_t mix64 (uint64_t nValue)
+{
+   nValue ^= nValue >> 33;
+   nValue *= 0xff51afd7ed558ccdULL;
+   nValue ^= nValue >> 33;
+   nValue *= 0xc4ceb9fe1a85ec53ULL;
+   nValue ^= nValue >> 33;
+
+   return nValue;
+}
+
 #endif